@@ -0,0 +1,134 @@
+#include "buffer_pool.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace Akumuli {
+
+//                        //
+//     Receive buffer     //
+//                        //
+
+ReceiveBuffer::ReceiveBuffer(BufferPool* pool)
+    : refcount_{0}
+    , pool_(pool)
+    , next_(nullptr)
+{
+}
+
+Byte* ReceiveBuffer::data() {
+    return reinterpret_cast<Byte*>(this + 1);
+}
+
+const Byte* ReceiveBuffer::data() const {
+    return reinterpret_cast<const Byte*>(this + 1);
+}
+
+size_t ReceiveBuffer::size() const {
+    return pool_->buffer_size();
+}
+
+int ReceiveBuffer::use_count() const {
+    return refcount_.load(std::memory_order_relaxed);
+}
+
+void intrusive_ptr_add_ref(const ReceiveBuffer* buf) {
+    buf->refcount_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void intrusive_ptr_release(const ReceiveBuffer* buf) {
+    if (buf->refcount_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        buf->pool_->recycle(const_cast<ReceiveBuffer*>(buf));
+    }
+}
+
+//                     //
+//     Buffer pool     //
+//                     //
+
+static size_t get_stride(size_t buffer_size) {
+    size_t size = sizeof(ReceiveBuffer) + buffer_size;
+    return (size + BufferPool::ALIGNMENT - 1) & ~static_cast<size_t>(BufferPool::ALIGNMENT - 1);
+}
+
+BufferPool::BufferPool(size_t buffer_size, size_t slab_size)
+    : refcount_{0}
+    , buffer_size_(buffer_size)
+    , slab_size_(slab_size ? slab_size : 1)
+    , stride_(get_stride(buffer_size))
+    , free_list_(nullptr)
+{
+}
+
+BufferPool::~BufferPool() {
+    // All buffers are in the free list at this point
+    for (auto slab: slabs_) {
+        free(slab);
+    }
+}
+
+BufferPoolPtr BufferPool::create(size_t buffer_size, size_t slab_size) {
+    return BufferPoolPtr(new BufferPool(buffer_size, slab_size));
+}
+
+void BufferPool::allocate_slab() {
+    void* slab = nullptr;
+    if (posix_memalign(&slab, ALIGNMENT, stride_*slab_size_) != 0) {
+        throw std::bad_alloc();
+    }
+    slabs_.push_back(slab);
+    auto begin = static_cast<char*>(slab);
+    // Buffers are linked in reverse order so the first buffer of the slab goes first
+    for (size_t i = slab_size_; i --> 0;) {
+        auto buf = new (begin + i*stride_) ReceiveBuffer(this);
+        buf->next_ = free_list_;
+        free_list_ = buf;
+    }
+}
+
+BufferPtr BufferPool::acquire() {
+    ReceiveBuffer* buf;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (free_list_ == nullptr) {
+            allocate_slab();
+        }
+        buf = free_list_;
+        free_list_ = buf->next_;
+    }
+    buf->next_ = nullptr;
+    // Buffer keeps the pool alive
+    intrusive_ptr_add_ref(this);
+    return BufferPtr(buf);
+}
+
+void BufferPool::recycle(ReceiveBuffer* buf) {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        buf->next_ = free_list_;
+        free_list_ = buf;
+    }
+    // Can destroy the pool if this is the last reference
+    intrusive_ptr_release(this);
+}
+
+size_t BufferPool::buffer_size() const {
+    return buffer_size_;
+}
+
+size_t BufferPool::capacity() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return slabs_.size()*slab_size_;
+}
+
+void intrusive_ptr_add_ref(BufferPool* pool) {
+    pool->refcount_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void intrusive_ptr_release(BufferPool* pool) {
+    if (pool->refcount_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete pool;
+    }
+}
+
+}  // namespace
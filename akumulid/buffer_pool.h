@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+
+#include <boost/intrusive_ptr.hpp>
+
+#include "stream.h"
+
+namespace Akumuli {
+
+class BufferPool;
+
+/** Fixed size receive buffer.
+  * Buffer header is placed at the beginning of the slab chunk and data follows it.
+  * Reference counter is intrusive, buffer returns to the pool when the last
+  * reference is released.
+  */
+class ReceiveBuffer {
+    friend class BufferPool;
+
+    mutable std::atomic<int> refcount_;
+    BufferPool*              pool_;
+    ReceiveBuffer*           next_;  //< Next buffer in the free list
+
+    ReceiveBuffer(BufferPool* pool);
+    ReceiveBuffer(ReceiveBuffer const&) = delete;
+    ReceiveBuffer& operator = (ReceiveBuffer const&) = delete;
+public:
+    //! Get pointer to the beginning of the buffer
+    Byte* data();
+
+    //! Get pointer to the beginning of the buffer
+    const Byte* data() const;
+
+    //! Get size of the buffer
+    size_t size() const;
+
+    //! Get number of references
+    int use_count() const;
+
+    friend void intrusive_ptr_add_ref(const ReceiveBuffer* buf);
+    friend void intrusive_ptr_release(const ReceiveBuffer* buf);
+};
+
+typedef boost::intrusive_ptr<ReceiveBuffer>         BufferPtr;
+typedef boost::intrusive_ptr<const ReceiveBuffer>   ConstBufferPtr;
+typedef boost::intrusive_ptr<BufferPool>            BufferPoolPtr;
+
+
+/** Pool of fixed size receive buffers.
+  * Memory is allocated in slabs (several buffers at once) and never returned
+  * to the system until the pool is destroyed. Every acquired buffer holds a
+  * reference to the pool so the pool can't be destroyed before all buffers
+  * are returned back. Pool can be shared between threads.
+  */
+class BufferPool {
+    std::atomic<int>    refcount_;
+    const size_t        buffer_size_;   //< Size of the buffer (without header)
+    const size_t        slab_size_;     //< Number of buffers in one slab
+    const size_t        stride_;        //< Distance between buffers in the slab
+    std::mutex          lock_;          //< Free list lock
+    ReceiveBuffer*      free_list_;     //< List of available buffers
+    std::vector<void*>  slabs_;         //< Allocated slabs
+
+    BufferPool(size_t buffer_size, size_t slab_size);
+    BufferPool(BufferPool const&) = delete;
+    BufferPool& operator = (BufferPool const&) = delete;
+    ~BufferPool();
+
+    //! Allocate new slab and add its buffers to the free list (lock should be held)
+    void allocate_slab();
+
+    //! Return buffer to the free list
+    void recycle(ReceiveBuffer* buf);
+public:
+    enum {
+        DEFAULT_SLAB_SIZE = 64,
+        ALIGNMENT = 64,  //< Buffers are aligned by cache line size
+    };
+
+    /** Create new pool.
+      * @param buffer_size size of the single buffer
+      * @param slab_size number of buffers to allocate at once
+      */
+    static BufferPoolPtr create(size_t buffer_size, size_t slab_size = DEFAULT_SLAB_SIZE);
+
+    //! Take buffer from the pool (allocate new slab if free list is empty)
+    BufferPtr acquire();
+
+    //! Get size of the buffers
+    size_t buffer_size() const;
+
+    //! Get total number of buffers allocated by pool
+    size_t capacity();
+
+    friend void intrusive_ptr_add_ref(BufferPool* pool);
+    friend void intrusive_ptr_release(BufferPool* pool);
+    friend void intrusive_ptr_release(const ReceiveBuffer* buf);
+};
+
+}  // namespace
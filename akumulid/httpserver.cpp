@@ -2,39 +2,244 @@
 #include "utility.h"
 #include <cstring>
 #include <thread>
+#include <mutex>
+#include <algorithm>
+#include <sstream>
 
 #include <boost/bind.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
 
 namespace Akumuli {
 namespace Http {
 
+#if MHD_VERSION >= 0x00095100
+static const unsigned int SUSPEND_RESUME_FLAG = MHD_USE_SUSPEND_RESUME;
+#else
+static const unsigned int SUSPEND_RESUME_FLAG = MHD_USE_PIPE_FOR_SHUTDOWN;
+#endif
+
+/** Query output producer.
+  * Output is produced by the worker pool in chunks and consumed by the
+  * microhttpd event loop. Two buffers are used, worker fills one of them
+  * while another one is sent to the client. Connection is suspended when
+  * the output is consumed faster than it is produced.
+  * Continuous query can run out of data without reaching the end of stream,
+  * in this case worker is released and connection stays suspended until
+  * the database notifies the stream about new data.
+  * Live streams are registered in the server, server resumes suspended
+  * connections on shutdown.
+  */
+struct QueryStream : std::enable_shared_from_this<QueryStream> {
+    enum {
+        CHUNK_SIZE = 64*1024,
+    };
+    std::unique_ptr<ReadOperation>  cursor_;
+    MHD_Connection                 *connection_;
+    HttpServer                     *server_;
+    HttpServer::IOServiceT         *workers_;
+    std::mutex                      lock_;
+    std::vector<char>               front_;         //< Buffer that is being sent
+    size_t                          front_pos_;
+    size_t                          front_size_;
+    std::vector<char>               back_;          //< Buffer that is being filled by worker
+    size_t                          back_size_;
+    bool                            done_;          //< Worker have reached end of stream
+    bool                            pending_;       //< Worker is filling back buffer
+    bool                            suspended_;     //< Connection is suspended
+    bool                            closed_;        //< Connection is closed
+    bool                            started_;       //< Query is started
+    const bool                      continuous_;    //< Continuous query (subscription)
+    bool                            waiting_;       //< Continuous query is waiting for new data
+    bool                            notified_;      //< New data arrived while worker was filling the buffer
+    bool                            stopped_;       //< Server is shutting down
+
+    QueryStream(ReadOperation* cursor, MHD_Connection* connection, HttpServer* server, bool continuous)
+        : cursor_(cursor)
+        , connection_(connection)
+        , server_(server)
+        , workers_(&server->workers_)
+        , front_(CHUNK_SIZE)
+        , front_pos_(0)
+        , front_size_(0)
+        , back_(CHUNK_SIZE)
+        , back_size_(0)
+        , done_(false)
+        , pending_(false)
+        , suspended_(false)
+        , closed_(false)
+        , started_(false)
+        , continuous_(continuous)
+        , waiting_(false)
+        , notified_(false)
+        , stopped_(false)
+    {
+    }
+
+    ~QueryStream() {
+        if (started_) {
+            cursor_->close();
+        }
+    }
+
+    //! Start query (stream shouldn't be shared at this point)
+    void start() {
+        if (continuous_) {
+            // Notification is delivered through the worker pool, writer thread can't
+            // hold the last reference to the stream (cursor can't be closed by callback)
+            std::weak_ptr<QueryStream> weak = shared_from_this();
+            auto workers = workers_;
+            cursor_->subscribe([weak, workers]() {
+                workers->post([weak]() {
+                    if (auto self = weak.lock()) {
+                        self->notify();
+                    }
+                });
+            });
+        }
+        cursor_->start();
+        started_ = true;
+    }
+
+    //! Schedule next chunk (lock should be held)
+    void schedule_fill() {
+        pending_ = true;
+        notified_ = false;
+        auto self = shared_from_this();
+        workers_->post([self]() {
+            self->fill();
+        });
+    }
+
+    //! Fill back buffer (runs in worker pool)
+    void fill() {
+        char* buf = back_.data();
+        size_t size = 0;
+        bool done = false;
+        try {
+            do {
+                std::tie(size, done) = cursor_->read_some(buf, CHUNK_SIZE);
+            } while (size == 0 && !done && !continuous_);
+        } catch (const std::exception& err) {
+            int len = snprintf(buf, CHUNK_SIZE, "-%s\r\n", err.what());
+            size = len > 0 ? std::min(static_cast<size_t>(len), static_cast<size_t>(CHUNK_SIZE - 1)) : 0u;
+            done = true;
+        }
+        std::lock_guard<std::mutex> guard(lock_);
+        back_size_ = size;
+        done_ = done;
+        pending_ = false;
+        if (size == 0 && !done) {
+            // Continuous query have no new data
+            if (notified_) {
+                schedule_fill();
+            } else {
+                waiting_ = true;
+            }
+        }
+        if (suspended_ && !pending_ && !waiting_ && !closed_ && !stopped_) {
+            suspended_ = false;
+            MHD_resume_connection(connection_);
+        }
+    }
+
+    //! New data is available (runs in worker pool)
+    void notify() {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (closed_ || stopped_) {
+            return;
+        }
+        if (waiting_) {
+            waiting_ = false;
+            schedule_fill();
+        } else if (pending_) {
+            // Worker can miss new data
+            notified_ = true;
+        }
+    }
+
+    //! Copy output to microhttpd buffer (runs in event loop)
+    ssize_t read(char* buf, size_t max) {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (stopped_) {
+            return MHD_CONTENT_READER_END_WITH_ERROR;
+        }
+        if (front_pos_ == front_size_) {
+            if (pending_ || waiting_) {
+                // Output is not ready yet, worker will resume connection
+                suspended_ = true;
+                MHD_suspend_connection(connection_);
+                return 0;
+            }
+            if (back_size_ == 0 && done_) {
+                return MHD_CONTENT_READER_END_OF_STREAM;
+            }
+            std::swap(front_, back_);
+            front_pos_ = 0;
+            front_size_ = back_size_;
+            back_size_ = 0;
+            if (!done_) {
+                // Prefetch next chunk while current one is being sent
+                schedule_fill();
+            }
+        }
+        size_t sz = std::min(max, front_size_ - front_pos_);
+        memcpy(buf, front_.data() + front_pos_, sz);
+        front_pos_ += sz;
+        return static_cast<ssize_t>(sz);
+    }
+
+    //! Called when microhttpd destroys response
+    void close() {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            closed_ = true;
+        }
+        server_->unregister_stream(this);
+    }
+
+    //! Terminate output and resume connection, so microhttpd could close it (called on server shutdown)
+    void shutdown() {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopped_ = true;
+        if (suspended_ && !closed_) {
+            suspended_ = false;
+            MHD_resume_connection(connection_);
+        }
+    }
+};
+
+typedef std::shared_ptr<QueryStream> PQueryStream;
+
 //! Microhttpd callback functions
 namespace MHD {
 static ssize_t read_callback(void *data, uint64_t pos, char *buf, size_t max) {
     AKU_UNUSED(pos);
-    ReadOperation* cur = (ReadOperation*)data;
-    auto status = cur->get_error();
-    if (status) {
-        return MHD_CONTENT_READER_END_OF_STREAM;
-    }
-    size_t sz;
-    bool is_done;
-    std::tie(sz, is_done) = cur->read_some(buf, max);
-    if (is_done) {
-        return MHD_CONTENT_READER_END_OF_STREAM;
-    } else {
-        if (sz == 0u) {
-            // Not at the end of the stream but data is not ready yet.
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        }
-    }
-    return sz;
+    PQueryStream* stream = static_cast<PQueryStream*>(data);
+    return (*stream)->read(buf, max);
 }
 
 static void free_callback(void *data) {
-    ReadOperation* cur = (ReadOperation*)data;
-    cur->close();
-    delete cur;
+    PQueryStream* stream = static_cast<PQueryStream*>(data);
+    // Query stream can outlive the connection if worker is still running
+    (*stream)->close();
+    delete stream;
+}
+
+//! Add pipeline stats to the database stats (under `pipeline` key)
+static std::string merge_stats(std::string const& dbstats, std::string const& plstats) {
+    boost::property_tree::ptree dbtree, pltree;
+    try {
+        std::stringstream dbstream(dbstats), plstream(plstats);
+        boost::property_tree::json_parser::read_json(dbstream, dbtree);
+        boost::property_tree::json_parser::read_json(plstream, pltree);
+    } catch (boost::property_tree::json_parser_error const&) {
+        return dbstats;
+    }
+    dbtree.add_child("pipeline", pltree);
+    std::stringstream out;
+    boost::property_tree::json_parser::write_json(out, dbtree, true);
+    return out.str();
 }
 
 static int accept_connection(void           *cls,
@@ -46,12 +251,13 @@ static int accept_connection(void           *cls,
                              size_t         *upload_data_size,
                              void          **con_cls)
 {
+    HttpServer *server = static_cast<HttpServer*>(cls);
     if (strcmp(method, "POST") == 0) {
-        ReadOperationBuilder *queryproc = static_cast<ReadOperationBuilder*>(cls);
         ReadOperation* cursor = static_cast<ReadOperation*>(*con_cls);
 
         if (cursor == nullptr) {
-            cursor = queryproc->create();
+            cursor = server->proc_->create();
+            cursor->set_accept(MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT));
             *con_cls = cursor;
             return MHD_YES;
         }
@@ -70,9 +276,13 @@ static int accept_connection(void           *cls,
             return ret;
         };
 
+        // Stream owns the cursor, POST to /subscribe starts continuous query
+        bool continuous = strcmp(url, "/subscribe") == 0;
+        auto query_stream = std::make_shared<QueryStream>(cursor, connection, server, continuous);
+
         // Should be called once
         try {
-            cursor->start();
+            query_stream->start();
         } catch (const std::exception& err) {
             return error_response(err.what());
         }
@@ -84,13 +294,27 @@ static int accept_connection(void           *cls,
             return error_response(error_msg);
         }
 
-        auto response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 64*1024, &read_callback, cursor, &free_callback);
-        int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+        auto content_type = cursor->get_content_type();
+        server->register_stream(query_stream);
+        auto stream = new PQueryStream(std::move(query_stream));
+        {
+            // Start producing output before the first read
+            std::lock_guard<std::mutex> guard((*stream)->lock_);
+            (*stream)->schedule_fill();
+        }
+        auto response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, QueryStream::CHUNK_SIZE,
+                                                          &read_callback, stream, &free_callback);
+        int ret = MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, content_type);
+        if (ret == MHD_NO) {
+            MHD_destroy_response(response);
+            return ret;
+        }
+        ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
         MHD_destroy_response(response);
         return ret;
     } else {
         static const char* SIGIL = "";
-        auto queryproc = static_cast<ReadOperationBuilder*>(cls);
+        auto queryproc = server->proc_;
         auto cursor = static_cast<const char*>(*con_cls);
         if (cursor == nullptr) {
             *con_cls = const_cast<char*>(SIGIL);
@@ -99,6 +323,9 @@ static int accept_connection(void           *cls,
         std::string path = url;
         if (path == "/stats") {
             std::string stats = queryproc->get_all_stats();
+            if (server->pipeline_) {
+                stats = merge_stats(stats, server->pipeline_->get_all_stats());
+            }
             auto response = MHD_create_response_from_buffer(stats.size(), const_cast<char*>(stats.data()), MHD_RESPMEM_MUST_COPY);
             int ret = MHD_add_response_header(response, "content-type", "application/json");
             if (ret == MHD_NO) {
@@ -107,32 +334,100 @@ static int accept_connection(void           *cls,
             ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
             MHD_destroy_response(response);
             return ret;
+        } else if (path == "/metrics") {
+            std::string metrics;
+            aku_trace_cb_t append = [](const char* data, size_t size, void* arg) {
+                static_cast<std::string*>(arg)->append(data, size);
+            };
+            auto status = aku_metrics_dump(append, &metrics);
+            if (status != AKU_SUCCESS) {
+                return MHD_NO;
+            }
+            std::stringstream out;
+            Metrics::TextWriter writer(out);
+            queryproc->write_metrics(writer);
+            if (server->pipeline_) {
+                server->pipeline_->write_metrics(writer);
+            }
+            metrics += out.str();
+            auto response = MHD_create_response_from_buffer(metrics.size(), const_cast<char*>(metrics.data()), MHD_RESPMEM_MUST_COPY);
+            int ret = MHD_add_response_header(response, "content-type", "text/plain; version=0.0.4");
+            if (ret == MHD_NO) {
+                return ret;
+            }
+            ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+            MHD_destroy_response(response);
+            return ret;
+        } else if (path == "/trace") {
+            std::string trace;
+            aku_trace_cb_t append = [](const char* data, size_t size, void* arg) {
+                static_cast<std::string*>(arg)->append(data, size);
+            };
+            auto status = aku_trace_dump(append, &trace);
+            if (status != AKU_SUCCESS) {
+                return MHD_NO;
+            }
+            auto response = MHD_create_response_from_buffer(trace.size(), const_cast<char*>(trace.data()), MHD_RESPMEM_MUST_COPY);
+            int ret = MHD_add_response_header(response, "content-type", "application/json");
+            if (ret == MHD_NO) {
+                return ret;
+            }
+            ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+            MHD_destroy_response(response);
+            return ret;
         }
     }
     return MHD_NO;
 }
 }
 
-HttpServer::HttpServer(unsigned short port, std::shared_ptr<ReadOperationBuilder> qproc, AccessControlList const& acl)
+HttpServer::HttpServer(unsigned short port, std::shared_ptr<ReadOperationBuilder> qproc, int nworkers, AccessControlList const& acl,
+                       std::shared_ptr<IngestionPipeline> pipeline)
     : acl_(acl)
     , proc_(qproc)
+    , pipeline_(pipeline)
     , port_(port)
+    , daemon_(nullptr)
+    , nworkers_(nworkers > 0 ? nworkers : std::max(1, static_cast<int>(std::thread::hardware_concurrency())))
+    , stopping_(false)
+    , logger_("http-server", 32)
 {
 }
 
-HttpServer::HttpServer(unsigned short port, std::shared_ptr<ReadOperationBuilder> qproc)
-    : HttpServer(port, qproc, AccessControlList())
+HttpServer::HttpServer(unsigned short port, std::shared_ptr<ReadOperationBuilder> qproc, int nworkers)
+    : HttpServer(port, qproc, nworkers, AccessControlList())
 {
 }
 
 void HttpServer::start(SignalHandler* sig, int id) {
-    daemon_ = MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION,
+    work_.reset(new WorkT(workers_));
+    for (int i = 0; i < nworkers_; i++) {
+        auto self = shared_from_this();
+        threads_.emplace_back([self]() {
+            self->workers_.run();
+        });
+    }
+    logger_.info() << "Query worker pool size: " << nworkers_;
+
+    // Event loop uses epoll if available
+    unsigned int flags = MHD_USE_SELECT_INTERNALLY|SUSPEND_RESUME_FLAG;
+    daemon_ = MHD_start_daemon(flags|MHD_USE_EPOLL_LINUX_ONLY,
                                port_,
                                NULL,
                                NULL,
                                &MHD::accept_connection,
-                               proc_.get(),
+                               this,
                                MHD_OPTION_END);
+    if (daemon_ == nullptr) {
+        logger_.info() << "Can't start daemon using epoll, falling back to poll";
+        daemon_ = MHD_start_daemon(flags|MHD_USE_POLL,
+                                   port_,
+                                   NULL,
+                                   NULL,
+                                   &MHD::accept_connection,
+                                   this,
+                                   MHD_OPTION_END);
+    }
     if (daemon_ == nullptr) {
         BOOST_THROW_EXCEPTION(std::runtime_error("can't start daemon"));
     }
@@ -141,8 +436,45 @@ void HttpServer::start(SignalHandler* sig, int id) {
     sig->add_handler(boost::bind(&HttpServer::stop, std::move(self)), id);
 }
 
+void HttpServer::register_stream(std::shared_ptr<QueryStream> const& stream) {
+    std::lock_guard<std::mutex> guard(streams_lock_);
+    if (stopping_) {
+        stream->shutdown();
+    }
+    streams_[stream.get()] = stream;
+}
+
+void HttpServer::unregister_stream(QueryStream* stream) {
+    std::lock_guard<std::mutex> guard(streams_lock_);
+    streams_.erase(stream);
+}
+
 void HttpServer::stop() {
+    // Microhttpd panics if daemon is stopped while some connections are suspended
+    std::vector<std::shared_ptr<QueryStream>> streams;
+    {
+        std::lock_guard<std::mutex> guard(streams_lock_);
+        stopping_ = true;
+        for (auto const& kv: streams_) {
+            if (auto stream = kv.second.lock()) {
+                streams.push_back(stream);
+            }
+        }
+    }
+    logger_.info() << "Closing " << streams.size() << " query streams";
+    for (auto const& stream: streams) {
+        stream->shutdown();
+    }
+    streams.clear();
     MHD_stop_daemon(daemon_);
+
+    // Workers can still use the streams until daemon is stopped
+    work_.reset();
+    workers_.stop();
+    for (auto& thread: threads_) {
+        thread.join();
+    }
+    threads_.clear();
 }
 
 struct HttpServerBuilder {
@@ -151,10 +483,10 @@ struct HttpServerBuilder {
         ServerFactory::instance().register_type("HTTP", *this);
     }
 
-    std::shared_ptr<Server> operator () (std::shared_ptr<IngestionPipeline>,
+    std::shared_ptr<Server> operator () (std::shared_ptr<IngestionPipeline> pipeline,
                                          std::shared_ptr<ReadOperationBuilder> qproc,
                                          const ServerSettings& settings) {
-        return std::make_shared<HttpServer>(settings.port, qproc);
+        return std::make_shared<HttpServer>(settings.port, qproc, settings.nworkers, AccessControlList(), pipeline);
     }
 };
 
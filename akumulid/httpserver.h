@@ -17,10 +17,16 @@
 #pragma once
 #include <string>
 #include <memory>
+#include <mutex>
 #include <tuple>
+#include <unordered_map>
+#include <thread>
+#include <vector>
 
 #include <microhttpd.h>
 
+#include <boost/asio.hpp>
+
 #include "logger.h"
 #include "akumuli.h"
 #include "server.h"
@@ -30,18 +36,54 @@ namespace Http {
 
 struct AccessControlList {};  // TODO: implement ACL
 
+struct QueryStream;
+
+/** HTTP server.
+  * Connections are served by the single microhttpd event loop. Queries are
+  * executed by the bounded worker pool, connection is suspended while the
+  * next chunk of the query output is produced and resumed by the worker.
+  */
 struct HttpServer : std::enable_shared_from_this<HttpServer>, Server
 {
+    typedef boost::asio::io_service         IOServiceT;
+    typedef boost::asio::io_service::work   WorkT;
+
     AccessControlList                       acl_;
     std::shared_ptr<ReadOperationBuilder>   proc_;
+    std::shared_ptr<IngestionPipeline>      pipeline_;  //< Ingestion pipeline (used to collect stats, can be null)
     unsigned short                          port_;
     MHD_Daemon                             *daemon_;
+    int                                     nworkers_;  //< Query worker pool size
+    IOServiceT                              workers_;   //< Query worker pool
+    std::unique_ptr<WorkT>                  work_;      //< Keeps worker pool running
+    std::vector<std::thread>                threads_;   //< Worker threads
+    std::mutex                              streams_lock_;
+    std::unordered_map<QueryStream*, std::weak_ptr<QueryStream>> streams_;  //< Live query streams
+    bool                                    stopping_;  //< Server is shutting down
+    Logger                                  logger_;
 
-    HttpServer(unsigned short port, std::shared_ptr<ReadOperationBuilder> qproc);
-    HttpServer(unsigned short port, std::shared_ptr<ReadOperationBuilder> qproc, AccessControlList const& acl);
+    /** C-tor.
+      * @param port port number
+      * @param qproc read operation builder
+      * @param nworkers number of threads that execute queries (hardware concurrency if not positive)
+      * @param pipeline ingestion pipeline, its counters are added to `/stats` output (can be null)
+      */
+    HttpServer(unsigned short port, std::shared_ptr<ReadOperationBuilder> qproc, int nworkers = 0);
+    HttpServer(unsigned short port, std::shared_ptr<ReadOperationBuilder> qproc, int nworkers, AccessControlList const& acl,
+               std::shared_ptr<IngestionPipeline> pipeline = nullptr);
 
     virtual void start(SignalHandler* handler, int id);
+
+    /** Stop the server. Suspended connections are resumed and closed before
+      * microhttpd daemon is stopped, worker pool is stopped last.
+      */
     void stop();
+
+    //! Add query stream to the list of live streams (stream is closed immediately if server is stopping)
+    void register_stream(std::shared_ptr<QueryStream> const& stream);
+
+    //! Remove query stream from the list of live streams
+    void unregister_stream(QueryStream* stream);
 };
 
 }
@@ -2,6 +2,8 @@
 #include "logger.h"
 #include "utility.h"
 
+#include <algorithm>
+#include <sstream>
 #include <thread>
 
 #include <boost/exception/all.hpp>
@@ -38,14 +40,36 @@ struct AkumuliCursor : DbCursor {
     virtual void close() {
         aku_cursor_close(cursor_);
     }
+
+    virtual int param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size) {
+        return aku_cursor_param_id_to_series(cursor_, id, buffer, buffer_size);
+    }
+};
+
+//! Continuous query cursor (owns notification callback)
+struct AkumuliSubscription : AkumuliCursor {
+    std::shared_ptr<std::function<void()>> notify_;
+
+    AkumuliSubscription(aku_Cursor* cur, std::shared_ptr<std::function<void()>> notify)
+        : AkumuliCursor(cur)
+        , notify_(notify)
+    {
+    }
 };
 
+static void notify_subscriber(void* arg) {
+    (*static_cast<std::function<void()>*>(arg))();
+}
+
 AkumuliConnection::AkumuliConnection(const char *path,
                                      bool hugetlb,
                                      Durability durability,
                                      uint32_t compression_threshold,
                                      uint64_t window_width,
-                                     uint64_t cache_size)
+                                     uint64_t cache_size,
+                                     bool enable_wal,
+                                     uint64_t query_cache_size,
+                                     std::string rollup_tiers)
     : dbpath_(path)
 {
     aku_FineTuneParams params = {};
@@ -56,6 +80,9 @@ AkumuliConnection::AkumuliConnection(const char *path,
     params.compression_threshold = compression_threshold;
     params.window_size = window_width;
     params.max_cache_size = cache_size;
+    params.enable_wal = enable_wal ? 1u : 0u;
+    params.query_cache_size = query_cache_size;
+    params.rollup_tiers = rollup_tiers.empty() ? nullptr : rollup_tiers.c_str();
     db_ = aku_open_database(dbpath_.c_str(), params);
 
     aku_Status status = aku_open_status(db_);
@@ -80,6 +107,13 @@ std::shared_ptr<DbCursor> AkumuliConnection::search(std::string query) {
     return std::make_shared<AkumuliCursor>(cursor);
 }
 
+std::shared_ptr<DbCursor> AkumuliConnection::subscribe(std::string query, std::function<void()> notify) {
+    // Callback should outlive the cursor, it's released after cursor is closed
+    auto cb = std::make_shared<std::function<void()>>(std::move(notify));
+    aku_Cursor* cursor = aku_subscribe(db_, query.c_str(), &notify_subscriber, cb.get());
+    return std::make_shared<AkumuliSubscription>(cursor, cb);
+}
+
 int AkumuliConnection::param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size) {
     return aku_param_id_to_series(db_, id, buffer, buffer_size);
 }
@@ -99,18 +133,30 @@ std::string AkumuliConnection::get_all_stats() {
 }
 
 // Pipeline spout
-PipelineSpout::PipelineSpout(std::shared_ptr<Queue> q, BackoffPolicy bp, std::shared_ptr<DbConnection> con)
+PipelineSpout::PipelineSpout(std::shared_ptr<Queue> q, BackoffPolicy bp, std::shared_ptr<DbConnection> con,
+                             int pool_size, int max_batch_size)
     : created_{0}
     , deleted_{0}
     , pool_()
     , queue_(q)
     , backoff_(bp)
+    , pool_size_(pool_size > 0 ? pool_size : POOL_SIZE)
+    , max_batch_size_(max_batch_size > 0 ? max_batch_size : 1)
+    , batch_size_{1}
+    , batch_(nullptr)
     , logger_("pipeline-spout", 32)
     , db_(con)
+    , id_(0)
+    , nsamples_{0}
+    , nbatches_{0}
+    , nqueue_full_{0}
+    , npool_full_{0}
+    , ndropped_{0}
 {
-    pool_.resize(POOL_SIZE);
-    for(int ix = POOL_SIZE; ix --> 0;) {
+    pool_.resize(pool_size_);
+    for(int ix = pool_size_; ix --> 0;) {
         pool_.at(ix).reset(new TVal());
+        pool_.at(ix)->samples.reserve(1);
     }
 }
 
@@ -121,28 +167,66 @@ void PipelineSpout::set_error_cb(PipelineErrorCb cb) {
     on_error_ = cb;
 }
 
+//! Increment counter that is modified by the single thread
+static void increment(PipelineSpout::SpoutCounter& cnt, uint64_t value = 1) {
+    cnt.store(cnt.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
 void PipelineSpout::write(const aku_Sample& sample) {
-    int ix = get_index_of_empty_slot();
-    while (AKU_UNLIKELY(ix < 0)) {
-        ix = get_index_of_empty_slot();
-        if (ix < 0 && backoff_ == AKU_LINEAR_BACKOFF) {
-            std::this_thread::yield();
-            continue;
-        } else if ( ix < 0 && backoff_ == AKU_THROTTLE) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            return;
+    if (batch_ == nullptr) {
+        int ix = get_index_of_empty_slot();
+        if (AKU_UNLIKELY(ix < 0)) {
+            // Writer lags behind
+            increment(npool_full_);
+            batch_size_.store(std::min(batch_size_.load(std::memory_order_relaxed)*2, max_batch_size_),
+                              std::memory_order_relaxed);
         }
+        while (AKU_UNLIKELY(ix < 0)) {
+            ix = get_index_of_empty_slot();
+            if (ix < 0 && backoff_ == AKU_LINEAR_BACKOFF) {
+                std::this_thread::yield();
+                continue;
+            } else if ( ix < 0 && backoff_ == AKU_THROTTLE) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                increment(ndropped_);
+                return;
+            }
+        }
+
+        batch_ = pool_.at(ix).get();
+        batch_->samples.clear();
+        batch_->cnt      =  &deleted_;
+        batch_->on_error = &on_error_;
     }
 
-    auto pvalue = pool_.at(ix).get();
+    batch_->samples.push_back(sample);
 
-    pvalue->sample   =     sample;
-    pvalue->cnt      =  &deleted_;
-    pvalue->on_error = &on_error_;
+    if (batch_->samples.size() >= static_cast<size_t>(batch_size_.load(std::memory_order_relaxed))) {
+        flush();
+    }
+}
 
-    while (!queue_->push(pvalue)) {
-        std::this_thread::yield();
+void PipelineSpout::flush() {
+    if (batch_ == nullptr) {
+        return;
+    }
+    auto batch_size = batch_size_.load(std::memory_order_relaxed);
+    auto nsamples = batch_->samples.size();
+    if (AKU_UNLIKELY(!queue_->push(batch_))) {
+        // Writer lags behind
+        increment(nqueue_full_);
+        batch_size = std::min(batch_size*2, max_batch_size_);
+        while (!queue_->push(batch_)) {
+            std::this_thread::yield();
+        }
+    } else if (batch_size > 1 && (created_ - deleted_) < static_cast<uint64_t>(pool_size_/4)) {
+        // Writer caught up
+        batch_size /= 2;
     }
+    batch_size_.store(batch_size, std::memory_order_relaxed);
+    batch_ = nullptr;
+    increment(nsamples_, nsamples);
+    increment(nbatches_);
 }
 
 aku_Status PipelineSpout::series_to_param_id(const char *str, size_t strlen, aku_Sample *sample) {
@@ -155,9 +239,9 @@ void PipelineSpout::add_bulk_string(const Byte *buffer, size_t n) {
 }
 
 int PipelineSpout::get_index_of_empty_slot() {
-    if (created_ - deleted_ < POOL_SIZE) {
+    if (created_ - deleted_ < static_cast<uint64_t>(pool_size_)) {
         // There is some space in the pool
-        auto result = created_  % POOL_SIZE;
+        auto result = created_  % pool_size_;
         created_++;
         return result;
     }
@@ -168,19 +252,40 @@ bool PipelineSpout::is_empty() const {
     return created_ == deleted_;
 }
 
+void PipelineSpout::get_stats(boost::property_tree::ptree* out) const {
+    std::string prefix = "spout_" + std::to_string(id_) + ".";
+    out->put(prefix + "samples", nsamples_.load(std::memory_order_relaxed));
+    out->put(prefix + "batches", nbatches_.load(std::memory_order_relaxed));
+    out->put(prefix + "batch_size", batch_size_.load(std::memory_order_relaxed));
+    out->put(prefix + "in_flight", created_.load() - deleted_.load());
+    out->put(prefix + "queue_full", nqueue_full_.load(std::memory_order_relaxed));
+    out->put(prefix + "pool_full", npool_full_.load(std::memory_order_relaxed));
+    out->put(prefix + "dropped", ndropped_.load(std::memory_order_relaxed));
+}
+
 // Ingestion pipeline
 
-IngestionPipeline::IngestionPipeline(std::shared_ptr<DbConnection> con, BackoffPolicy bp)
+IngestionPipeline::IngestionPipeline(std::shared_ptr<DbConnection> con,
+                                     BackoffPolicy bp,
+                                     int pool_size,
+                                     int queue_capacity,
+                                     int max_batch_size,
+                                     int nqueues)
     : con_(con)
     , ixmake_{0}
     , stopbar_(2)
     , startbar_(2)
     , backoff_(bp)
+    , pool_size_(pool_size)
+    , max_batch_(max_batch_size)
     , logger_("ingestion-pipeline", 32)
-
+    , next_id_(0)
+    , nwritten_{0}
+    , nerrors_{0}
 {
-    for (int i = N_QUEUES; i --> 0;) {
-        queues_.push_back(std::make_shared<PipelineSpout::Queue>(PipelineSpout::QCAP));
+    auto capacity = queue_capacity > 0 ? queue_capacity : PipelineSpout::QCAP;
+    for (int i = std::max(nqueues, static_cast<int>(N_QUEUES)); i --> 0;) {
+        queues_.push_back(std::make_shared<PipelineSpout::Queue>(capacity));
     }
 }
 
@@ -196,16 +301,17 @@ void IngestionPipeline::start() {
             PipelineSpout::TVal *val;
             int poison_cnt = 0;
             std::vector<PipelineSpout::PQueue> queues = self->queues_;
+            const int nqueues = static_cast<int>(queues.size());
             const int IDLE_THRESHOLD = 0x10000;
             int idle_count = 0;
-            for (int ix = 0; true; ix++) {
-                auto& qref = queues.at(ix % N_QUEUES);
+            for (int ix = 0; true; ix = (ix + 1) % nqueues) {
+                auto& qref = queues.at(ix);
                 if (qref->pop(val)) {
                     idle_count = 0;
                     // New write
                     if (AKU_UNLIKELY(val->cnt == nullptr)) {  //poisoned
                         poison_cnt++;
-                        if (poison_cnt == N_QUEUES) {
+                        if (poison_cnt == nqueues) {
                             // Check
                             for (auto& x: self->queues_) {
                                 if (!x->empty()) {
@@ -221,16 +327,25 @@ void IngestionPipeline::start() {
                             return;
                         }
                     } else {
-                        auto error = self->con_->write(val->sample);
-                        (*val->cnt)++;
-                        if (AKU_UNLIKELY(error != AKU_SUCCESS)) {
-                            (*val->on_error)(error, *val->cnt);
+                        uint64_t nerrors = 0;
+                        for (auto const& sample: val->samples) {
+                            auto error = self->con_->write(sample);
+                            if (AKU_UNLIKELY(error != AKU_SUCCESS)) {
+                                nerrors++;
+                                (*val->on_error)(error, *val->cnt);
+                            }
+                        }
+                        increment(self->nwritten_, val->samples.size());
+                        if (AKU_UNLIKELY(nerrors)) {
+                            increment(self->nerrors_, nerrors);
                         }
+                        // Batch can be reused by the spout after this point
+                        (*val->cnt)++;
                     }
                 } else {
                     idle_count++;
                     if (idle_count > IDLE_THRESHOLD) {
-                        if (idle_count % N_QUEUES == 0) {
+                        if (idle_count % nqueues == 0) {
                             // in idle state
                             // check all queues and go idle again
                             std::this_thread::sleep_for(std::chrono::milliseconds(1));
@@ -254,9 +369,25 @@ void IngestionPipeline::start() {
     logger_.info() << "Pipeline started";
 }
 
+std::shared_ptr<PipelineSpout> IngestionPipeline::add_spout(PipelineSpout::PQueue queue) {
+    auto spout = std::make_shared<PipelineSpout>(queue, backoff_, con_, pool_size_, max_batch_);
+    std::lock_guard<std::mutex> guard(spouts_lock_);
+    // Remove spouts of the closed sessions
+    spouts_.erase(std::remove_if(spouts_.begin(), spouts_.end(),
+                                 [](std::weak_ptr<PipelineSpout> const& p) { return p.expired(); }),
+                  spouts_.end());
+    spout->id_ = next_id_++;
+    spouts_.push_back(spout);
+    return spout;
+}
+
 std::shared_ptr<PipelineSpout> IngestionPipeline::make_spout() {
     ixmake_++;
-    return std::make_shared<PipelineSpout>(queues_.at(ixmake_ % N_QUEUES), backoff_, con_);
+    return add_spout(queues_.at(ixmake_ % queues_.size()));
+}
+
+std::shared_ptr<PipelineSpout> IngestionPipeline::make_spout(int index) {
+    return add_spout(queues_.at(static_cast<size_t>(index) % queues_.size()));
 }
 
 PipelineSpout::TVal* IngestionPipeline::POISON = new PipelineSpout::TVal{{}, nullptr, nullptr};
@@ -275,4 +406,49 @@ void IngestionPipeline::stop() {
     logger_.info() << "Pipeline stopped (IngestionPipeline::stop)";
 }
 
+std::string IngestionPipeline::get_all_stats() {
+    boost::property_tree::ptree ptree;
+    ptree.put("writer.samples", nwritten_.load(std::memory_order_relaxed));
+    ptree.put("writer.errors", nerrors_.load(std::memory_order_relaxed));
+    {
+        std::lock_guard<std::mutex> guard(spouts_lock_);
+        for (auto const& weak: spouts_) {
+            auto spout = weak.lock();
+            if (spout) {
+                spout->get_stats(&ptree);
+            }
+        }
+    }
+    std::stringstream out;
+    boost::property_tree::json_parser::write_json(out, ptree, true);
+    return out.str();
+}
+
+void IngestionPipeline::write_metrics(Metrics::TextWriter& writer) {
+    Metrics::TextWriter::LabeledValues depth, samples;
+    {
+        std::lock_guard<std::mutex> guard(spouts_lock_);
+        for (auto const& weak: spouts_) {
+            auto spout = weak.lock();
+            if (spout) {
+                auto id = std::to_string(spout->id_);
+                depth.push_back(std::make_pair(id, static_cast<double>(spout->created_.load() - spout->deleted_.load())));
+                samples.push_back(std::make_pair(id, static_cast<double>(spout->nsamples_.load(std::memory_order_relaxed))));
+            }
+        }
+    }
+    writer.counter("akumuli_pipeline_samples_written_total",
+                   "Number of samples written by the pipeline worker",
+                   nwritten_.load(std::memory_order_relaxed));
+    writer.counter("akumuli_pipeline_write_errors_total",
+                   "Number of samples rejected by the storage",
+                   nerrors_.load(std::memory_order_relaxed));
+    writer.gauge("akumuli_pipeline_spout_queue_depth",
+                 "Number of batches sent by the spout and not yet written",
+                 "spout", depth);
+    writer.counter("akumuli_pipeline_spout_samples_total",
+                   "Number of samples sent to the queue by the spout",
+                   "spout", samples);
+}
+
 }
@@ -19,12 +19,16 @@
 #include <memory>
 #include <atomic>
 #include <functional>
+#include <mutex>
+#include <vector>
 
 #include <boost/lockfree/queue.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
 #include <boost/thread/barrier.hpp>
 
 #include "protocol_consumer.h"
 #include "logger.h"
+#include "metrics.h"
 // akumuli-storage API
 #include "akumuli.h"
 #include "akumuli_config.h"
@@ -45,6 +49,9 @@ struct DbCursor {
 
     //! Close cursor
     virtual void close() = 0;
+
+    //! Convert paramid returned by cursor to series name
+    virtual int param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size) = 0;
 };
 
 //! Abstraction layer above aku_Database
@@ -60,6 +67,12 @@ struct DbConnection {
     //! Execute search query
     virtual std::shared_ptr<DbCursor> search(std::string query) = 0;
 
+    /** Execute continuous query. Cursor returns new data when it's written to the database.
+      * @param notify is called from the writer thread when new data is available (or cursor
+      *        is done), callback shouldn't block and can't be called after cursor is closed
+      */
+    virtual std::shared_ptr<DbCursor> subscribe(std::string query, std::function<void()> notify) = 0;
+
     //! Convert paramid to series name
     virtual int param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size) = 0;
 
@@ -82,7 +95,7 @@ private:
     std::string     dbpath_;
     aku_Database   *db_;
 public:
-    AkumuliConnection(const char* path, bool hugetlb, Durability durability, uint32_t compression_threshold, uint64_t window_width, uint64_t cache_size);
+    AkumuliConnection(const char* path, bool hugetlb, Durability durability, uint32_t compression_threshold, uint64_t window_width, uint64_t cache_size, bool enable_wal, uint64_t query_cache_size, std::string rollup_tiers);
 
     virtual void close();
 
@@ -90,6 +103,8 @@ public:
 
     virtual std::shared_ptr<DbCursor> search(std::string query);
 
+    virtual std::shared_ptr<DbCursor> subscribe(std::string query, std::function<void()> notify);
+
     virtual int param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size);
 
     virtual aku_Status series_to_param_id(const char *name, size_t size, aku_Sample *sample);
@@ -119,6 +134,9 @@ typedef std::function<void(aku_Status, uint64_t)> PipelineErrorCb;
   * they was created. This shuld minimize contention inside
   * allocator and limit overall memory usage (no need to create
   * pool of objects beforehand).
+  * Samples are sent to the queue in batches. Batch size is adaptive, it
+  * grows when the writer lags behind (queue or pool is full) and shrinks
+  * back when the writer catches up. Incomplete batch is sent on `flush`.
   */
 struct PipelineSpout : ProtocolConsumer {
 
@@ -133,10 +151,10 @@ struct PipelineSpout : ProtocolConsumer {
     typedef struct { char emptybits[64]; }       Padding;        //< Padding
     typedef std::atomic<uint64_t>                SpoutCounter;   //< Shared counter
     typedef struct {
-        aku_Sample             sample;                           //< Value
+        std::vector<aku_Sample> samples;                         //< Values
         SpoutCounter          *cnt;                              //< Pointer to spout's shared counter
         PipelineErrorCb       *on_error;                         //< On error callback
-    }                                            TVal;           //< Value
+    }                                            TVal;           //< Batch of values
     typedef std::shared_ptr<TVal>                PVal;           //< Pointer to value
     typedef queue<TVal*>                         Queue;          //< Queue class
     typedef std::shared_ptr<Queue>               PQueue;         //< Pointer to queue
@@ -150,12 +168,31 @@ struct PipelineSpout : ProtocolConsumer {
     Padding             pad1;
     PQueue              queue_;                                  //< Queue
     const BackoffPolicy backoff_;
+    const int           pool_size_;                              //< Number of TVals in the pool
+    const int           max_batch_size_;                         //< Batch size limit
+    std::atomic<int>    batch_size_;                             //< Current batch size
+    TVal               *batch_;                                  //< Batch that is being filled (or null)
     Logger              logger_;                                 //< Logger instance
     PipelineErrorCb     on_error_;                               //< Session callback
     PDatabase           db_;
-
-    // C-tor
-    PipelineSpout(std::shared_ptr<Queue> q, BackoffPolicy bp, std::shared_ptr<DbConnection> con);
+    int                 id_;                                     //< Spout id (used in stats)
+
+    // Stats (updated by the spout's thread only)
+    SpoutCounter        nsamples_;                               //< Number of samples sent to the queue
+    SpoutCounter        nbatches_;                               //< Number of batches sent to the queue
+    SpoutCounter        nqueue_full_;                            //< Number of times the queue was full
+    SpoutCounter        npool_full_;                             //< Number of times the pool was exhausted
+    SpoutCounter        ndropped_;                               //< Number of throttled samples
+
+    /** C-tor
+      * @param q queue connected to the pipeline
+      * @param bp back-pressure policy (used when the pool is exhausted)
+      * @param con database connection
+      * @param pool_size max number of batches in flight
+      * @param max_batch_size batch size limit (1 - samples are sent one by one)
+      */
+    PipelineSpout(std::shared_ptr<Queue> q, BackoffPolicy bp, std::shared_ptr<DbConnection> con,
+                  int pool_size = POOL_SIZE, int max_batch_size = 1);
    ~PipelineSpout();
 
     void set_error_cb(PipelineErrorCb cb);
@@ -164,6 +201,9 @@ struct PipelineSpout : ProtocolConsumer {
     virtual void write(const aku_Sample& sample);
     virtual void add_bulk_string(const Byte *buffer, size_t n);
 
+    //! Send incomplete batch to the queue (should be called when there is no more input at the moment)
+    void flush();
+
     // Utility
     //! Reserve index for the next TVal in the pool or negative value on error.
     int get_index_of_empty_slot();
@@ -177,6 +217,9 @@ struct PipelineSpout : ProtocolConsumer {
 
     /** Returns true if all TVal's is processed */
     bool is_empty() const;
+
+    //! Add spout's counters to the property tree (can be called from any thread)
+    void get_stats(boost::property_tree::ptree* out) const;
 };
 
 class IngestionPipeline : public std::enable_shared_from_this<IngestionPipeline>
@@ -193,11 +236,33 @@ class IngestionPipeline : public std::enable_shared_from_this<IngestionPipeline>
     static PipelineSpout::TVal        *POISON;      //< Poisoned object to stop worker thread
     static int                         TIMEOUT;     //< Close timeout
     const BackoffPolicy                backoff_;    //< Back-pressure policy
+    const int                          pool_size_;  //< Spout pool size
+    const int                          max_batch_;  //< Spout batch size limit
     Logger                             logger_;     //< Logger instance
+    std::mutex                         spouts_lock_;
+    std::vector<std::weak_ptr<PipelineSpout>> spouts_;  //< Spouts (used to collect stats)
+    int                                next_id_;    //< Id of the next spout
+    PipelineSpout::SpoutCounter        nwritten_;   //< Number of samples written by the worker
+    PipelineSpout::SpoutCounter        nerrors_;    //< Number of write errors
+
+    //! Create spout connected to the queue and add it to the list
+    std::shared_ptr<PipelineSpout> add_spout(PipelineSpout::PQueue queue);
 public:
     /** Create new pipeline topology.
+      * @param con database connection
+      * @param bp back-pressure policy
+      * @param pool_size max number of batches in flight per spout
+      * @param queue_capacity capacity of every queue
+      * @param max_batch_size spout's batch size limit (1 - samples are never batched)
+      * @param nqueues min number of queues, spouts created by `make_spout(index)` with
+      *        different indexes in [0, nqueues) range never share the queue
       */
-    IngestionPipeline(std::shared_ptr<DbConnection> con, BackoffPolicy bp = AKU_THROTTLE);
+    IngestionPipeline(std::shared_ptr<DbConnection> con,
+                      BackoffPolicy bp = AKU_THROTTLE,
+                      int pool_size = PipelineSpout::POOL_SIZE,
+                      int queue_capacity = PipelineSpout::QCAP,
+                      int max_batch_size = 1,
+                      int nqueues = 0);
 
     /** Run pipeline topology.
       */
@@ -206,7 +271,18 @@ public:
     /** Add new pipeline spout. */
     std::shared_ptr<PipelineSpout> make_spout();
 
+    /** Add new pipeline spout connected to the specific queue.
+      * @param index queue index (wraps around number of queues)
+      */
+    std::shared_ptr<PipelineSpout> make_spout(int index);
+
     void stop();
+
+    //! Get pipeline and spout counters as JSON
+    std::string get_all_stats();
+
+    //! Write pipeline counters and spout queue depth in Prometheus text format
+    void write_metrics(Metrics::TextWriter& writer);
 };
 
 }  // namespace Akumuli
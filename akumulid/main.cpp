@@ -6,6 +6,7 @@
 #include "query_results_pooler.h"
 #include "signal_handler.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <regex>
@@ -61,6 +62,12 @@ compression_threshold=1000
 # will be better.
 durability=max
 
+# Write-ahead log. All  samples that wasn't  merged to the
+# volume yet  (the sliding window)  are written to the log
+# and  replayed  on  restart.  With  enabled log  it's safe
+# to set durability to min.
+wal=1
+
 # This parameter  can  be used to  emable huge  pages for
 # data volumes.  This can speed up searching  and writing
 # process a bit. Setting  this  option can't  do any harm
@@ -72,12 +79,43 @@ huge_tlb = 0
 # define size of this cache (default value: 512Mb).
 max_cache_size=536870912
 
+# Query  results cache capacity in bytes.  Samples  read by
+# the  query from  volumes  that are closed for writing are
+# cached  and  reused  when  the  same  query  is  repeated
+# (default value: 64Mb).
+query_cache_size=67108864
+
+# Rollup tiers.  Min, max, sum and count of every series are
+# precomputed at ingest for each tier.  Queries that use `paa`,
+# `min-paa` or `max-paa` with  large `group-by` time step read
+# precomputed data instead of raw data.  Each  tier is defined
+# as `step:capacity` pair,  where capacity is a number of steps
+# to keep (e.g. "1m:1440,1h:720" - one day of minutes and month
+# of hours).  Empty value disables rollups.
+rollup_tiers=
+
+
+# Ingestion pipeline config
+
+[Pipeline]
+# Max number of sample batches in flight per ingestion session,
+# session waits for the writer when this limit is reached
+pool_size=512
+# Capacity of every pipeline queue
+queue_capacity=16
+# Max number of samples sent to the writer at once.  Batch size
+# grows when the writer lags behind and shrinks when it catches
+# up (1 - samples are sent one by one)
+max_batch_size=64
+
 
 # HTTP server config
 
 [HTTP]
 # port number
 port=8181
+# number of threads used to execute queries (0 - number of CPU cores)
+pool_size=0
 
 
 # TCP ingestion server config (delete to disable)
@@ -87,6 +125,10 @@ port=8181
 port=8282
 # worker pool size
 pool_size=1
+# Use separate listening socket (SO_REUSEPORT), event loop and pipeline
+# queue for every worker (pipeline gets max(8, pool_size) queues),
+# workers are pinned to CPU cores
+reuse_port=false
 
 
 # UDP ingestion server config (delete to disable)
@@ -96,6 +138,16 @@ pool_size=1
 port=8383
 # worker pool size
 pool_size=1
+# Max number of datagrams received by one system call
+batch_size=512
+# Busy polling time in microseconds (SO_BUSY_POLL), reduces latency
+# at cost of CPU usage, 0 - disabled
+busy_poll=0
+# Receive coalesced datagrams (UDP_GRO, Linux 5.0+), every worker
+# allocates batch_size*64KB of memory when enabled
+gro=false
+# Pin worker threads to CPU cores
+pin_threads=false
 
 # Logging configuration
 # This is just a log4cxx configuration without any modifications
@@ -185,6 +237,18 @@ struct ConfigFile {
         return conf.get<bool>("huge_tlb");
     }
 
+    static bool get_wal(PTree conf) {
+        return conf.get<bool>("wal", false);
+    }
+
+    static uint64_t get_query_cache_size(PTree conf) {
+        return conf.get<uint64_t>("query_cache_size", 0ul);
+    }
+
+    static std::string get_rollup_tiers(PTree conf) {
+        return conf.get<std::string>("rollup_tiers", "");
+    }
+
     static int get_nvolumes(PTree conf) {
         return conf.get<int>("nvolumes");
     }
@@ -193,6 +257,18 @@ struct ConfigFile {
         return conf.get<int>("compression_threshold");
     }
 
+    static int get_pipeline_pool_size(PTree conf) {
+        return conf.get<int>("Pipeline.pool_size", PipelineSpout::POOL_SIZE);
+    }
+
+    static int get_pipeline_queue_capacity(PTree conf) {
+        return conf.get<int>("Pipeline.queue_capacity", PipelineSpout::QCAP);
+    }
+
+    static int get_pipeline_max_batch_size(PTree conf) {
+        return conf.get<int>("Pipeline.max_batch_size", 1);
+    }
+
     static AkumuliConnection::Durability get_durability(PTree conf) {
         std::string m = conf.get<std::string>("durability");
         AkumuliConnection::Durability res;
@@ -210,7 +286,12 @@ struct ConfigFile {
         ServerSettings settings;
         settings.name = "HTTP";
         settings.port = conf.get<int>("HTTP.port");
-        settings.nworkers = -1;
+        settings.nworkers = conf.get<int>("HTTP.pool_size", 0);
+        settings.reuse_port = false;
+        settings.batch_size = 0;
+        settings.busy_poll = 0;
+        settings.gro = false;
+        settings.pin_threads = false;
         return settings;
     }
 
@@ -219,6 +300,11 @@ struct ConfigFile {
         settings.name = "UDP";
         settings.port = conf.get<int>("UDP.port");
         settings.nworkers = conf.get<int>("UDP.pool_size");
+        settings.reuse_port = false;
+        settings.batch_size = conf.get<int>("UDP.batch_size", 512);
+        settings.busy_poll = conf.get<int>("UDP.busy_poll", 0);
+        settings.gro = conf.get<bool>("UDP.gro", false);
+        settings.pin_threads = conf.get<bool>("UDP.pin_threads", false);
         return settings;
     }
 
@@ -227,6 +313,11 @@ struct ConfigFile {
         settings.name = "TCP";
         settings.port = conf.get<int>("TCP.port");
         settings.nworkers = conf.get<int>("TCP.pool_size");
+        settings.reuse_port = conf.get<bool>("TCP.reuse_port", false);
+        settings.batch_size = 0;
+        settings.busy_poll = 0;
+        settings.gro = false;
+        settings.pin_threads = false;
         return settings;
     }
 
@@ -395,7 +486,13 @@ void cmd_run_server() {
     auto path                   = ConfigFile::get_path(config);
     auto compression_threshold  = ConfigFile::get_compression_threshold(config);
     auto huge_tlb               = ConfigFile::get_huge_tlb(config);
+    auto enable_wal             = ConfigFile::get_wal(config);
     auto cache_size             = ConfigFile::get_cache_size(config);
+    auto query_cache_size       = ConfigFile::get_query_cache_size(config);
+    auto rollup_tiers           = ConfigFile::get_rollup_tiers(config);
+    auto pool_size              = ConfigFile::get_pipeline_pool_size(config);
+    auto queue_capacity         = ConfigFile::get_pipeline_queue_capacity(config);
+    auto max_batch_size         = ConfigFile::get_pipeline_max_batch_size(config);
     auto ingestion_servers      = ConfigFile::get_server_settings(config);
 
     auto full_path = boost::filesystem::path(path) / "db.akumuli";
@@ -405,9 +502,25 @@ void cmd_run_server() {
                                                           durability,
                                                           compression_threshold,
                                                           window,
-                                                          cache_size);
+                                                          cache_size,
+                                                          enable_wal,
+                                                          query_cache_size,
+                                                          rollup_tiers);
+
+    // Workers of the server with `reuse_port` set shouldn't share pipeline queues
+    int nqueues = 0;
+    for (auto const& settings: ingestion_servers) {
+        if (settings.reuse_port) {
+            nqueues = std::max(nqueues, settings.nworkers);
+        }
+    }
 
-    auto pipeline = std::make_shared<IngestionPipeline>(connection, AKU_LINEAR_BACKOFF);
+    auto pipeline = std::make_shared<IngestionPipeline>(connection,
+                                                        AKU_LINEAR_BACKOFF,
+                                                        pool_size,
+                                                        queue_capacity,
+                                                        max_batch_size,
+                                                        nqueues);
     auto qproc = std::make_shared<QueryProcessor>(connection, 1000);
 
     SignalHandler sighandler;
@@ -11,7 +11,7 @@ ProtocolParserError::ProtocolParserError(std::string line, int pos)
 }
 
 const PDU ProtocolParser::POISON_ = {
-    std::shared_ptr<const Byte>(),
+    ConstBufferPtr(),
     0u, 0u
 };
 
@@ -28,93 +28,106 @@ void ProtocolParser::start() {
     coroutine_.reset(new Coroutine(fn));
 }
 
+/** Read next sample from the stream.
+  * Bulk strings are passed to consumer as is.
+  * @param buffer is a scratch buffer, should be RESPStream::STRING_LENGTH_MAX bytes long and zeroed
+  * @return true if sample was read, false if bulk string was read instead
+  * @throw on error
+  */
+static bool read_sample(RESPStream& stream, ByteStreamReader const& reader, ProtocolConsumer& consumer,
+                        Byte* buffer, aku_Sample* sample)
+{
+    const int buffer_len = RESPStream::STRING_LENGTH_MAX;
+    int bytes_read = 0;
+
+    // read id
+    auto next = stream.next_type();
+    switch(next) {
+    case RESPStream::INTEGER:
+        sample->paramid = stream.read_int();
+        break;
+    case RESPStream::STRING:
+        bytes_read = stream.read_string(buffer, buffer_len);
+        consumer.series_to_param_id(buffer, bytes_read, sample);
+        break;
+    case RESPStream::BULK_STR:
+        // Compressed chunk of data
+        bytes_read = stream.read_bulkstr(buffer, buffer_len);
+        consumer.add_bulk_string(buffer, bytes_read);
+        return false;
+    default:
+        // Bad frame
+        {
+            std::string msg;
+            size_t pos;
+            std::tie(msg, pos) = reader.get_error_context("unexpected parameter id format");
+            BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
+        }
+    };
+
+    // read ts
+    next = stream.next_type();
+    switch(next) {
+    case RESPStream::INTEGER:
+        sample->timestamp = stream.read_int();
+        break;
+    case RESPStream::STRING:
+        bytes_read = stream.read_string(buffer, buffer_len);
+        buffer[bytes_read] = '\0';
+        if (aku_parse_timestamp(buffer, sample) == AKU_SUCCESS) {
+            break;
+        }
+    default:
+        {
+            std::string msg;
+            size_t pos;
+            std::tie(msg, pos) = reader.get_error_context("Unexpected parameter timestamp format");
+            BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
+        }
+    };
+
+    // read value
+    next = stream.next_type();
+    switch(next) {
+    case RESPStream::INTEGER:
+        sample->payload.type = AKU_PAYLOAD_FLOAT;
+        sample->payload.float64 = stream.read_int();
+        sample->payload.size = sizeof(aku_Sample);
+        break;
+    case RESPStream::STRING:
+        bytes_read = stream.read_string(buffer, buffer_len);
+        buffer[bytes_read] = '\0';
+        sample->payload.type = AKU_PAYLOAD_FLOAT;
+        sample->payload.float64 = strtod(buffer, nullptr);
+        sample->payload.size = sizeof(aku_Sample);
+        memset(buffer, 0, bytes_read);
+        break;
+    default:
+        // Bad frame
+        {
+            std::string msg;
+            size_t pos;
+            std::tie(msg, pos) = reader.get_error_context("Unexpected parameter value format");
+            BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
+        }
+    };
+    return true;
+}
+
 void ProtocolParser::worker(Caller& caller) {
     // Remember caller for use in ByteStreamReader's methods
     set_caller(caller);
     // Buffer to read strings from
-    const int     buffer_len         = RESPStream::STRING_LENGTH_MAX;
-    Byte          buffer[buffer_len] = {};
-    int           bytes_read         = 0;
+    Byte          buffer[RESPStream::STRING_LENGTH_MAX] = {};
     // Data to read
-    std::string   sid;
     aku_Sample    sample;
     //
     try {
         RESPStream stream(this);
         while(true) {
-            // read id
-            auto next = stream.next_type();
-            switch(next) {
-            case RESPStream::INTEGER:
-                sample.paramid = stream.read_int();
-                break;
-            case RESPStream::STRING:
-                bytes_read = stream.read_string(buffer, buffer_len);
-                consumer_->series_to_param_id(buffer, bytes_read, &sample);
-                break;
-            case RESPStream::BULK_STR:
-                // Compressed chunk of data
-                bytes_read = stream.read_bulkstr(buffer, buffer_len);
-                consumer_->add_bulk_string(buffer, bytes_read);
-                continue;
-            default:
-                // Bad frame
-                {
-                    std::string msg;
-                    size_t pos;
-                    std::tie(msg, pos) = get_error_context("unexpected parameter id format");
-                    BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
-                }
-            };
-
-            // read ts
-            next = stream.next_type();
-            switch(next) {
-            case RESPStream::INTEGER:
-                sample.timestamp = stream.read_int();
-                break;
-            case RESPStream::STRING:
-                bytes_read = stream.read_string(buffer, buffer_len);
-                buffer[bytes_read] = '\0';
-                if (aku_parse_timestamp(buffer, &sample) == AKU_SUCCESS) {
-                    break;
-                }
-            default:
-                {
-                    std::string msg;
-                    size_t pos;
-                    std::tie(msg, pos) = get_error_context("Unexpected parameter timestamp format");
-                    BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
-                }
-            };
-
-            // read value
-            next = stream.next_type();
-            switch(next) {
-            case RESPStream::INTEGER:
-                sample.payload.type = AKU_PAYLOAD_FLOAT;
-                sample.payload.float64 = stream.read_int();
-                sample.payload.size = sizeof(aku_Sample);
-                break;
-            case RESPStream::STRING:
-                bytes_read = stream.read_string(buffer, buffer_len);
-                buffer[bytes_read] = '\0';
-                sample.payload.type = AKU_PAYLOAD_FLOAT;
-                sample.payload.float64 = strtod(buffer, nullptr);
-                sample.payload.size = sizeof(aku_Sample);
-                memset(buffer, 0, bytes_read);
-                break;
-            default:
-                // Bad frame
-                {
-                    std::string msg;
-                    size_t pos;
-                    std::tie(msg, pos) = get_error_context("Unexpected parameter value format");
-                    BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
-                }
-            };
-
-            consumer_->write(sample);
+            if (read_sample(stream, *this, *consumer_, buffer, &sample)) {
+                consumer_->write(sample);
+            }
         }
     } catch(EStopIteration const&) {
         logger_.info() << "EStopIteration";
@@ -141,7 +154,7 @@ void ProtocolParser::throw_if_poisoned(PDU const& top) const {
 }
 
 void ProtocolParser::parse_next(PDU pdu) {
-    buffers_.push(pdu);
+    buffers_.push(std::move(pdu));
     yield_to_worker();
 }
 
@@ -153,7 +166,7 @@ Byte ProtocolParser::get() {
         auto& top = buffers_.front();
         throw_if_poisoned(top);
         if (top.pos < top.size) {
-            auto buf = top.buffer.get();
+            auto buf = top.buffer->data();
             return buf[top.pos++];
         }
         buffers_.pop();
@@ -171,7 +184,7 @@ Byte ProtocolParser::pick() const {
         auto& top = buffers_.front();
         throw_if_poisoned(top);
         if (top.pos < top.size) {
-            auto buf = top.buffer.get();
+            auto buf = top.buffer->data();
             return buf[top.pos];
         }
         buffers_.pop();
@@ -195,7 +208,7 @@ int ProtocolParser::read(Byte *buffer, size_t buffer_len) {
         if (top.pos < top.size) {
             size_t sz = top.size - top.pos;
             size_t bytes_to_copy = std::min(sz, buffer_len);
-            memcpy(buffer, top.buffer.get() + top.pos, bytes_to_copy);
+            memcpy(buffer, top.buffer->data() + top.pos, bytes_to_copy);
             bytes_copied += (int)bytes_to_copy;
             top.pos += bytes_to_copy;
             if (bytes_to_copy == buffer_len) {
@@ -219,7 +232,7 @@ void ProtocolParser::close() {
 }
 
 std::tuple<std::string, size_t> ProtocolParser::get_error_from_pdu(PDU const& pdu) const {
-    const char* origin = pdu.buffer.get();
+    const char* origin = pdu.buffer->data();
     // Scan to PDU head
     if (pdu.pos == 0) {
         // Error in first symbol
@@ -268,4 +281,27 @@ std::tuple<std::string, size_t> ProtocolParser::get_error_context(const char* ms
     return std::make_tuple(message.str(), pos);
 }
 
+//                         //
+//     Datagram parser     //
+//                         //
+
+DatagramParser::DatagramParser(std::shared_ptr<ProtocolConsumer> consumer)
+    : consumer_(consumer)
+{
+}
+
+size_t DatagramParser::parse(const Byte* data, size_t size) {
+    aku_Sample      sample;
+    size_t          nsamples = 0;
+    MemStreamReader reader(data, size);
+    RESPStream      stream(&reader);
+    while (!reader.is_eof()) {
+        if (read_sample(stream, reader, *consumer_, buffer_, &sample)) {
+            consumer_->write(sample);
+            nsamples++;
+        }
+    }
+    return nsamples;
+}
+
 }
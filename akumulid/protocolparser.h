@@ -25,6 +25,7 @@
 #include <queue>
 
 #include "stream.h"
+#include "buffer_pool.h"
 #include "resp.h"
 #include "protocol_consumer.h"
 #include "logger.h"
@@ -33,9 +34,9 @@ namespace Akumuli {
 
 /** Protocol Data Unit */
 struct PDU {
-    std::shared_ptr<const Byte> buffer;  //< Pointer to buffer (buffer can be referenced by several PDU)
-    size_t                      size;    //< Size of the buffer
-    size_t                      pos;     //< Position in the buffer
+    ConstBufferPtr  buffer;  //< Pointer to buffer (buffer can be referenced by several PDU)
+    size_t          size;    //< End of the data in the buffer
+    size_t          pos;     //< Position in the buffer
 };
 
 struct ProtocolParserError : StreamError {
@@ -85,5 +86,25 @@ public:
 };
 
 
+/** Stateless parser for self-contained messages (e.g. UDP datagrams).
+  * Every message should contain whole samples, nothing is carried over
+  * to the next message so malformed message can't affect the others.
+  */
+class DatagramParser {
+    std::shared_ptr<ProtocolConsumer> consumer_;
+    //! Scratch buffer for the strings, reused between messages (not initialized,
+    //! only bytes written by the stream are read back)
+    Byte buffer_[RESPStream::STRING_LENGTH_MAX];
+public:
+    DatagramParser(std::shared_ptr<ProtocolConsumer> consumer);
+
+    /** Parse message and write samples to consumer.
+      * @return number of samples written
+      * @throw StreamError if message is malformed (samples that precede the
+      *        error are written anyway)
+      */
+    size_t parse(const Byte* data, size_t size);
+};
+
 }  // namespace
 
@@ -1,175 +1,143 @@
 #include "query_results_pooler.h"
 #include <cstdio>
+#include <cstring>
 #include <thread>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
+#include <unordered_set>
 #include <boost/exception/all.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include "queryparser.h"
+#include "textformat.h"
 
 namespace Akumuli {
 
-static boost::property_tree::ptree from_json(std::string json) {
-    //! C-string to streambuf adapter
-    struct MemStreambuf : std::streambuf {
-        MemStreambuf(const char* buf) {
-            char* p = const_cast<char*>(buf);
-            setg(p, p, p+strlen(p));
-        }
-    };
+static const char* COLUMNAR_MEDIA_TYPE = "application/x-akumuli-columnar";
+
+//! Write `n` characters, return nullptr if buffer is too small
+static char* put_chars(const char* str, size_t n, char* begin, char* end) {
+    if (static_cast<size_t>(end - begin) < n) {
+        return nullptr;
+    }
+    memcpy(begin, str, n);
+    return begin + n;
+}
 
-    boost::property_tree::ptree ptree;
-    MemStreambuf strbuf(json.c_str());
-    std::istream stream(&strbuf);
-    boost::property_tree::json_parser::read_json(stream, ptree);
-    return ptree;
+//! Write series name or "id=<paramid>" if series is unknown
+static char* put_series_name(DbCursor& cursor, aku_ParamId id, char* begin, char* end) {
+    int len = cursor.param_id_to_series(id, begin, end - begin);
+    // '\0' character is counted in len
+    if (len == 0) { // Error, no such Id
+        begin = put_chars("id=", 3, begin, end);
+        return begin ? format_uint(id, begin, end) : nullptr;
+    } else if (len < 0) {
+        // Not enough space
+        return nullptr;
+    }
+    return begin + len - 1;  // terminating '\0' character should be rewritten
+}
+
+//! Write ISO timestamp or "ts=<timestamp>" (custom timestamps are always written as numbers)
+static char* put_timestamp(IsoTimestampFormatter& iso, bool use_iso, const aku_Sample& sample, char* begin, char* end) {
+    if ((sample.payload.type & aku_PData::CUSTOM_TIMESTAMP) == 0 && use_iso) {
+        return iso.format(sample.timestamp, begin, end);
+    }
+    begin = put_chars("ts=", 3, begin, end);
+    return begin ? format_uint(sample.timestamp, begin, end) : nullptr;
+}
+
+//! Write SAX word
+static char* put_sax_word(const aku_Sample& sample, char* begin, char* end) {
+    size_t sample_size = std::max(sizeof(aku_Sample), (size_t)sample.payload.size);
+    size_t sax_word_sz = sample_size - sizeof(aku_Sample);
+    return put_chars(sample.payload.data, sax_word_sz, begin, end);
 }
 
 struct CSVOutputFormatter : OutputFormatter {
 
-    std::shared_ptr<DbConnection> connection_;
+    std::shared_ptr<DbCursor> cursor_;
     const bool iso_timestamps_;
+    IsoTimestampFormatter iso_;
 
     // TODO: parametrize column separator
 
-    CSVOutputFormatter(std::shared_ptr<DbConnection> con, bool iso_timestamps)
-        : connection_(con)
+    CSVOutputFormatter(std::shared_ptr<DbCursor> cursor, bool iso_timestamps)
+        : cursor_(cursor)
         , iso_timestamps_(iso_timestamps)
     {
     }
 
+    //! Add ',' if some column was already written
+    static char* put_separator(bool required, char* begin, char* end) {
+        return required ? put_chars(",", 1, begin, end) : begin;
+    }
+
     virtual char* format(char* begin, char* end, const aku_Sample& sample) {
         if(begin >= end) {
             return nullptr;  // not enough space inside the buffer
         }
-        int size = end - begin;
 
         bool newline_required = false;
 
-        int len = 0;
-
         if (sample.payload.type & aku_PData::PARAMID_BIT) {
             // Series name
-            len = connection_->param_id_to_series(sample.paramid, begin, size);
-            // '\0' character is counted in len
-            if (len == 0) { // Error, no such Id
-                len = snprintf(begin, size, "id=%lu", sample.paramid);
-                if (len < 0 || len == size) {
-                    // Not enough space inside the buffer
-                    return nullptr;
-                }
-                len += 1;  // for terminating '\0' character
-            } else if (len < 0) {
-                // Not enough space
+            begin = put_series_name(*cursor_, sample.paramid, begin, end);
+            if (begin == nullptr) {
                 return nullptr;
             }
-            len--;  // terminating '\0' character should be rewritten
-            begin += len;
-            size  -= len;
             newline_required = true;
         }
 
         if (sample.payload.type & aku_PData::TIMESTAMP_BIT) {
-            if (newline_required) {
-                // Add trailing ',' to the end
-                if (size < 1) {
-                    return nullptr;
-                }
-                begin[0] = ',';
-                begin += 1;
-                size  -= 1;
+            begin = put_separator(newline_required, begin, end);
+            if (begin) {
+                begin = put_timestamp(iso_, iso_timestamps_, sample, begin, end);
             }
-
-            // Timestamp
-            if (size < 0) {
+            if (begin == nullptr) {
                 return nullptr;
             }
-            if ((sample.payload.type&aku_PData::CUSTOM_TIMESTAMP) == 0 && iso_timestamps_) {
-                len = aku_timestamp_to_string(sample.timestamp, begin, size) - 1;  // -1 is for '\0' character
-            } else {
-                len = -1;
-            }
-            if (len == -1) {
-                // Invalid or custom timestamp, format as number
-                len = snprintf(begin, size, "ts=%lu", sample.timestamp);
-                if (len < 0 || len == size) {
-                    // Not enough space inside the buffer
-                    return nullptr;
-                }
-            } else if (len < -1) {
-                return nullptr;
-            }
-            begin += len;
-            size  -= len;
             newline_required = true;
         }
 
         // Payload
-        if (size < 0) {
-            return nullptr;
-        }
 
         if (sample.payload.type & aku_PData::FLOAT_BIT) {
-            if (newline_required) {
-                // Add trailing ',' to the end
-                if (size < 1) {
-                    return nullptr;
-                }
-                begin[0] = ',';
-                begin += 1;
-                size  -= 1;
+            begin = put_separator(newline_required, begin, end);
+            if (begin) {
+                begin = format_double(sample.payload.float64, begin, end);
             }
-            // Floating-point
-            len = snprintf(begin, size, "%.17g", sample.payload.float64);
-            if (len == size || len < 0) {
+            if (begin == nullptr) {
                 return nullptr;
             }
-            begin += len;
-            size  -= len;
             newline_required = true;
         }
 
         if (sample.payload.type & aku_PData::SAX_WORD) {
-            if (newline_required) {
-                // Add trailing ',' to the end
-                if (size < 1) {
-                    return nullptr;
-                }
-                begin[0] = ',';
-                begin += 1;
-                size  -= 1;
+            begin = put_separator(newline_required, begin, end);
+            if (begin) {
+                begin = put_sax_word(sample, begin, end);
             }
-            size_t sample_size = std::max(sizeof(aku_Sample), (size_t)sample.payload.size);
-            int sax_word_sz = static_cast<int>(sample_size - sizeof(aku_Sample));
-            if (size < (sax_word_sz + 3)) {
+            if (begin == nullptr) {
                 return nullptr;
             }
-            for(int i = 0; i < sax_word_sz; i++) {
-                begin[i] = sample.payload.data[i];
-            }
-            begin += sax_word_sz;
-            size  -= sax_word_sz;
             newline_required = true;
         }
 
         if (newline_required) {
-            if (size < 1) {
-                return nullptr;
-            }
-            begin[0] = '\n';
-            begin += 1;
-            size  -= 1;
+            return put_chars("\n", 1, begin, end);
         }
-
         return begin;
     }
 };
+
 //! RESP output implementation
 struct RESPOutputFormatter : OutputFormatter {
 
-    std::shared_ptr<DbConnection> connection_;
+    std::shared_ptr<DbCursor> cursor_;
     const bool iso_timestamps_;
+    IsoTimestampFormatter iso_;
 
-    RESPOutputFormatter(std::shared_ptr<DbConnection> con, bool iso_timestamps)
-        : connection_(con)
+    RESPOutputFormatter(std::shared_ptr<DbCursor> cursor, bool iso_timestamps)
+        : cursor_(cursor)
         , iso_timestamps_(iso_timestamps)
     {
     }
@@ -180,116 +148,246 @@ struct RESPOutputFormatter : OutputFormatter {
         if(begin >= end) {
             return nullptr;  // not enough space inside the buffer
         }
-        int size = end - begin;
-
-        begin[0] = '+';
-        begin++;
-        size--;
-
-        // sz can't be zero here because of precondition
-
-        int len = 0;
 
         if (sample.payload.type & aku_PData::PARAMID_BIT) {
             // Series name
-            len = connection_->param_id_to_series(sample.paramid, begin, size);
-            // '\0' character is counted in len
-            if (len == 0) { // Error, no such Id
-                len = snprintf(begin, size, "id=%lu", sample.paramid);
-                if (len < 0 || len == size) {
-                    // Not enough space inside the buffer
-                    return nullptr;
-                }
-                len += 1;  // for terminating '\0' character
-            } else if (len < 0) {
-                // Not enough space
-                return nullptr;
+            begin = put_chars("+", 1, begin, end);
+            if (begin) {
+                begin = put_series_name(*cursor_, sample.paramid, begin, end);
             }
-            len--;  // terminating '\0' character should be rewritten
-            begin += len;
-            size  -= len;
-            // Add trailing \r\n to the end
-            if (size < 2) {
+            if (begin) {
+                begin = put_chars("\r\n", 2, begin, end);
+            }
+            if (begin == nullptr) {
                 return nullptr;
             }
-            begin[0] = '\r';
-            begin[1] = '\n';
-            begin += 2;
-            size  -= 2;
         }
 
         if (sample.payload.type & aku_PData::TIMESTAMP_BIT) {
             // Timestamp
-            begin[0] = '+';
-            begin++;
-            size--;
-            if (size < 0) {
-                return nullptr;
+            begin = put_chars("+", 1, begin, end);
+            if (begin) {
+                begin = put_timestamp(iso_, iso_timestamps_, sample, begin, end);
             }
-            if ((sample.payload.type&aku_PData::CUSTOM_TIMESTAMP) == 0 && iso_timestamps_) {
-                len = aku_timestamp_to_string(sample.timestamp, begin, size) - 1;  // -1 is for '\0' character
-            } else {
-                len = -1;
+            if (begin) {
+                begin = put_chars("\r\n", 2, begin, end);
             }
-            if (len == -1) {
-                // Invalid or custom timestamp, format as number
-                len = snprintf(begin, size, "ts=%lu", sample.timestamp);
-                if (len < 0 || len == size) {
-                    // Not enough space inside the buffer
-                    return nullptr;
-                }
-            } else if (len < -1) {
+            if (begin == nullptr) {
                 return nullptr;
             }
-            begin += len;
-            size  -= len;
-            // Add trailing \r\n to the end
-            if (size < 2) {
-                return nullptr;
-            }
-            begin[0] = '\r';
-            begin[1] = '\n';
-            begin += 2;
-            size  -= 2;
         }
 
         // Payload
-        if (size < 0) {
-            return nullptr;
-        }
 
         if (sample.payload.type & aku_PData::FLOAT_BIT) {
             // Floating-point
-            len = snprintf(begin, size, "+%.17g\r\n", sample.payload.float64);
-            if (len == size || len < 0) {
+            begin = put_chars("+", 1, begin, end);
+            if (begin) {
+                begin = format_double(sample.payload.float64, begin, end);
+            }
+            if (begin) {
+                begin = put_chars("\r\n", 2, begin, end);
+            }
+            if (begin == nullptr) {
                 return nullptr;
             }
-            begin += len;
-            size  -= len;
         }
 
         if (sample.payload.type & aku_PData::SAX_WORD) {
-            size_t sample_size = std::max(sizeof(aku_Sample), (size_t)sample.payload.size);
-            int sax_word_sz = static_cast<int>(sample_size - sizeof(aku_Sample));
-            if (size < (sax_word_sz + 3)) {
-                return nullptr;
+            begin = put_sax_word(sample, begin, end);
+            if (begin) {
+                begin = put_chars("\r\n", 2, begin, end);
+            }
+        }
+        return begin;
+    }
+};
+
+//! Binary columnar output implementation (see ColumnarBlockHeader)
+struct ColumnarOutputFormatter : OutputFormatter {
+
+    enum {
+        BLOCK_SIZE = 4096,  //< Max number of rows (or dictionary entries) in one block
+    };
+
+    std::shared_ptr<DbCursor> cursor_;
+    const bool compressed_;
+    std::vector<aku_ParamId>   ids_;
+    std::vector<aku_Timestamp> timestamps_;
+    std::vector<double>        values_;
+    std::vector<aku_ParamId>   new_series_;    //< Dictionary delta of the current block
+    std::unordered_set<aku_ParamId> known_series_;
+    std::vector<char>          block_;         //< Encoded block
+    size_t                     block_pos_;     //< Number of bytes of the block already written
+    std::vector<char>          namebuf_;
+
+    ColumnarOutputFormatter(std::shared_ptr<DbCursor> cursor, bool compressed)
+        : cursor_(cursor)
+        , compressed_(compressed)
+        , block_pos_(0u)
+        , namebuf_(0x1000)
+    {
+    }
+
+    template<class T>
+    void put_raw(T const& value) {
+        auto ptr = reinterpret_cast<const char*>(&value);
+        block_.insert(block_.end(), ptr, ptr + sizeof(T));
+    }
+
+    void put_varint(uint64_t value) {
+        while (value >= 0x80) {
+            block_.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        block_.push_back(static_cast<char>(value));
+    }
+
+    void put_delta(uint64_t value, uint64_t prev) {
+        // zig-zag encoding, scan can go in both directions
+        int64_t delta = static_cast<int64_t>(value - prev);
+        put_varint((static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+    }
+
+    void put_series_name(aku_ParamId id) {
+        int len = cursor_->param_id_to_series(id, namebuf_.data(), namebuf_.size());
+        if (len < 0) {
+            namebuf_.resize(static_cast<size_t>(-len) + 1);
+            len = cursor_->param_id_to_series(id, namebuf_.data(), namebuf_.size());
+        }
+        std::string name;
+        if (len > 0) {
+            name.assign(namebuf_.data(), static_cast<size_t>(len) - 1);  // without '\0'
+        } else {
+            name = "id=" + std::to_string(id);
+        }
+        put_raw<uint64_t>(id);
+        put_raw<uint32_t>(static_cast<uint32_t>(name.size()));
+        block_.insert(block_.end(), name.begin(), name.end());
+    }
+
+    void encode_block() {
+        block_.clear();
+        block_pos_ = 0u;
+        block_.resize(sizeof(ColumnarBlockHeader));
+        if (compressed_) {
+            uint64_t prev = 0u;
+            for (auto id: ids_) {
+                put_delta(id, prev);
+                prev = id;
             }
-            for(int i = 0; i < sax_word_sz; i++) {
-                begin[i] = sample.payload.data[i];
+            prev = 0u;
+            for (auto ts: timestamps_) {
+                put_delta(ts, prev);
+                prev = ts;
             }
-            begin += sax_word_sz;
-            size  -= sax_word_sz;
-            begin[0] = '\r';
-            begin[1] = '\n';
-            begin += 2;
-            size  -= 2;
+            prev = 0u;
+            for (auto value: values_) {
+                uint64_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                put_varint(bits ^ prev);
+                prev = bits;
+            }
+        } else {
+            auto put_column = [this](const char* ptr, size_t size) {
+                block_.insert(block_.end(), ptr, ptr + size);
+            };
+            put_column(reinterpret_cast<const char*>(ids_.data()), ids_.size()*sizeof(aku_ParamId));
+            put_column(reinterpret_cast<const char*>(timestamps_.data()), timestamps_.size()*sizeof(aku_Timestamp));
+            put_column(reinterpret_cast<const char*>(values_.data()), values_.size()*sizeof(double));
+        }
+        for (auto id: new_series_) {
+            put_series_name(id);
+        }
+        block_.resize((block_.size() + 7) & ~size_t(7), 0);
+
+        ColumnarBlockHeader header = {};
+        header.magic    = ColumnarBlockHeader::MAGIC;
+        header.version  = ColumnarBlockHeader::VERSION;
+        header.flags    = compressed_ ? ColumnarBlockHeader::COMPRESSED : 0;
+        header.nrows    = static_cast<uint32_t>(ids_.size());
+        header.nseries  = static_cast<uint32_t>(new_series_.size());
+        header.size     = static_cast<uint32_t>(block_.size() - sizeof(header));
+        memcpy(block_.data(), &header, sizeof(header));
+
+        ids_.clear();
+        timestamps_.clear();
+        values_.clear();
+        new_series_.clear();
+    }
+
+    virtual char* format(char* begin, char* end, const aku_Sample& sample) {
+        if (block_pos_ < block_.size()) {
+            return nullptr;  // previous block should be written first
+        }
+        if ((sample.payload.type & aku_PData::PARAMID_BIT) && known_series_.insert(sample.paramid).second) {
+            new_series_.push_back(sample.paramid);
+        }
+        if (sample.payload.type & aku_PData::FLOAT_BIT) {
+            ids_.push_back(sample.paramid);
+            timestamps_.push_back(sample.timestamp);
+            values_.push_back(sample.payload.float64);
+        }
+        if (ids_.size() == BLOCK_SIZE || new_series_.size() == BLOCK_SIZE) {
+            encode_block();
         }
         return begin;
     }
+
+    virtual char* flush(char* begin, char* end, bool last) {
+        if (last && block_pos_ == block_.size() && (!ids_.empty() || !new_series_.empty())) {
+            encode_block();
+        }
+        size_t size = std::min(static_cast<size_t>(end - begin), block_.size() - block_pos_);
+        memcpy(begin, block_.data() + block_pos_, size);
+        block_pos_ += size;
+        return begin + size;
+    }
 };
 
-QueryResultsPooler::QueryResultsPooler(std::shared_ptr<DbConnection> con, int readbufsize)
-    : connection_(con)
+//! Check if columnar format is acceptable, `compressed` is set if compression is requested
+static bool accepts_columnar(std::string const& accept, bool* compressed) {
+    std::vector<std::string> items;
+    boost::split(items, accept, boost::is_any_of(","));
+    for (auto const& item: items) {
+        std::vector<std::string> params;
+        boost::split(params, item, boost::is_any_of(";"));
+        if (boost::trim_copy(params.front()) != COLUMNAR_MEDIA_TYPE) {
+            continue;
+        }
+        *compressed = false;
+        for (size_t i = 1; i < params.size(); i++) {
+            if (boost::erase_all_copy(params.at(i), " ") == "compression=delta") {
+                *compressed = true;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+QueryMetrics::QueryMetrics()
+    : duration({0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0, 10.0, 60.0})
+{
+}
+
+void QueryMetrics::write_text(Metrics::TextWriter& writer) const {
+    writer.counter("akumuli_queries_total",
+                   "Number of started queries",
+                   queries.value());
+    writer.histogram("akumuli_query_duration_seconds",
+                     "Time between the start of the query and the end of the output",
+                     duration);
+    writer.counter("akumuli_query_output_bytes_total",
+                   "Number of bytes produced by the output formatters",
+                   bytes_formatted.value());
+}
+
+QueryResultsPooler::QueryResultsPooler(std::shared_ptr<DbConnection> con, int readbufsize,
+                                       std::shared_ptr<QueryMetrics> metrics)
+    : content_type_("text/plain")
+    , connection_(con)
+    , metrics_(metrics)
     , rdbuf_pos_(0)
     , rdbuf_top_(0)
 {
@@ -313,48 +411,81 @@ void QueryResultsPooler::throw_if_not_started() const {
     }
 }
 
+void QueryResultsPooler::set_accept(const char* media_types) {
+    throw_if_started();
+    accept_ = media_types ? media_types : "";
+}
+
+void QueryResultsPooler::subscribe(std::function<void()> notify) {
+    throw_if_started();
+    notify_ = notify;
+}
+
 void QueryResultsPooler::start() {
     throw_if_started();
-    enum Format { RESP, CSV };  // TODO: add protobuf support
+    enum Format { RESP, CSV, COLUMNAR };  // TODO: add protobuf support
     bool use_iso_timestamps = true;
+    bool compressed = false;
     Format output_format = RESP;
-    boost::property_tree::ptree tree = from_json(query_text_);
-    auto output = tree.get_child_optional("output");
-    if (output) {
-        for (auto kv: *output) {
-            if (kv.first == "timestamp") {
-                std::string ts = kv.second.get_value<std::string>();
-                if (ts == "iso" || ts == "ISO") {
-                    use_iso_timestamps = true;
-                } else if (ts == "raw" || ts == "RAW") {
-                    use_iso_timestamps = false;
-                } else {
-                    std::runtime_error err("invalid output statement (timestamp)");
-                    BOOST_THROW_EXCEPTION(err);
-                }
-            } else if (kv.first == "format") {
-                std::string fmt = kv.second.get_value<std::string>();
-                if (fmt == "resp" || fmt == "RESP") {
-                    output_format = RESP;
-                } else if (fmt == "csv" || fmt == "CSV") {
-                    output_format = CSV;
-                } else {
-                    std::runtime_error err("invalid output statement (format)");
-                    BOOST_THROW_EXCEPTION(err);
-                }
+    auto ast = QP::QueryAST::parse(query_text_.data(), query_text_.data() + query_text_.size());
+    if (ast.output_timestamp) {
+        std::string const& ts = *ast.output_timestamp;
+        if (ts == "iso" || ts == "ISO") {
+            use_iso_timestamps = true;
+        } else if (ts == "raw" || ts == "RAW") {
+            use_iso_timestamps = false;
+        } else {
+            std::runtime_error err("invalid output statement (timestamp)");
+            BOOST_THROW_EXCEPTION(err);
+        }
+    }
+    if (ast.output_format) {
+        std::string const& fmt = *ast.output_format;
+        if (fmt == "resp" || fmt == "RESP") {
+            output_format = RESP;
+        } else if (fmt == "csv" || fmt == "CSV") {
+            output_format = CSV;
+        } else {
+            std::runtime_error err("invalid output statement (format)");
+            BOOST_THROW_EXCEPTION(err);
+        }
+    }
+    // Binary format should be requested explicitly by the client
+    if (accepts_columnar(accept_, &compressed)) {
+        for (auto const& sampler: ast.samplers) {
+            if (sampler.get<std::string>("name", "") == "sax") {
+                std::runtime_error err("SAX can't be used with binary output format");
+                BOOST_THROW_EXCEPTION(err);
             }
         }
+        output_format = COLUMNAR;
+    }
+    cursor_ = notify_ ? connection_->subscribe(query_text_, notify_)
+                      : connection_->search(query_text_);
+    start_time_ = std::chrono::steady_clock::now();
+    if (metrics_) {
+        metrics_->queries.inc();
     }
+
+    // Series names are resolved through the cursor (query can override them)
     switch(output_format) {
     case RESP:
-        formatter_.reset(new RESPOutputFormatter(connection_, use_iso_timestamps));
+        formatter_.reset(new RESPOutputFormatter(cursor_, use_iso_timestamps));
+        content_type_ = "text/plain";
         break;
     case CSV:
-        formatter_.reset(new CSVOutputFormatter(connection_, use_iso_timestamps));
+        formatter_.reset(new CSVOutputFormatter(cursor_, use_iso_timestamps));
+        content_type_ = "text/csv";
+        break;
+    case COLUMNAR:
+        formatter_.reset(new ColumnarOutputFormatter(cursor_, compressed));
+        content_type_ = COLUMNAR_MEDIA_TYPE;
         break;
     };
+}
 
-    cursor_ = connection_->search(query_text_);
+const char* QueryResultsPooler::get_content_type() const {
+    return content_type_;
 }
 
 void QueryResultsPooler::append(const char *data, size_t data_size) {
@@ -372,9 +503,29 @@ aku_Status QueryResultsPooler::get_error() {
 
 std::tuple<size_t, bool> QueryResultsPooler::read_some(char *buf, size_t buf_size) {
     throw_if_not_started();
+    auto result = format_some(buf, buf_size);
+    if (metrics_) {
+        metrics_->bytes_formatted.inc(std::get<0>(result));
+    }
+    return result;
+}
+
+std::tuple<size_t, bool> QueryResultsPooler::format_some(char *buf, size_t buf_size) {
+    char* begin = buf;
+    char* end = begin + buf_size;
+    // Output buffered by the formatter goes first
+    begin = formatter_->flush(begin, end, false);
+    if (begin == end) {
+        // Buffered output can be incomplete, nothing should be written in the middle of it
+        return std::make_tuple(begin - buf, false);
+    }
+    if (!error_msg_.empty()) {
+        return write_error(buf, begin, end);
+    }
     if (rdbuf_pos_ == rdbuf_top_) {
         if (cursor_->is_done()) {
-            return std::make_tuple(0u, true);
+            begin = formatter_->flush(begin, end, true);
+            return std::make_tuple(begin - buf, begin == buf);
         }
         // read new data from DB
         rdbuf_top_ = cursor_->read(rdbuf_.data(), rdbuf_.size());
@@ -382,23 +533,23 @@ std::tuple<size_t, bool> QueryResultsPooler::read_some(char *buf, size_t buf_siz
         aku_Status status = AKU_SUCCESS;
         if (cursor_->is_error(&status)) {
             // Some error occured, put error message to the outgoing buffer and return
-            int len = snprintf(buf, buf_size, "-%s\r\n", aku_error_message(status));
-            if (len > 0) {
-                return std::make_tuple((size_t)len, true);
-            }
-            return std::make_tuple(0u, true);
+            error_msg_ = std::string("-") + aku_error_message(status) + "\r\n";
+            return write_error(buf, begin, end);
+        }
+        if (rdbuf_top_ == 0 && notify_) {
+            // No new data, client shouldn't wait for the partially filled block
+            begin = formatter_->flush(begin, end, true);
         }
     }
 
     // format output
-    char* begin = buf;
-    char* end = begin + buf_size;
     while(rdbuf_pos_ < rdbuf_top_) {
         const aku_Sample* sample = reinterpret_cast<const aku_Sample*>(rdbuf_.data() + rdbuf_pos_);
         if (sample->payload.type != aku_PData::EMPTY) {
             char* next = formatter_->format(begin, end, *sample);
             if (next == nullptr) {
-                // done
+                // done, formatter can have some buffered output
+                begin = formatter_->flush(begin, end, false);
                 break;
             }
             begin = next;
@@ -409,24 +560,41 @@ std::tuple<size_t, bool> QueryResultsPooler::read_some(char *buf, size_t buf_siz
     return std::make_tuple(begin - buf, false);
 }
 
+std::tuple<size_t, bool> QueryResultsPooler::write_error(char *buf, char *begin, char *end) {
+    size_t size = std::min(static_cast<size_t>(end - begin), error_msg_.size());
+    memcpy(begin, error_msg_.data(), size);
+    error_msg_.erase(0, size);
+    begin += size;
+    return std::make_tuple(begin - buf, error_msg_.empty());
+}
+
 void QueryResultsPooler::close() {
     throw_if_not_started();
     cursor_->close();
+    if (metrics_) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time_;
+        metrics_->duration.observe(elapsed.count());
+    }
 }
 
 QueryProcessor::QueryProcessor(std::shared_ptr<DbConnection> con, int rdbuf)
     : con_(con)
     , rdbufsize_(rdbuf)
+    , metrics_(std::make_shared<QueryMetrics>())
 {
 }
 
 ReadOperation *QueryProcessor::create() {
-    return new QueryResultsPooler(con_, rdbufsize_);
+    return new QueryResultsPooler(con_, rdbufsize_, metrics_);
 }
 
 std::string QueryProcessor::get_all_stats() {
     return con_->get_all_stats();
 }
 
+void QueryProcessor::write_metrics(Metrics::TextWriter& writer) {
+    metrics_->write_text(writer);
+}
+
 }  // namespace
 
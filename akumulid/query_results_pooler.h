@@ -1,23 +1,86 @@
 #pragma once
-#include "httpserver.h"
 #include "ingestion_pipeline.h"
 #include "server.h"
+#include "metrics.h"
+#include <chrono>
 #include <memory>
 
 namespace Akumuli {
 
 //! Output formatter interface
 struct OutputFormatter {
+    virtual ~OutputFormatter() = default;
+
+    /** Format sample.
+      * @return pointer to the end of the output or nullptr if sample can't be
+      *         written to the buffer (it will be passed again on the next call)
+      */
     virtual char* format(char* begin, char* end, const aku_Sample& sample) = 0;
+
+    /** Write output buffered by the formatter.
+      * @param last is set when there is no more samples
+      * @return pointer to the end of the output (`begin` if nothing was written)
+      */
+    virtual char* flush(char* begin, char* end, bool last) {
+        return begin;
+    }
 };
 
+/** Binary columnar output format.
+  * Selected by `Accept: application/x-akumuli-columnar` request header, add
+  * `; compression=delta` parameter to get compressed columns. Output is a
+  * sequence of blocks, each block is a header followed by the body:
+  * - ids: nrows x uint64
+  * - timestamps: nrows x uint64
+  * - values: nrows x double
+  * - series dictionary delta: nseries x {uint64 id, uint32 length, char name[length]},
+  *   only series that wasn't listed in previous blocks are included
+  * - zero padding, size of the block is a multiple of 8
+  * Numbers are stored in host byte order (little-endian). If COMPRESSED flag is
+  * set, columns are stored as LEB128 varints: ids and timestamps as zig-zag
+  * encoded deltas, values as bits XOR-ed with the previous value (first row of
+  * the block is relative to zero). Errors are reported the same way as in RESP
+  * output ("-message\r\n" instead of the next block).
+  */
+struct ColumnarBlockHeader {
+    enum {
+        MAGIC       = 0x42434b41,  // "AKCB"
+        VERSION     = 1,
+        COMPRESSED  = 1,           //< Flag, columns are compressed
+    };
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t nrows;                //< Number of rows in the columns
+    uint32_t nseries;              //< Number of entries in the dictionary delta
+    uint32_t size;                 //< Size of the body in bytes
+    uint32_t reserved;
+} __attribute__((packed));
+
+
+//! Query counters shared by all read operations
+struct QueryMetrics {
+    Metrics::Counter    queries;          //< Number of started queries
+    Metrics::Histogram  duration;         //< Time between query start and cursor close
+    Metrics::Counter    bytes_formatted;  //< Size of the formatted output
+
+    QueryMetrics();
+
+    void write_text(Metrics::TextWriter& writer) const;
+};
 
 struct QueryResultsPooler : ReadOperation {
 
     std::string query_text_;
+    std::string accept_;
+    const char* content_type_;
     std::shared_ptr<DbConnection> connection_;
     std::shared_ptr<DbCursor> cursor_;
     std::unique_ptr<OutputFormatter> formatter_;
+    std::function<void()> notify_;    //! Set for continuous queries
+    std::shared_ptr<QueryMetrics> metrics_;  //! Can be null
+    std::chrono::steady_clock::time_point start_time_;
+    std::string error_msg_;           //! Error message (or its remainder) that should be sent to the client
 
     std::vector<char>   rdbuf_;       //! Read buffer
     int                 rdbuf_pos_;   //! Read position in buffer
@@ -25,20 +88,33 @@ struct QueryResultsPooler : ReadOperation {
     static const size_t DEFAULT_RDBUF_SIZE_ = 1000u;
     static const size_t DEFAULT_ITEM_SIZE_ = sizeof(aku_Sample);
 
-    QueryResultsPooler(std::shared_ptr<DbConnection> con, int readbufsize);
+    QueryResultsPooler(std::shared_ptr<DbConnection> con, int readbufsize,
+                       std::shared_ptr<QueryMetrics> metrics = std::shared_ptr<QueryMetrics>());
 
     void throw_if_started() const;
 
     void throw_if_not_started() const;
 
+    virtual void set_accept(const char* media_types);
+
+    virtual void subscribe(std::function<void()> notify);
+
     virtual void start();
 
+    virtual const char* get_content_type() const;
+
     virtual void append(const char *data, size_t data_size);
 
     virtual aku_Status get_error();
 
     virtual std::tuple<size_t, bool> read_some(char *buf, size_t buf_size);
 
+    //! Format next portion of the output (implementation of `read_some`)
+    std::tuple<size_t, bool> format_some(char *buf, size_t buf_size);
+
+    //! Write pending error message to the [begin, end) part of the `buf`
+    std::tuple<size_t, bool> write_error(char *buf, char *begin, char *end);
+
     virtual void close();
 };
 
@@ -46,12 +122,15 @@ struct QueryProcessor : ReadOperationBuilder
 {
     std::shared_ptr<DbConnection> con_;
     int rdbufsize_;
+    std::shared_ptr<QueryMetrics> metrics_;
 
     QueryProcessor(std::shared_ptr<DbConnection> con, int rdbuf);
 
     virtual ReadOperation *create();
 
     virtual std::string get_all_stats();
+
+    virtual void write_metrics(Metrics::TextWriter& writer);
 };
 
 }  // namespace
@@ -2,11 +2,17 @@
 #include "akumuli.h"
 #include "signal_handler.h"
 #include "ingestion_pipeline.h"
+#include "logger.h"
+#include "metrics.h"
 
 #include <map>
+#include <functional>
 #include <tuple>
 #include <string>
 #include <tuple>
+#include <thread>
+#include <cstring>
+#include <pthread.h>
 
 namespace Akumuli {
 
@@ -14,6 +20,11 @@ struct ServerSettings {
     std::string name;
     int         port;
     int         nworkers;
+    bool        reuse_port;  //< Listening socket per worker (SO_REUSEPORT)
+    int         batch_size;  //< Max number of datagrams received at once (UDP)
+    int         busy_poll;   //< Busy polling time in microseconds, 0 - disabled (UDP)
+    bool        gro;         //< Generic receive offload (UDP)
+    bool        pin_threads; //< Bind worker threads to CPU cores (UDP)
 };
 
 
@@ -22,10 +33,25 @@ struct ServerSettings {
 struct ReadOperation {
     virtual ~ReadOperation() = default;
 
+    /** Set acceptable output formats (value of the HTTP `Accept` header, can be null).
+      * Should be called before `start`.
+      */
+    virtual void set_accept(const char* media_types) = 0;
+
+    /** Turn read operation into continuous query (subscription to new data). Should be called
+      * before `start`. Continuous read operation returns (0, false) from `read_some` when there
+      * is no new data, `notify` is called from another thread when new data arrives.
+      */
+    virtual void subscribe(std::function<void()> notify) = 0;
+
     /** Start query execution
       */
     virtual void start() = 0;
 
+    /** Return media type of the output. Valid after `start` was called.
+      */
+    virtual const char* get_content_type() const = 0;
+
     /** Append query data to cursor
       */
     virtual void append(const char* data, size_t data_size) = 0;
@@ -57,9 +83,27 @@ struct ReadOperationBuilder {
     virtual ~ReadOperationBuilder() = default;
     virtual ReadOperation* create() = 0;
     virtual std::string get_all_stats() = 0;
+    //! Write query metrics in Prometheus text format
+    virtual void write_metrics(Metrics::TextWriter& writer) = 0;
 };
 
 
+//! Bind thread to CPU core (index is wrapped around number of cores)
+inline void set_thread_affinity(std::thread& thread, int index, Logger* logger) {
+    auto ncores = std::thread::hardware_concurrency();
+    if (ncores == 0) {
+        return;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(static_cast<unsigned>(index) % ncores, &cpuset);
+    int err = pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+    if (err != 0) {
+        logger->error() << "Can't set thread affinity: " << strerror(err);
+    }
+}
+
+
 //! Server interface
 struct Server {
     virtual ~Server() = default;
@@ -1,6 +1,8 @@
 #include "tcp_server.h"
 #include "utility.h"
 #include <thread>
+#include <cstring>
+#include <pthread.h>
 #include <boost/function.hpp>
 
 namespace Akumuli {
@@ -9,11 +11,13 @@ namespace Akumuli {
 //     Tcp Session     //
 //                     //
 
-TcpSession::TcpSession(IOServiceT *io, std::shared_ptr<PipelineSpout> spout)
+TcpSession::TcpSession(IOServiceT *io, std::shared_ptr<PipelineSpout> spout, BufferPoolPtr pool, bool use_strand)
     : io_(io)
     , socket_(*io)
     , strand_(*io)
     , spout_(spout)
+    , pool_(pool)
+    , use_strand_(use_strand)
     , parser_(spout)
     , logger_("tcp-session", 10)
 {
@@ -30,27 +34,33 @@ std::tuple<TcpSession::BufferT, size_t, size_t> TcpSession::get_next_buffer(Buff
                                                                             size_t pos,
                                                                             size_t bytes_read)
 {
-    Byte *buffer = (Byte*)malloc(BUFFER_SIZE);
-    auto deleter = [](Byte* p) {
-        free((void*)p);
-    };
-    std::shared_ptr<Byte> bufptr(buffer, deleter);
-    return std::make_tuple(bufptr, BUFFER_SIZE, 0u);
+    if (prev_buf) {
+        pos += bytes_read;
+        if (size - pos >= BUFFER_SIZE_THRESHOLD) {
+            // Continue reading to the free space after the last chunk, parser
+            // reads only the previous part of the buffer
+            return std::make_tuple(prev_buf, size, pos);
+        }
+    }
+    auto buffer = pool_->acquire();
+    return std::make_tuple(buffer, buffer->size(), 0u);
 }
 
 void TcpSession::start(BufferT buf, size_t buf_size, size_t pos, size_t bytes_read) {
     std::tie(buf, buf_size, pos) = get_next_buffer(buf, buf_size, pos, bytes_read);
-    socket_.async_read_some(
-                boost::asio::buffer(buf.get() + pos, buf_size - pos),
-                strand_.wrap(
-                    boost::bind(&TcpSession::handle_read,
-                                shared_from_this(),
-                                buf,
-                                pos,
-                                buf_size,
-                                boost::asio::placeholders::error,
-                                boost::asio::placeholders::bytes_transferred)
-                ));
+    auto handler = boost::bind(&TcpSession::handle_read,
+                               shared_from_this(),
+                               buf,
+                               pos,
+                               buf_size,
+                               boost::asio::placeholders::error,
+                               boost::asio::placeholders::bytes_transferred);
+    auto asiobuf = boost::asio::buffer(buf->data() + pos, buf_size - pos);
+    if (use_strand_) {
+        socket_.async_read_some(asiobuf, strand_.wrap(handler));
+    } else {
+        socket_.async_read_some(asiobuf, handler);
+    }
 }
 
 PipelineErrorCb TcpSession::get_error_cb() {
@@ -75,7 +85,7 @@ PipelineErrorCb TcpSession::get_error_cb() {
     return PipelineErrorCb(fn);
 }
 
-std::shared_ptr<Byte> TcpSession::NO_BUFFER = std::shared_ptr<Byte>();
+TcpSession::BufferT TcpSession::NO_BUFFER = TcpSession::BufferT();
 
 void TcpSession::handle_read(BufferT buffer,
                              size_t pos,
@@ -86,11 +96,11 @@ void TcpSession::handle_read(BufferT buffer,
         try {
             start(buffer, buf_size, pos, nbytes);
             PDU pdu = {
-                buffer,
-                nbytes,
+                std::move(buffer),
+                pos + nbytes,
                 pos
             };
-            parser_.parse_next(pdu);
+            parser_.parse_next(std::move(pdu));
         } catch (RESPError const& resp_err) {
             // This error is related to client so we need to send it back
             logger_.error() << resp_err.what();
@@ -116,10 +126,12 @@ void TcpSession::handle_read(BufferT buffer,
                                                  boost::asio::placeholders::error)
                                      );
         }
-
+        // Send incomplete batch to the pipeline before waiting for the next read
+        spout_->flush();
     } else {
         logger_.error() << error.message();
         parser_.close();
+        spout_->flush();
         drain_pipeline_spout();
     }
 }
@@ -163,6 +175,21 @@ TcpAcceptor::TcpAcceptor(// Server parameters
     for (auto io: sessions_io_) {
         sessions_work_.emplace_back(*io);
     }
+
+    // Receive buffer pools, sessions that share io-service share the pool
+    for (size_t i = 0; i < sessions_io_.size(); i++) {
+        BufferPoolPtr pool;
+        for (size_t j = 0; j < i; j++) {
+            if (sessions_io_[j] == sessions_io_[i]) {
+                pool = sessions_pool_[j];
+                break;
+            }
+        }
+        if (!pool) {
+            pool = BufferPool::create(TcpSession::BUFFER_SIZE);
+        }
+        sessions_pool_.push_back(pool);
+    }
 }
 
 void TcpAcceptor::start() {
@@ -202,7 +229,8 @@ void TcpAcceptor::_run_one() {
 void TcpAcceptor::_start() {
     std::shared_ptr<TcpSession> session;
     auto spout = pipeline_->make_spout();
-    session.reset(new TcpSession(sessions_io_.at(io_index_++ % sessions_io_.size()), spout));
+    auto ix = static_cast<size_t>(io_index_++) % sessions_io_.size();
+    session.reset(new TcpSession(sessions_io_.at(ix), spout, sessions_pool_.at(ix)));
     // attach session to spout
     spout->set_error_cb(session->get_error_cb());
     // run session
@@ -241,16 +269,92 @@ void TcpAcceptor::handle_accept(std::shared_ptr<TcpSession> session, boost::syst
     }
 }
 
+//                           //
+//     Tcp Core Acceptor     //
+//                           //
+
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> ReusePortT;
+
+TcpCoreAcceptor::TcpCoreAcceptor(int port, int index, std::shared_ptr<IngestionPipeline> pipeline)
+    : acceptor_(io_)
+    , pool_(BufferPool::create(TcpSession::BUFFER_SIZE))
+    , pipeline_(pipeline)
+    , index_(index)
+    , logger_("tcp-core-acceptor", 10)
+{
+    EndpointT endpoint(boost::asio::ip::tcp::v4(), port);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(AcceptorT::reuse_address(true));
+    acceptor_.set_option(ReusePortT(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    logger_.info() << "Core acceptor " << index << " created, port: " << port;
+}
+
+IOServiceT& TcpCoreAcceptor::get_io() {
+    return io_;
+}
+
+void TcpCoreAcceptor::start() {
+    auto spout = pipeline_->make_spout(index_);
+    auto session = std::make_shared<TcpSession>(&io_, spout, pool_, false);
+    spout->set_error_cb(session->get_error_cb());
+    acceptor_.async_accept(
+                session->socket(),
+                boost::bind(&TcpCoreAcceptor::handle_accept,
+                            shared_from_this(),
+                            session,
+                            boost::asio::placeholders::error)
+                );
+}
+
+void TcpCoreAcceptor::stop() {
+    logger_.info() << "Stopping core acceptor " << index_;
+    // Acceptor is not thread safe, it should be closed by the core's thread
+    auto self = shared_from_this();
+    io_.post([self]() {
+        self->acceptor_.close();
+    });
+}
+
+void TcpCoreAcceptor::_stop() {
+    acceptor_.close();
+}
+
+void TcpCoreAcceptor::_run_one() {
+    io_.run_one();
+}
+
+void TcpCoreAcceptor::handle_accept(std::shared_ptr<TcpSession> session, boost::system::error_code err) {
+    if (AKU_LIKELY(!err)) {
+        session->start(TcpSession::NO_BUFFER, 0u, 0u, 0u);
+        start();
+    } else {
+        logger_.error() << "Acceptor error " << err.message();
+    }
+}
+
 //                    //
 //     Tcp Server     //
 //                    //
 
-TcpServer::TcpServer(std::shared_ptr<IngestionPipeline> pipeline, int concurrency, int port)
+TcpServer::TcpServer(std::shared_ptr<IngestionPipeline> pipeline, int concurrency, int port, bool reuse_port)
     : pline(pipeline)
     , barrier(concurrency)
     , stopped{0}
     , logger_("tcp-server", 32)
 {
+    if (reuse_port) {
+        logger_.info() << "Using per-core acceptors";
+        for (int i = 0; i < concurrency; i++) {
+            cores.push_back(std::make_shared<TcpCoreAcceptor>(port, i, pline));
+        }
+        pline->start();
+        for (auto core: cores) {
+            core->start();
+        }
+        return;
+    }
     for(;concurrency --> 0;) {
         iovec.push_back(&io);
     }
@@ -283,11 +387,22 @@ void TcpServer::start(SignalHandler* sig, int id) {
         std::thread iothread(iorun(*io, barrier));
         iothread.detach();
     }
+
+    for (size_t i = 0; i < cores.size(); i++) {
+        std::thread iothread(iorun(cores[i]->get_io(), barrier));
+        set_thread_affinity(iothread, static_cast<int>(i), &logger_);
+        iothread.detach();
+    }
 }
 
 void TcpServer::stop() {
     if (stopped++ == 0) {
-        serv->stop();
+        if (serv) {
+            serv->stop();
+        }
+        for (auto core: cores) {
+            core->stop();
+        }
         logger_.info() << "TcpServer stopped";
 
         // No need to joint I/O threads, just wait until they completes.
@@ -300,6 +415,9 @@ void TcpServer::stop() {
         for (auto io: iovec) {
             io->stop();
         }
+        for (auto core: cores) {
+            core->get_io().stop();
+        }
         logger_.info() << "I/O service stopped";
     }
 }
@@ -313,7 +431,7 @@ struct TcpServerBuilder {
     std::shared_ptr<Server> operator () (std::shared_ptr<IngestionPipeline> pipeline,
                                          std::shared_ptr<ReadOperationBuilder>,
                                          const ServerSettings& settings) {
-        return std::make_shared<TcpServer>(pipeline, settings.nworkers, settings.port);
+        return std::make_shared<TcpServer>(pipeline, settings.nworkers, settings.port, settings.reuse_port);
     }
 };
 
@@ -44,19 +44,27 @@ typedef boost::asio::io_service::work   WorkT;
   */
 class TcpSession : public std::enable_shared_from_this<TcpSession> {
     // TODO: Unique session ID
-    enum {
-        BUFFER_SIZE           = 0x1000,  //< Buffer size
-        BUFFER_SIZE_THRESHOLD = 0x0200,  //< Min free buffer space
-    };
     IOServiceT *io_;
     SocketT socket_;
     StrandT strand_;
     std::shared_ptr<PipelineSpout> spout_;
+    BufferPoolPtr pool_;  //< Receive buffer pool (should outlive the parser)
+    const bool use_strand_;  //< Serialize handlers (io-service is run by many threads)
     ProtocolParser parser_;
     Logger logger_;
 public:
-    typedef std::shared_ptr<Byte> BufferT;
-    TcpSession(IOServiceT *io, std::shared_ptr<PipelineSpout> spout);
+    enum {
+        BUFFER_SIZE           = 0x1000,  //< Buffer size
+        BUFFER_SIZE_THRESHOLD = 0x0200,  //< Min free buffer space
+    };
+    typedef BufferPtr BufferT;
+    /** C-tor.
+      * @param io io-service instance
+      * @param spout pipeline spout
+      * @param pool receive buffer pool
+      * @param use_strand should be false if io-service is run by a single thread
+      */
+    TcpSession(IOServiceT *io, std::shared_ptr<PipelineSpout> spout, BufferPoolPtr pool, bool use_strand = true);
 
     SocketT& socket();
 
@@ -70,7 +78,7 @@ public:
     static BufferT NO_BUFFER;
 private:
 
-    /** Allocate new buffer or reuse old if there is enough space in there.
+    /** Take new buffer from the pool or reuse old if there is enough space in there.
       * @param prev_buf previous buffer or NO_BUFFER
       * @param size buffer full size
       * @param pos position in the buffer
@@ -103,6 +111,7 @@ class TcpAcceptor : public std::enable_shared_from_this<TcpAcceptor>
     AcceptorT                           acceptor_;       //< Acceptor
     std::vector<IOServiceT*>            sessions_io_;    //< List of io-services for sessions
     std::vector<WorkT>                  sessions_work_;  //< Work to block io-services from completing too early
+    std::vector<BufferPoolPtr>          sessions_pool_;  //< Receive buffer pools (one per io-service)
     std::shared_ptr<IngestionPipeline>  pipeline_;       //< Pipeline instance
     std::atomic<int>                    io_index_;       //< I/O service index
 
@@ -142,17 +151,68 @@ private:
 };
 
 
+/** Per-core tcp acceptor.
+  * Owns listening socket (bound with SO_REUSEPORT), io-service and pipeline
+  * queue. Kernel distributes new connections between all acceptors that
+  * listen on the same port. Sessions accepted by this acceptor are served by
+  * the same single threaded io-service, so no strands or cross thread
+  * handoff is needed.
+  */
+class TcpCoreAcceptor : public std::enable_shared_from_this<TcpCoreAcceptor>
+{
+    IOServiceT                          io_;        //< Core's io-service
+    AcceptorT                           acceptor_;  //< Listening socket
+    BufferPoolPtr                       pool_;      //< Receive buffer pool
+    std::shared_ptr<IngestionPipeline>  pipeline_;  //< Pipeline instance
+    const int                           index_;     //< Core index (used to pick pipeline queue)
+    Logger                              logger_;
+public:
+    /** C-tor. Should be created in the heap.
+      * @param port port to listen for new connections
+      * @param index core index
+      * @param pipeline ingestion pipeline
+      */
+    TcpCoreAcceptor(int port, int index, std::shared_ptr<IngestionPipeline> pipeline);
+
+    //! Get io-service (should be run by exactly one thread)
+    IOServiceT& get_io();
+
+    //! Start accepting connections
+    void start();
+
+    //! Stop listening on socket (can be called from any thread)
+    void stop();
+
+    //! Stop listening on socket (for testing)
+    void _stop();
+
+    //! Run one handler (should be used only for testing)
+    void _run_one();
+private:
+
+    //! Accept event handler
+    void handle_accept(std::shared_ptr<TcpSession> session, boost::system::error_code err);
+};
+
+
 struct TcpServer : std::enable_shared_from_this<TcpServer>, Server
 {
     std::shared_ptr<IngestionPipeline>  pline;
     std::shared_ptr<TcpAcceptor>        serv;
+    std::vector<std::shared_ptr<TcpCoreAcceptor>> cores;  //< Per-core acceptors (if reuse_port is set)
     boost::asio::io_service             io;
     std::vector<IOServiceT*>            iovec;
     boost::barrier                      barrier;
     std::atomic<int>                    stopped;
     Logger                              logger_;
 
-    TcpServer(std::shared_ptr<IngestionPipeline> pipeline, int concurrency, int port);
+    /** C-tor.
+      * @param pipeline ingestion pipeline
+      * @param concurrency number of I/O threads
+      * @param port port to listen for new connections
+      * @param reuse_port create listening socket and io-service per I/O thread
+      */
+    TcpServer(std::shared_ptr<IngestionPipeline> pipeline, int concurrency, int port, bool reuse_port = false);
 
     //! Run IO service
     virtual void start(SignalHandler* sig_handler, int id);
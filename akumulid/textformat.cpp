@@ -0,0 +1,450 @@
+/**
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "textformat.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace Akumuli {
+
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static int count_digits(uint64_t value) {
+    int n = 1;
+    while (value >= 10000u) {
+        value /= 10000u;
+        n += 4;
+    }
+    if (value >= 1000u) return n + 3;
+    if (value >= 100u)  return n + 2;
+    if (value >= 10u)   return n + 1;
+    return n;
+}
+
+//! Write exactly `ndigits` digits of the `value` ending at `end`
+static void write_digits(uint64_t value, char* end, int ndigits) {
+    while (ndigits >= 2) {
+        auto pair = DIGIT_PAIRS + (value % 100u)*2;
+        value /= 100u;
+        *--end = pair[1];
+        *--end = pair[0];
+        ndigits -= 2;
+    }
+    if (ndigits) {
+        *--end = static_cast<char>('0' + value % 10u);
+    }
+}
+
+char* format_uint(uint64_t value, char* begin, char* end) {
+    int ndigits = count_digits(value);
+    if (end - begin < ndigits) {
+        return nullptr;
+    }
+    write_digits(value, begin + ndigits, ndigits);
+    return begin + ndigits;
+}
+
+//                         //
+//     Grisu2 algorithm    //
+//                         //
+
+/* Implementation of the Grisu2 algorithm by Florian Loitsch ("Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers", PLDI 2010).
+ * Output is the shortest (in most cases) sequence of digits that round-trips.
+ */
+namespace Grisu {
+
+//! Floating point number f * 2^e
+struct DiyFp {
+    uint64_t f;
+    int      e;
+};
+
+static DiyFp sub(DiyFp x, DiyFp y) {
+    assert(x.e == y.e && x.f >= y.f);
+    return DiyFp{ x.f - y.f, x.e };
+}
+
+//! Multiply and round upper 64 bits of the product
+static DiyFp mul(DiyFp x, DiyFp y) {
+    unsigned __int128 p = static_cast<unsigned __int128>(x.f) * y.f;
+    uint64_t h = static_cast<uint64_t>(p >> 64) + static_cast<uint64_t>((p >> 63) & 1u);
+    return DiyFp{ h, x.e + y.e + 64 };
+}
+
+static DiyFp normalize(DiyFp x) {
+    while ((x.f >> 63) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+static DiyFp normalize_to(DiyFp x, int e) {
+    return DiyFp{ x.f << (x.e - e), e };
+}
+
+//! Normalized value and its boundaries (middle points between the value and its neighbours)
+struct Boundaries {
+    DiyFp w;
+    DiyFp minus;
+    DiyFp plus;
+};
+
+static Boundaries compute_boundaries(double value) {
+    static const int      BIAS       = 1075;  // 1023 + 52
+    static const int      MIN_EXP    = 1 - BIAS;
+    static const uint64_t HIDDEN_BIT = 1ull << 52;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t E = (bits >> 52) & 0x7FF;
+    uint64_t F = bits & (HIDDEN_BIT - 1);
+
+    DiyFp v = E == 0 ? DiyFp{ F, MIN_EXP }
+                     : DiyFp{ F + HIDDEN_BIT, static_cast<int>(E) - BIAS };
+    // Lower boundary is closer if value is a power of two (except the smallest normal number)
+    bool lower_is_closer = F == 0 && E > 1;
+    DiyFp m_plus = DiyFp{ 2*v.f + 1, v.e - 1 };
+    DiyFp m_minus = lower_is_closer ? DiyFp{ 4*v.f - 1, v.e - 2 }
+                                    : DiyFp{ 2*v.f - 1, v.e - 1 };
+    DiyFp w_plus = normalize(m_plus);
+    DiyFp w_minus = normalize_to(m_minus, w_plus.e);
+    return Boundaries{ normalize(v), w_minus, w_plus };
+}
+
+static const int ALPHA = -60;
+static const int GAMMA = -32;
+
+//! Normalized 10^k, f * 2^e
+struct CachedPower {
+    uint64_t f;
+    int      e;
+    int      k;
+};
+
+//! Returns c = 10^k such that ALPHA <= e_c + e + 64 <= GAMMA
+static CachedPower get_cached_power(int e) {
+    static const int MIN_DEC_EXP = -300;
+    static const int DEC_EXP_STEP = 8;
+    static const CachedPower POWERS[] = {
+        { 0xAB70FE17C79AC6CA, -1060,  -300 },
+        { 0xFF77B1FCBEBCDC4F, -1034,  -292 },
+        { 0xBE5691EF416BD60C, -1007,  -284 },
+        { 0x8DD01FAD907FFC3C,  -980,  -276 },
+        { 0xD3515C2831559A83,  -954,  -268 },
+        { 0x9D71AC8FADA6C9B5,  -927,  -260 },
+        { 0xEA9C227723EE8BCB,  -901,  -252 },
+        { 0xAECC49914078536D,  -874,  -244 },
+        { 0x823C12795DB6CE57,  -847,  -236 },
+        { 0xC21094364DFB5637,  -821,  -228 },
+        { 0x9096EA6F3848984F,  -794,  -220 },
+        { 0xD77485CB25823AC7,  -768,  -212 },
+        { 0xA086CFCD97BF97F4,  -741,  -204 },
+        { 0xEF340A98172AACE5,  -715,  -196 },
+        { 0xB23867FB2A35B28E,  -688,  -188 },
+        { 0x84C8D4DFD2C63F3B,  -661,  -180 },
+        { 0xC5DD44271AD3CDBA,  -635,  -172 },
+        { 0x936B9FCEBB25C996,  -608,  -164 },
+        { 0xDBAC6C247D62A584,  -582,  -156 },
+        { 0xA3AB66580D5FDAF6,  -555,  -148 },
+        { 0xF3E2F893DEC3F126,  -529,  -140 },
+        { 0xB5B5ADA8AAFF80B8,  -502,  -132 },
+        { 0x87625F056C7C4A8B,  -475,  -124 },
+        { 0xC9BCFF6034C13053,  -449,  -116 },
+        { 0x964E858C91BA2655,  -422,  -108 },
+        { 0xDFF9772470297EBD,  -396,  -100 },
+        { 0xA6DFBD9FB8E5B88F,  -369,   -92 },
+        { 0xF8A95FCF88747D94,  -343,   -84 },
+        { 0xB94470938FA89BCF,  -316,   -76 },
+        { 0x8A08F0F8BF0F156B,  -289,   -68 },
+        { 0xCDB02555653131B6,  -263,   -60 },
+        { 0x993FE2C6D07B7FAC,  -236,   -52 },
+        { 0xE45C10C42A2B3B06,  -210,   -44 },
+        { 0xAA242499697392D3,  -183,   -36 },
+        { 0xFD87B5F28300CA0E,  -157,   -28 },
+        { 0xBCE5086492111AEB,  -130,   -20 },
+        { 0x8CBCCC096F5088CC,  -103,   -12 },
+        { 0xD1B71758E219652C,   -77,    -4 },
+        { 0x9C40000000000000,   -50,     4 },
+        { 0xE8D4A51000000000,   -24,    12 },
+        { 0xAD78EBC5AC620000,     3,    20 },
+        { 0x813F3978F8940984,    30,    28 },
+        { 0xC097CE7BC90715B3,    56,    36 },
+        { 0x8F7E32CE7BEA5C70,    83,    44 },
+        { 0xD5D238A4ABE98068,   109,    52 },
+        { 0x9F4F2726179A2245,   136,    60 },
+        { 0xED63A231D4C4FB27,   162,    68 },
+        { 0xB0DE65388CC8ADA8,   189,    76 },
+        { 0x83C7088E1AAB65DB,   216,    84 },
+        { 0xC45D1DF942711D9A,   242,    92 },
+        { 0x924D692CA61BE758,   269,   100 },
+        { 0xDA01EE641A708DEA,   295,   108 },
+        { 0xA26DA3999AEF774A,   322,   116 },
+        { 0xF209787BB47D6B85,   348,   124 },
+        { 0xB454E4A179DD1877,   375,   132 },
+        { 0x865B86925B9BC5C2,   402,   140 },
+        { 0xC83553C5C8965D3D,   428,   148 },
+        { 0x952AB45CFA97A0B3,   455,   156 },
+        { 0xDE469FBD99A05FE3,   481,   164 },
+        { 0xA59BC234DB398C25,   508,   172 },
+        { 0xF6C69A72A3989F5C,   534,   180 },
+        { 0xB7DCBF5354E9BECE,   561,   188 },
+        { 0x88FCF317F22241E2,   588,   196 },
+        { 0xCC20CE9BD35C78A5,   614,   204 },
+        { 0x98165AF37B2153DF,   641,   212 },
+        { 0xE2A0B5DC971F303A,   667,   220 },
+        { 0xA8D9D1535CE3B396,   694,   228 },
+        { 0xFB9B7CD9A4A7443C,   720,   236 },
+        { 0xBB764C4CA7A44410,   747,   244 },
+        { 0x8BAB8EEFB6409C1A,   774,   252 },
+        { 0xD01FEF10A657842C,   800,   260 },
+        { 0x9B10A4E5E9913129,   827,   268 },
+        { 0xE7109BFBA19C0C9D,   853,   276 },
+        { 0xAC2820D9623BF429,   880,   284 },
+        { 0x80444B5E7AA7CF85,   907,   292 },
+        { 0xBF21E44003ACDD2D,   933,   300 },
+        { 0x8E679C2F5E44FF8F,   960,   308 },
+        { 0xD433179D9C8CB841,   986,   316 },
+        { 0x9E19DB92B4E31BA9,  1013,   324 },
+    };
+    const int f = ALPHA - e - 1;
+    const int k = (f * 78913) / (1 << 18) + static_cast<int>(f > 0);  // ceil(f * log10(2))
+    const int index = (-MIN_DEC_EXP + k + (DEC_EXP_STEP - 1)) / DEC_EXP_STEP;
+    assert(index >= 0 && static_cast<size_t>(index) < sizeof(POWERS)/sizeof(CachedPower));
+    CachedPower cached = POWERS[index];
+    assert(ALPHA <= cached.e + e + 64 && GAMMA >= cached.e + e + 64);
+    return cached;
+}
+
+//! Largest power of ten that is less or equal to `n`, returns number of digits
+static int find_largest_pow10(uint32_t n, uint32_t* pow10) {
+    static const uint32_t POW10[] = {
+        1u, 10u, 100u, 1000u, 10000u, 100000u, 1000000u, 10000000u, 100000000u, 1000000000u
+    };
+    int k = 10;
+    while (k > 1 && n < POW10[k - 1]) {
+        k--;
+    }
+    *pow10 = POW10[k - 1];
+    return k;
+}
+
+static void round_weed(char* buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k) {
+    // Move the last digit closer to the exact value while the result stays inside the boundaries
+    while (rest < dist && delta - rest >= ten_k && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+        buf[len - 1]--;
+        rest += ten_k;
+    }
+}
+
+static void digit_gen(char* buf, int* len, int* decimal_exponent, DiyFp m_minus, DiyFp w, DiyFp m_plus) {
+    uint64_t delta = sub(m_plus, m_minus).f;
+    uint64_t dist  = sub(m_plus, w).f;
+
+    const DiyFp one = DiyFp{ 1ull << -m_plus.e, m_plus.e };
+    uint32_t p1 = static_cast<uint32_t>(m_plus.f >> -one.e);  // integral part
+    uint64_t p2 = m_plus.f & (one.f - 1);                      // fractional part
+
+    uint32_t pow10;
+    int n = find_largest_pow10(p1, &pow10);
+    while (n > 0) {
+        buf[(*len)++] = static_cast<char>('0' + p1 / pow10);
+        p1 %= pow10;
+        n--;
+        uint64_t rest = (static_cast<uint64_t>(p1) << -one.e) + p2;
+        if (rest <= delta) {
+            *decimal_exponent += n;
+            round_weed(buf, *len, dist, delta, rest, static_cast<uint64_t>(pow10) << -one.e);
+            return;
+        }
+        pow10 /= 10;
+    }
+    int m = 0;
+    while (true) {
+        p2 *= 10;
+        buf[(*len)++] = static_cast<char>('0' + (p2 >> -one.e));
+        p2 &= one.f - 1;
+        m++;
+        delta *= 10;
+        dist *= 10;
+        if (p2 <= delta) {
+            break;
+        }
+    }
+    *decimal_exponent -= m;
+    round_weed(buf, *len, dist, delta, p2, one.f);
+}
+
+//! Generate digits of the positive finite value, value = digits * 10^decimal_exponent
+static void grisu2(double value, char* buf, int* len, int* decimal_exponent) {
+    Boundaries b = compute_boundaries(value);
+    CachedPower cached = get_cached_power(b.plus.e);
+    DiyFp c = DiyFp{ cached.f, cached.e };
+    DiyFp w = mul(b.w, c);
+    DiyFp w_minus = mul(b.minus, c);
+    DiyFp w_plus = mul(b.plus, c);
+    // Boundaries are inexact after multiplication, shrink the interval to stay on the safe side
+    DiyFp m_minus = DiyFp{ w_minus.f + 1, w_minus.e };
+    DiyFp m_plus = DiyFp{ w_plus.f - 1, w_plus.e };
+    *len = 0;
+    *decimal_exponent = -cached.k;
+    digit_gen(buf, len, decimal_exponent, m_minus, w, m_plus);
+}
+
+}  // namespace Grisu
+
+static char* copy_str(const char* str, char* begin, char* end) {
+    size_t len = strlen(str);
+    if (static_cast<size_t>(end - begin) < len) {
+        return nullptr;
+    }
+    memcpy(begin, str, len);
+    return begin + len;
+}
+
+//! Format positive finite value, `out` should have enough space for 32 characters
+static char* format_digits(double value, char* out) {
+    char digits[20];
+    int ndigits, exp10;
+    Grisu::grisu2(value, digits, &ndigits, &exp10);
+
+    // Value is 0.digits * 10^n
+    const int n = ndigits + exp10;
+    if (ndigits <= n && n <= 17) {
+        // Integer, digits followed by zeros
+        memcpy(out, digits, ndigits);
+        memset(out + ndigits, '0', n - ndigits);
+        out += n;
+    } else if (0 < n && n <= 17) {
+        // Decimal point inside digits
+        memcpy(out, digits, n);
+        out += n;
+        *out++ = '.';
+        memcpy(out, digits + n, ndigits - n);
+        out += ndigits - n;
+    } else if (-4 < n && n <= 0) {
+        // Leading zeros
+        *out++ = '0';
+        *out++ = '.';
+        memset(out, '0', -n);
+        out += -n;
+        memcpy(out, digits, ndigits);
+        out += ndigits;
+    } else {
+        // Scientific notation, at least two exponent digits
+        *out++ = digits[0];
+        if (ndigits > 1) {
+            *out++ = '.';
+            memcpy(out, digits + 1, ndigits - 1);
+            out += ndigits - 1;
+        }
+        *out++ = 'e';
+        int e = n - 1;
+        *out++ = e < 0 ? '-' : '+';
+        e = e < 0 ? -e : e;
+        int edigits = e < 100 ? 2 : 3;
+        write_digits(static_cast<uint64_t>(e), out + edigits, edigits);
+        out += edigits;
+    }
+    return out;
+}
+
+char* format_double(double value, char* begin, char* end) {
+    if (std::isnan(value)) {
+        return copy_str(std::signbit(value) ? "-nan" : "nan", begin, end);
+    }
+    if (std::isinf(value)) {
+        return copy_str(value < 0 ? "-inf" : "inf", begin, end);
+    }
+    // Longest output: sign, 17 digits, point, up to 3 leading zeros or 5 exponent characters
+    char buf[32];
+    char* out = buf;
+    if (std::signbit(value)) {
+        *out++ = '-';
+        value = -value;
+    }
+    if (value == 0.0) {
+        *out++ = '0';
+    } else {
+        out = format_digits(value, out);
+    }
+    size_t len = out - buf;
+    if (static_cast<size_t>(end - begin) < len) {
+        return nullptr;
+    }
+    memcpy(begin, buf, len);
+    return begin + len;
+}
+
+//                               //
+//     IsoTimestampFormatter     //
+//                               //
+
+static const uint64_t NS_PER_SECOND = 1000000000ull;
+
+IsoTimestampFormatter::IsoTimestampFormatter()
+    : second_(~0ull)
+{
+}
+
+char* IsoTimestampFormatter::format(aku_Timestamp ts, char* begin, char* end) {
+    if (end - begin < SIZE) {
+        return nullptr;
+    }
+    aku_Timestamp second = ts - ts % NS_PER_SECOND;
+    if (second != second_) {
+        uint64_t seconds = ts / NS_PER_SECOND;
+        uint64_t days = seconds / 86400u;
+        uint64_t tod = seconds % 86400u;
+        // Civil date from the number of days since epoch (proleptic Gregorian calendar)
+        uint64_t z = days + 719468u;
+        uint64_t era = z / 146097u;
+        uint64_t doe = z - era*146097u;
+        uint64_t yoe = (doe - doe/1460u + doe/36524u - doe/146096u) / 365u;
+        uint64_t doy = doe - (365u*yoe + yoe/4u - yoe/100u);
+        uint64_t mp = (5u*doy + 2u) / 153u;
+        uint64_t day = doy - (153u*mp + 2u)/5u + 1u;
+        uint64_t month = mp < 10u ? mp + 3u : mp - 9u;
+        uint64_t year = yoe + era*400u + (month <= 2u ? 1u : 0u);
+
+        write_digits(year,           prefix_ + 4,  4);
+        write_digits(month,          prefix_ + 6,  2);
+        write_digits(day,            prefix_ + 8,  2);
+        prefix_[8] = 'T';
+        write_digits(tod / 3600u,    prefix_ + 11, 2);
+        write_digits(tod / 60u % 60u, prefix_ + 13, 2);
+        write_digits(tod % 60u,      prefix_ + 15, 2);
+        second_ = second;
+    }
+    memcpy(begin, prefix_, PREFIX_SIZE);
+    begin[PREFIX_SIZE] = '.';
+    write_digits(ts % NS_PER_SECOND, begin + SIZE, 9);
+    return begin + SIZE;
+}
+
+}  // namespace
@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include "akumuli.h"
+#include <cstdint>
+
+namespace Akumuli {
+
+/* Allocation-free and locale-independent text formatting.
+ * Every function writes the output to [begin, end) range and returns pointer
+ * to the end of the output or nullptr if the buffer is too small. Output is
+ * not null-terminated.
+ */
+
+//! Format unsigned integer
+char* format_uint(uint64_t value, char* begin, char* end);
+
+/** Format double using the shortest representation that round-trips (Grisu2).
+  * Layout follows "%.17g" (e.g. "0.1", "1e+20", "nan").
+  */
+char* format_double(double value, char* begin, char* end);
+
+/** ISO 8601 timestamp formatter ("YYYYMMDDTHHMMSS.nnnnnnnnn").
+  * Date and time of the last formatted second are cached, consecutive
+  * timestamps usually differ only in sub-second part.
+  */
+struct IsoTimestampFormatter {
+    enum {
+        PREFIX_SIZE = 15,   //< Size of the "YYYYMMDDTHHMMSS" part
+        SIZE = 25,          //< Size of the output
+    };
+
+    aku_Timestamp   second_;            //< Beginning of the cached second (in nanoseconds)
+    char            prefix_[PREFIX_SIZE];
+
+    IsoTimestampFormatter();
+
+    char* format(aku_Timestamp ts, char* begin, char* end);
+};
+
+}  // namespace
@@ -1,25 +1,94 @@
 #include "udp_server.h"
 
+#include <algorithm>
 #include <thread>
 
 #include <netinet/ip.h>
+#include <netinet/udp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <boost/bind.hpp>
 
 namespace Akumuli {
 
-UdpServer::UdpServer(std::shared_ptr<IngestionPipeline> pipeline, int nworkers, int port)
+// Not defined by older headers
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+//                    //
+//     Recv buffer    //
+//                    //
+
+UdpServer::IOBuf::IOBuf(int npackets, size_t bufsize, size_t ctrlsize)
+    : pps{0}
+    , bps{0}
+    , bufsize(bufsize)
+    , ctrlsize(ctrlsize)
+    , msgs(npackets)
+    , iovecs(npackets)
+    , data(npackets*bufsize)
+    , control(npackets*ctrlsize)
+{
+    for (int i = 0; i < npackets; i++) {
+        memset(&msgs[i], 0, sizeof(mmsghdr));
+        iovecs[i].iov_base = data.data() + i*bufsize;
+        iovecs[i].iov_len  = bufsize;
+        msgs[i].msg_hdr.msg_iov    = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        reset(i);
+    }
+}
+
+const Byte* UdpServer::IOBuf::buffer(int i) const {
+    return data.data() + i*bufsize;
+}
+
+void UdpServer::IOBuf::reset(int i) {
+    auto& hdr = msgs[i].msg_hdr;
+    // Kernel overwrites control buffer length and flags on every call
+    hdr.msg_control    = ctrlsize ? control.data() + i*ctrlsize : nullptr;
+    hdr.msg_controllen = ctrlsize;
+    hdr.msg_flags      = 0;
+    msgs[i].msg_len = 0;
+}
+
+//! Get size of the GRO segment from ancillary data (0 if datagram wasn't coalesced)
+static size_t get_gro_segment_size(msghdr* hdr) {
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int size;
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            return size > 0 ? static_cast<size_t>(size) : 0u;
+        }
+    }
+    return 0u;
+}
+
+//                    //
+//     Udp Server     //
+//                    //
+
+UdpServer::UdpServer(std::shared_ptr<IngestionPipeline> pipeline, int nworkers, int port,
+                     int batch_size, int busy_poll, bool gro, bool pin_threads)
     : pipeline_(pipeline)
     , start_barrier_(nworkers + 1)
     , stop_barrier_(nworkers + 1)
     , stop_{0}
     , port_(port)
     , nworkers_(nworkers)
+    , batch_size_(batch_size > 0 ? batch_size : NPACKETS)
+    , busy_poll_(busy_poll)
+    , gro_(gro)
+    , pin_threads_(pin_threads)
     , logger_("UdpServer", 128)
 {
 }
@@ -39,6 +108,9 @@ void UdpServer::start(SignalHandler *sig, int id) {
         auto spout = pipeline_->make_spout();
         spout->set_error_cb(error_cb);
         std::thread thread(std::bind(&UdpServer::worker, shared_from_this(), spout));
+        if (pin_threads_) {
+            set_thread_affinity(thread, i, &logger_);
+        }
         thread.detach();
     }
     start_barrier_.wait();
@@ -52,65 +124,87 @@ void UdpServer::stop() {
 }
 
 
-void UdpServer::worker(std::shared_ptr<PipelineSpout> spout) {
-    start_barrier_.wait();
-
-    int sockfd, retval;
+int UdpServer::create_socket() {
+    int sockfd;
     sockaddr_in sa;
 
-    ProtocolParser parser(spout);
-    try {
+    // Create socket
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd == -1) {
+        const char* msg = strerror(errno);
+        std::stringstream fmt;
+        fmt << "can't create socket: " << msg;
+        std::runtime_error err(fmt.str());
+        BOOST_THROW_EXCEPTION(err);
+    }
 
-        parser.start();
+    // Set socket options
+    int optval = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
+        const char* msg = strerror(errno);
+        close(sockfd);
+        std::stringstream fmt;
+        fmt << "can't set socket options: " << msg;
+        std::runtime_error err(fmt.str());
+        BOOST_THROW_EXCEPTION(err);
+    }
 
-        // Create socket
-        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sockfd == -1) {
-            const char* msg = strerror(errno);
-            std::stringstream fmt;
-            fmt << "can't create socket: " << msg;
-            std::runtime_error err(fmt.str());
-            BOOST_THROW_EXCEPTION(err);
-        }
+    timeval tval;
+    tval.tv_sec = 0;
+    tval.tv_usec = RCV_TIMEOUT_MS*1000;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tval, sizeof(tval)) == -1) {
+        const char* msg = strerror(errno);
+        close(sockfd);
+        std::stringstream fmt;
+        fmt << "can't set socket timeout: " << msg;
+        std::runtime_error err(fmt.str());
+        BOOST_THROW_EXCEPTION(err);
+    }
 
-        // Set socket options
-        int optval = 1;
-        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
-            const char* msg = strerror(errno);
-            std::stringstream fmt;
-            fmt << "can't set socket options: " << msg;
-            std::runtime_error err(fmt.str());
-            BOOST_THROW_EXCEPTION(err);
+    // Optional features, server can work without them
+    if (busy_poll_ > 0) {
+        if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_, sizeof(busy_poll_)) == -1) {
+            logger_.error() << "can't enable busy polling: " << strerror(errno);
         }
-
-        timeval tval;
-        tval.tv_sec = 0;
-        tval.tv_usec = 1000;  // 1ms
-        if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tval, sizeof(tval)) == -1) {
-            const char* msg = strerror(errno);
-            std::stringstream fmt;
-            fmt << "can't set socket timeout: " << msg;
-            std::runtime_error err(fmt.str());
-            BOOST_THROW_EXCEPTION(err);
+    }
+    if (gro_) {
+        if (setsockopt(sockfd, SOL_UDP, UDP_GRO, &optval, sizeof(optval)) == -1) {
+            logger_.error() << "can't enable UDP_GRO: " << strerror(errno);
         }
+    }
 
-        // Bind socket to port
-        sa.sin_family = AF_INET;
-        sa.sin_addr.s_addr = htonl(INADDR_ANY);
-        sa.sin_port = htons(port_);
-
-        if (bind(sockfd, (sockaddr *) &sa, sizeof(sa)) == -1) {
-            const char* msg = strerror(errno);
-            std::stringstream fmt;
-            fmt << "can't bind socket: " << msg;
-            std::runtime_error err(fmt.str());
-            BOOST_THROW_EXCEPTION(err);
-        }
+    // Bind socket to port
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    sa.sin_port = htons(port_);
+
+    if (bind(sockfd, (sockaddr *) &sa, sizeof(sa)) == -1) {
+        const char* msg = strerror(errno);
+        close(sockfd);
+        std::stringstream fmt;
+        fmt << "can't bind socket: " << msg;
+        std::runtime_error err(fmt.str());
+        BOOST_THROW_EXCEPTION(err);
+    }
+    return sockfd;
+}
+
+
+void UdpServer::worker(std::shared_ptr<PipelineSpout> spout) {
+    start_barrier_.wait();
+
+    int sockfd = -1, retval;
 
-        auto iobuf = std::make_shared<IOBuf>();
+    DatagramParser parser(spout);
+    try {
+        sockfd = create_socket();
+
+        auto iobuf = std::make_shared<IOBuf>(batch_size_,
+                                             gro_ ? GRO_MSS : MSS,
+                                             gro_ ? CMSG_SPACE(sizeof(int)) : 0u);
 
         while(!stop_.load(std::memory_order_relaxed)) {
-            retval = recvmmsg(sockfd, iobuf->msgs, NPACKETS, MSG_WAITFORONE, nullptr);
+            retval = recvmmsg(sockfd, iobuf->msgs.data(), batch_size_, MSG_WAITFORONE, nullptr);
             if (retval == -1) {
                 if (errno == EAGAIN || errno == EINTR) {
                     continue;
@@ -122,32 +216,44 @@ void UdpServer::worker(std::shared_ptr<PipelineSpout> spout) {
                 BOOST_THROW_EXCEPTION(err);
             }
 
-            iobuf->pps++;
+            iobuf->pps += retval;
 
             for (int i = 0; i < retval; i++) {
+                auto& msg = iobuf->msgs[i];
+                size_t mlen = msg.msg_len;
+                iobuf->bps += mlen;
+                if (msg.msg_hdr.msg_flags & MSG_TRUNC) {
+                    logger_.error() << "datagram truncated, " << mlen << " bytes received";
+                    iobuf->reset(i);
+                    continue;
+                }
+                // Coalesced datagram is a sequence of segments of the same size
+                // (last one can be shorter), every segment is parsed separately
+                size_t segment = gro_ ? get_gro_segment_size(&msg.msg_hdr) : 0u;
+                if (segment == 0) {
+                    segment = mlen;
+                }
+                auto data = iobuf->buffer(i);
+                for (size_t offset = 0; offset < mlen; offset += segment) {
+                    try {
+                        parser.parse(data + offset, std::min(segment, mlen - offset));
+                    } catch (StreamError const& e) {
+                        logger_.error() << "bad datagram: " << e.what();
+                    }
+                }
                 // reset buffer to receive new message
-                iobuf->bps += iobuf->msgs[i].msg_len;
-                size_t mlen = iobuf->msgs[i].msg_len;
-                iobuf->msgs[i].msg_len = 0;
-
-                // parse message content
-                PDU pdu = {
-                    std::shared_ptr<Byte>(iobuf, iobuf->bufs[i]),
-                    mlen,
-                    0u,
-                };
-
-                parser.parse_next(pdu);
-            }
-            if (retval != 0) {
-                iobuf = std::make_shared<IOBuf>();
+                iobuf->reset(i);
             }
+            // Send incomplete batch to the pipeline before going to sleep
+            spout->flush();
         }
     } catch(...) {
         logger_.error() << boost::current_exception_diagnostic_information();
     }
 
-    parser.close();
+    if (sockfd != -1) {
+        close(sockfd);
+    }
 
     stop_barrier_.wait();
 }
@@ -162,7 +268,9 @@ struct UdpServerBuilder {
     std::shared_ptr<Server> operator () (std::shared_ptr<IngestionPipeline> pipeline,
                                          std::shared_ptr<ReadOperationBuilder>,
                                          const ServerSettings& settings) {
-        return std::make_shared<UdpServer>(pipeline, settings.nworkers, settings.port);
+        return std::make_shared<UdpServer>(pipeline, settings.nworkers, settings.port,
+                                           settings.batch_size, settings.busy_poll,
+                                           settings.gro, settings.pin_threads);
     }
 };
 
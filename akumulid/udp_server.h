@@ -18,6 +18,9 @@
 
 #include <memory>
 #include <atomic>
+#include <vector>
+
+#include <sys/socket.h>
 
 #include <boost/thread/barrier.hpp>
 
@@ -31,6 +34,9 @@ namespace Akumuli {
 
 
 /** UDP server for data ingestion.
+  * Every worker has its own socket (SO_REUSEPORT) and receives datagrams in
+  * batches using recvmmsg. Datagrams are self-contained and parsed without
+  * any state carried between them.
   */
 class UdpServer : public std::enable_shared_from_this<UdpServer>, public Server
 {
@@ -40,11 +46,17 @@ class UdpServer : public std::enable_shared_from_this<UdpServer>, public Server
     std::atomic<int> stop_;
     const int port_;
     const int nworkers_;
+    const int batch_size_;          //< Max number of datagrams received at once
+    const int busy_poll_;           //< SO_BUSY_POLL value (0 - disabled)
+    const bool gro_;                //< Use UDP_GRO
+    const bool pin_threads_;        //< Bind workers to CPU cores
 
     Logger logger_;
 
     static const int MSS = 2048-128;
+    static const int GRO_MSS = 0x10000;     //< Max size of the coalesced datagram
     static const int NPACKETS = 512;
+    static const int RCV_TIMEOUT_MS = 100;  //< Recv timeout, used to check stop flag
 
     struct IOBuf {
         // Counters
@@ -52,21 +64,21 @@ class UdpServer : public std::enable_shared_from_this<UdpServer>, public Server
         std::atomic<uint64_t> bps;
 
         // Packet recv structs
-        mmsghdr   msgs[NPACKETS];
-        iovec   iovecs[NPACKETS];
-        char      bufs[NPACKETS][MSS];
-
-        IOBuf() {
-            memset(this, 0, sizeof(IOBuf));
-            for (int i = 0; i < NPACKETS; i++) {
-                iovecs[i].iov_base         = bufs[i];
-                iovecs[i].iov_len          = MSS;
-                msgs[i].msg_hdr.msg_iov    = &iovecs[i];
-                msgs[i].msg_hdr.msg_iovlen = 1;
-            }
-        }
-
-    } __attribute__((aligned (64)));  // Otherwise struct will be aligned by sizeof(bufs) and this is crazy expensive
+        const size_t            bufsize;    //< Size of the single receive buffer
+        const size_t            ctrlsize;   //< Size of the single ancillary data buffer
+        std::vector<mmsghdr>    msgs;
+        std::vector<iovec>      iovecs;
+        std::vector<Byte>       data;       //< Receive buffers
+        std::vector<Byte>       control;    //< Ancillary data buffers
+
+        IOBuf(int npackets, size_t bufsize, size_t ctrlsize);
+
+        //! Get pointer to the beginning of the i-th receive buffer
+        const Byte* buffer(int i) const;
+
+        //! Prepare header to receive new message
+        void reset(int i);
+    };
 
 public:
 
@@ -74,8 +86,13 @@ public:
       * @param nworker number of workers
       * @param port port number
       * @param pipeline pointer to ingestion pipeline
+      * @param batch_size max number of datagrams received at once
+      * @param busy_poll busy polling time in microseconds (0 - disabled)
+      * @param gro receive coalesced datagrams (UDP_GRO)
+      * @param pin_threads bind workers to CPU cores
       */
-    UdpServer(std::shared_ptr<IngestionPipeline> pipeline, int nworkers, int port);
+    UdpServer(std::shared_ptr<IngestionPipeline> pipeline, int nworkers, int port,
+              int batch_size = NPACKETS, int busy_poll = 0, bool gro = false, bool pin_threads = false);
 
     //! Start processing packets
     virtual void start(SignalHandler* sig, int id);
@@ -84,6 +101,9 @@ private:
     //! Stop processing packets
     void stop();
 
+    //! Create and bind worker's socket
+    int create_socket();
+
     void worker(std::shared_ptr<PipelineSpout> spout);
 };
 
@@ -8,6 +8,8 @@ except ImportError:
     import configparser as ini
 import os
 import StringIO
+import struct
+import time
 
 
 def parse_timestamp(ts):
@@ -86,6 +88,68 @@ def infinite_msg_stream(batch_size, metric_name, **kwargs):
         yield m
         i += 1
 
+COLUMNAR_MEDIA_TYPE = 'application/x-akumuli-columnar'
+
+
+def _read_varints(data, pos, count):
+    result = []
+    for _ in xrange(count):
+        value, shift = 0, 0
+        while True:
+            byte = ord(data[pos])
+            pos += 1
+            value |= (byte & 0x7F) << shift
+            if byte < 0x80:
+                break
+            shift += 7
+        result.append(value)
+    return result, pos
+
+
+def _undelta(values):
+    result, prev = [], 0
+    for zz in values:
+        prev = (prev + ((zz >> 1) ^ -(zz & 1))) & 0xFFFFFFFFFFFFFFFF
+        result.append(prev)
+    return result
+
+
+def read_columnar(response):
+    """Decode binary columnar output, yields (series, timestamp, value) tuples,
+    timestamp is a number of nanoseconds since epoch"""
+    names = {}
+    while True:
+        header = response.read(24)
+        if not header:
+            return
+        if header[0] == '-':
+            raise ValueError(header + response.read())
+        magic, version, flags, nrows, nseries, size, _ = struct.unpack('<IHHIIII', header)
+        if magic != 0x42434b41:
+            raise ValueError("Invalid block header")
+        body = response.read(size)
+        if flags & 1:
+            ids, pos = _read_varints(body, 0, nrows)
+            timestamps, pos = _read_varints(body, pos, nrows)
+            xored, pos = _read_varints(body, pos, nrows)
+            ids, timestamps = _undelta(ids), _undelta(timestamps)
+            values, prev = [], 0
+            for bits in xored:
+                prev ^= bits
+                values.append(struct.unpack('<d', struct.pack('<Q', prev))[0])
+        else:
+            ids = struct.unpack_from('<{0}Q'.format(nrows), body, 0)
+            timestamps = struct.unpack_from('<{0}Q'.format(nrows), body, 8*nrows)
+            values = struct.unpack_from('<{0}d'.format(nrows), body, 16*nrows)
+            pos = 24*nrows
+        for _ in xrange(nseries):
+            sid, length = struct.unpack_from('<QI', body, pos)
+            names[sid] = body[pos + 12:pos + 12 + length]
+            pos += 12 + length
+        for sid, ts, value in zip(ids, timestamps, values):
+            yield names.get(sid, ''), ts, value
+
+
 def makequery(metric, begin, end, **kwargs):
     query = {
             "metric": metric,
@@ -144,6 +208,13 @@ class Akumulid:
 
     def stop(self):
         self.__process.send_signal(subprocess.signal.SIGINT)
+
+    def wait(self, timeout):
+        """Wait for process to exit, return exit code or None on timeout"""
+        deadline = time.time() + timeout
+        while self.__process.poll() is None and time.time() < deadline:
+            time.sleep(0.1)
+        return self.__process.poll()
         
     def terminate(self):
         self.__process.terminate()
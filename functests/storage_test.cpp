@@ -247,7 +247,7 @@ struct LocalStorage : Storage {
             std::logic_error err("Database allready opened");
             BOOST_THROW_EXCEPTION(err);
         }
-        aku_FineTuneParams params;
+        aku_FineTuneParams params = {};
 
         params.durability = durability_;
         params.enable_huge_tlb = enable_huge_tlb_ ? 1 : 0;
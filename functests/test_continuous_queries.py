@@ -29,10 +29,14 @@ Test plan:
     - Long pause.
     - Write data in range (mid, end] in a loop.
     - Exit.
+    Test is performed two times, first time data is read using regular query,
+    second time using subscription (POST to /subscribe). Subscription only
+    receives data written after it was created so writer waits for the reader.
 """
 
-def writer(dt, delta, N):
+def writer(dt, delta, N, delay):
     try:
+        time.sleep(delay)
         chan = att.TCPChan(HOST, TCPPORT)
 
         # fill data in
@@ -55,9 +59,10 @@ def writer(dt, delta, N):
         traceback.print_exc()
         sys.exit(1)
 
-def reader(dtstart, delta, N):
+def reader(dtstart, delta, N, path):
     # Start writer process
-    wproc = multiprocessing.Process(name='Writer', target=writer, args=[dtstart, delta, N])
+    delay = 5 if path == '/subscribe' else 0
+    wproc = multiprocessing.Process(name='Writer', target=writer, args=[dtstart, delta, N, delay])
     wproc.start()
 
     try:
@@ -69,14 +74,14 @@ def reader(dtstart, delta, N):
                                         (delta.seconds*1000000.0 + delta.microseconds))) + 1
         query_params = {"output": { "format":  "csv" }}
         query = att.makequery("test", begin, end, **query_params)
-        queryurl = "http://{0}:{1}".format(HOST, HTTPPORT)
+        queryurl = "http://{0}:{1}{2}".format(HOST, HTTPPORT, path)
         response = urlopen(queryurl, json.dumps(query))
 
         exp_ts = begin
         exp_value = 0
         iterations = 0
 
-        print("Test #1 - continuous queries")
+        print("Test - continuous queries ({0})".format(path))
 
         for line in response:
             try:
@@ -100,7 +105,7 @@ def reader(dtstart, delta, N):
         # Check that we received all values
         if iterations != points_required:
             raise ValueError("Expect {0} data points, get {1} data points".format(points_required, iterations))
-        print("Test #1 passed")
+        print("Test passed")
     finally:
         wproc.join()
 
@@ -122,13 +127,18 @@ def main(path, debug=False):
         print("Akumulid should be started first")
     try:
 
-        dt = datetime.datetime.utcnow()
+        dtstart = datetime.datetime.utcnow()
         delta = datetime.timedelta(milliseconds=1)
         nmsgs = 100000
-
-        rproc = multiprocessing.Process(name='Reader', target=reader, args=[dt, delta, nmsgs])
-        rproc.start()
-        rproc.join()
+        for ix, path in enumerate(['/', '/subscribe']):
+            # Time ranges of the runs shouldn't overlap (late writes are rejected)
+            dt = dtstart + 2*ix*nmsgs*delta
+
+            rproc = multiprocessing.Process(name='Reader', target=reader, args=[dt, delta, nmsgs, path])
+            rproc.start()
+            rproc.join()
+            if rproc.exitcode != 0:
+                raise ValueError("Reader failed ({0})".format(path))
 
     except:
         traceback.print_exc()
@@ -7,9 +7,9 @@ import time
 import akumulid_test_tools as att
 import json
 try:
-    from urllib2 import urlopen
+    from urllib2 import urlopen, Request
 except ImportError:
-    from urllib import urlopen
+    from urllib.request import urlopen, Request
 import traceback
 import itertools
 import math
@@ -282,6 +282,43 @@ def test_read_in_forward_direction(dtstart, delta, N):
     print("Test #6 passed")
 
 
+def test_read_all_binary(testname, dtstart, delta, N, accept):
+    """Read all data in backward direction using binary output format"""
+    begin = dtstart + delta*(N-1)
+    end = dtstart
+    query = att.makequery("test", begin, end)
+    queryurl = "http://{0}:{1}".format(HOST, HTTPPORT)
+    request = Request(queryurl, json.dumps(query), {"Accept": accept})
+    response = urlopen(request)
+    if response.info().getheader("Content-Type") != att.COLUMNAR_MEDIA_TYPE:
+        raise ValueError("Unexpected content type")
+
+    expected_tags = [
+        "tag3=D",
+        "tag3=E",
+        "tag3=F",
+        "tag3=G",
+        "tag3=H",
+    ]
+    epoch = datetime.datetime(1970, 1, 1)
+    exp_ts = begin
+    exp_value = N-1
+    iterations = 0
+    print(testname)
+    for tagline, ts, value in att.read_columnar(response):
+        timestamp = epoch + datetime.timedelta(microseconds=ts//1000)
+        exp_tags = expected_tags[(N-iterations-1) % len(expected_tags)]
+        att.check_values(exp_tags, tagline, 'ENDS', exp_ts, timestamp, exp_value*1.0, value, iterations)
+        exp_ts -= delta
+        exp_value -= 1
+        iterations += 1
+
+    # Check that we received all values
+    if iterations != N:
+        raise ValueError("Expect {0} data points, get {1} data points".format(N, iterations))
+    print("{0} passed".format(testname.split(' - ')[0]))
+
+
 def test_paa_in_backward_direction(testname, dtstart, delta, N, fn, query):
     expected_values = [
         reversed(range(9, 100000, 10)),
@@ -428,6 +465,9 @@ def main(path, debug=False):
         test_paa_in_backward_direction("Test #11 - min PAA", dt, delta, nmsgs, min, "min-paa")
         test_paa_in_backward_direction("Test #12 - first wins PAA", dt, delta, nmsgs, lambda buf: buf[0], "first-paa")
         test_paa_in_backward_direction("Test #13 - last wins PAA", dt, delta, nmsgs, lambda buf: buf[-1], "last-paa")
+        test_read_all_binary("Test #14 - binary output", dt, delta, nmsgs, att.COLUMNAR_MEDIA_TYPE)
+        test_read_all_binary("Test #15 - compressed binary output", dt, delta, nmsgs,
+                             att.COLUMNAR_MEDIA_TYPE + "; compression=delta")
     except:
         traceback.print_exc()
         sys.exit(1)
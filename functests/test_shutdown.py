@@ -0,0 +1,109 @@
+from __future__ import print_function
+import akumulid_test_tools as att
+import datetime
+import json
+import multiprocessing
+import os
+import sys
+import time
+import traceback
+try:
+    from urllib2 import urlopen
+except ImportError:
+    from urllib import urlopen
+
+HOST = '127.0.0.1'
+TCPPORT = 8282
+HTTPPORT = 8181
+
+
+"""
+Test plan:
+    - Start server.
+    - Open subscription (POST to /subscribe) in a separate process.
+    - Write some data, subscription receives it and becomes idle
+      (connection is suspended until new data arrives).
+    - Stop the server (SIGINT) while subscription is still open.
+    - Server should exit cleanly and close the subscription.
+"""
+
+def subscriber(dtstart):
+    try:
+        query = att.makequery("test", dtstart, dtstart + datetime.timedelta(days=1), output=dict(format='csv'))
+        queryurl = "http://{0}:{1}/subscribe".format(HOST, HTTPPORT)
+        response = urlopen(queryurl, json.dumps(query))
+        nlines = 0
+        try:
+            for line in response:
+                nlines += 1
+        except:
+            # Connection can be closed without proper chunked encoding terminator
+            pass
+        print("Subscription closed, {0} lines received".format(nlines))
+    except:
+        print("Exception in subscriber")
+        traceback.print_exc()
+        sys.exit(1)
+
+def main(path):
+    if not os.path.exists(path):
+        print("Path {0} doesn't exists".format(path))
+        sys.exit(1)
+
+    akumulid = att.Akumulid(path)
+    # Reset database
+    akumulid.delete_database()
+    akumulid.create_database()
+    # start ./akumulid server
+    print("Starting server...")
+    akumulid.serve()
+    time.sleep(5)
+
+    dtstart = datetime.datetime.utcnow()
+    delta = datetime.timedelta(milliseconds=1)
+    nmsgs = 1000
+    sproc = multiprocessing.Process(name='Subscriber', target=subscriber, args=[dtstart])
+    try:
+        print("Test - stop server with open subscription")
+        sproc.start()
+        time.sleep(2)
+
+        chan = att.TCPChan(HOST, TCPPORT)
+        for it in att.generate_messages(dtstart, delta, nmsgs, 'test', tag=['Foo']):
+            chan.send(it)
+        # Subscription runs out of data and gets suspended
+        time.sleep(5)
+        chan.close()
+    except:
+        traceback.print_exc()
+        akumulid.terminate()
+        sys.exit(1)
+
+    print("Stopping server...")
+    akumulid.stop()
+    retcode = akumulid.wait(30)
+    if retcode is None:
+        print("Server didn't stop")
+        akumulid.terminate()
+        sys.exit(1)
+    if retcode != 0:
+        print("Server exited with code {0}".format(retcode))
+        sys.exit(1)
+
+    sproc.join(30)
+    if sproc.is_alive():
+        print("Subscription wasn't closed")
+        sproc.terminate()
+        sys.exit(1)
+    if sproc.exitcode != 0:
+        print("Subscriber failed")
+        sys.exit(1)
+    print("Test passed")
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        print("Not enough arguments")
+        sys.exit(1)
+    main(sys.argv[1])
+else:
+    raise ImportError("This module shouldn't be imported")
@@ -315,6 +315,22 @@ AKU_EXPORT aku_Status aku_write(aku_Database* db, const aku_Sample* sample);
   */
 AKU_EXPORT aku_Cursor* aku_query(aku_Database* db, const char* query);
 
+//! Callback that signals availability of new data
+typedef void (*aku_notify_cb_t) (void* arg);
+
+/** @brief Subscribe to new data (continuous query)
+  * Query is applied to samples when they're written to the database. Cursor never blocks,
+  * `aku_cursor_read` returns 0 if there is no new data and cursor is done only if query
+  * range ends (or on error). Subscription is cancelled when cursor is closed.
+  * @param db should point to opened database instance
+  * @param query should contain valid query with forward direction
+  * @param notify is invoked by the writer thread when new data is available or cursor
+  *        is done, it should be short and can't call any library functions (can be NULL)
+  * @param notify_arg is passed to callback
+  * @return cursor instance
+  */
+AKU_EXPORT aku_Cursor* aku_subscribe(aku_Database* db, const char* query, aku_notify_cb_t notify, void* notify_arg);
+
 /**
  * @brief Close cursor
  * @param pcursor pointer to cursor
@@ -351,6 +367,17 @@ AKU_EXPORT int aku_timestamp_to_string(aku_Timestamp, char* buffer, size_t buffe
   */
 AKU_EXPORT int aku_param_id_to_series(aku_Database* db, aku_ParamId id, char* buffer, size_t buffer_size);
 
+/** Convert param-id returned by the cursor to series name.
+  * Query can override series names (e.g. group-by statement), this function
+  * works in any thread unlike `aku_param_id_to_series`.
+  * @param pcursor cursor
+  * @param id param id returned by the cursor
+  * @param buffer is a destination buffer
+  * @param buffer_size is a destination buffer size
+  * @return 0 if no such id, -LEN if buffer is too small, LEN on success
+  */
+AKU_EXPORT int aku_cursor_param_id_to_series(aku_Cursor* pcursor, aku_ParamId id, char* buffer, size_t buffer_size);
+
 //--------------------
 // Stats and counters
 //--------------------
@@ -373,3 +400,25 @@ AKU_EXPORT void aku_debug_print(aku_Database *db);
 
 AKU_EXPORT int aku_json_stats(aku_Database *db, char* buffer, size_t size);
 
+//! Callback that receives output of the `aku_trace_dump` and `aku_metrics_dump`
+typedef void (*aku_trace_cb_t) (const char* data, size_t size, void* arg);
+
+/** @brief Dump recorded tracing spans
+  * Spans are recorded by the hot path functions (sequencer, page, queries) to the per-thread
+  * ring buffers only if library is built with AKU_ENABLE_TRACING option. Output is a JSON
+  * document in Chrome trace event format, it can be loaded into chrome://tracing.
+  * @param cb is invoked one or more times with consecutive parts of the output
+  * @param arg is passed to callback
+  * @return AKU_SUCCESS or error code
+  */
+AKU_EXPORT aku_Status aku_trace_dump(aku_trace_cb_t cb, void* arg);
+
+/** @brief Dump storage engine metrics
+  * Counters and histograms (samples written, late writes, merges, flushes, volume rotations,
+  * compression ratio, cache hits and misses) are written in Prometheus text exposition format.
+  * @param cb is invoked one or more times with consecutive parts of the output
+  * @param arg is passed to callback
+  * @return AKU_SUCCESS or error code
+  */
+AKU_EXPORT aku_Status aku_metrics_dump(aku_trace_cb_t cb, void* arg);
+
@@ -70,5 +70,14 @@ typedef struct
     //! Cache size limit
     uint64_t max_cache_size;
 
+    //! 0 - write-ahead log disabled, other value - enabled
+    uint32_t enable_wal;
+
+    //! Query results cache size limit
+    uint64_t query_cache_size;
+
+    //! Rollup tiers, comma separated list of `step:capacity` pairs (e.g. "1m:1440,1h:720"), null - disabled
+    const char* rollup_tiers;
+
 } aku_FineTuneParams;
 
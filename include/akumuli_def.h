@@ -100,4 +100,7 @@ typedef enum {
 //! Default cache size - 128Mb
 #define AKU_DEFAULT_MAX_CACHE_SIZE (1024*1024*128)
 
+//! Default query results cache size - 64Mb
+#define AKU_DEFAULT_QUERY_CACHE_SIZE (1024*1024*64)
+
 #endif
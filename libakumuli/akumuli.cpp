@@ -26,6 +26,8 @@
 #include "akumuli.h"
 #include "storage.h"
 #include "datetime.h"
+#include "tracing.h"
+#include "metrics.h"
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
@@ -92,14 +94,29 @@ struct CursorImpl : aku_Cursor {
     std::unique_ptr<ExternalCursor> cursor_;
     aku_Status status_;
     std::string query_;
+    Storage& storage_;
+    SeriesMatcher* matcher_;  //< Series matcher override installed by the query
 
     CursorImpl(Storage& storage, const char* query)
         : query_(query)
+        , storage_(storage)
+        , matcher_(nullptr)
     {
         status_ = AKU_SUCCESS;
         cursor_ = CoroCursor::make(&Storage::search, &storage, query_.data());
     }
 
+    //! Continuous query cursor
+    CursorImpl(Storage& storage, const char* query, aku_notify_cb_t notify, void* notify_arg)
+        : query_(query)
+        , storage_(storage)
+    {
+        status_ = AKU_SUCCESS;
+        auto sub = storage_.subscribe(query_.data(), notify, notify_arg);
+        matcher_ = sub->matcher();
+        cursor_.reset(new SubscriptionCursor(sub, storage_.subscriptions_));
+    }
+
     ~CursorImpl() {
         cursor_->close();
     }
@@ -119,7 +136,16 @@ struct CursorImpl : aku_Cursor {
     size_t read_values( void  *values
                       , size_t values_size )
     {
-        return cursor_->read_ex(values, values_size);
+        // Cursor can be read by different threads, matcher override is thread local
+        storage_.set_thread_local_matcher(matcher_);
+        auto nbytes = cursor_->read_ex(values, values_size);
+        matcher_ = storage_.get_thread_local_matcher();
+        return nbytes;
+    }
+
+    int param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size) {
+        storage_.set_thread_local_matcher(matcher_);
+        return storage_.param_id_to_series(id, buffer, buffer_size);
     }
 };
 
@@ -163,6 +189,10 @@ struct DatabaseImpl : public aku_Database
         return pcur;
     }
 
+    CursorImpl* subscribe(const char* query, aku_notify_cb_t notify, void* notify_arg) {
+        return new CursorImpl(storage_, query, notify, notify_arg);
+    }
+
     // TODO: remove obsolete
     CursorImpl* select(aku_SelectQuery const* query) {
         throw "depricated";
@@ -275,6 +305,10 @@ aku_Database* aku_open_database(const char* path, aku_FineTuneParams config)
         config.max_cache_size = AKU_DEFAULT_MAX_CACHE_SIZE;
         (*config.logger)(AKU_LOG_INFO, "config.window_size = default(AKU_DEFAULT_WINDOW_SIZE)");
     }
+    if (config.query_cache_size == 0) {
+        config.query_cache_size = AKU_DEFAULT_QUERY_CACHE_SIZE;
+        (*config.logger)(AKU_LOG_INFO, "config.query_cache_size = default(AKU_DEFAULT_QUERY_CACHE_SIZE)");
+    }
     auto ptr = new DatabaseImpl(path, config);
     return static_cast<aku_Database*>(ptr);
 }
@@ -317,6 +351,11 @@ aku_Cursor* aku_query(aku_Database* db, const char* query) {
     return dbi->query(query);
 }
 
+aku_Cursor* aku_subscribe(aku_Database* db, const char* query, aku_notify_cb_t notify, void* notify_arg) {
+    auto dbi = reinterpret_cast<DatabaseImpl*>(db);
+    return dbi->subscribe(query, notify, notify_arg);
+}
+
 void aku_cursor_close(aku_Cursor* pcursor) {
     CursorImpl* pimpl = reinterpret_cast<CursorImpl*>(pcursor);
     delete pimpl;
@@ -341,6 +380,11 @@ int aku_cursor_is_error(aku_Cursor* pcursor, aku_Status* out_error_code_or_null)
     return static_cast<int>(pimpl->is_error(out_error_code_or_null));
 }
 
+int aku_cursor_param_id_to_series(aku_Cursor* pcursor, aku_ParamId id, char* buffer, size_t buffer_size) {
+    CursorImpl* pimpl = reinterpret_cast<CursorImpl*>(pcursor);
+    return pimpl->param_id_to_series(id, buffer, buffer_size);
+}
+
 int aku_timestamp_to_string(aku_Timestamp ts, char* buffer, size_t buffer_size) {
     return DateTimeUtil::to_iso_string(ts, buffer, buffer_size);
 }
@@ -427,6 +471,33 @@ int aku_json_stats(aku_Database *db, char* buffer, size_t size) {
     return -1;
 }
 
+aku_Status aku_trace_dump(aku_trace_cb_t cb, void* arg) {
+    try {
+        std::stringstream out;
+        Tracing::dump_chrome_trace(out);
+        auto str = out.str();
+        cb(str.data(), str.size(), arg);
+        return AKU_SUCCESS;
+    } catch (std::exception const& e) {
+        aku_console_logger(AKU_LOG_ERROR, e.what());
+    }
+    return AKU_EGENERAL;
+}
+
+aku_Status aku_metrics_dump(aku_trace_cb_t cb, void* arg) {
+    try {
+        std::stringstream out;
+        Metrics::TextWriter writer(out);
+        Metrics::library().write_text(writer);
+        auto str = out.str();
+        cb(str.data(), str.size(), arg);
+        return AKU_SUCCESS;
+    } catch (std::exception const& e) {
+        aku_console_logger(AKU_LOG_ERROR, e.what());
+    }
+    return AKU_EGENERAL;
+}
+
 void aku_debug_print(aku_Database *db) {
     auto dbi = reinterpret_cast<DatabaseImpl*>(db);
     dbi->debug_print();
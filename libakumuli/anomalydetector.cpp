@@ -3,6 +3,9 @@
 
 #include <random>
 #include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
 
 #include <boost/exception/all.hpp>
 
@@ -13,24 +16,36 @@ namespace QP {
 //      CountingSketch      //
 //                          //
 
+/** Counting sketch.
+  * All N rows are stored in one contiguous cache aligned array (row-major),
+  * row operations are plain loops over this array that can be vectorized
+  * by the compiler.
+  */
 struct CountingSketch {
+    enum { ALIGNMENT = 64 };
+
     HashFnFamily const& hashes_;
     const uint32_t N;
     const uint32_t K;
     double sum_;
-    std::vector<std::vector<double>> tables_;
+    std::unique_ptr<double, decltype(&free)> table_;
+
+    static double* allocate(size_t size) {
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, ALIGNMENT, size*sizeof(double)) != 0) {
+            throw std::bad_alloc();
+        }
+        return static_cast<double*>(ptr);
+    }
 
     CountingSketch(HashFnFamily const& hf)
         : hashes_(hf)
         , N(hf.N)
         , K(hf.K)
         , sum_(0.0)
+        , table_(allocate(N*K), &free)
     {
-        for (uint32_t i = 0u; i < N; i++) {
-            std::vector<double> row;
-            row.resize(K, 0.0);
-            tables_.push_back(std::move(row));
-        }
+        std::fill(table_.get(), table_.get() + N*K, 0.0);
     }
 
     CountingSketch(CountingSketch const& cs)
@@ -38,130 +53,121 @@ struct CountingSketch {
         , N(cs.N)
         , K(cs.K)
         , sum_(cs.sum_)
+        , table_(allocate(N*K), &free)
     {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
-            std::vector<double> row;
-            row.resize(K, 0.0);
-            std::vector<double> const& rcs = cs.tables_[ixrow];
-            for (auto col = 0u; col < K; col++) {
-                row[col] = rcs[col];
-            }
-            tables_.push_back(std::move(row));
-        }
+        std::copy(cs.table_.get(), cs.table_.get() + N*K, table_.get());
     }
 
     void _update_sum() {
+        const double* row = table_.get();
         sum_ = 0.0;
-        for (auto val: tables_[0]) {
-            sum_ += val;
+        for (auto col = 0u; col < K; col++) {
+            sum_ += row[col];
         }
     }
 
+    //! Median of the small array (N is always odd)
+    double median(double* values) const {
+        std::nth_element(values, values + N/2, values + N);
+        return values[N/2];
+    }
+
     void add(uint64_t id, double value) {
+        uint32_t hashes[HashFnFamily::MAX_N];
+        hashes_.hash_all(id, hashes);
         sum_ += value;
+        double* table = table_.get();
         for (uint32_t i = 0; i < N; i++) {
-            // calculate hash from id to K
-            uint32_t hash = hashes_.hash(i, id);
-            tables_[i][hash] += value;
+            table[i*K + hashes[i]] += value;
         }
     }
 
     //! Second moment estimator
     double estimateF2() const {
-        std::vector<double> results;
+        double results[HashFnFamily::MAX_N];
         auto f = 1./(K - 1);
+        const double* table = table_.get();
         for (uint32_t i = 0u; i < N; i++) {
-            double rowsum = std::accumulate(tables_[i].begin(), tables_[i].end(), 0.0, [](double acc, double val) {
-                return acc + val*val;
-            });
-            double res = K*f*sqrt(rowsum) - f*sum_*sum_;
-            results.push_back(res);
+            const double* row = table + i*K;
+            double rowsum = 0.0;
+            for (auto col = 0u; col < K; col++) {
+                rowsum += row[col]*row[col];
+            }
+            results[i] = K*f*sqrt(rowsum) - f*sum_*sum_;
         }
-        std::sort(results.begin(), results.end());
-        return results[N/2];
+        return median(results);
     }
 
     //! Unbiased value estimator
     double estimate(uint64_t id) const {
-        std::vector<double> results;
+        uint32_t hashes[HashFnFamily::MAX_N];
+        double results[HashFnFamily::MAX_N];
+        hashes_.hash_all(id, hashes);
+        const double* table = table_.get();
+        const double bias = sum_/K;
+        const double norm = 1./(1. - 1./K);
         for (uint32_t i = 0u; i < N; i++) {
-            uint32_t hash = hashes_.hash(i, id);
-            double value = tables_[i][hash];
-            double estimate = (value - sum_/K)/(1. - 1./K);
-            results.push_back(estimate);
+            results[i] = (table[i*K + hashes[i]] - bias)*norm;
         }
-        std::sort(results.begin(), results.end());
-        return results[N/2];
+        return median(results);
     }
 
     //! current sketch <- absolute difference between two arguments
     void diff(CountingSketch const& lhs, CountingSketch const& rhs) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
-            std::vector<double>& row = tables_[ixrow];
-            std::vector<double> const& lrow = lhs.tables_[ixrow];
-            std::vector<double> const& rrow = rhs.tables_[ixrow];
-            for (auto col = 0u; col < K; col++) {
-                row[col] = abs(lrow[col] - rrow[col]);
-            }
+        double* __restrict__ dst = table_.get();
+        const double* __restrict__ lsrc = lhs.table_.get();
+        const double* __restrict__ rsrc = rhs.table_.get();
+        for (auto i = 0u; i < N*K; i++) {
+            dst[i] = std::fabs(lsrc[i] - rsrc[i]);
         }
         _update_sum();
     }
 
     //! Add sketch
     void add(CountingSketch const& val) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
-            std::vector<double>& row = tables_[ixrow];
-            std::vector<double> const& rval = val.tables_[ixrow];
-            for (auto col = 0u; col < K; col++) {
-                row[col] = row[col] + rval[col];
-            }
+        double* __restrict__ dst = table_.get();
+        const double* __restrict__ src = val.table_.get();
+        for (auto i = 0u; i < N*K; i++) {
+            dst[i] += src[i];
         }
         _update_sum();
     }
 
     //! Substract sketch
     void sub(CountingSketch const& val) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
-            std::vector<double>& row = tables_[ixrow];
-            std::vector<double> const& rval = val.tables_[ixrow];
-            for (auto col = 0u; col < K; col++) {
-                row[col] = row[col] - rval[col];
-            }
+        double* __restrict__ dst = table_.get();
+        const double* __restrict__ src = val.table_.get();
+        for (auto i = 0u; i < N*K; i++) {
+            dst[i] -= src[i];
         }
         _update_sum();
     }
 
     //! Multiply sketch by value
     void mul(double value) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
-            std::vector<double>& row = tables_[ixrow];
-            for (auto col = 0u; col < K; col++) {
-                row[col] *= value;
-            }
+        double* __restrict__ dst = table_.get();
+        for (auto i = 0u; i < N*K; i++) {
+            dst[i] *= value;
         }
-        _update_sum();
+        sum_ *= value;
     }
 
     //! Multiply by another sketch
     void mul(CountingSketch const& value) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
-            std::vector<double>& row = tables_[ixrow];
-            std::vector<double> const& rval = value.tables_[ixrow];
-            for (auto col = 0u; col < K; col++) {
-                row[col] = row[col] * rval[col];
-            }
+        double* __restrict__ dst = table_.get();
+        const double* __restrict__ src = value.table_.get();
+        for (auto i = 0u; i < N*K; i++) {
+            dst[i] *= src[i];
         }
         _update_sum();
     }
 
     //! Divide by another sketch
     void div(CountingSketch const& value) {
-        for (auto ixrow = 0u; ixrow < N; ixrow++) {
-            std::vector<double>& row = tables_[ixrow];
-            std::vector<double> const& rval = value.tables_[ixrow];
-            for (auto col = 0u; col < K; col++) {
-                row[col] = row[col] / rval[col];
-            }
+        double* __restrict__ dst = table_.get();
+        const double* __restrict__ src = value.table_.get();
+        for (auto i = 0u; i < N*K; i++) {
+            dst[i] /= src[i];
         }
         _update_sum();
     }
@@ -172,8 +178,12 @@ struct CountingSketch {
 //      PreciseCounter      //
 //                          //
 
+/** Precise counter.
+  * Ids are expected to be dense (query processor remaps series ids to slots),
+  * so values are stored in plain array indexed by id.
+  */
 struct PreciseCounter {
-    std::unordered_map<uint64_t, double> table_;
+    std::vector<double> table_;
 
     //! C-tor. Parameter `hf` is unused for the sake of interface unification.
     PreciseCounter(HashFnFamily const& hf) {
@@ -185,81 +195,82 @@ struct PreciseCounter {
     }
 
     void add(uint64_t id, double value) {
+        if (id >= table_.size()) {
+            table_.resize(id + 1, 0.);
+        }
         table_[id] += value;
     }
 
     //! Unbiased value estimator
     double estimate(uint64_t id) const {
-        auto it = table_.find(id);
-        if (it != table_.end()) {
-            return it->second;
+        if (id < table_.size()) {
+            return table_[id];
         }
         return 0.;
     }
 
     //! Second moment estimator
     double estimateF2() const {
-        double sum = std::accumulate(table_.begin(), table_.end(), 0.0,
-                                     [](double acc, std::pair<uint64_t, double> pval) {
-            return acc + pval.second*pval.second;
-        });
+        double sum = 0.;
+        for (auto val: table_) {
+            sum += val*val;
+        }
         return sqrt(sum);
     }
 
     //! current sketch <- absolute difference between two arguments
     void diff(PreciseCounter const& lhs, PreciseCounter const& rhs) {
-        const std::unordered_map<uint64_t, double> *small, *large;
-        if (lhs.table_.size() < rhs.table_.size()) {
-            small = &lhs.table_;
-            large = &rhs.table_;
-        } else {
-            small = &rhs.table_;
-            large = &lhs.table_;
-        }
-        table_.clear();
-        // Scan largest
-        for (auto it = large->begin(); it != large->end(); it++) {
-            auto small_it = small->find(it->first);
-            double val = 0.;
-            if (small_it != small->end()) {
-                val = small_it->second;
-            }
-            table_[it->first] = abs(it->second - val);
+        auto size = std::max(lhs.table_.size(), rhs.table_.size());
+        table_.resize(size);
+        for (size_t i = 0; i < size; i++) {
+            table_[i] = std::fabs(lhs.estimate(i) - rhs.estimate(i));
         }
     }
 
     //! Add sketch
     void add(PreciseCounter const& val) {
-        for(auto it = val.table_.begin(); it != val.table_.end(); it++) {
-            table_[it->first] += it->second;
+        if (val.table_.size() > table_.size()) {
+            table_.resize(val.table_.size(), 0.);
+        }
+        for (size_t i = 0; i < val.table_.size(); i++) {
+            table_[i] += val.table_[i];
         }
     }
 
     //! Substract sketch
     void sub(PreciseCounter const& val) {
-        for(auto it = val.table_.begin(); it != val.table_.end(); it++) {
-            table_[it->first] -= it->second;
+        if (val.table_.size() > table_.size()) {
+            table_.resize(val.table_.size(), 0.);
+        }
+        for (size_t i = 0; i < val.table_.size(); i++) {
+            table_[i] -= val.table_[i];
         }
     }
 
     //! Multiply sketch by value
     void mul(double value) {
-        for(auto it = table_.begin(); it != table_.end(); it++) {
-            it->second *= value;
+        for (auto& val: table_) {
+            val *= value;
         }
     }
 
     //! Multiply
     void mul(PreciseCounter const& val) {
-        for(auto it = val.table_.begin(); it != val.table_.end(); it++) {
-            table_[it->first] *= it->second;
+        if (val.table_.size() > table_.size()) {
+            table_.resize(val.table_.size(), 0.);
+        }
+        for (size_t i = 0; i < val.table_.size(); i++) {
+            table_[i] *= val.table_[i];
         }
     }
 
     //! Divide
     void div(PreciseCounter const& val) {
-        for(auto it = val.table_.begin(); it != val.table_.end(); it++) {
-            table_[it->first] /= it->second;
+        if (val.table_.size() > table_.size()) {
+            table_.resize(val.table_.size(), 0.);
+        }
+        for (size_t i = 0; i < val.table_.size(); i++) {
+            table_[i] /= val.table_[i];
         }
     }
 };
@@ -9,7 +9,10 @@
 namespace Akumuli {
 namespace QP {
 
-/** Anomaly detector interface */
+/** Anomaly detector interface.
+  * Precise detectors store per-series values in arrays indexed by id so ids
+  * should be dense (see SlotMap).
+  */
 struct AnomalyDetectorIface {
     virtual void add(uint64_t id, double value) = 0;
     virtual bool is_anomaly_candidate(uint64_t id) const = 0;
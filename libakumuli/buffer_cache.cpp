@@ -1,4 +1,5 @@
 #include "buffer_cache.h"
+#include "metrics.h"
 
 namespace Akumuli {
 
@@ -52,5 +53,49 @@ void ChunkCache::put(KeyT key, const std::shared_ptr<UncompressedChunk>& header)
     total_size_ += szdelta;
 }
 
+
+QueryCache::QueryCache(size_t limit)
+    : total_size_(0ul)
+    , hits_(0ul)
+    , misses_(0ul)
+    , size_limit_(limit)
+{
 }
 
+QueryCache::ItemT QueryCache::get(KeyT const& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = cache_.find(key);
+    if (it == cache_.end()) {
+        misses_++;
+        Metrics::library().query_cache_misses.inc();
+        return ItemT();
+    }
+    hits_++;
+    Metrics::library().query_cache_hits.inc();
+    return it->second;
+}
+
+void QueryCache::put(KeyT const& key, ItemT samples) {
+    auto szdelta = samples->size()*sizeof(aku_Sample) + std::get<0>(key).size();
+    if (szdelta > size_limit_/4) {
+        // Large results will evict everything else
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cache_.count(key)) {
+        return;
+    }
+    while (total_size_ + szdelta > size_limit_ && !fifo_.empty()) {
+        KeyT ekey;
+        size_t esz;
+        std::tie(ekey, esz) = fifo_.back();
+        fifo_.pop_back();
+        cache_.erase(ekey);
+        total_size_ -= esz;
+    }
+    fifo_.push_front(std::make_tuple(key, szdelta));
+    cache_[key] = samples;
+    total_size_ += szdelta;
+}
+
+}
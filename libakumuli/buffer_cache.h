@@ -1,11 +1,14 @@
 #pragma once
 
+#include "akumuli.h"
 #include "compression.h"
 
 #include <map>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <vector>
 
 namespace Akumuli {
 
@@ -31,5 +34,33 @@ struct ChunkCache
     void put(KeyT key, const std::shared_ptr<UncompressedChunk>& header);
 };
 
-}
 
+/** Cache of the samples extracted from closed volumes by queries.
+  * Closed volumes doesn't change until reopened for writing (this changes
+  * open count) so samples extracted by the query can be replayed instead
+  * of the volume scan. Key is a canonical query text (see QP::canonical_json)
+  * plus the volume version (page id, open count and close count).
+  */
+struct QueryCache
+{
+    //! Canonical query + page id + open count + close count
+    typedef std::tuple<std::string, uint32_t, uint32_t, uint32_t> KeyT;
+    typedef std::tuple<KeyT, size_t> QueueItemT;
+    typedef std::shared_ptr<const std::vector<aku_Sample>> ItemT;
+
+    std::map<KeyT, ItemT> cache_;
+    std::list<QueueItemT> fifo_;
+    size_t                total_size_;
+    size_t                hits_;
+    size_t                misses_;
+    mutable std::mutex    mutex_;
+    const size_t          size_limit_;
+
+    QueryCache(size_t limit);
+
+    ItemT get(KeyT const& key);
+
+    void put(KeyT const& key, ItemT samples);
+};
+
+}
@@ -1,5 +1,6 @@
 #include "compression.h"
 #include "util.h"
+#include "tracing.h"
 
 #include <unordered_map>
 #include <algorithm>
@@ -304,6 +305,7 @@ aku_Status CompressionUtil::decode_chunk( UncompressedChunk   *header
                                         , const unsigned char *pend
                                         , uint32_t             nelements)
 {
+    AKU_TRACE_SPAN("compression.decode_chunk");
     try {
         Base128StreamReader rstream(pbegin, pend);
         // Paramids
@@ -1,14 +1,11 @@
 #include "hashfnfamily.h"
 
 #include <stdexcept>
+#include <algorithm>
 #include <boost/exception/all.hpp>
 
 namespace Akumuli {
 
-static uint32_t combine(uint32_t hi, uint32_t lo) {
-    return (uint32_t)(2 - (int)hi + (int)lo);
-}
-
 HashFnFamily::HashFnFamily(uint32_t N, uint32_t K)
     : N(N)
     , K(K)
@@ -24,38 +21,41 @@ HashFnFamily::HashFnFamily(uint32_t N, uint32_t K)
         std::runtime_error err("invalid argument K (should be a power of two)");
         BOOST_THROW_EXCEPTION(err);
     }
-    // Generate tables
+    if (N > MAX_N) {
+        std::runtime_error err("invalid argument N (too large)");
+        BOOST_THROW_EXCEPTION(err);
+    }
+    // Generate coefficients
     std::random_device randdev;
-    std::mt19937 generator(randdev());
-    std::uniform_int_distribution<> distribution;
+    std::mt19937_64 generator(randdev());
     for (uint32_t i = 0; i < N; i++) {
-        std::vector<unsigned short> col;
-        auto mask = K-1;
-        for (int j = 0; j < 0x10000; j++) {
-            int value = distribution(generator);
-            col.push_back((uint32_t)mask&value);
-        }
-        table_.push_back(col);
+        mul_.push_back(generator() | 1ull);
+        add_.push_back(generator());
+    }
+    shift_ = 64;
+    while (mask) {
+        shift_--;
+        mask >>= 1;
     }
 }
 
 uint32_t HashFnFamily::hash(int ix, uint64_t key) const {
-    auto hi32 = key >> 32;
-    auto lo32 = key & 0xFFFFFFFF;
-    auto hilo = combine(hi32, lo32);
-
-    auto hi32hash = hash32(ix, hi32);
-    auto lo32hash = hash32(ix, lo32);
-    auto hilohash = hash32(ix, hilo);
-
-    return hi32hash ^ lo32hash ^ hilohash;
+    if (shift_ == 64) {
+        return 0u;
+    }
+    return static_cast<uint32_t>((mul_[ix]*key + add_[ix]) >> shift_);
 }
 
-uint32_t HashFnFamily::hash32(int ix, uint32_t key) const {
-    auto hi16 = key >> 16;
-    auto lo16 = key & 0xFFFF;
-    auto hilo = combine(hi16, lo16);
-    return table_[ix][lo16] ^ table_[ix][hi16] ^ table_[ix][hilo];
+void HashFnFamily::hash_all(uint64_t key, uint32_t* out) const {
+    if (shift_ == 64) {
+        std::fill(out, out + N, 0u);
+        return;
+    }
+    const uint64_t* mul = mul_.data();
+    const uint64_t* add = add_.data();
+    for (uint32_t i = 0; i < N; i++) {
+        out[i] = static_cast<uint32_t>((mul[i]*key + add[i]) >> shift_);
+    }
 }
 
 }  // namespace
@@ -6,12 +6,23 @@
 
 namespace Akumuli {
 
-//! Family of 4-universal hash functions
+/** Family of universal hash functions.
+  * Multiply-add-shift scheme is used: h(x) = (a*x + b) >> (64 - log2(K)), where `a` is
+  * a random odd number and `b` is a random number. Only 2N random numbers should be
+  * generated in c-tor and all N hashes can be computed without table lookups.
+  */
 struct HashFnFamily {
+    //! Max number of hash functions
+    enum { MAX_N = 16 };
+
     const uint32_t N;
     const uint32_t K;
-    //! Tabulation based hash fn used, N tables should be generated using RNG in c-tor
-    std::vector<std::vector<unsigned short>> table_;
+    //! Multipliers (odd)
+    std::vector<uint64_t> mul_;
+    //! Increments
+    std::vector<uint64_t> add_;
+    //! Shift width
+    uint32_t shift_;
 
     //! C-tor. N - number of different hash functions, K - number of values (should be a power of two)
     HashFnFamily(uint32_t N, uint32_t K);
@@ -19,8 +30,8 @@ struct HashFnFamily {
     //! Calculate hash value in range [0, K)
     uint32_t hash(int ix, uint64_t key) const;
 
-private:
-    uint32_t hash32(int ix, uint32_t key) const;
+    //! Calculate all N hash values in range [0, K), `out` should have space for N values
+    void hash_all(uint64_t key, uint32_t* out) const;
 };
 
 }  // namespace
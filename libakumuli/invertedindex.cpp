@@ -45,31 +45,34 @@ uint64_t TwoUnivHashFnFamily::hash(int ix, uint64_t value) const {
 }
 
 void Postings::append(aku_ParamId id) {
-    auto it = counters_.find(id);
-    if (it != counters_.end()) {
-        it->second++;
+    if (!ids_.contains(id)) {
+        ids_.add(id);
     } else {
-        counters_[id] = 1u;
+        counters_[id]++;
     }
 }
 
 size_t Postings::get_size() const {
-    return counters_.size();
+    return ids_.cardinality();
 }
 
 size_t Postings::get_count(aku_ParamId id) const {
+    if (!ids_.contains(id)) {
+        return 0u;
+    }
     auto it = counters_.find(id);
     if (it != counters_.end()) {
-        return it->second;
+        return 1u + it->second;
     }
-    return 0u;
+    return 1u;
 }
 
 void Postings::merge(const Postings& other) {
+    ids_ = ids_ & other.ids_;
     std::unordered_map<aku_ParamId, size_t> tmp;
     for (auto kv: counters_) {
         auto it = other.counters_.find(kv.first);
-        if (it != other.counters_.end()) {
+        if (it != other.counters_.end() && ids_.contains(kv.first)) {
             tmp[kv.first] = std::min(kv.second, it->second);
         }
     }
@@ -106,22 +109,19 @@ void InvertedIndex::append(aku_ParamId id, const char* begin, const char* end) {
 
 std::vector<std::pair<aku_ParamId, size_t>> InvertedIndex::get_count(const char *begin, const char *end) {
     auto hash = sdbm(begin, end);
-    std::vector<std::unique_ptr<Postings>> postings;
+    std::vector<Postings const*> postings;
     for (int i = 0; i < CARDINALITY; i++) {
         auto ith_hash = table_hash_.hash(i, hash);
-        Postings& original = *table_.at(ith_hash);
-        std::unique_ptr<Postings> copy;
-        copy.reset(new Postings());
-        *copy = original;
-        postings.push_back(std::move(copy));
+        postings.push_back(table_.at(ith_hash).get());
     }
 
     std::sort(postings.begin(), postings.end(),
-    [](const std::unique_ptr<Postings>& lhs, const std::unique_ptr<Postings>& rhs) {
+    [](Postings const* lhs, Postings const* rhs) {
         return lhs->get_size() < rhs->get_size();
     });
 
-    auto merged = std::move(postings[0]);
+    // Only the smallest list is copied
+    std::unique_ptr<Postings> merged(new Postings(*postings[0]));
     auto pbegin = postings.begin();
     pbegin++;
     while(pbegin != postings.end()) {
@@ -131,11 +131,21 @@ std::vector<std::pair<aku_ParamId, size_t>> InvertedIndex::get_count(const char
 
     std::vector<std::pair<aku_ParamId, size_t>> results;
 
-    for (auto kv: merged->counters_) {
-        results.push_back(kv);
+    for (auto id: merged->ids_.to_vector()) {
+        results.push_back(std::make_pair(id, merged->get_count(id)));
     }
 
     return results;
 }
 
+size_t InvertedIndex::estimate(const char* begin, const char* end) const {
+    auto hash = sdbm(begin, end);
+    size_t result = ~0ul;
+    for (int i = 0; i < CARDINALITY; i++) {
+        auto ith_hash = table_hash_.hash(i, hash);
+        result = std::min(result, table_.at(ith_hash)->get_size());
+    }
+    return result;
+}
+
 }  // namespace
@@ -17,6 +17,7 @@
 #pragma once
 #include "akumuli.h"
 #include "hashfnfamily.h"
+#include "roaring.h"
 
 #include <vector>
 #include <unordered_map>
@@ -38,9 +39,12 @@ struct TwoUnivHashFnFamily {
 
 /** Posting list.
  * In case of time-series data posting list is a pair of time-series Id and time-stamp
- * of the occurence.
+ * of the occurence. Ids are stored in compressed bitmap, most ids occur only once
+ * so only extra occurences are counted separately.
  */
 struct Postings {
+    RoaringBitmap ids_;
+    //! Number of extra occurences (only for ids that occur more than once)
     std::unordered_map<aku_ParamId, size_t> counters_;
 
     void append(aku_ParamId id);
@@ -72,6 +76,9 @@ struct InvertedIndex {
     void append(aku_ParamId id, const char* begin, const char* end);
 
     std::vector<std::pair<aku_ParamId, size_t> > get_count(const char* begin, const char* end);
+
+    //! Upper bound of the number of ids returned by `get_count` (cheap, can be used for query planning)
+    size_t estimate(const char* begin, const char* end) const;
 };
 
 }  // namespace
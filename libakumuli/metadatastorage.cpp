@@ -19,6 +19,7 @@
 #include "util.h"
 
 #include <sstream>
+#include <algorithm>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/exception/diagnostic_information.hpp>
@@ -59,6 +60,8 @@ MetadataStorage::MetadataStorage(const char* db, aku_logger_cb_t logger)
     , driver_(nullptr)
     , handle_(nullptr, AprHandleDeleter(nullptr))
     , logger_(logger)
+    , writer_stop_(false)
+    , writer_errors_{0}
 {
     apr_pool_t *pool = nullptr;
     auto status = apr_pool_create(&pool, NULL);
@@ -88,7 +91,7 @@ MetadataStorage::MetadataStorage(const char* db, aku_logger_cb_t logger)
     create_tables();
 
     // Create prepared statement
-    const char* query = "INSERT INTO akumuli_series (series_id, keyslist, storage_id) VALUES (%s, %s, %d)";
+    const char* query = "INSERT INTO akumuli_series (series_id, keyslist, storage_id) VALUES (%s, %s, %lld)";
     status = apr_dbd_prepare(driver_, pool_.get(), handle_.get(), query, "INSERT_SERIES_NAME", &insert_);
     if (status != 0) {
         (*logger_)(AKU_LOG_ERROR, "Error creating prepared statement");
@@ -96,6 +99,10 @@ MetadataStorage::MetadataStorage(const char* db, aku_logger_cb_t logger)
     }
 }
 
+MetadataStorage::~MetadataStorage() {
+    stop_writer();
+}
+
 int MetadataStorage::execute_query(std::string query) {
     int nrows = -1;
     int status = apr_dbd_query(driver_, handle_.get(), &nrows, query.c_str());
@@ -269,46 +276,134 @@ static bool split_series(const char* str, int n, LightweightString* outname, Lig
     return true;
 }
 
-void MetadataStorage::insert_new_names(std::vector<MetadataStorage::SeriesT> items) {
+void MetadataStorage::insert_new_names(std::vector<MetadataStorage::SeriesT> const& items) {
     if (items.size() == 0) {
         return;
     }
 
     execute_query("BEGIN TRANSACTION;");
+    try {
+        insert_names_(items);
+        execute_query("END TRANSACTION;");
+    } catch (...) {
+        // Nothing from the batch is saved, so it can be retried as a whole
+        int nrows = -1;
+        apr_dbd_query(driver_, handle_.get(), &nrows, "ROLLBACK TRANSACTION;");
+        throw;
+    }
+}
 
-    // Write all data
-    while(!items.empty()) {
-        const size_t batchsize = 100;
-        const size_t newsize = items.size() > batchsize ? items.size() - batchsize : 0;
-        std::vector<MetadataStorage::SeriesT> batch(items.begin() + newsize, items.end());
-        items.resize(newsize);
-        std::stringstream query;
-        query << "INSERT INTO akumuli_series (series_id, keyslist, storage_id)" << std::endl;
-        bool first = true;
-        for (auto item: batch) {
-            LightweightString name, keys;
-            auto stid = std::get<2>(item);
-            if (split_series(std::get<0>(item), std::get<1>(item), &name, &keys)) {
-                if (first) {
-                    query << "\tSELECT '" << name << "' as series_id, '"
-                                          << keys << "' as keyslist, "
-                                          << stid << "  as storage_id"
-                                          << std::endl;
-                    first = false;
+void MetadataStorage::insert_names_(std::vector<SeriesT> const& items) {
+    std::string name, keys, stid;
+    for (auto const& item: items) {
+        LightweightString lwname, lwkeys;
+        if (!split_series(std::get<0>(item), std::get<1>(item), &lwname, &lwkeys)) {
+            continue;
+        }
+        name.assign(lwname.str, lwname.len);
+        keys.assign(lwkeys.str, lwkeys.len);
+        stid = std::to_string(std::get<2>(item));
+        const char* args[] = { name.c_str(), keys.c_str(), stid.c_str() };
+        int nrows = -1;
+        int status = apr_dbd_pquery(driver_, pool_.get(), handle_.get(), &nrows, insert_, 3, args);
+        if (status != 0) {
+            std::stringstream fmt;
+            fmt << "Error inserting series " << lwname << " " << lwkeys << ": "
+                << apr_dbd_error(driver_, handle_.get(), status);
+            if ((status & 0xFF) != SQLITE_CONSTRAINT) {
+                // Database is locked or broken, whole transaction should fail
+                throw std::runtime_error(fmt.str());
+            }
+            // Skip bad row, other names from the batch should be saved anyway
+            (*logger_)(AKU_LOG_ERROR, fmt.str().c_str());
+        }
+    }
+}
+
+void MetadataStorage::start_writer(CommitCallbackT on_commit) {
+    on_commit_ = on_commit;
+    writer_stop_ = false;
+    writer_ = std::thread(&MetadataStorage::writer_loop_, this);
+}
+
+void MetadataStorage::insert_new_names_async(std::vector<SeriesT>&& items) {
+    if (items.empty()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(writer_mutex_);
+    if (writer_queue_.empty()) {
+        std::swap(writer_queue_, items);
+    } else {
+        writer_queue_.insert(writer_queue_.end(), items.begin(), items.end());
+    }
+    lock.unlock();
+    writer_cond_.notify_one();
+}
+
+void MetadataStorage::stop_writer() {
+    if (!writer_.joinable()) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(writer_mutex_);
+        writer_stop_ = true;
+    }
+    writer_cond_.notify_one();
+    writer_.join();
+}
+
+void MetadataStorage::writer_loop_() {
+    std::vector<SeriesT> batch;  // can contain names from the failed transaction
+    bool done = false;
+    int nretries = 0;
+    while (!done) {
+        {
+            std::unique_lock<std::mutex> lock(writer_mutex_);
+            if (batch.empty()) {
+                writer_cond_.wait(lock, [this] {
+                    return writer_stop_ || !writer_queue_.empty();
+                });
+                std::swap(batch, writer_queue_);
+            } else {
+                // Give database some time to recover before the next attempt
+                writer_cond_.wait_for(lock, std::chrono::milliseconds(WRITER_RETRY_DELAY));
+                batch.insert(batch.end(), writer_queue_.begin(), writer_queue_.end());
+                writer_queue_.clear();
+            }
+            done = writer_stop_;
+        }
+        if (batch.empty()) {
+            continue;
+        }
+        uint64_t max_id = 0;
+        try {
+            insert_new_names(batch);
+            for (auto const& item: batch) {
+                max_id = std::max(max_id, std::get<2>(item));
+            }
+            batch.clear();
+            nretries = 0;
+        } catch (std::exception const& err) {
+            writer_errors_++;
+            nretries++;
+            std::stringstream fmt;
+            fmt << "Can't save " << batch.size() << " series names (attempt " << nretries << "): " << err.what();
+            (*logger_)(AKU_LOG_ERROR, fmt.str().c_str());
+            if (done) {
+                if (nretries < WRITER_MAX_RETRIES) {
+                    done = false;
                 } else {
-                    query << "\tUNION "
-                          <<   "SELECT '" << name << "', '"
-                                          << keys << "', "
-                                          << stid
-                                          << std::endl;
+                    // Names are kept in the queue, they are still in memory but not in sqlite
+                    (*logger_)(AKU_LOG_ERROR, "Metadata writer stopped, series names are not saved");
+                    std::unique_lock<std::mutex> lock(writer_mutex_);
+                    writer_queue_.insert(writer_queue_.begin(), batch.begin(), batch.end());
                 }
             }
         }
-        std::string full_query = query.str();
-        execute_query(full_query);
+        if (max_id && on_commit_) {
+            on_commit_(max_id);
+        }
     }
-
-    execute_query("END TRANSACTION;");
 }
 
 uint64_t MetadataStorage::get_prev_largest_id() {
@@ -332,10 +427,12 @@ uint64_t MetadataStorage::get_prev_largest_id() {
 }
 
 
-aku_Status MetadataStorage::load_matcher_data(SeriesMatcher& matcher) {
-    auto query = "SELECT series_id || ' ' || keyslist, storage_id FROM akumuli_series;";
+aku_Status MetadataStorage::load_matcher_data(SeriesMatcher& matcher, uint64_t after_id) {
+    std::stringstream query;
+    query << "SELECT series_id || ' ' || keyslist, storage_id FROM akumuli_series WHERE storage_id > "
+          << after_id << " ORDER BY storage_id;";
     try {
-        auto results = select_query(query);
+        auto results = select_query(query.str().c_str());
         for(auto row: results) {
             if (row.size() != 2) {
                 continue;
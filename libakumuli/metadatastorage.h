@@ -18,6 +18,11 @@
 #include <cstddef>
 #include <vector>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
 
 #include <apr.h>
 #include <apr_dbd.h>
@@ -53,6 +58,9 @@ struct MetadataStorage {
     typedef std::pair<int, std::string>                                     VolumeDesc;
     typedef apr_dbd_prepared_t*                                             PreparedT;
 
+    typedef std::tuple<const char*, int, uint64_t> SeriesT;
+    typedef std::function<void(uint64_t)>          CommitCallbackT;
+
     // Members
     PoolT           pool_;
     DriverT         driver_;
@@ -60,11 +68,27 @@ struct MetadataStorage {
     PreparedT       insert_;
     aku_logger_cb_t logger_;
 
+    // Metadata writer thread
+    std::thread             writer_;
+    std::mutex              writer_mutex_;
+    std::condition_variable writer_cond_;
+    std::vector<SeriesT>    writer_queue_;    //< Names waiting to be inserted
+    bool                    writer_stop_;
+    CommitCallbackT         on_commit_;
+    std::atomic<uint64_t>   writer_errors_;   //< Number of failed transactions
+
+    enum {
+        WRITER_RETRY_DELAY = 100,  //< Delay between attempts to save the failed batch (ms)
+        WRITER_MAX_RETRIES = 10,   //< Number of attempts to save the failed batch on stop
+    };
+
     /** Create new or open existing db.
       * @throw std::runtime_error in a case of error
       */
     MetadataStorage(const char* db, aku_logger_cb_t logger);
 
+    ~MetadataStorage();
+
     // Creation //
 
     /** Create tables if database is empty
@@ -91,17 +115,44 @@ struct MetadataStorage {
     /** Read larges series id */
     uint64_t get_prev_largest_id();
 
-    aku_Status load_matcher_data(SeriesMatcher& matcher);
+    /** Load series names to matcher.
+      * @param matcher is a series matcher to fill
+      * @param after_id only series with larger ids will be loaded
+      */
+    aku_Status load_matcher_data(SeriesMatcher& matcher, uint64_t after_id = 0);
 
     // Writing //
 
-    typedef std::tuple<const char*, int, uint64_t> SeriesT;
-
     /** Add new series to the metadata storage.
+      * All series are inserted using prepared statement in one transaction.
+      * Rows that violate table constraints are skipped, any other error
+      * rolls back the whole transaction.
+      * @throw std::runtime_error if transaction failed (nothing is saved)
       */
-    void insert_new_names(std::vector<SeriesT> items);
+    void insert_new_names(std::vector<SeriesT> const& items);
+
+    /** Start metadata writer thread. After this call database should
+      * be accessed only through `insert_new_names_async` (sqlite handle
+      * is owned by writer thread).
+      * @param on_commit is called from writer thread with largest inserted id after each transaction
+      */
+    void start_writer(CommitCallbackT on_commit);
+
+    /** Add new series to the writer queue.
+      * Strings should stay valid until written (string pool memory is never freed).
+      * Batch is retried if transaction fails.
+      */
+    void insert_new_names_async(std::vector<SeriesT>&& items);
+
+    //! Write everything from the queue and stop writer thread
+    void stop_writer();
 
 private:
+    void writer_loop_();
+
+    //! Insert names using prepared statement (transaction should be started)
+    void insert_names_(std::vector<SeriesT> const& items);
+
     /** Execute query that doesn't return anything.
       * @throw std::runtime_error in a case of error
       * @return number of rows changed
@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "metrics.h"
+
+#include <iomanip>
+#include <limits>
+
+namespace Akumuli {
+namespace Metrics {
+
+//! Escape label value (backslash, double quote and line feed should be escaped)
+static std::string escape_label(std::string const& value) {
+    std::string result;
+    for (char c: value) {
+        switch (c) {
+        case '\\':
+            result += "\\\\";
+            break;
+        case '"':
+            result += "\\\"";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        default:
+            result += c;
+        };
+    }
+    return result;
+}
+
+TextWriter::TextWriter(std::ostream& out)
+    : out_(out)
+{
+    out_ << std::setprecision(std::numeric_limits<double>::digits10);
+}
+
+void TextWriter::header(const char* name, const char* help, const char* type) {
+    out_ << "# HELP " << name << " " << help << "\n";
+    out_ << "# TYPE " << name << " " << type << "\n";
+}
+
+void TextWriter::counter(const char* name, const char* help, uint64_t value) {
+    header(name, help, "counter");
+    out_ << name << " " << value << "\n";
+}
+
+void TextWriter::gauge(const char* name, const char* help, double value) {
+    header(name, help, "gauge");
+    out_ << name << " " << value << "\n";
+}
+
+void TextWriter::counter(const char* name, const char* help, const char* label, LabeledValues const& values) {
+    header(name, help, "counter");
+    for (auto const& kv: values) {
+        out_ << name << "{" << label << "=\"" << escape_label(kv.first) << "\"} " << kv.second << "\n";
+    }
+}
+
+void TextWriter::gauge(const char* name, const char* help, const char* label, LabeledValues const& values) {
+    header(name, help, "gauge");
+    for (auto const& kv: values) {
+        out_ << name << "{" << label << "=\"" << escape_label(kv.first) << "\"} " << kv.second << "\n";
+    }
+}
+
+void TextWriter::histogram(const char* name, const char* help, Histogram const& histogram) {
+    header(name, help, "histogram");
+    auto const& bounds = histogram.bounds();
+    uint64_t total = 0;
+    for (size_t i = 0; i < bounds.size(); i++) {
+        total += histogram.bucket_count(i);
+        out_ << name << "_bucket{le=\"" << bounds[i] << "\"} " << total << "\n";
+    }
+    // Count is derived from the buckets to keep the output consistent
+    total += histogram.bucket_count(bounds.size());
+    out_ << name << "_bucket{le=\"+Inf\"} " << total << "\n";
+    out_ << name << "_sum " << histogram.sum() << "\n";
+    out_ << name << "_count " << total << "\n";
+}
+
+void LibraryMetrics::write_text(TextWriter& writer) const {
+    writer.counter("akumuli_samples_written_total",
+                   "Number of samples accepted by the storage",
+                   samples_written.value());
+    writer.counter("akumuli_late_writes_total",
+                   "Number of samples rejected because they are older than the sliding window",
+                   late_writes.value());
+    writer.counter("akumuli_merges_total",
+                   "Number of times the sequencer was merged and compressed into the page",
+                   merges.value());
+    writer.histogram("akumuli_merge_duration_seconds",
+                     "Duration of the sequencer merge",
+                     merge_duration);
+    writer.histogram("akumuli_flush_duration_seconds",
+                     "Duration of the volume flush",
+                     flush_duration);
+    writer.counter("akumuli_volume_rotations_total",
+                   "Number of times the active volume was switched",
+                   volume_rotations.value());
+    writer.histogram("akumuli_chunk_compression_ratio",
+                     "Uncompressed size of the chunk divided by the compressed size",
+                     compression_ratio);
+    writer.counter("akumuli_cache_hits_total",
+                   "Number of cache hits",
+                   "cache",
+                   {
+                       { "chunk", static_cast<double>(chunk_cache_hits.value()) },
+                       { "query", static_cast<double>(query_cache_hits.value()) },
+                   });
+    writer.counter("akumuli_cache_misses_total",
+                   "Number of cache misses",
+                   "cache",
+                   {
+                       { "chunk", static_cast<double>(chunk_cache_misses.value()) },
+                       { "query", static_cast<double>(query_cache_misses.value()) },
+                   });
+}
+
+}  // namespace Metrics
+}  // namespace Akumuli
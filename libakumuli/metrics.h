@@ -0,0 +1,175 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Counters and histograms exported in Prometheus text format.
+ *
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <initializer_list>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Akumuli {
+namespace Metrics {
+
+//! Monotonic counter
+class Counter {
+    std::atomic<uint64_t> value_;
+public:
+    Counter()
+        : value_{0}
+    {
+    }
+
+    void inc(uint64_t n = 1) {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+};
+
+/** Histogram with fixed bucket bounds.
+  * @brief Every observation increments one bucket counter and adds value to
+  * the sum, no locks are used. Snapshot taken by the reader is not atomic
+  * (counts of different buckets can be slightly out of sync with each other).
+  */
+class Histogram {
+    const std::vector<double>               bounds_;  //< Upper bounds of the buckets (inclusive, sorted)
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;  //< Bucket counters, last one is +Inf
+    std::atomic<double>                     sum_;
+public:
+    Histogram(std::initializer_list<double> bounds)
+        : bounds_(bounds)
+        , counts_(new std::atomic<uint64_t>[bounds.size() + 1])
+        , sum_{0.0}
+    {
+        for (size_t i = 0; i <= bounds_.size(); i++) {
+            counts_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void observe(double value) {
+        size_t ix = 0;
+        while (ix < bounds_.size() && value > bounds_[ix]) {
+            ix++;
+        }
+        counts_[ix].fetch_add(1, std::memory_order_relaxed);
+        auto sum = sum_.load(std::memory_order_relaxed);
+        while (!sum_.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::vector<double> const& bounds() const {
+        return bounds_;
+    }
+
+    //! Get number of observations in bucket (non-cumulative), `bounds().size()` is the +Inf bucket
+    uint64_t bucket_count(size_t ix) const {
+        return counts_[ix].load(std::memory_order_relaxed);
+    }
+
+    double sum() const {
+        return sum_.load(std::memory_order_relaxed);
+    }
+};
+
+//! Adds duration of the scope (in seconds) to histogram
+class ScopedTimer {
+    typedef std::chrono::steady_clock Clock;
+    Histogram&          histogram_;
+    Clock::time_point   start_;
+public:
+    ScopedTimer(Histogram& histogram)
+        : histogram_(histogram)
+        , start_(Clock::now())
+    {
+    }
+
+    ScopedTimer(ScopedTimer const&) = delete;
+    ScopedTimer& operator = (ScopedTimer const&) = delete;
+
+    ~ScopedTimer() {
+        std::chrono::duration<double> elapsed = Clock::now() - start_;
+        histogram_.observe(elapsed.count());
+    }
+};
+
+//! Writes metrics in Prometheus text exposition format
+class TextWriter {
+    std::ostream& out_;
+
+    void header(const char* name, const char* help, const char* type);
+public:
+    //! Metric value with label value (label name is passed separately)
+    typedef std::vector<std::pair<std::string, double>> LabeledValues;
+
+    TextWriter(std::ostream& out);
+
+    void counter(const char* name, const char* help, uint64_t value);
+
+    void gauge(const char* name, const char* help, double value);
+
+    //! Write counter family with one label (e.g. `name{label="value"} 1`)
+    void counter(const char* name, const char* help, const char* label, LabeledValues const& values);
+
+    //! Write gauge family with one label
+    void gauge(const char* name, const char* help, const char* label, LabeledValues const& values);
+
+    void histogram(const char* name, const char* help, Histogram const& histogram);
+};
+
+//! Storage engine metrics (updated by the library, one instance per process)
+struct LibraryMetrics {
+    Counter     samples_written;
+    Counter     late_writes;
+    Counter     merges;
+    Histogram   merge_duration;
+    Histogram   flush_duration;
+    Counter     volume_rotations;
+    Histogram   compression_ratio;    //< Uncompressed chunk size divided by compressed size
+    Counter     chunk_cache_hits;
+    Counter     chunk_cache_misses;
+    Counter     query_cache_hits;
+    Counter     query_cache_misses;
+
+    LibraryMetrics()
+        : merge_duration({0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0})
+        , flush_duration({0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0})
+        , compression_ratio({1.0, 1.5, 2.0, 3.0, 4.0, 6.0, 8.0, 12.0, 16.0, 32.0})
+    {
+    }
+
+    void write_text(TextWriter& writer) const;
+};
+
+//! Get library metrics instance
+inline LibraryMetrics& library() {
+    static LibraryMetrics metrics;
+    return metrics;
+}
+
+}  // namespace Metrics
+}  // namespace Akumuli
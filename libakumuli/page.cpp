@@ -26,6 +26,8 @@
 #include "akumuli_def.h"
 #include "search.h"
 #include "buffer_cache.h"
+#include "tracing.h"
+#include "metrics.h"
 
 #include <random>
 #include <iostream>
@@ -181,6 +183,7 @@ aku_Status PageHeader::add_chunk(const aku_MemRange range, const uint32_t free_s
 }
 
 aku_Status PageHeader::complete_chunk(const UncompressedChunk& data) {
+    AKU_TRACE_SPAN("page.complete_chunk");
     CompressedChunkDesc desc;
     Rand rand;
     aku_Timestamp first_ts;
@@ -216,6 +219,10 @@ aku_Status PageHeader::complete_chunk(const UncompressedChunk& data) {
     if (status != AKU_SUCCESS) {
         return status;
     }
+    if (writer.end > writer.begin) {
+        double nbytes = static_cast<double>(data.paramids.size())*(sizeof(aku_ParamId) + sizeof(aku_Timestamp) + sizeof(double));
+        Metrics::library().compression_ratio.observe(nbytes/static_cast<double>(writer.end - writer.begin));
+    }
 
     // Calculate checksum of the new compressed data
     boost::crc_32_type checksum;
@@ -493,7 +500,11 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
         if (cache_ && cache_->contains(key)) {
             // Fast path
             header = cache_->get(key);
+            Metrics::library().chunk_cache_hits.inc();
         } else {
+            if (cache_) {
+                Metrics::library().chunk_cache_misses.inc();
+            }
             chunk_header.reset(new UncompressedChunk());
             header.reset(new UncompressedChunk());
             auto pdesc  = reinterpret_cast<CompressedChunkDesc const*>(&probe_entry->value[0]);
@@ -680,6 +691,7 @@ struct SearchAlgorithm : InterpolationSearch<SearchAlgorithm>
 
 
 void PageHeader::search(std::shared_ptr<QP::IQueryProcessor> query, std::shared_ptr<ChunkCache> cache) const {
+    AKU_TRACE_SPAN("page.search");
     SearchAlgorithm search_alg(this, query, cache);
     if (search_alg.fast_path() == false) {
         if (search_alg.interpolation()) {
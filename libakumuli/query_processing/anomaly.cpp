@@ -94,6 +94,7 @@ static void validate_coef(double value, double range_begin, double range_end, co
 
 AnomalyDetector::AnomalyDetector(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next)
     : next_(next)
+    , slots_(std::make_shared<SlotMap>())
 {
     validate_anomaly_detector_params(ptree);
     double threshold = ptree.get<double>("threshold");
@@ -149,6 +150,7 @@ AnomalyDetector::AnomalyDetector(
         FcastMethod method,
         std::shared_ptr<Node> next)
     : next_(next)
+    , slots_(std::make_shared<SlotMap>())
 {
     try {
         switch(method) {
@@ -195,8 +197,9 @@ bool AnomalyDetector::put(const aku_Sample &sample) {
         detector_->move_sliding_window();
         return next_->put(sample);
     } else if (sample.payload.type & aku_PData::FLOAT_BIT) {
-        detector_->add(sample.paramid, sample.payload.float64);
-        if (detector_->is_anomaly_candidate(sample.paramid)) {
+        auto slot = slots_->slot(sample.paramid);
+        detector_->add(slot, sample.payload.float64);
+        if (detector_->is_anomaly_candidate(slot)) {
             aku_Sample anomaly = sample;
             anomaly.payload.type |= aku_PData::URGENT;
             return next_->put(anomaly);
@@ -213,6 +216,10 @@ int AnomalyDetector::get_requirements() const {
     return TERMINAL|GROUP_BY_REQUIRED;
 }
 
+void AnomalyDetector::set_slot_map(std::shared_ptr<SlotMap> slots) {
+    slots_ = slots;
+}
+
 //! Register anomaly detector for use in queries
 static QueryParserToken<AnomalyDetector> detector_token("anomaly-detector");
 
@@ -25,6 +25,7 @@ struct AnomalyDetector : Node {
 
     std::shared_ptr<Node> next_;
     PDetector detector_;
+    std::shared_ptr<SlotMap> slots_;  //< Detectors are fed with slots instead of ids
 
     AnomalyDetector(uint32_t nhashes,
                     uint32_t bits,
@@ -45,6 +46,8 @@ struct AnomalyDetector : Node {
     virtual void set_error(aku_Status status);
 
     virtual int get_requirements() const;
+
+    virtual void set_slot_map(std::shared_ptr<SlotMap> slots);
 };
 
 
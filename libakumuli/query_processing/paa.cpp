@@ -34,8 +34,8 @@ MeanPAA::MeanPAA(const boost::property_tree::ptree &, std::shared_ptr<Node> next
 }
 
 void MedianCounter::reset() {
-    std::vector<double> tmp;
-    std::swap(tmp, acc);
+    // Capacity is preserved and reused in the next bucket
+    acc.clear();
 }
 
 double MedianCounter::value() const {
@@ -49,7 +49,7 @@ double MedianCounter::value() const {
     }
     auto middle = acc.begin();
     std::advance(middle, acc.size() / 2);
-    std::partial_sort(acc.begin(), middle + 1, acc.end());
+    std::nth_element(acc.begin(), middle, acc.end());
     return *middle;
 }
 
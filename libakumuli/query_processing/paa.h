@@ -1,7 +1,7 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
-#include <unordered_map>
 #include <vector>
 
 #include "../queryprocessor_framework.h"
@@ -14,40 +14,51 @@ namespace QP {
 template<class State>
 struct PAA : Node {
     std::shared_ptr<Node> next_;
-    std::unordered_map<aku_ParamId, State> counters_;
+    std::shared_ptr<SlotMap> slots_;
+    std::vector<State> counters_;  //< Per-series state indexed by slot
+    std::vector<uint32_t> active_;  //< Slots that received samples in current bucket
 
     PAA(std::shared_ptr<Node> next)
         : next_(next)
+        , slots_(std::make_shared<SlotMap>())
     {
     }
 
     bool average_samples(aku_Sample const& margin) {
-        std::vector<aku_ParamId> ids;
-        for (auto& pair: counters_) {
-            ids.push_back(pair.first);
-        }
+        // Only series that received samples in this bucket are visited,
+        // `active_` is reused between buckets to avoid allocations.
+        auto const& ids = slots_->ids_;
         if (margin.payload.type == aku_PData::LO_MARGIN) {
             // Moving in backward direction
-            std::sort(ids.begin(), ids.end(), std::greater<aku_ParamId>());
+            std::sort(active_.begin(), active_.end(), [&ids](uint32_t lhs, uint32_t rhs) {
+                return ids[lhs] > ids[rhs];
+            });
         } else {
             // Moving forward
-            std::sort(ids.begin(), ids.end(), std::less<aku_ParamId>());
+            std::sort(active_.begin(), active_.end(), [&ids](uint32_t lhs, uint32_t rhs) {
+                return ids[lhs] < ids[rhs];
+            });
         }
-        for (auto id: ids) {
-            State& state = counters_[id];
-            if (state.ready()) {
-                aku_Sample sample;
-                sample.paramid = id;
-                sample.payload.float64 = state.value();
-                sample.payload.type = AKU_PAYLOAD_FLOAT;
-                sample.payload.size = sizeof(aku_Sample);
-                sample.timestamp = margin.timestamp;
-                state.reset();
-                if (!next_->put(sample)) {
-                    return false;
+        aku_Sample sample;
+        sample.payload.type = AKU_PAYLOAD_FLOAT;
+        sample.payload.size = sizeof(aku_Sample);
+        sample.timestamp = margin.timestamp;
+        for (size_t i = 0; i < active_.size(); i++) {
+            auto slot = active_[i];
+            State& state = counters_[slot];
+            sample.paramid = ids[slot];
+            sample.payload.float64 = state.value();
+            state.reset();
+            if (!next_->put(sample)) {
+                // Reset remaining states to keep `active_` consistent
+                for (i++; i < active_.size(); i++) {
+                    counters_[active_[i]].reset();
                 }
+                active_.clear();
+                return false;
             }
         }
+        active_.clear();
         if (!next_->put(margin)) {
             return false;
         }
@@ -64,7 +75,15 @@ struct PAA : Node {
                 return false;
             }
         } else {
-            auto& state = counters_[sample.paramid];
+            auto slot = slots_->slot(sample.paramid);
+            if (slot >= counters_.size()) {
+                counters_.resize(slots_->size());
+            }
+            auto& state = counters_[slot];
+            if (!state.ready()) {
+                // First sample in the bucket
+                active_.push_back(slot);
+            }
             state.add(sample);
         }
         return true;
@@ -77,6 +96,13 @@ struct PAA : Node {
     virtual int get_requirements() const {
         return GROUP_BY_REQUIRED;
     }
+
+    virtual void set_slot_map(std::shared_ptr<SlotMap> slots) {
+        slots_ = slots;
+        counters_.clear();
+        counters_.resize(slots_->size());
+        active_.clear();
+    }
 };
 
 
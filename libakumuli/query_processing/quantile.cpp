@@ -0,0 +1,317 @@
+#include "quantile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+#include <boost/property_tree/ptree.hpp>
+
+namespace Akumuli {
+namespace QP {
+
+//                  //
+//     DDSketch     //
+//                  //
+
+DDSketch::Store::Store()
+    : offset(0)
+    , count(0u)
+{
+}
+
+void DDSketch::Store::add(int index, uint64_t n, size_t max_bins) {
+    count += n;
+    if (bins.empty()) {
+        offset = index;
+        bins.assign(1, n);
+        return;
+    }
+    int lo = offset;
+    int hi = offset + static_cast<int>(bins.size()) - 1;
+    if (index >= lo && index <= hi) {
+        bins[index - lo] += n;
+        return;
+    }
+    // Range should be extended, collapse lowest buckets if it's too wide
+    int new_lo = std::min(lo, index);
+    int new_hi = std::max(hi, index);
+    if (new_hi - new_lo + 1 > static_cast<int>(max_bins)) {
+        new_lo = new_hi - static_cast<int>(max_bins) + 1;
+    }
+    std::vector<uint64_t> tmp(new_hi - new_lo + 1, 0u);
+    for (int i = lo; i <= hi; i++) {
+        tmp[std::max(i, new_lo) - new_lo] += bins[i - lo];
+    }
+    tmp[std::max(index, new_lo) - new_lo] += n;
+    bins.swap(tmp);
+    offset = new_lo;
+}
+
+void DDSketch::Store::reset() {
+    bins.clear();
+    offset = 0;
+    count = 0u;
+}
+
+DDSketch::DDSketch(double accuracy, size_t max_bins)
+    : gamma_((1.0 + accuracy)/(1.0 - accuracy))
+    , log_gamma_(std::log(gamma_))
+    , max_bins_(max_bins)
+    , zero_count_(0u)
+    , min_(std::numeric_limits<double>::max())
+    , max_(std::numeric_limits<double>::lowest())
+{
+}
+
+int DDSketch::index(double value) const {
+    return static_cast<int>(std::ceil(std::log(value)/log_gamma_));
+}
+
+double DDSketch::bucket_value(int index) const {
+    // Middle of the bucket (relative error is the same for both bounds)
+    return 2.0*std::pow(gamma_, index)/(gamma_ + 1.0);
+}
+
+void DDSketch::add(double value) {
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+    if (value > std::numeric_limits<double>::min()) {
+        positive_.add(index(value), 1u, max_bins_);
+    } else if (value < -std::numeric_limits<double>::min()) {
+        negative_.add(index(-value), 1u, max_bins_);
+    } else {
+        zero_count_++;
+    }
+}
+
+void DDSketch::merge(DDSketch const& other) {
+    for (size_t i = 0; i < other.positive_.bins.size(); i++) {
+        if (other.positive_.bins[i]) {
+            positive_.add(other.positive_.offset + static_cast<int>(i), other.positive_.bins[i], max_bins_);
+        }
+    }
+    for (size_t i = 0; i < other.negative_.bins.size(); i++) {
+        if (other.negative_.bins[i]) {
+            negative_.add(other.negative_.offset + static_cast<int>(i), other.negative_.bins[i], max_bins_);
+        }
+    }
+    zero_count_ += other.zero_count_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+}
+
+uint64_t DDSketch::count() const {
+    return positive_.count + negative_.count + zero_count_;
+}
+
+double DDSketch::quantile(double q) const {
+    auto total = count();
+    if (total == 0) {
+        return NAN;
+    }
+    uint64_t rank = static_cast<uint64_t>(q*(total - 1));
+    double result;
+    if (rank < negative_.count) {
+        // Largest absolute values go first
+        uint64_t acc = 0;
+        int i = static_cast<int>(negative_.bins.size()) - 1;
+        for (; i > 0; i--) {
+            acc += negative_.bins[i];
+            if (acc > rank) {
+                break;
+            }
+        }
+        result = -bucket_value(negative_.offset + i);
+    } else if (rank < negative_.count + zero_count_) {
+        result = 0.0;
+    } else {
+        uint64_t acc = negative_.count + zero_count_;
+        size_t i = 0;
+        for (; i + 1 < positive_.bins.size(); i++) {
+            acc += positive_.bins[i];
+            if (acc > rank) {
+                break;
+            }
+        }
+        result = bucket_value(positive_.offset + static_cast<int>(i));
+    }
+    return std::max(min_, std::min(max_, result));
+}
+
+void DDSketch::reset() {
+    positive_.reset();
+    negative_.reset();
+    zero_count_ = 0u;
+    min_ = std::numeric_limits<double>::max();
+    max_ = std::numeric_limits<double>::lowest();
+}
+
+//                      //
+//     QuantileNode     //
+//                      //
+
+static const double DEFAULT_ACCURACY = 0.01;
+static const size_t DEFAULT_MAX_BINS = 2048;
+
+QuantileNode::QuantileNode(std::vector<double> quantiles, double accuracy, size_t max_bins, std::shared_ptr<Node> next)
+    : next_(next)
+    , slots_(std::make_shared<SlotMap>())
+    , quantiles_(quantiles)
+    , accuracy_(accuracy)
+    , max_bins_(max_bins)
+    , input_matcher_(nullptr)
+    , output_matcher_(1ul)
+{
+}
+
+QuantileNode::QuantileNode(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next)
+    : next_(next)
+    , slots_(std::make_shared<SlotMap>())
+    , input_matcher_(nullptr)
+    , output_matcher_(1ul)
+{
+    accuracy_ = ptree.get<double>("accuracy", DEFAULT_ACCURACY);
+    max_bins_ = ptree.get<size_t>("max-bins", DEFAULT_MAX_BINS);
+    if (accuracy_ <= 0.0 || accuracy_ >= 1.0) {
+        QueryParserError error("`accuracy` should be in (0, 1) range");
+        BOOST_THROW_EXCEPTION(error);
+    }
+    if (max_bins_ == 0) {
+        QueryParserError error("`max-bins` can't be 0");
+        BOOST_THROW_EXCEPTION(error);
+    }
+    auto qlist = ptree.get_child_optional("quantiles");
+    if (qlist) {
+        for (auto item: *qlist) {
+            double q = item.second.get_value<double>();
+            if (q < 0.0 || q > 1.0) {
+                QueryParserError error("quantile should be in [0, 1] range");
+                BOOST_THROW_EXCEPTION(error);
+            }
+            quantiles_.push_back(q);
+        }
+    }
+    if (quantiles_.empty()) {
+        quantiles_ = { 0.5, 0.9, 0.99, 0.999 };
+    }
+}
+
+bool QuantileNode::flush(aku_Sample const& margin) {
+    std::vector<uint32_t> nonempty;
+    for (uint32_t slot = 0; slot < sketches_.size(); slot++) {
+        if (sketches_[slot].count() != 0) {
+            nonempty.push_back(slot);
+        }
+    }
+    auto const& ids = slots_->ids_;
+    if (margin.payload.type == aku_PData::LO_MARGIN) {
+        // Moving in backward direction
+        std::sort(nonempty.begin(), nonempty.end(), [&ids](uint32_t lhs, uint32_t rhs) {
+            return ids[lhs] > ids[rhs];
+        });
+    } else {
+        // Moving forward
+        std::sort(nonempty.begin(), nonempty.end(), [&ids](uint32_t lhs, uint32_t rhs) {
+            return ids[lhs] < ids[rhs];
+        });
+    }
+    for (auto slot: nonempty) {
+        DDSketch& sketch = sketches_[slot];
+        for (size_t qix = 0; qix < quantiles_.size(); qix++) {
+            aku_Sample sample;
+            sample.paramid = output_id_(slot, qix);
+            sample.payload.float64 = sketch.quantile(quantiles_[qix]);
+            sample.payload.type = AKU_PAYLOAD_FLOAT;
+            sample.payload.size = sizeof(aku_Sample);
+            sample.timestamp = margin.timestamp;
+            if (!next_->put(sample)) {
+                return false;
+            }
+        }
+        sketch.reset();
+    }
+    return next_->put(margin);
+}
+
+void QuantileNode::complete() {
+    next_->complete();
+}
+
+bool QuantileNode::put(const aku_Sample &sample) {
+    if (sample.payload.type > aku_PData::MARGIN) {
+        return flush(sample);
+    }
+    if ((sample.payload.type&aku_PData::FLOAT_BIT) == 0) {
+        return true;
+    }
+    auto slot = slots_->slot(sample.paramid);
+    if (slot >= sketches_.size()) {
+        sketches_.resize(slots_->size(), DDSketch(accuracy_, max_bins_));
+    }
+    sketches_[slot].add(sample.payload.float64);
+    return true;
+}
+
+void QuantileNode::set_error(aku_Status status) {
+    next_->set_error(status);
+}
+
+int QuantileNode::get_requirements() const {
+    return GROUP_BY_REQUIRED;
+}
+
+void QuantileNode::set_slot_map(std::shared_ptr<SlotMap> slots) {
+    slots_ = slots;
+    sketches_.clear();
+    output_ids_.clear();
+}
+
+SeriesMatcher* QuantileNode::set_input_matcher(SeriesMatcher const* matcher) {
+    input_matcher_ = matcher;
+    // Input ids are passed through as is if series names are not available
+    return matcher ? &output_matcher_ : nullptr;
+}
+
+aku_ParamId QuantileNode::output_id_(uint32_t slot, size_t qix) {
+    auto id = slots_->id(slot);
+    if (input_matcher_ == nullptr) {
+        return id;
+    }
+    size_t ix = slot*quantiles_.size() + qix;
+    if (ix >= output_ids_.size()) {
+        output_ids_.resize((slot + 1)*quantiles_.size(), 0u);
+    }
+    if (output_ids_[ix] == 0) {
+        std::stringstream name;
+        auto sname = input_matcher_->id2str(id);
+        if (sname.first) {
+            name.write(sname.first, sname.second);
+        } else {
+            name << id;
+        }
+        name << " quantile=" << quantiles_[qix];
+        auto str = name.str();
+        // Quantile tag should be placed according to the series name ordering rules
+        char buffer[AKU_LIMITS_MAX_SNAME];
+        const char* begin = str.data();
+        const char* end = str.data() + str.size();
+        const char* keystr_begin = nullptr;
+        const char* keystr_end = nullptr;
+        if (SeriesParser::to_normal_form(begin, end, buffer, buffer + AKU_LIMITS_MAX_SNAME,
+                                         &keystr_begin, &keystr_end) == AKU_SUCCESS) {
+            begin = buffer;
+            end = keystr_end;
+        }
+        auto outid = output_matcher_.match(begin, end);
+        if (outid == 0) {
+            outid = output_matcher_.add(begin, end);
+        }
+        output_ids_[ix] = outid;
+    }
+    return output_ids_[ix];
+}
+
+static QueryParserToken<QuantileNode> quantile_token("quantile");
+
+}}  // namespace
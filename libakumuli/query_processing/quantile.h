@@ -0,0 +1,101 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "../queryprocessor_framework.h"
+
+namespace Akumuli {
+namespace QP {
+
+/** Mergeable quantile sketch with relative error guarantee (DDSketch).
+  * Values are counted in logarithmic buckets, bucket `i` covers
+  * (gamma^(i-1), gamma^i] range where gamma = (1 + accuracy)/(1 - accuracy).
+  * Number of buckets is bounded by `max_bins`, lowest buckets are collapsed
+  * when this limit is reached (only lowest quantiles lose accuracy).
+  */
+struct DDSketch {
+
+    //! Dense bucket store
+    struct Store {
+        std::vector<uint64_t> bins;
+        int                   offset;  //< Index of the first bucket
+        uint64_t              count;
+
+        Store();
+
+        void add(int index, uint64_t n, size_t max_bins);
+
+        void reset();
+    };
+
+    double   gamma_;
+    double   log_gamma_;
+    size_t   max_bins_;
+    Store    positive_;
+    Store    negative_;   //< Negative values are stored by absolute value
+    uint64_t zero_count_;
+    double   min_;
+    double   max_;
+
+    DDSketch(double accuracy, size_t max_bins);
+
+    void add(double value);
+
+    //! Merge other sketch (should have the same parameters) into this one
+    void merge(DDSketch const& other);
+
+    //! Get quantile estimate, `q` should be in [0, 1] range
+    double quantile(double q) const;
+
+    uint64_t count() const;
+
+    void reset();
+
+private:
+    int index(double value) const;
+    double bucket_value(int index) const;
+};
+
+
+/** Quantile sampler.
+  * Maintains quantile sketch per series per group-by-time bucket and emits
+  * one sample per requested quantile (by default p50, p90, p99 and p99.9,
+  * in this order) when bucket is closed. Every quantile is emitted as a separate
+  * series, quantile is added to the series name as a tag (`cpu host=A quantile=0.99`).
+  */
+struct QuantileNode : Node {
+    std::shared_ptr<Node> next_;
+    std::shared_ptr<SlotMap> slots_;
+    std::vector<DDSketch> sketches_;  //< Sketches indexed by slot
+    std::vector<double> quantiles_;
+    double accuracy_;
+    size_t max_bins_;
+    SeriesMatcher const* input_matcher_;  //< Resolves ids of the input series
+    SeriesMatcher output_matcher_;        //< Local string pool for the quantile series names
+    std::vector<aku_ParamId> output_ids_;  //< Output ids indexed by `slot*quantiles_.size() + quantile index`
+
+    QuantileNode(std::vector<double> quantiles, double accuracy, size_t max_bins, std::shared_ptr<Node> next);
+
+    QuantileNode(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next);
+
+    bool flush(aku_Sample const& margin);
+
+    virtual void complete();
+
+    virtual bool put(const aku_Sample &sample);
+
+    virtual void set_error(aku_Status status);
+
+    virtual int get_requirements() const;
+
+    virtual void set_slot_map(std::shared_ptr<SlotMap> slots);
+
+    virtual SeriesMatcher* set_input_matcher(SeriesMatcher const* matcher);
+
+private:
+    //! Get id of the series that holds quantile `qix` of the series in `slot`
+    aku_ParamId output_id_(uint32_t slot, size_t qix);
+};
+
+}}  // namespace
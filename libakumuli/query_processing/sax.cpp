@@ -5,9 +5,11 @@ namespace QP {
 
 SAXNode::SAXNode(int alphabet_size, int window_width, bool disable_original_value, std::shared_ptr<Node> next)
     : next_(next)
+    , slots_(std::make_shared<SlotMap>())
     , window_width_(window_width)
     , alphabet_size_(alphabet_size)
     , disable_value_(disable_original_value)
+    , inverse_(false)
 {
     if (alphabet_size_ > 20 || alphabet_size_ < 1) {
         QueryParserError err("`alphabet_size` should be in [1, 20] range");
@@ -21,6 +23,8 @@ SAXNode::SAXNode(int alphabet_size, int window_width, bool disable_original_valu
 
 SAXNode::SAXNode(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next)
     : next_(next)
+    , slots_(std::make_shared<SlotMap>())
+    , inverse_(false)
 {
     alphabet_size_ = ptree.get<int>("alphabet_size");
     window_width_  = ptree.get<int>("window_width");
@@ -43,11 +47,9 @@ bool SAXNode::put(const aku_Sample &sample) {
     if (sample.payload.type > aku_PData::MARGIN) {
         return true;
     }
-    SAX::SAXWord word;
-    auto it = encoders_.find(sample.paramid);
-    if (it == encoders_.end()) {
-        encoders_[sample.paramid] = SAX::SAXEncoder(alphabet_size_, window_width_);
-        it = encoders_.find(sample.paramid);
+    auto slot = slots_->slot(sample.paramid);
+    if (slot >= encoders_.size()) {
+        encoders_.resize(slots_->size(), SAX::SAXEncoder(alphabet_size_, window_width_));
     }
     size_t ssize = sizeof(aku_Sample) + window_width_;
     void* ptr = alloca(ssize);
@@ -58,7 +60,7 @@ bool SAXNode::put(const aku_Sample &sample) {
     if (disable_value_) {
         psample->payload.type &= ~aku_PData::FLOAT_BIT;
     }
-    if (it->second.encode(sample.payload.float64, psample->payload.data, window_width_)) {
+    if (encoders_[slot].encode(sample.payload.float64, psample->payload.data, window_width_)) {
         if (inverse_) {
             std::reverse(psample->payload.data, psample->payload.data + window_width_);
         }
@@ -75,6 +77,11 @@ int SAXNode::get_requirements() const {
     return GROUP_BY_REQUIRED;
 }
 
+void SAXNode::set_slot_map(std::shared_ptr<SlotMap> slots) {
+    slots_ = slots;
+    encoders_.clear();
+}
+
 static QueryParserToken<SAXNode> sax_token("sax");
 
 }}  // namespace
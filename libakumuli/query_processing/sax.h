@@ -1,7 +1,7 @@
 #pragma once
 
 #include <memory>
-#include <unordered_map>
+#include <vector>
 
 #include "../queryprocessor_framework.h"
 #include "../saxencoder.h"
@@ -17,7 +17,8 @@ namespace QP {
 struct SAXNode : Node {
 
     std::shared_ptr<Node> next_;
-    std::unordered_map<aku_ParamId, SAX::SAXEncoder> encoders_;
+    std::shared_ptr<SlotMap> slots_;
+    std::vector<SAX::SAXEncoder> encoders_;  //< Encoders indexed by slot
     int window_width_;
     int alphabet_size_;
     bool disable_value_;
@@ -34,6 +35,8 @@ struct SAXNode : Node {
     virtual void set_error(aku_Status status);
 
     virtual int get_requirements() const;
+
+    virtual void set_slot_map(std::shared_ptr<SlotMap> slots);
 };
 
 }}  // namespace
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <memory>
-#include <unordered_map>
+#include <vector>
 
 #include "../queryprocessor_framework.h"
 
@@ -15,9 +15,14 @@ struct SpaceSaver : Node {
     struct Item {
         double count;
         double error;
+        uint32_t slot;
     };
 
-    std::unordered_map<aku_ParamId, Item> counters_;
+    std::shared_ptr<SlotMap> slots_;
+    //! Monitored items (at most M)
+    std::vector<Item> counters_;
+    //! Slot -> position in `counters_` plus one (zero if item is not monitored)
+    std::vector<uint32_t> index_;
     //! Capacity
     double N;
     size_t M;
@@ -31,6 +36,7 @@ struct SpaceSaver : Node {
       */
     SpaceSaver(double error, double portion, std::shared_ptr<Node> next)
         : next_(next)
+        , slots_(std::make_shared<SlotMap>())
         , N(0)
         , M(ceil(1.0/error))
         , P(portion)  // between 0 and 1
@@ -41,6 +47,8 @@ struct SpaceSaver : Node {
 
     SpaceSaver(boost::property_tree::ptree const& ptree, std::shared_ptr<Node> next)
         : next_(next)
+        , slots_(std::make_shared<SlotMap>())
+        , N(0)
     {
         double error = ptree.get<double>("error");
         double portion = ptree.get<double>("portion");
@@ -63,13 +71,13 @@ struct SpaceSaver : Node {
     bool count() {
         std::vector<aku_Sample> samples;
         auto support = N*P;
-        for (auto it: counters_) {
-            auto estimate = it.second.count - it.second.error;
+        for (auto const& item: counters_) {
+            auto estimate = item.count - item.error;
             if (support < estimate) {
                 aku_Sample s;
-                s.paramid = it.first;
+                s.paramid = slots_->id(item.slot);
                 s.payload.type = aku_PData::PARAMID_BIT|aku_PData::FLOAT_BIT;
-                s.payload.float64 = it.second.count;
+                s.payload.float64 = item.count;
                 s.payload.size = sizeof(aku_Sample);
                 samples.push_back(s);
             }
@@ -82,6 +90,9 @@ struct SpaceSaver : Node {
                 return false;
             }
         }
+        for (auto const& item: counters_) {
+            index_[item.slot] = 0;
+        }
         counters_.clear();
         return true;
     }
@@ -100,31 +111,38 @@ struct SpaceSaver : Node {
                 return true;
             }
         }
-        auto id = sample.paramid;
+        auto slot = slots_->slot(sample.paramid);
+        if (slot >= index_.size()) {
+            index_.resize(slots_->size(), 0);
+        }
         auto weight = weighted ? sample.payload.float64 : 1.0;
-        auto it = counters_.find(id);
-        if (it == counters_.end()) {
+        auto pos = index_[slot];
+        if (pos == 0) {
             // new element
             double count = weight;
             double error = 0;
             if (counters_.size() == M) {
-                // remove element with smallest count
+                // replace element with smallest count
                 size_t min = std::numeric_limits<size_t>::max();
-                auto min_iter = it;
-                for (auto i = counters_.begin(); i != counters_.end(); i++) {
-                    if (i->second.count < min) {
-                        min_iter = i;
-                        min = i->second.count;
+                size_t min_pos = 0;
+                for (size_t i = 0; i < counters_.size(); i++) {
+                    if (counters_[i].count < min) {
+                        min_pos = i;
+                        min = counters_[i].count;
                     }
                 }
-                counters_.erase(min_iter);
                 count += min;
                 error  = min;
+                index_[counters_[min_pos].slot] = 0;
+                counters_[min_pos] = { count, error, slot };
+                index_[slot] = static_cast<uint32_t>(min_pos + 1);
+            } else {
+                counters_.push_back({ count, error, slot });
+                index_[slot] = static_cast<uint32_t>(counters_.size());
             }
-            counters_[id] = { count, error };
         } else {
             // increment
-            it->second.count += weight;
+            counters_[pos - 1].count += weight;
         }
         N += weight;
         return true;
@@ -137,6 +155,12 @@ struct SpaceSaver : Node {
     virtual int get_requirements() const {
         return EMPTY|TERMINAL;
     }
+
+    virtual void set_slot_map(std::shared_ptr<SlotMap> slots) {
+        slots_ = slots;
+        counters_.clear();
+        index_.clear();
+    }
 };
 
 }}  // namespace
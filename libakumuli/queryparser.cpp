@@ -0,0 +1,557 @@
+/**
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "queryparser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/exception/all.hpp>
+
+namespace Akumuli {
+namespace QP {
+
+//                    //
+//     JsonReader     //
+//                    //
+
+JsonReader::JsonReader(const char* begin, const char* end)
+    : begin_(begin)
+    , pos_(begin)
+    , end_(end)
+    , text_(std::make_pair(begin, 0))
+    , value_expected_(false)
+    , done_(false)
+{
+}
+
+void JsonReader::error(const char* msg) const {
+    std::stringstream fmt;
+    fmt << "invalid query, " << msg << " at position " << (pos_ - begin_);
+    QueryParserError err(fmt.str().c_str());
+    BOOST_THROW_EXCEPTION(err);
+}
+
+void JsonReader::skip_ws() {
+    while (pos_ < end_ && (*pos_ == ' ' || *pos_ == '\n' || *pos_ == '\r' || *pos_ == '\t')) {
+        pos_++;
+    }
+}
+
+void JsonReader::value_done() {
+    if (stack_.empty()) {
+        done_ = true;
+    }
+}
+
+JsonReader::Token JsonReader::next() {
+    skip_ws();
+    if (!stack_.empty() && !value_expected_) {
+        Frame& top = stack_.back();
+        char close = top.type == '{' ? '}' : ']';
+        if (pos_ < end_ && *pos_ == close) {
+            pos_++;
+            stack_.pop_back();
+            value_done();
+            return close == '}' ? OBJECT_END : ARRAY_END;
+        }
+        if (top.nonempty) {
+            if (pos_ == end_ || *pos_ != ',') {
+                error("',' expected");
+            }
+            pos_++;
+            skip_ws();
+        }
+        top.nonempty = true;
+        if (top.type == '{') {
+            if (pos_ == end_ || *pos_ != '"') {
+                error("object key expected");
+            }
+            read_string();
+            skip_ws();
+            if (pos_ == end_ || *pos_ != ':') {
+                error("':' expected");
+            }
+            pos_++;
+            value_expected_ = true;
+            return KEY;
+        }
+    } else if (done_) {
+        if (pos_ != end_) {
+            error("unexpected data after the end of the query");
+        }
+        return END;
+    }
+    value_expected_ = false;
+    if (pos_ == end_) {
+        error("unexpected end of the query");
+    }
+    switch (*pos_) {
+    case '{':
+        pos_++;
+        stack_.push_back({'{', false});
+        return OBJECT_BEGIN;
+    case '[':
+        pos_++;
+        stack_.push_back({'[', false});
+        return ARRAY_BEGIN;
+    case '"':
+        read_string();
+        value_done();
+        return STRING;
+    case 't':
+    case 'f':
+    case 'n':
+        read_literal();
+        value_done();
+        return LITERAL;
+    default:
+        read_number();
+        value_done();
+        return NUMBER;
+    };
+}
+
+static bool parse_hex4(const char* p, const char* end, uint32_t* out) {
+    if (end - p < 4) {
+        return false;
+    }
+    uint32_t result = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        result <<= 4;
+        if (c >= '0' && c <= '9') {
+            result |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            result |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            result |= c - 'A' + 10;
+        } else {
+            return false;
+        }
+    }
+    *out = result;
+    return true;
+}
+
+static void append_utf8(uint32_t cp, std::string* out) {
+    if (cp < 0x80) {
+        out->push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+        out->push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out->push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else {
+        out->push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        out->push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+}
+
+void JsonReader::read_string() {
+    const char* start = ++pos_;
+    while (pos_ < end_ && *pos_ != '"' && *pos_ != '\\') {
+        pos_++;
+    }
+    if (pos_ == end_) {
+        error("unterminated string");
+    }
+    if (*pos_ == '"') {
+        // Fast path, string can be used as is
+        text_ = std::make_pair(start, static_cast<int>(pos_ - start));
+        pos_++;
+        return;
+    }
+    buffer_.assign(start, pos_);
+    while (true) {
+        if (pos_ == end_) {
+            error("unterminated string");
+        }
+        char c = *pos_++;
+        if (c == '"') {
+            break;
+        }
+        if (c != '\\') {
+            buffer_.push_back(c);
+            continue;
+        }
+        if (pos_ == end_) {
+            error("unterminated string");
+        }
+        c = *pos_++;
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+            buffer_.push_back(c);
+            break;
+        case 'b':
+            buffer_.push_back('\b');
+            break;
+        case 'f':
+            buffer_.push_back('\f');
+            break;
+        case 'n':
+            buffer_.push_back('\n');
+            break;
+        case 'r':
+            buffer_.push_back('\r');
+            break;
+        case 't':
+            buffer_.push_back('\t');
+            break;
+        case 'u': {
+            uint32_t cp;
+            if (!parse_hex4(pos_, end_, &cp)) {
+                error("invalid escape sequence");
+            }
+            pos_ += 4;
+            if (cp >= 0xD800 && cp < 0xDC00) {
+                // Surrogate pair
+                uint32_t low;
+                if (end_ - pos_ < 2 || pos_[0] != '\\' || pos_[1] != 'u'
+                    || !parse_hex4(pos_ + 2, end_, &low) || low < 0xDC00 || low > 0xDFFF)
+                {
+                    error("invalid surrogate pair");
+                }
+                pos_ += 6;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            }
+            append_utf8(cp, &buffer_);
+            break;
+        }
+        default:
+            error("invalid escape sequence");
+        };
+    }
+    text_ = std::make_pair(buffer_.data(), static_cast<int>(buffer_.size()));
+}
+
+void JsonReader::read_number() {
+    const char* start = pos_;
+    bool has_digits = false;
+    while (pos_ < end_) {
+        char c = *pos_;
+        if (c >= '0' && c <= '9') {
+            has_digits = true;
+        } else if (c != '-' && c != '+' && c != '.' && c != 'e' && c != 'E') {
+            break;
+        }
+        pos_++;
+    }
+    if (!has_digits) {
+        error("unexpected character");
+    }
+    text_ = std::make_pair(start, static_cast<int>(pos_ - start));
+}
+
+void JsonReader::read_literal() {
+    static const char* literals[] = { "true", "false", "null" };
+    for (auto lit: literals) {
+        size_t len = strlen(lit);
+        if (static_cast<size_t>(end_ - pos_) >= len && memcmp(pos_, lit, len) == 0) {
+            text_ = std::make_pair(pos_, static_cast<int>(len));
+            pos_ += len;
+            return;
+        }
+    }
+    error("unexpected character");
+}
+
+JsonReader::StringT JsonReader::text() const {
+    return text_;
+}
+
+std::string JsonReader::str() const {
+    return std::string(text_.first, text_.first + text_.second);
+}
+
+bool JsonReader::equals(const char* str) const {
+    size_t len = strlen(str);
+    return static_cast<size_t>(text_.second) == len && memcmp(text_.first, str, len) == 0;
+}
+
+void JsonReader::skip(Token token) {
+    if (token != OBJECT_BEGIN && token != ARRAY_BEGIN) {
+        return;
+    }
+    int depth = 1;
+    while (depth) {
+        switch (next()) {
+        case OBJECT_BEGIN:
+        case ARRAY_BEGIN:
+            depth++;
+            break;
+        case OBJECT_END:
+        case ARRAY_END:
+            depth--;
+            break;
+        default:
+            break;
+        };
+    }
+}
+
+static void write_json_string(JsonReader::StringT str, std::string* out) {
+    static const char* hex = "0123456789abcdef";
+    out->push_back('"');
+    for (int i = 0; i < str.second; i++) {
+        char c = str.first[i];
+        if (c == '"' || c == '\\') {
+            out->push_back('\\');
+            out->push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out->append("\\u00");
+            out->push_back(hex[(c >> 4) & 0xF]);
+            out->push_back(hex[c & 0xF]);
+        } else {
+            out->push_back(c);
+        }
+    }
+    out->push_back('"');
+}
+
+static void write_canonical(JsonReader& reader, JsonReader::Token token, std::string* out) {
+    switch (token) {
+    case JsonReader::OBJECT_BEGIN: {
+        // Key and value of every member, array elements keep their order
+        std::vector<std::pair<std::string, std::string>> members;
+        for (token = reader.next(); token != JsonReader::OBJECT_END; token = reader.next()) {
+            members.emplace_back();
+            write_json_string(reader.text(), &members.back().first);
+            write_canonical(reader, reader.next(), &members.back().second);
+        }
+        std::stable_sort(members.begin(), members.end(),
+                         [](std::pair<std::string, std::string> const& lhs,
+                            std::pair<std::string, std::string> const& rhs) {
+            return lhs.first < rhs.first;
+        });
+        out->push_back('{');
+        for (size_t i = 0; i < members.size(); i++) {
+            if (i) {
+                out->push_back(',');
+            }
+            out->append(members[i].first);
+            out->push_back(':');
+            out->append(members[i].second);
+        }
+        out->push_back('}');
+        break;
+    }
+    case JsonReader::ARRAY_BEGIN: {
+        out->push_back('[');
+        bool first = true;
+        for (token = reader.next(); token != JsonReader::ARRAY_END; token = reader.next()) {
+            if (!first) {
+                out->push_back(',');
+            }
+            first = false;
+            write_canonical(reader, token, out);
+        }
+        out->push_back(']');
+        break;
+    }
+    case JsonReader::STRING:
+        write_json_string(reader.text(), out);
+        break;
+    default: {
+        auto text = reader.text();
+        out->append(text.first, text.first + text.second);
+        break;
+    }
+    };
+}
+
+std::string canonical_json(const char* begin, const char* end) {
+    std::string result;
+    JsonReader reader(begin, end);
+    write_canonical(reader, reader.next(), &result);
+    reader.next();  // check that nothing follows the document
+    return result;
+}
+
+//                  //
+//     QueryAST     //
+//                  //
+
+QueryAST::QueryAST()
+    : has_sample(false)
+    , limit(0u)
+    , offset(0u)
+{
+}
+
+static void type_error(const char* name, const char* type) {
+    std::stringstream fmt;
+    fmt << "`" << name << "` should be " << type;
+    QueryParserError err(fmt.str().c_str());
+    BOOST_THROW_EXCEPTION(err);
+}
+
+static bool is_scalar(JsonReader::Token token) {
+    return token == JsonReader::STRING || token == JsonReader::NUMBER || token == JsonReader::LITERAL;
+}
+
+static std::string read_scalar(JsonReader& reader, const char* name) {
+    if (!is_scalar(reader.next())) {
+        type_error(name, "a string");
+    }
+    return reader.str();
+}
+
+static uint64_t read_uint(JsonReader& reader, const char* name) {
+    auto str = read_scalar(reader, name);
+    if (!str.empty() && str.front() == '-') {
+        // lexical_cast wraps negative values around
+        type_error(name, "a non-negative integer");
+    }
+    try {
+        return boost::lexical_cast<uint64_t>(str);
+    } catch (boost::bad_lexical_cast const&) {
+        type_error(name, "a non-negative integer");
+    }
+    return 0u;
+}
+
+//! Read scalar or list of scalars
+static void read_list(JsonReader& reader, const char* name, std::vector<std::string>* out) {
+    auto token = reader.next();
+    if (is_scalar(token)) {
+        out->push_back(reader.str());
+        return;
+    }
+    if (token != JsonReader::ARRAY_BEGIN) {
+        type_error(name, "a list");
+    }
+    for (token = reader.next(); token != JsonReader::ARRAY_END; token = reader.next()) {
+        if (!is_scalar(token)) {
+            type_error(name, "a list of strings");
+        }
+        out->push_back(reader.str());
+    }
+}
+
+static void expect_object(JsonReader& reader, const char* name) {
+    if (reader.next() != JsonReader::OBJECT_BEGIN) {
+        type_error(name, "an object");
+    }
+}
+
+//! Read value that starts with `token` into property tree (same layout as json_parser produces)
+static void read_ptree(JsonReader& reader, JsonReader::Token token, boost::property_tree::ptree* out) {
+    if (token == JsonReader::OBJECT_BEGIN) {
+        for (token = reader.next(); token != JsonReader::OBJECT_END; token = reader.next()) {
+            auto key = reader.str();
+            boost::property_tree::ptree child;
+            read_ptree(reader, reader.next(), &child);
+            out->push_back(std::make_pair(key, child));
+        }
+    } else if (token == JsonReader::ARRAY_BEGIN) {
+        for (token = reader.next(); token != JsonReader::ARRAY_END; token = reader.next()) {
+            boost::property_tree::ptree child;
+            read_ptree(reader, token, &child);
+            out->push_back(std::make_pair(std::string(), child));
+        }
+    } else {
+        out->put_value(reader.str());
+    }
+}
+
+QueryAST QueryAST::parse(const char* begin, const char* end) {
+    typedef JsonReader R;
+    QueryAST ast;
+    R reader(begin, end);
+    if (reader.next() != R::OBJECT_BEGIN) {
+        QueryParserError err("query should be a JSON object");
+        BOOST_THROW_EXCEPTION(err);
+    }
+    for (auto token = reader.next(); token != R::OBJECT_END; token = reader.next()) {
+        if (reader.equals("metric")) {
+            ast.metric = read_scalar(reader, "metric");
+        } else if (reader.equals("select")) {
+            ast.select = read_scalar(reader, "select");
+        } else if (reader.equals("range")) {
+            expect_object(reader, "range");
+            for (token = reader.next(); token != R::OBJECT_END; token = reader.next()) {
+                if (reader.equals("from")) {
+                    ast.range_from = read_scalar(reader, "from");
+                } else if (reader.equals("to")) {
+                    ast.range_to = read_scalar(reader, "to");
+                } else {
+                    reader.skip(reader.next());
+                }
+            }
+        } else if (reader.equals("where")) {
+            expect_object(reader, "where");
+            for (token = reader.next(); token != R::OBJECT_END; token = reader.next()) {
+                ast.where.emplace_back();
+                auto& item = ast.where.back();
+                item.first = reader.str();
+                read_list(reader, "where", &item.second);
+            }
+        } else if (reader.equals("group-by")) {
+            expect_object(reader, "group-by");
+            for (token = reader.next(); token != R::OBJECT_END; token = reader.next()) {
+                if (reader.equals("time")) {
+                    ast.groupby_time = read_scalar(reader, "time");
+                } else if (reader.equals("tag")) {
+                    read_list(reader, "tag", &ast.groupby_tags);
+                } else {
+                    reader.skip(reader.next());
+                }
+            }
+        } else if (reader.equals("sample")) {
+            ast.has_sample = true;
+            token = reader.next();
+            if (token == R::ARRAY_BEGIN) {
+                for (token = reader.next(); token != R::ARRAY_END; token = reader.next()) {
+                    ast.samplers.emplace_back();
+                    read_ptree(reader, token, &ast.samplers.back());
+                }
+            } else if (token == R::OBJECT_BEGIN) {
+                ast.samplers.emplace_back();
+                read_ptree(reader, token, &ast.samplers.back());
+            }
+        } else if (reader.equals("limit")) {
+            ast.limit = read_uint(reader, "limit");
+        } else if (reader.equals("offset")) {
+            ast.offset = read_uint(reader, "offset");
+        } else if (reader.equals("output")) {
+            expect_object(reader, "output");
+            for (token = reader.next(); token != R::OBJECT_END; token = reader.next()) {
+                if (reader.equals("format")) {
+                    ast.output_format = read_scalar(reader, "format");
+                } else if (reader.equals("timestamp")) {
+                    ast.output_timestamp = read_scalar(reader, "timestamp");
+                } else {
+                    reader.skip(reader.next());
+                }
+            }
+        } else {
+            reader.skip(reader.next());
+        }
+    }
+    reader.next();  // check that nothing follows the query
+    return ast;
+}
+
+}}  // namespace
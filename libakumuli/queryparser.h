@@ -0,0 +1,139 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Streaming query parser.
+ *
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/optional.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "queryprocessor_framework.h"
+
+namespace Akumuli {
+namespace QP {
+
+/** Streaming JSON tokenizer.
+  * Reads tokens directly from the input without building a tree. Strings
+  * without escape sequences are returned as pointers into the input, escaped
+  * strings are decoded into internal buffer (valid until the next token).
+  * Malformed input triggers QueryParserError.
+  */
+struct JsonReader {
+
+    typedef std::pair<const char*, int> StringT;
+
+    enum Token {
+        OBJECT_BEGIN,
+        OBJECT_END,
+        ARRAY_BEGIN,
+        ARRAY_END,
+        KEY,            //< Object key (colon is consumed)
+        STRING,
+        NUMBER,
+        LITERAL,        //< true, false or null
+        END,            //< End of input
+    };
+
+    JsonReader(const char* begin, const char* end);
+
+    //! Read next token
+    Token next();
+
+    //! Text of the last KEY, STRING, NUMBER or LITERAL token
+    StringT text() const;
+
+    //! Copy of the text of the last token
+    std::string str() const;
+
+    //! Skip value that starts with `token`
+    void skip(Token token);
+
+    //! Check that text of the last token is equal to `str`
+    bool equals(const char* str) const;
+
+private:
+    struct Frame {
+        char type;      //< '{' or '['
+        bool nonempty;  //< At least one item was read
+    };
+
+    const char*         begin_;
+    const char*         pos_;
+    const char*         end_;
+    StringT             text_;
+    std::string         buffer_;           //< Decoded string
+    std::vector<Frame>  stack_;
+    bool                value_expected_;   //< Key was read, value should follow
+    bool                done_;             //< Top level value was read
+
+    void skip_ws();
+    void read_string();
+    void read_number();
+    void read_literal();
+    void value_done();
+    void error(const char* msg) const;
+};
+
+
+/** Convert JSON document to canonical form (object keys sorted, no whitespaces).
+  * Scalars are copied as written, so `10` and `"10"` stay different.
+  * @throw QueryParserError if document is malformed
+  */
+std::string canonical_json(const char* begin, const char* end);
+
+
+/** Typed representation of the query.
+  * Produced by single pass over the query string. Sampler descriptions are
+  * small and are stored as property trees since processing nodes are created
+  * from them.
+  */
+struct QueryAST {
+    boost::optional<std::string>                metric;
+    boost::optional<std::string>                select;
+    boost::optional<std::string>                range_from;
+    boost::optional<std::string>                range_to;
+    //! `where` clause, every tag should match one of the values
+    std::vector<std::pair<std::string, std::vector<std::string>>> where;
+    //! Group-by time step as written in the query
+    boost::optional<std::string>                groupby_time;
+    std::vector<std::string>                    groupby_tags;
+    //! Set if `sample` statement present
+    bool                                        has_sample;
+    std::vector<boost::property_tree::ptree>    samplers;
+    uint64_t                                    limit;
+    uint64_t                                    offset;
+    boost::optional<std::string>                output_format;
+    boost::optional<std::string>                output_timestamp;
+
+    QueryAST();
+
+    /** Parse query.
+      * @param begin points to the beginning of the query string
+      * @param end points to the end of the query string
+      * @throw QueryParserError if query is malformed
+      */
+    static QueryAST parse(const char* begin, const char* end);
+};
+
+}}  // namespace
@@ -19,15 +19,17 @@
 #include "datetime.h"
 #include "anomalydetector.h"
 #include "saxencoder.h"
+#include "queryparser.h"
+#include "tracing.h"
 
 #include <random>
 #include <algorithm>
 #include <unordered_set>
 #include <set>
+#include <map>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
 #include <boost/exception/diagnostic_information.hpp>
 
 // Include query processors
@@ -63,44 +65,47 @@ static std::shared_ptr<Node> make_sampler(boost::property_tree::ptree const& ptr
 
 
 
-struct RegexFilter : IQueryFilter {
-    std::string regex_;
-    std::unordered_set<aku_ParamId> ids_;
-    StringPool const& spool_;
-    StringPoolOffset offset_;
+/** Series filter that uses tag index.
+  * Filter is refreshed when new series is added to the index.
+  */
+struct TagFilter : IQueryFilter {
+    TagIndex::Query query_;
+    SlotMap ids_;
+    TagIndex const& index_;
+    uint64_t next_id_;  //< Ids below this one are already processed
     size_t prev_size_;
 
-    RegexFilter(std::string regex, StringPool const& spool)
-        : regex_(regex)
-        , spool_(spool)
-        , offset_{}
+    TagFilter(TagIndex::Query query, TagIndex const& index)
+        : query_(query)
+        , index_(index)
+        , next_id_(0ul)
         , prev_size_(0ul)
     {
         refresh();
     }
 
     void refresh() {
-        std::vector<StringPool::StringT> results = spool_.regex_match(regex_.c_str(), &offset_, &prev_size_);
-        int ix = 0;
-        for (StringPool::StringT item: results) {
-            auto id = StringTools::extract_id_from_pool(item);
-            ids_.insert(id);
-            ix++;
+        prev_size_ = index_.size();
+        auto results = index_.query(query_, &next_id_);
+        if (ids_.size() == 0) {
+            ids_ = SlotMap(results);
+        } else {
+            for (auto id: results) {
+                ids_.slot(id);
+            }
         }
     }
 
     virtual std::vector<aku_ParamId> get_ids() {
-        std::vector<aku_ParamId> result;
-        std::copy(ids_.begin(), ids_.end(), std::back_inserter(result));
-        return result;
+        return ids_.ids_;
     }
 
     virtual FilterResult apply(aku_ParamId id) {
         // Atomic operation, can be a source of contention
-        if (spool_.size() != prev_size_) {
+        if (index_.size() != prev_size_) {
             refresh();
         }
-        return ids_.count(id) != 0 ? PROCESS : SKIP_THIS;
+        return ids_.find(id) != SlotMap::NO_SLOT ? PROCESS : SKIP_THIS;
     }
 };
 
@@ -174,36 +179,34 @@ bool GroupByTime::empty() const {
 }
 
 //  GroupByTag  //
-GroupByTag::GroupByTag(StringPool const* spool, std::string metric, std::vector<std::string> const& tags)
-    : spool_(spool)
-    , offset_{0}
+GroupByTag::GroupByTag(SeriesMatcher const* matcher, std::string metric, std::vector<std::string> const& tags)
+    : matcher_(matcher)
+    , next_id_(0)
     , prev_size_(0)
     , tags_(tags)
     , local_matcher_(1ul)
     , snames_(StringTools::create_set(64))
 {
     std::sort(tags_.begin(), tags_.end());
-    // Build regexp
-    std::stringstream series_regexp;
-    //cpu(?:\s\w+=\w+)* (?:\s\w+=\w+)*\s hash=\w+ (?:\s\w+=\w+)*
-    series_regexp << metric << "(?:\\s\\w+=\\w+)*";
-    for (auto tag: tags) {
-        series_regexp << "(?:\\s\\w+=\\w+)*\\s" << tag << "=\\w+";
-    }
-    series_regexp << "(?:\\s\\w+=\\w+)*";
-    regex_ = series_regexp.str();
+    // Series should have metric name and all tags from the list
+    query_.metric = metric;
+    query_.tags = tags_;
     refresh_();
 }
 
 void GroupByTag::refresh_() {
-    std::vector<StringPool::StringT> results = spool_->regex_match(regex_.c_str(), &offset_, &prev_size_);
+    prev_size_ = matcher_->index.size();
+    auto results = matcher_->index.query(query_, &next_id_);
     auto filter = StringTools::create_set(tags_.size());
     for (const auto& tag: tags_) {
         filter.insert(std::make_pair(tag.data(), tag.size()));
     }
     char buffer[AKU_LIMITS_MAX_SNAME];
-    for (StringPool::StringT item: results) {
-        auto id = StringTools::extract_id_from_pool(item);
+    for (auto id: results) {
+        StringPool::StringT item = matcher_->id2str(id);
+        if (item.first == nullptr) {
+            continue;
+        }
         aku_Status status;
         SeriesParser::StringT result;
         std::tie(status, result) = SeriesParser::filter_tags(item, filter, buffer);
@@ -213,31 +216,46 @@ void GroupByTag::refresh_() {
                 auto localid = local_matcher_.add(result.first, result.first + result.second);
                 auto str = local_matcher_.id2str(localid);
                 snames_.insert(str);
-                ids_[id] = localid;
+                set_local_id_(id, localid);
             } else {
                 // local name already created
                 auto localid = local_matcher_.match(result.first, result.first + result.second);
                 if (localid == 0ul) {
                     AKU_PANIC("inconsistent matcher state");
                 }
-                ids_[id] = localid;
+                set_local_id_(id, localid);
             }
         }
     }
 }
 
 bool GroupByTag::apply(aku_Sample* sample) {
-    if (spool_->size() != prev_size_) {
+    if (matcher_->index.size() != prev_size_) {
         refresh_();
     }
-    auto it = ids_.find(sample->paramid);
-    if (it != ids_.end()) {
-        sample->paramid = it->second;
+    auto slot = slots_.find(sample->paramid);
+    if (slot != SlotMap::NO_SLOT) {
+        sample->paramid = local_ids_[slot];
         return true;
     }
     return false;
 }
 
+void GroupByTag::set_local_id_(aku_ParamId id, aku_ParamId localid) {
+    auto slot = slots_.slot(id);
+    if (slot >= local_ids_.size()) {
+        local_ids_.resize(slot + 1);
+    }
+    local_ids_[slot] = localid;
+}
+
+std::vector<aku_ParamId> GroupByTag::get_ids() const {
+    std::vector<aku_ParamId> result(local_ids_);
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
 
 //  ScanQueryProcessor  //
 
@@ -247,7 +265,8 @@ ScanQueryProcessor::ScanQueryProcessor(std::vector<std::shared_ptr<Node>> nodes,
                                        aku_Timestamp end,
                                        std::shared_ptr<IQueryFilter> filter,
                                        GroupByTime groupby,
-                                       std::unique_ptr<GroupByTag> groupbytag
+                                       std::unique_ptr<GroupByTag> groupbytag,
+                                       SeriesMatcher const* matcher
                                        )
     : lowerbound_(std::min(begin, end))
     , upperbound_(std::max(begin, end))
@@ -257,6 +276,7 @@ ScanQueryProcessor::ScanQueryProcessor(std::vector<std::shared_ptr<Node>> nodes,
     , groupby_(groupby)
     , filter_(filter)
     , groupby_tag_(std::move(groupbytag))
+    , output_matcher_(nullptr)
 {
     if (nodes.empty()) {
         AKU_PANIC("`nodes` shouldn't be empty")
@@ -264,6 +284,21 @@ ScanQueryProcessor::ScanQueryProcessor(std::vector<std::shared_ptr<Node>> nodes,
 
     root_node_ = nodes.front();
     last_node_ = nodes.back();
+    nodes_ = nodes;
+
+    // Output ids can be replaced by group-by-tag and by processing nodes
+    SeriesMatcher const* input = matcher;
+    if (groupby_tag_) {
+        output_matcher_ = &groupby_tag_->local_matcher_;
+        input = output_matcher_;
+    }
+    for (auto const& node: nodes_) {
+        auto node_matcher = node->set_input_matcher(input);
+        if (node_matcher) {
+            output_matcher_ = node_matcher;
+            input = node_matcher;
+        }
+    }
 
     // validate query processor data
     if (groupby_.empty()) {
@@ -293,13 +328,22 @@ IQueryFilter& ScanQueryProcessor::filter() {
 }
 
 SeriesMatcher* ScanQueryProcessor::matcher() {
-    if (groupby_tag_) {
-        return &groupby_tag_->local_matcher_;
-    }
-    return nullptr;
+    return output_matcher_;
 }
 
 bool ScanQueryProcessor::start() {
+    // Processing nodes store per-series state in arrays indexed by slot,
+    // all ids that can be seen at this point get consecutive slots.
+    std::vector<aku_ParamId> ids;
+    if (groupby_tag_) {
+        ids = groupby_tag_->get_ids();
+    } else {
+        ids = filter_->get_ids();
+    }
+    auto slots = std::make_shared<SlotMap>(ids);
+    for (auto const& node: nodes_) {
+        node->set_slot_map(slots);
+    }
     return true;
 }
 
@@ -338,6 +382,133 @@ int ScanQueryProcessor::direction() const {
     return direction_;
 }
 
+//  RollupQueryProcessor  //
+
+RollupQueryProcessor::RollupQueryProcessor(std::vector<std::shared_ptr<Node>> nodes,
+                                           std::string metric,
+                                           aku_Timestamp begin,
+                                           aku_Timestamp end,
+                                           std::shared_ptr<IQueryFilter> filter,
+                                           GroupByTime groupby,
+                                           IRollupStorage const& rollups,
+                                           size_t tier,
+                                           aku_Timestamp rollup_begin,
+                                           aku_Timestamp split,
+                                           Aggregate aggregate,
+                                           SeriesMatcher const* matcher)
+    : ScanQueryProcessor(nodes, metric, begin, end, filter, groupby, std::unique_ptr<GroupByTag>(), matcher)
+    , rollups_(rollups)
+    , tier_(tier)
+    , rollup_begin_(rollup_begin)
+    , split_(split)
+    , aggregate_(aggregate)
+    , next_(nodes.at(1))
+{
+}
+
+aku_Timestamp RollupQueryProcessor::lowerbound() const {
+    return std::max(lowerbound_, split_);
+}
+
+bool RollupQueryProcessor::put_rollups_() {
+    AKU_TRACE_SPAN("qp.put_rollups");
+    const aku_Timestamp step = groupby_.step_;
+    // Tier buckets are merged into query buckets (key is a bucket and series id)
+    std::map<std::pair<aku_Timestamp, aku_ParamId>, RollupBucket> buckets;
+    std::vector<RollupBucket> items;
+    for (auto id: filter_->get_ids()) {
+        rollups_.read(tier_, id, rollup_begin_, split_, &items);
+        auto it = buckets.end();
+        for (auto const& item: items) {
+            aku_Timestamp bucket = item.timestamp / step * step;
+            if (it == buckets.end() || it->first.first != bucket) {
+                RollupBucket acc = item;
+                acc.timestamp = bucket;
+                it = buckets.insert(std::make_pair(std::make_pair(bucket, id), acc)).first;
+                continue;
+            }
+            RollupBucket& acc = it->second;
+            acc.min = std::min(acc.min, item.min);
+            acc.max = std::max(acc.max, item.max);
+            acc.sum += item.sum;
+            acc.count += item.count;
+        }
+    }
+    aku_Sample sample;
+    sample.payload.type = AKU_PAYLOAD_FLOAT;
+    sample.payload.size = sizeof(aku_Sample);
+    aku_Sample margin = direction_ == AKU_CURSOR_DIR_FORWARD ? SAMPLING_HI_MARGIN : SAMPLING_LO_MARGIN;
+    // Output order is the same as PAA output order (series ids are sorted in scan direction)
+    auto put = [&](RollupBucket const& acc, aku_ParamId id) {
+        aku_Timestamp ts = acc.timestamp + step;
+        if (margin.timestamp != ts) {
+            if (margin.timestamp != 0u && !next_->put(margin)) {
+                return false;
+            }
+            margin.timestamp = ts;
+        }
+        sample.paramid = id;
+        sample.timestamp = ts;
+        switch (aggregate_) {
+        case MEAN:
+            sample.payload.float64 = acc.sum / acc.count;
+            break;
+        case MIN:
+            sample.payload.float64 = acc.min;
+            break;
+        case MAX:
+            sample.payload.float64 = acc.max;
+            break;
+        };
+        return next_->put(sample);
+    };
+    if (direction_ == AKU_CURSOR_DIR_FORWARD) {
+        for (auto it = buckets.begin(); it != buckets.end(); it++) {
+            if (!put(it->second, it->first.second)) {
+                return false;
+            }
+        }
+    } else {
+        for (auto it = buckets.rbegin(); it != buckets.rend(); it++) {
+            if (!put(it->second, it->first.second)) {
+                return false;
+            }
+        }
+    }
+    if (margin.timestamp != 0u) {
+        return next_->put(margin);
+    }
+    return true;
+}
+
+bool RollupQueryProcessor::start() {
+    ScanQueryProcessor::start();
+    if (direction_ == AKU_CURSOR_DIR_FORWARD) {
+        // Rollup data goes first
+        if (!put_rollups_()) {
+            root_node_->complete();
+            return false;
+        }
+    }
+    return true;
+}
+
+void RollupQueryProcessor::stop() {
+    if (direction_ == AKU_CURSOR_DIR_BACKWARD) {
+        bool proceed = true;
+        if (!groupby_.first_hit_) {
+            // Close last bucket of the raw data
+            aku_Sample margin = SAMPLING_LO_MARGIN;
+            margin.timestamp = groupby_.upperbound_;
+            proceed = root_node_->put(margin);
+        }
+        if (proceed) {
+            put_rollups_();
+        }
+    }
+    root_node_->complete();
+}
+
 MetadataQueryProcessor::MetadataQueryProcessor(std::shared_ptr<IQueryFilter> flt, std::shared_ptr<Node> node)
     : filter_(flt)
     , root_(node)
@@ -399,14 +570,12 @@ void MetadataQueryProcessor::set_error(aku_Status error) {
 //                          //
 //                          //
 
-static boost::optional<std::string> parse_select_stmt(boost::property_tree::ptree const& ptree, aku_logger_cb_t logger) {
-    auto select = ptree.get_child_optional("select");
-    if (select && select->empty()) {
+static boost::optional<std::string> parse_select_stmt(QueryAST const& ast, aku_logger_cb_t logger) {
+    if (ast.select) {
         // simple select query
-        auto str = select->get_value<std::string>("");
-        if (str == "names") {
+        if (*ast.select == "names") {
             // the only supported select query for now
-            return str;
+            return ast.select;
         }
         (*logger)(AKU_LOG_ERROR, "Invalid `select` query");
         auto rte = std::runtime_error("Invalid `select` query");
@@ -415,69 +584,39 @@ static boost::optional<std::string> parse_select_stmt(boost::property_tree::ptre
     return boost::optional<std::string>();
 }
 
-static std::tuple<QP::GroupByTime, std::vector<std::string>> parse_groupby(boost::property_tree::ptree const& ptree,
+static std::tuple<QP::GroupByTime, std::vector<std::string>> parse_groupby(QueryAST const& ast,
                                                                            aku_logger_cb_t logger) {
-    std::vector<std::string> tags;
     aku_Timestamp duration = 0u;
-    auto groupby = ptree.get_child_optional("group-by");
-    if (groupby) {
-        for(auto child: *groupby) {
-            if (child.first == "time") {
-                std::string str = child.second.get_value<std::string>();
-                duration = DateTimeUtil::parse_duration(str.c_str(), str.size());
-            } else if (child.first == "tag") {
-                if (!child.second.empty()) {
-                    for (auto tag: child.second) {
-                        tags.push_back(tag.second.get_value<std::string>());
-                    }
-                } else {
-                    auto tag = child.second.get_value<std::string>();
-                    tags.push_back(tag);
-                }
-            }
-        }
+    if (ast.groupby_time) {
+        std::string const& str = *ast.groupby_time;
+        duration = DateTimeUtil::parse_duration(str.c_str(), str.size());
     }
-    return std::make_tuple(QP::GroupByTime(duration), tags);
+    return std::make_tuple(QP::GroupByTime(duration), ast.groupby_tags);
 }
 
-static std::pair<uint64_t, uint64_t> parse_limit_offset(boost::property_tree::ptree const& ptree, aku_logger_cb_t logger) {
-    uint64_t limit = 0ul, offset = 0ul;
-    auto optlimit = ptree.get_child_optional("limit");
-    if (optlimit) {
-        limit = optlimit->get_value<uint64_t>();
-    }
-    auto optoffset = ptree.get_child_optional("offset");
-    if (optoffset) {
-        limit = optoffset->get_value<uint64_t>();
-    }
-    return std::make_pair(limit, offset);
+static std::pair<uint64_t, uint64_t> parse_limit_offset(QueryAST const& ast, aku_logger_cb_t logger) {
+    return std::make_pair(ast.limit, ast.offset);
 }
 
-static std::string parse_metric(boost::property_tree::ptree const& ptree,
+static std::string parse_metric(QueryAST const& ast,
                                 aku_logger_cb_t logger) {
-    auto opt = ptree.get_child_optional("metric");
-    if (opt) {
-        auto single = opt->get_value<std::string>();
-        return single;
+    if (ast.metric) {
+        return *ast.metric;
     }
-    auto select = ptree.get_child_optional("select");
-    if (!select) {
+    if (!ast.select) {
         QueryParserError error("`metric` not set");
         BOOST_THROW_EXCEPTION(error);
     }
     return "";
 }
 
-static aku_Timestamp parse_range_timestamp(boost::property_tree::ptree const& ptree,
+static aku_Timestamp parse_range_timestamp(QueryAST const& ast,
                                            std::string const& name,
                                            aku_logger_cb_t logger) {
-    auto range = ptree.get_child("range");
-    for(auto child: range) {
-        if (child.first == name) {
-            auto iso_string = child.second.get_value<std::string>();
-            auto ts = DateTimeUtil::from_iso_string(iso_string.c_str());
-            return ts;
-        }
+    auto const& value = name == "from" ? ast.range_from : ast.range_to;
+    if (value) {
+        auto ts = DateTimeUtil::from_iso_string(value->c_str());
+        return ts;
     }
     std::stringstream fmt;
     fmt << "can't find `" << name << "` tag inside the query";
@@ -485,121 +624,131 @@ static aku_Timestamp parse_range_timestamp(boost::property_tree::ptree const& pt
     BOOST_THROW_EXCEPTION(error);
 }
 
-static std::shared_ptr<RegexFilter> parse_where_clause(boost::property_tree::ptree const& ptree,
-                                                       std::string metric,
-                                                       std::string pred,
-                                                       StringPool const& pool,
-                                                       aku_logger_cb_t logger)
+static std::shared_ptr<TagFilter> parse_where_clause(QueryAST const& ast,
+                                                     std::string metric,
+                                                     std::string pred,
+                                                     TagIndex const& index,
+                                                     aku_logger_cb_t logger)
 {
-    std::shared_ptr<RegexFilter> result;
-    bool not_set = false;
-    auto where = ptree.get_child_optional("where");
-    if (where) {
+    TagIndex::Query query;
+    query.metric = metric;
+    if (!ast.where.empty()) {
         if (metric.empty()) {
             QueryParserError error("metric is not set");
             BOOST_THROW_EXCEPTION(error);
         }
-        for (auto item: *where) {
-            bool firstitem = true;
-            std::stringstream series_regexp;
-            std::string tag = item.first;
-            auto idslist = item.second;
-            // Read idlist
-            for (auto idnode: idslist) {
-                std::string value = idnode.second.get_value<std::string>();
-                if (firstitem) {
-                    firstitem = false;
-                    series_regexp << "(?:";
-                } else {
-                    series_regexp << "|";
-                }
-                series_regexp << "(" << metric << R"((?:\s\w+=\w+)*\s)"
-                              << tag << "=" << value << R"((?:\s\w+=\w+)*))";
-            }
-            series_regexp << ")";
-            std::string regex = series_regexp.str();
-            result = std::make_shared<RegexFilter>(regex, pool);
-        }
+        // Every tag from the where clause should match one of the values from the list
+        query.where = ast.where;
+    }
+    // Empty metric name includes all series
+    return std::make_shared<TagFilter>(query, index);
+}
+
+/** Try to use rollup tier instead of raw data.
+  * Tier can be used if sampler is `paa`, `min-paa` or `max-paa`, group-by
+  * step is a multiple of the tier step and the tier covers beginning of the
+  * range. Tier with the largest step is selected.
+  * @return query processor or null if rollups can't be used
+  */
+static std::shared_ptr<IQueryProcessor> route_to_rollup(std::string const& sampler,
+                                                        std::vector<std::shared_ptr<Node>> const& nodes,
+                                                        std::string const& metric,
+                                                        aku_Timestamp begin,
+                                                        aku_Timestamp end,
+                                                        std::shared_ptr<IQueryFilter> filter,
+                                                        GroupByTime const& groupby,
+                                                        IRollupStorage const& rollups,
+                                                        SeriesMatcher const& matcher,
+                                                        aku_logger_cb_t logger)
+{
+    RollupQueryProcessor::Aggregate aggregate;
+    if (sampler == "paa") {
+        aggregate = RollupQueryProcessor::MEAN;
+    } else if (sampler == "min-paa") {
+        aggregate = RollupQueryProcessor::MIN;
+    } else if (sampler == "max-paa") {
+        aggregate = RollupQueryProcessor::MAX;
     } else {
-        not_set = true;
+        return std::shared_ptr<IQueryProcessor>();
     }
-    if (not_set) {
-        // we need to include all series
-        if (metric.empty()) {
-            metric = "\\w+";
+    const aku_Timestamp step = groupby.step_;
+    const aku_Timestamp lo = std::min(begin, end);
+    const aku_Timestamp hi = std::max(begin, end);
+    auto tiers = rollups.get_tiers();
+    int best = -1;
+    aku_Timestamp rollup_begin = 0u, split = 0u;
+    for (int i = 0; i < static_cast<int>(tiers.size()); i++) {
+        auto const& tier = tiers[i];
+        if (step % tier.step != 0) {
+            continue;
+        }
+        if (lo % tier.step != 0) {
+            // First tier bucket would include samples that precede the range
+            continue;
+        }
+        // Rollup is used up to the last complete query bucket, the rest is read from raw data
+        aku_Timestamp tier_begin = lo;
+        aku_Timestamp tier_split = std::min(tier.end, hi) / step * step;
+        if (tier_begin < tier.begin || tier_split <= tier_begin) {
+            continue;
+        }
+        if (best < 0 || tier.step > tiers[best].step) {
+            best = i;
+            rollup_begin = tier_begin;
+            split = tier_split;
         }
-        std::stringstream series_regexp;
-        series_regexp << metric << "(?:\\s\\w+=\\w+)+";
-        std::string regex = series_regexp.str();
-        result = std::make_shared<RegexFilter>(regex, pool);
     }
-    return result;
-}
-
-static std::string to_json(boost::property_tree::ptree const& ptree, bool pretty_print = true) {
-    std::stringstream ss;
-    boost::property_tree::write_json(ss, ptree, pretty_print);
-    return ss.str();
+    if (best < 0) {
+        return std::shared_ptr<IQueryProcessor>();
+    }
+    logger(AKU_LOG_INFO, "Query uses rollup tier");
+    return std::make_shared<RollupQueryProcessor>(nodes, metric, begin, end, filter, groupby,
+                                                  rollups, best, rollup_begin, split, aggregate, &matcher);
 }
 
 std::shared_ptr<QP::IQueryProcessor> Builder::build_query_processor(const char* query,
                                                                     std::shared_ptr<QP::Node> terminal,
                                                                     const SeriesMatcher &matcher,
-                                                                    aku_logger_cb_t logger) {
-    namespace pt = boost::property_tree;
+                                                                    aku_logger_cb_t logger,
+                                                                    IRollupStorage const* rollups) {
+    AKU_TRACE_SPAN("qp.build");
     using namespace QP;
 
+    logger(AKU_LOG_INFO, "Parsing query:");
+    logger(AKU_LOG_INFO, query);
 
-    const auto NOSAMPLE = std::make_pair<std::string, size_t>("", 0u);
-
-    //! C-string to streambuf adapter
-    struct MemStreambuf : std::streambuf {
-        MemStreambuf(const char* buf) {
-            char* p = const_cast<char*>(buf);
-            setg(p, p, p+strlen(p));
-        }
-    };
-
-    boost::property_tree::ptree ptree;
-    MemStreambuf strbuf(query);
-    std::istream stream(&strbuf);
+    QueryAST ast;
     try {
-        pt::json_parser::read_json(stream, ptree);
-    } catch (pt::json_parser_error& e) {
+        ast = QueryAST::parse(query, query + strlen(query));
+    } catch (QueryParserError const& e) {
         // Error, bad query
         (*logger)(AKU_LOG_ERROR, e.what());
-        throw QueryParserError(e.what());
+        throw;
     }
 
-    logger(AKU_LOG_INFO, "Parsing query:");
-    logger(AKU_LOG_INFO, to_json(ptree, true).c_str());
-
     try {
         // Read metric name
-        auto metric = parse_metric(ptree, logger);
+        auto metric = parse_metric(ast, logger);
 
         // Read groupby statement
         std::vector<std::string> tags;
         GroupByTime groupbytime;
-        std::tie(groupbytime, tags) = parse_groupby(ptree, logger);
+        std::tie(groupbytime, tags) = parse_groupby(ast, logger);
         auto groupbytag = std::unique_ptr<GroupByTag>();
         if (!tags.empty()) {
-            groupbytag.reset(new GroupByTag(&matcher.pool, metric, tags));
+            groupbytag.reset(new GroupByTag(&matcher, metric, tags));
         }
 
         // Read limit/offset
-        auto limoff = parse_limit_offset(ptree, logger);
+        auto limoff = parse_limit_offset(ast, logger);
 
         // Read select statment
-        auto select = parse_select_stmt(ptree, logger);
-
-        // Read sampling method
-        auto sampling_params = ptree.get_child_optional("sample");
+        auto select = parse_select_stmt(ast, logger);
 
         // Read where clause
-        auto filter = parse_where_clause(ptree, metric, "in", matcher.pool, logger);
+        auto filter = parse_where_clause(ast, metric, "in", matcher.index, logger);
 
-        if (sampling_params && select) {
+        if (ast.has_sample && select) {
             (*logger)(AKU_LOG_ERROR, "Can't combine select and sample statements together");
             auto rte = std::runtime_error("`sample` and `select` can't be used together");
             BOOST_THROW_EXCEPTION(rte);
@@ -615,18 +764,23 @@ std::shared_ptr<QP::IQueryProcessor> Builder::build_query_processor(const char*
         }
         if (!select) {
             // Read timestamps
-            auto ts_begin = parse_range_timestamp(ptree, "from", logger);
-            auto ts_end = parse_range_timestamp(ptree, "to", logger);
+            auto ts_begin = parse_range_timestamp(ast, "from", logger);
+            auto ts_end = parse_range_timestamp(ast, "to", logger);
 
-            if (sampling_params) {
-                for (auto i = sampling_params->rbegin(); i != sampling_params->rend(); i++) {
-                    next = make_sampler(i->second, next, logger);
-                    allnodes.push_back(next);
-                }
+            for (auto i = ast.samplers.rbegin(); i != ast.samplers.rend(); i++) {
+                next = make_sampler(*i, next, logger);
+                allnodes.push_back(next);
             }
             std::reverse(allnodes.begin(), allnodes.end());
+            if (rollups && !ast.samplers.empty() && !groupbytag && !groupbytime.empty()) {
+                auto sampler = ast.samplers.front().get<std::string>("name", "");
+                auto proc = route_to_rollup(sampler, allnodes, metric, ts_begin, ts_end, filter, groupbytime, *rollups, matcher, logger);
+                if (proc) {
+                    return proc;
+                }
+            }
             // Build query processor
-            return std::make_shared<ScanQueryProcessor>(allnodes, metric, ts_begin, ts_end, filter, groupbytime, std::move(groupbytag));
+            return std::make_shared<ScanQueryProcessor>(allnodes, metric, ts_begin, ts_end, filter, groupbytime, std::move(groupbytag), &matcher);
         }
         return std::make_shared<MetadataQueryProcessor>(filter, next);
 
@@ -35,11 +35,13 @@ struct Builder {
       * @param query should point to 0-terminated query string
       * @param terminal_node should contain valid pointer to terminal(final) node
       * @param logger should contain valid pointer to logging function
+      * @param rollups can contain pointer to rollup tiers (used instead of raw data by PAA queries)
       */
     static std::shared_ptr<QP::IQueryProcessor> build_query_processor(const char* query,
                                                                       std::shared_ptr<QP::Node> terminal_node,
                                                                       const SeriesMatcher& matcher,
-                                                                      aku_logger_cb_t logger);
+                                                                      aku_logger_cb_t logger,
+                                                                      IRollupStorage const* rollups = nullptr);
 };
 
 
@@ -67,14 +69,17 @@ struct GroupByTime {
 
 /** Group-by tag statement processor */
 struct GroupByTag {
-    std::string regex_;
-    //! Mapping from global parameter ids to local parameter ids
-    std::unordered_map<aku_ParamId, aku_ParamId> ids_;
-    //! Shared string pool
-    StringPool const* spool_;
-    //! Previous string pool offset
-    StringPoolOffset offset_;
-    //! Previous string pool size
+    //! Tag index query
+    TagIndex::Query query_;
+    //! Global parameter ids of the matching series
+    SlotMap slots_;
+    //! Local parameter ids indexed by slot
+    std::vector<aku_ParamId> local_ids_;
+    //! Shared series matcher
+    SeriesMatcher const* matcher_;
+    //! Ids below this one are already processed
+    uint64_t next_id_;
+    //! Previous tag index size
     size_t prev_size_;
     //! List of tags of interest
     std::vector<std::string> tags_;
@@ -84,11 +89,16 @@ struct GroupByTag {
     StringTools::SetT snames_;
 
     //! Main c-tor
-    GroupByTag(StringPool const* spool, std::string metric, std::vector<std::string> const& tags);
+    GroupByTag(SeriesMatcher const* matcher, std::string metric, std::vector<std::string> const& tags);
 
     void refresh_();
 
+    void set_local_id_(aku_ParamId id, aku_ParamId localid);
+
     bool apply(aku_Sample* sample);
+
+    //! Get list of local ids
+    std::vector<aku_ParamId> get_ids() const;
 };
 
 
@@ -118,8 +128,12 @@ struct ScanQueryProcessor : IQueryProcessor {
     std::shared_ptr<Node>              root_node_;
     //! Final of the processing topology
     std::shared_ptr<Node>              last_node_;
+    //! All processing nodes
+    std::vector<std::shared_ptr<Node>> nodes_;
     //! Group-by-tag
     std::unique_ptr<GroupByTag>        groupby_tag_;
+    //! Matcher that resolves ids of the output samples (null if global ids are used)
+    SeriesMatcher*                     output_matcher_;
 
     /** Create new query processor.
       * @param root is a root of the processing topology
@@ -127,6 +141,7 @@ struct ScanQueryProcessor : IQueryProcessor {
       * @param begin is a timestamp to begin from
       * @param end is a timestamp to end with
       *        (depending on a scan direction can be greater or smaller then lo)
+      * @param matcher is a global series matcher (can be null if nodes doesn't need series names)
       */
     ScanQueryProcessor(std::vector<std::shared_ptr<Node> > nodes,
                        std::string metric,
@@ -134,7 +149,8 @@ struct ScanQueryProcessor : IQueryProcessor {
                        aku_Timestamp end,
                        std::shared_ptr<IQueryFilter> filter,
                        GroupByTime groupby,
-                       std::unique_ptr<GroupByTag> groupbytag);
+                       std::unique_ptr<GroupByTag> groupbytag,
+                       SeriesMatcher const* matcher = nullptr);
 
     //! Lowerbound
     aku_Timestamp lowerbound() const;
@@ -162,6 +178,60 @@ struct ScanQueryProcessor : IQueryProcessor {
 };
 
 
+/** Query processor that uses rollup tier to compute PAA.
+  * Complete buckets of the tier are used for the beginning of the range and raw
+  * data is scanned only for the rest of the range (data that isn't rolled up yet).
+  * First node of the topology should be a PAA sampler, it processes raw data,
+  * rollup data is sent directly to the next node.
+  * @note beginning of the range should be aligned to the tier step
+  */
+struct RollupQueryProcessor : ScanQueryProcessor {
+
+    enum Aggregate {
+        MEAN,
+        MIN,
+        MAX,
+    };
+
+    //! Rollup tiers
+    IRollupStorage const&              rollups_;
+    //! Index of the tier
+    const size_t                       tier_;
+    //! Beginning of the range covered by rollup (inclusive)
+    const aku_Timestamp                rollup_begin_;
+    //! End of the range covered by rollup, raw data is scanned from here
+    const aku_Timestamp                split_;
+    //! Aggregation function of the sampler
+    const Aggregate                    aggregate_;
+    //! Node that follows the sampler
+    std::shared_ptr<Node>              next_;
+
+    RollupQueryProcessor(std::vector<std::shared_ptr<Node>> nodes,
+                         std::string metric,
+                         aku_Timestamp begin,
+                         aku_Timestamp end,
+                         std::shared_ptr<IQueryFilter> filter,
+                         GroupByTime groupby,
+                         IRollupStorage const& rollups,
+                         size_t tier,
+                         aku_Timestamp rollup_begin,
+                         aku_Timestamp split,
+                         Aggregate aggregate,
+                         SeriesMatcher const* matcher = nullptr);
+
+    //! Lowerbound of the raw data scan
+    aku_Timestamp lowerbound() const;
+
+    bool start();
+
+    void stop();
+
+private:
+    //! Send rollup data to the next node
+    bool put_rollups_();
+};
+
+
 struct MetadataQueryProcessor : IQueryProcessor {
 
     std::shared_ptr<IQueryFilter>   filter_;
@@ -1,9 +1,79 @@
 #include "queryprocessor_framework.h"
+#include <algorithm>
 #include <map>
 
 namespace Akumuli {
 namespace QP {
 
+//  SlotMap  //
+
+SlotMap::SlotMap()
+    : base_(0u)
+{
+}
+
+SlotMap::SlotMap(std::vector<aku_ParamId> ids)
+    : base_(0u)
+{
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    if (ids.empty()) {
+        return;
+    }
+    base_ = ids.front();
+    auto range = ids.back() - ids.front() + 1;
+    bool dense = range <= MAX_SPARSENESS*ids.size() + MIN_TABLE_SIZE;
+    if (dense) {
+        table_.resize(range, NO_SLOT);
+    }
+    for (auto id: ids) {
+        uint32_t slot = static_cast<uint32_t>(ids_.size());
+        if (dense) {
+            table_[id - base_] = slot;
+        } else {
+            overflow_[id] = slot;
+        }
+        ids_.push_back(id);
+    }
+}
+
+uint32_t SlotMap::find(aku_ParamId id) const {
+    aku_ParamId offset = id - base_;
+    if (offset < table_.size() && table_[offset] != NO_SLOT) {
+        return table_[offset];
+    }
+    auto it = overflow_.find(id);
+    if (it != overflow_.end()) {
+        return it->second;
+    }
+    return NO_SLOT;
+}
+
+uint32_t SlotMap::slot_slow_(aku_ParamId id) {
+    // Direct table can grow over ids that was placed to overflow table before
+    auto it = overflow_.find(id);
+    if (it != overflow_.end()) {
+        return it->second;
+    }
+    uint32_t slot = static_cast<uint32_t>(ids_.size());
+    if (ids_.empty()) {
+        base_ = id;
+    }
+    aku_ParamId offset = id - base_;
+    if (offset >= table_.size()) {
+        if (id < base_ || offset >= MAX_SPARSENESS*(ids_.size() + 1) + MIN_TABLE_SIZE) {
+            // Too far from the direct table
+            overflow_[id] = slot;
+            ids_.push_back(id);
+            return slot;
+        }
+        table_.resize(std::max(offset + 1, table_.size()*2), NO_SLOT);
+    }
+    table_[offset] = slot;
+    ids_.push_back(id);
+    return slot;
+}
+
 struct QueryParserRegistry {
     std::map<std::string, BaseQueryParserToken const*> registry;
     static QueryParserRegistry& get() {
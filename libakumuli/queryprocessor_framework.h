@@ -1,6 +1,8 @@
 #pragma once
 #include <stdexcept>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include "akumuli.h"
 #include "seriesparser.h"
@@ -20,6 +22,60 @@ static const aku_Sample NO_DATA = {0u, 0u, {0.0, sizeof(aku_Sample), aku_PData::
 static const aku_Sample SAMPLING_LO_MARGIN = {0u, 0u, {0.0, sizeof(aku_Sample), aku_PData::LO_MARGIN}};
 static const aku_Sample SAMPLING_HI_MARGIN = {0u, 0u, {0.0, sizeof(aku_Sample), aku_PData::HI_MARGIN}};
 
+
+/** Dense remapping of the series ids.
+  * Processing nodes can store per-series state in plain arrays indexed by slot
+  * instead of hash tables. Ids known before the scan get slots in ascending
+  * order, ids that appear later (new series) get new slots on first access.
+  * Direct lookup table is used if the id range is dense enough (this is
+  * the common case since series ids are allocated sequentially), hash
+  * table is used as a fallback.
+  */
+struct SlotMap {
+    enum {
+        NO_SLOT = 0xFFFFFFFF,
+        MAX_SPARSENESS = 8,        //< Max ratio between id range and number of ids for direct table
+        MIN_TABLE_SIZE = 0x1000,   //< Direct table of this size is always allowed
+    };
+
+    aku_ParamId                                 base_;      //< Smallest id covered by direct table
+    std::vector<uint32_t>                       table_;     //< Direct table, `id - base_` -> slot
+    std::unordered_map<aku_ParamId, uint32_t>   overflow_;  //< Ids outside of the direct table
+    std::vector<aku_ParamId>                    ids_;       //< Slot -> id
+
+    //! Create empty map
+    SlotMap();
+
+    //! Create map for the set of known ids
+    SlotMap(std::vector<aku_ParamId> ids);
+
+    //! Get slot for id, new slot is allocated if id is not in the map
+    uint32_t slot(aku_ParamId id) {
+        aku_ParamId offset = id - base_;
+        if (offset < table_.size() && table_[offset] != NO_SLOT) {
+            return table_[offset];
+        }
+        return slot_slow_(id);
+    }
+
+    //! Find slot without allocating it (returns NO_SLOT if id is not in the map)
+    uint32_t find(aku_ParamId id) const;
+
+    //! Get id by slot
+    aku_ParamId id(uint32_t slot) const {
+        return ids_[slot];
+    }
+
+    //! Number of allocated slots
+    size_t size() const {
+        return ids_.size();
+    }
+
+private:
+    uint32_t slot_slow_(aku_ParamId id);
+};
+
+
 struct Node {
 
     virtual ~Node() = default;
@@ -45,6 +101,19 @@ struct Node {
     /** This method returns set of flags that describes its functioning.
       */
     virtual int get_requirements() const = 0;
+
+    /** Set id to slot mapping shared by all nodes of the query.
+      * Called before query execution starts. Nodes that keep per-series
+      * state should use this map instead of their own.
+      */
+    virtual void set_slot_map(std::shared_ptr<SlotMap> slots) {}
+
+    /** Set series matcher that resolves ids of the input samples.
+      * Called when query processor is created (nodes are visited in the
+      * processing order). Node that replaces series ids should return
+      * matcher that resolves ids of its output, other nodes return null.
+      */
+    virtual SeriesMatcher* set_input_matcher(SeriesMatcher const* matcher) { return nullptr; }
 };
 
 
@@ -79,6 +148,49 @@ struct BypassFilter : QP::IQueryFilter {
 };
 
 
+//! Aggregates of the series values that belongs to one rollup bucket
+struct RollupBucket {
+    aku_Timestamp timestamp;  //< Beginning of the bucket
+    double        min;
+    double        max;
+    double        sum;
+    uint64_t      count;
+};
+
+
+//! Rollup tier description
+struct RollupTier {
+    aku_Timestamp step;   //< Bucket width
+    aku_Timestamp begin;  //< All buckets in [begin, end) range are complete
+    aku_Timestamp end;
+};
+
+
+/** Downsampled series data maintained at ingest.
+  * Query builder can use it instead of raw data to compute PAA.
+  */
+struct IRollupStorage {
+
+    virtual ~IRollupStorage() = default;
+
+    //! Get list of tiers (index in the list identifies the tier)
+    virtual std::vector<RollupTier> get_tiers() const = 0;
+
+    /** Read buckets of the series in time order.
+      * @param tier is an index of the tier
+      * @param id is a series id
+      * @param begin is a beginning of the range (inclusive)
+      * @param end is an end of the range (exclusive)
+      * @param out is an output parameter
+      */
+    virtual void read(size_t tier,
+                      aku_ParamId id,
+                      aku_Timestamp begin,
+                      aku_Timestamp end,
+                      std::vector<RollupBucket>* out) const = 0;
+};
+
+
 //! Query processor interface
 struct IQueryProcessor {
 
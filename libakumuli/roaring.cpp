@@ -0,0 +1,448 @@
+/**
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "roaring.h"
+
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+
+namespace Akumuli {
+
+typedef RoaringBitmap::Container Container;
+
+static uint32_t popcount(std::vector<uint64_t> const& bits) {
+    uint32_t sum = 0;
+    for (auto word: bits) {
+        sum += static_cast<uint32_t>(__builtin_popcountll(word));
+    }
+    return sum;
+}
+
+static void set_bit(std::vector<uint64_t>* bits, uint16_t value) {
+    (*bits)[value >> 6] |= 1ull << (value & 63);
+}
+
+static bool get_bit(std::vector<uint64_t> const& bits, uint16_t value) {
+    return (bits[value >> 6] >> (value & 63)) & 1;
+}
+
+//                     //
+//      Container      //
+//                     //
+
+Container::Container()
+    : card(0u)
+{
+}
+
+bool Container::is_bitset() const {
+    return !bits.empty();
+}
+
+bool Container::contains(uint16_t value) const {
+    if (is_bitset()) {
+        return get_bit(bits, value);
+    }
+    return std::binary_search(array.begin(), array.end(), value);
+}
+
+void Container::add(uint16_t value) {
+    if (is_bitset()) {
+        if (!get_bit(bits, value)) {
+            set_bit(&bits, value);
+            card++;
+        }
+        return;
+    }
+    auto it = std::lower_bound(array.begin(), array.end(), value);
+    if (it != array.end() && *it == value) {
+        return;
+    }
+    array.insert(it, value);
+    card++;
+    optimize();
+}
+
+void Container::optimize() {
+    if (is_bitset() && card <= RoaringBitmap::ARRAY_MAX) {
+        std::vector<uint16_t> tmp;
+        tmp.reserve(card);
+        for (uint32_t i = 0; i < RoaringBitmap::BITSET_SIZE; i++) {
+            uint64_t word = bits[i];
+            while (word) {
+                int bit = __builtin_ctzll(word);
+                tmp.push_back(static_cast<uint16_t>(i*64 + bit));
+                word &= word - 1;
+            }
+        }
+        array.swap(tmp);
+        std::vector<uint64_t>().swap(bits);
+    } else if (!is_bitset() && card > RoaringBitmap::ARRAY_MAX) {
+        bits.resize(RoaringBitmap::BITSET_SIZE, 0ull);
+        for (auto value: array) {
+            set_bit(&bits, value);
+        }
+        std::vector<uint16_t>().swap(array);
+    }
+}
+
+static std::vector<uint64_t> to_bits(Container const& c) {
+    if (c.is_bitset()) {
+        return c.bits;
+    }
+    std::vector<uint64_t> bits(RoaringBitmap::BITSET_SIZE, 0ull);
+    for (auto value: c.array) {
+        set_bit(&bits, value);
+    }
+    return bits;
+}
+
+static Container container_and(Container const& a, Container const& b) {
+    Container result;
+    if (!a.is_bitset() && !b.is_bitset()) {
+        std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                              std::back_inserter(result.array));
+        result.card = static_cast<uint32_t>(result.array.size());
+    } else if (a.is_bitset() && b.is_bitset()) {
+        result.bits.resize(RoaringBitmap::BITSET_SIZE);
+        for (uint32_t i = 0; i < RoaringBitmap::BITSET_SIZE; i++) {
+            result.bits[i] = a.bits[i] & b.bits[i];
+        }
+        result.card = popcount(result.bits);
+        result.optimize();
+    } else {
+        Container const& arr = a.is_bitset() ? b : a;
+        Container const& bmp = a.is_bitset() ? a : b;
+        for (auto value: arr.array) {
+            if (get_bit(bmp.bits, value)) {
+                result.array.push_back(value);
+            }
+        }
+        result.card = static_cast<uint32_t>(result.array.size());
+    }
+    return result;
+}
+
+static uint32_t container_and_cardinality(Container const& a, Container const& b) {
+    uint32_t count = 0;
+    if (!a.is_bitset() && !b.is_bitset()) {
+        auto ia = a.array.begin(), ib = b.array.begin();
+        while (ia != a.array.end() && ib != b.array.end()) {
+            if (*ia < *ib) {
+                ia++;
+            } else if (*ib < *ia) {
+                ib++;
+            } else {
+                count++;
+                ia++;
+                ib++;
+            }
+        }
+    } else if (a.is_bitset() && b.is_bitset()) {
+        for (uint32_t i = 0; i < RoaringBitmap::BITSET_SIZE; i++) {
+            count += static_cast<uint32_t>(__builtin_popcountll(a.bits[i] & b.bits[i]));
+        }
+    } else {
+        Container const& arr = a.is_bitset() ? b : a;
+        Container const& bmp = a.is_bitset() ? a : b;
+        for (auto value: arr.array) {
+            count += get_bit(bmp.bits, value);
+        }
+    }
+    return count;
+}
+
+static Container container_or(Container const& a, Container const& b) {
+    Container result;
+    if (!a.is_bitset() && !b.is_bitset()) {
+        std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                       std::back_inserter(result.array));
+        result.card = static_cast<uint32_t>(result.array.size());
+        result.optimize();
+        return result;
+    }
+    Container const& src = a.is_bitset() ? b : a;
+    result.bits = a.is_bitset() ? a.bits : b.bits;
+    if (src.is_bitset()) {
+        for (uint32_t i = 0; i < RoaringBitmap::BITSET_SIZE; i++) {
+            result.bits[i] |= src.bits[i];
+        }
+    } else {
+        for (auto value: src.array) {
+            set_bit(&result.bits, value);
+        }
+    }
+    result.card = popcount(result.bits);
+    return result;
+}
+
+static Container container_and_not(Container const& a, Container const& b) {
+    Container result;
+    if (!a.is_bitset()) {
+        for (auto value: a.array) {
+            if (!b.contains(value)) {
+                result.array.push_back(value);
+            }
+        }
+        result.card = static_cast<uint32_t>(result.array.size());
+        return result;
+    }
+    result.bits = a.bits;
+    if (b.is_bitset()) {
+        for (uint32_t i = 0; i < RoaringBitmap::BITSET_SIZE; i++) {
+            result.bits[i] &= ~b.bits[i];
+        }
+    } else {
+        for (auto value: b.array) {
+            result.bits[value >> 6] &= ~(1ull << (value & 63));
+        }
+    }
+    result.card = popcount(result.bits);
+    result.optimize();
+    return result;
+}
+
+//                          //
+//      Roaring Bitmap      //
+//                          //
+
+void RoaringBitmap::add(uint64_t value) {
+    uint64_t key = value >> 16;
+    uint16_t low = static_cast<uint16_t>(value & 0xFFFF);
+    // Fast path, values are usually added in ascending order
+    if (keys_.empty() || keys_.back() < key) {
+        keys_.push_back(key);
+        containers_.emplace_back();
+        containers_.back().add(low);
+        return;
+    }
+    auto it = std::lower_bound(keys_.begin(), keys_.end(), key);
+    auto ix = std::distance(keys_.begin(), it);
+    if (it == keys_.end() || *it != key) {
+        keys_.insert(it, key);
+        containers_.insert(containers_.begin() + ix, Container());
+    }
+    containers_[ix].add(low);
+}
+
+bool RoaringBitmap::contains(uint64_t value) const {
+    uint64_t key = value >> 16;
+    auto it = std::lower_bound(keys_.begin(), keys_.end(), key);
+    if (it == keys_.end() || *it != key) {
+        return false;
+    }
+    return containers_[std::distance(keys_.begin(), it)].contains(static_cast<uint16_t>(value & 0xFFFF));
+}
+
+size_t RoaringBitmap::cardinality() const {
+    size_t sum = 0;
+    for (auto const& c: containers_) {
+        sum += c.card;
+    }
+    return sum;
+}
+
+bool RoaringBitmap::empty() const {
+    return keys_.empty();
+}
+
+size_t RoaringBitmap::and_cardinality(RoaringBitmap const& other) const {
+    size_t count = 0;
+    size_t i = 0, j = 0;
+    while (i < keys_.size() && j < other.keys_.size()) {
+        if (keys_[i] < other.keys_[j]) {
+            i++;
+        } else if (other.keys_[j] < keys_[i]) {
+            j++;
+        } else {
+            count += container_and_cardinality(containers_[i], other.containers_[j]);
+            i++;
+            j++;
+        }
+    }
+    return count;
+}
+
+RoaringBitmap RoaringBitmap::operator & (RoaringBitmap const& other) const {
+    RoaringBitmap result;
+    size_t i = 0, j = 0;
+    while (i < keys_.size() && j < other.keys_.size()) {
+        if (keys_[i] < other.keys_[j]) {
+            i++;
+        } else if (other.keys_[j] < keys_[i]) {
+            j++;
+        } else {
+            auto c = container_and(containers_[i], other.containers_[j]);
+            if (c.card != 0) {
+                result.keys_.push_back(keys_[i]);
+                result.containers_.push_back(std::move(c));
+            }
+            i++;
+            j++;
+        }
+    }
+    return result;
+}
+
+RoaringBitmap RoaringBitmap::operator | (RoaringBitmap const& other) const {
+    RoaringBitmap result;
+    size_t i = 0, j = 0;
+    while (i < keys_.size() || j < other.keys_.size()) {
+        if (j == other.keys_.size() || (i < keys_.size() && keys_[i] < other.keys_[j])) {
+            result.keys_.push_back(keys_[i]);
+            result.containers_.push_back(containers_[i]);
+            i++;
+        } else if (i == keys_.size() || other.keys_[j] < keys_[i]) {
+            result.keys_.push_back(other.keys_[j]);
+            result.containers_.push_back(other.containers_[j]);
+            j++;
+        } else {
+            result.keys_.push_back(keys_[i]);
+            result.containers_.push_back(container_or(containers_[i], other.containers_[j]));
+            i++;
+            j++;
+        }
+    }
+    return result;
+}
+
+RoaringBitmap RoaringBitmap::and_not(RoaringBitmap const& other) const {
+    RoaringBitmap result;
+    size_t j = 0;
+    for (size_t i = 0; i < keys_.size(); i++) {
+        while (j < other.keys_.size() && other.keys_[j] < keys_[i]) {
+            j++;
+        }
+        if (j < other.keys_.size() && other.keys_[j] == keys_[i]) {
+            auto c = container_and_not(containers_[i], other.containers_[j]);
+            if (c.card != 0) {
+                result.keys_.push_back(keys_[i]);
+                result.containers_.push_back(std::move(c));
+            }
+        } else {
+            result.keys_.push_back(keys_[i]);
+            result.containers_.push_back(containers_[i]);
+        }
+    }
+    return result;
+}
+
+std::vector<uint64_t> RoaringBitmap::to_vector() const {
+    std::vector<uint64_t> result;
+    result.reserve(cardinality());
+    for (size_t i = 0; i < keys_.size(); i++) {
+        uint64_t high = keys_[i] << 16;
+        Container const& c = containers_[i];
+        if (c.is_bitset()) {
+            for (uint32_t w = 0; w < BITSET_SIZE; w++) {
+                uint64_t word = c.bits[w];
+                while (word) {
+                    result.push_back(high | (w*64 + __builtin_ctzll(word)));
+                    word &= word - 1;
+                }
+            }
+        } else {
+            for (auto value: c.array) {
+                result.push_back(high | value);
+            }
+        }
+    }
+    return result;
+}
+
+template<class T>
+static void put(T value, std::vector<char>* out) {
+    const char* p = reinterpret_cast<const char*>(&value);
+    out->insert(out->end(), p, p + sizeof(T));
+}
+
+template<class T>
+static bool get(const char** it, const char* end, T* value) {
+    if (end - *it < static_cast<ptrdiff_t>(sizeof(T))) {
+        return false;
+    }
+    memcpy(value, *it, sizeof(T));
+    *it += sizeof(T);
+    return true;
+}
+
+void RoaringBitmap::serialize(std::vector<char>* out) const {
+    // Format: number of containers, then key, cardinality and payload of each
+    // container. Container type is defined by cardinality.
+    put<uint64_t>(keys_.size(), out);
+    for (size_t i = 0; i < keys_.size(); i++) {
+        Container const& c = containers_[i];
+        put<uint64_t>(keys_[i], out);
+        put<uint32_t>(c.card, out);
+        const char* p;
+        size_t size;
+        if (c.is_bitset()) {
+            p = reinterpret_cast<const char*>(c.bits.data());
+            size = c.bits.size()*sizeof(uint64_t);
+        } else {
+            p = reinterpret_cast<const char*>(c.array.data());
+            size = c.array.size()*sizeof(uint16_t);
+        }
+        out->insert(out->end(), p, p + size);
+    }
+}
+
+aku_Status RoaringBitmap::deserialize(const char* begin, size_t size, RoaringBitmap* out) {
+    const char* it = begin;
+    const char* end = begin + size;
+    uint64_t ncontainers;
+    if (!get(&it, end, &ncontainers)) {
+        return AKU_EBAD_DATA;
+    }
+    RoaringBitmap result;
+    for (uint64_t i = 0; i < ncontainers; i++) {
+        uint64_t key;
+        Container c;
+        if (!get(&it, end, &key) || !get(&it, end, &c.card)) {
+            return AKU_EBAD_DATA;
+        }
+        if (c.card == 0 || c.card > 0x10000 || (!result.keys_.empty() && result.keys_.back() >= key)) {
+            return AKU_EBAD_DATA;
+        }
+        size_t nbytes = c.card > ARRAY_MAX ? BITSET_SIZE*sizeof(uint64_t) : c.card*sizeof(uint16_t);
+        if (static_cast<size_t>(end - it) < nbytes) {
+            return AKU_EBAD_DATA;
+        }
+        if (c.card > ARRAY_MAX) {
+            c.bits.resize(BITSET_SIZE);
+            memcpy(c.bits.data(), it, nbytes);
+        } else {
+            c.array.resize(c.card);
+            memcpy(c.array.data(), it, nbytes);
+        }
+        it += nbytes;
+        result.keys_.push_back(key);
+        result.containers_.push_back(std::move(c));
+    }
+    *out = std::move(result);
+    return AKU_SUCCESS;
+}
+
+size_t RoaringBitmap::memory_usage() const {
+    size_t sum = keys_.capacity()*sizeof(uint64_t) + containers_.capacity()*sizeof(Container);
+    for (auto const& c: containers_) {
+        sum += c.array.capacity()*sizeof(uint16_t) + c.bits.capacity()*sizeof(uint64_t);
+    }
+    return sum;
+}
+
+}
@@ -0,0 +1,101 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Compressed bitmap with Roaring-style containers.
+ *
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "akumuli.h"
+
+namespace Akumuli {
+
+/** Compressed bitmap of 64-bit integers.
+  * Value space is split into chunks of 2^16 values. Every non-empty chunk
+  * is stored in container. Sparse containers (up to ARRAY_MAX values) are
+  * stored as sorted arrays of 16-bit values, dense containers are stored as
+  * plain bitsets of 2^16 bits.
+  */
+struct RoaringBitmap {
+
+    enum {
+        ARRAY_MAX   = 4096,          //< Max number of elements in array container
+        BITSET_SIZE = 0x10000/64,    //< Number of 64-bit words in bitset container
+    };
+
+    struct Container {
+        std::vector<uint16_t> array;   //< Sorted values (array container)
+        std::vector<uint64_t> bits;    //< Bitset (bitset container)
+        uint32_t              card;    //< Number of elements
+
+        Container();
+
+        bool is_bitset() const;
+
+        bool contains(uint16_t value) const;
+
+        void add(uint16_t value);
+
+        //! Convert to array or bitset depending on cardinality
+        void optimize();
+    };
+
+    std::vector<uint64_t>  keys_;        //< Sorted chunk keys (high 48 bits)
+    std::vector<Container> containers_;  //< Containers
+
+    //! Add value to bitmap
+    void add(uint64_t value);
+
+    bool contains(uint64_t value) const;
+
+    //! Number of elements
+    size_t cardinality() const;
+
+    //! Size of the intersection without materializing it (can be used for query planning)
+    size_t and_cardinality(RoaringBitmap const& other) const;
+
+    bool empty() const;
+
+    RoaringBitmap operator & (RoaringBitmap const& other) const;
+
+    RoaringBitmap operator | (RoaringBitmap const& other) const;
+
+    //! Elements of this bitmap that are not in `other`
+    RoaringBitmap and_not(RoaringBitmap const& other) const;
+
+    //! Get all values in ascending order
+    std::vector<uint64_t> to_vector() const;
+
+    //! Append serialized bitmap to buffer
+    void serialize(std::vector<char>* out) const;
+
+    /** Read bitmap from buffer.
+      * @param begin points to the beginning of the serialized bitmap
+      * @param size is a size of the buffer
+      * @param out is an output parameter
+      * @return AKU_SUCCESS or AKU_EBAD_DATA if buffer is malformed
+      */
+    static aku_Status deserialize(const char* begin, size_t size, RoaringBitmap* out);
+
+    //! Approximate memory footprint in bytes
+    size_t memory_usage() const;
+};
+
+}
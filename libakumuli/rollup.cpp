@@ -0,0 +1,350 @@
+/**
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rollup.h"
+#include "datetime.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+
+namespace Akumuli {
+
+//  Tier  //
+
+RollupStorage::Tier::Tier(aku_Timestamp step, size_t capacity)
+    : step(step)
+    , capacity(capacity)
+    , first(static_cast<aku_Timestamp>(AKU_MAX_TIMESTAMP))
+    , top(0u)
+{
+}
+
+aku_Timestamp RollupStorage::Tier::horizon() const {
+    aku_Timestamp width = (capacity - 1)*step;
+    return top > width ? top - width : 0u;
+}
+
+bool RollupStorage::Tier::is_live(QP::RollupBucket const& bucket) const {
+    return bucket.count != 0u && bucket.timestamp >= horizon();
+}
+
+QP::RollupBucket* RollupStorage::Tier::get_slot(RingT* ring, aku_Timestamp bucket) {
+    if (ring->empty()) {
+        ring->resize(std::min(capacity, static_cast<size_t>(INITIAL_RING_SIZE)));
+    }
+    while (true) {
+        auto& slot = ring->at(bucket / step % ring->size());
+        // Live buckets can't collide if ring is full sized, all of them are
+        // within [horizon, top] range
+        if (slot.timestamp == bucket || !is_live(slot) || ring->size() == capacity) {
+            return &slot;
+        }
+        RingT resized(std::min(capacity, ring->size()*2));
+        for (auto const& item: *ring) {
+            if (is_live(item)) {
+                resized.at(item.timestamp / step % resized.size()) = item;
+            }
+        }
+        ring->swap(resized);
+    }
+}
+
+void RollupStorage::Tier::add(aku_Timestamp ts, aku_ParamId id, double value) {
+    aku_Timestamp bucket = ts / step * step;
+    if (first == static_cast<aku_Timestamp>(AKU_MAX_TIMESTAMP)) {
+        // Some samples from the first bucket can be written before the tier was created
+        first = bucket + step;
+        top = bucket;
+    }
+    if (bucket > top) {
+        top = bucket;
+    } else if (bucket < horizon()) {
+        return;
+    }
+    auto slot = get_slot(&series[id], bucket);
+    if (slot->timestamp != bucket || !is_live(*slot)) {
+        // Empty or expired slot
+        *slot = { bucket, value, value, value, 1u };
+        return;
+    }
+    slot->min = std::min(slot->min, value);
+    slot->max = std::max(slot->max, value);
+    slot->sum += value;
+    slot->count++;
+}
+
+void RollupStorage::Tier::expire() {
+    for (auto it = series.begin(); it != series.end();) {
+        auto const& ring = it->second;
+        bool live = std::any_of(ring.begin(), ring.end(), [this](QP::RollupBucket const& b) {
+            return is_live(b);
+        });
+        if (live) {
+            it++;
+        } else {
+            it = series.erase(it);
+        }
+    }
+}
+
+//  RollupStorage  //
+
+RollupStorage::RollupStorage(std::vector<TierConfig> const& config)
+    : nsamples_(0u)
+{
+    for (auto const& cfg: config) {
+        tiers_.emplace_back(new Tier(cfg.first, cfg.second));
+    }
+}
+
+aku_Status RollupStorage::parse_config(std::string const& str, std::vector<TierConfig>* out) {
+    std::vector<std::string> items;
+    boost::split(items, str, boost::is_any_of(","));
+    for (auto item: items) {
+        boost::trim(item);
+        if (item.empty()) {
+            continue;
+        }
+        auto pos = item.find(':');
+        if (pos == std::string::npos) {
+            return AKU_EBAD_ARG;
+        }
+        auto step = boost::trim_copy(item.substr(0, pos));
+        auto capacity = boost::trim_copy(item.substr(pos + 1));
+        TierConfig cfg;
+        try {
+            cfg.first = DateTimeUtil::parse_duration(step.c_str(), step.size());
+            cfg.second = std::stoull(capacity);
+        } catch (std::exception const&) {
+            return AKU_EBAD_ARG;
+        }
+        if (cfg.first == 0u || cfg.second == 0u) {
+            return AKU_EBAD_ARG;
+        }
+        out->push_back(cfg);
+    }
+    return AKU_SUCCESS;
+}
+
+void RollupStorage::add(aku_Timestamp ts, aku_ParamId id, double value) {
+    for (auto& tier: tiers_) {
+        std::lock_guard<std::mutex> guard(tier->mutex);
+        tier->add(ts, id, value);
+    }
+    nsamples_++;
+}
+
+void RollupStorage::append(UncompressedChunk const& chunk) {
+    for (auto& tier: tiers_) {
+        std::lock_guard<std::mutex> guard(tier->mutex);
+        for (size_t i = 0; i < chunk.paramids.size(); i++) {
+            tier->add(chunk.timestamps[i], chunk.paramids[i], chunk.values[i]);
+        }
+    }
+    nsamples_ += chunk.paramids.size();
+}
+
+std::vector<QP::RollupTier> RollupStorage::get_tiers() const {
+    std::vector<QP::RollupTier> result;
+    for (auto const& tier: tiers_) {
+        std::lock_guard<std::mutex> guard(tier->mutex);
+        QP::RollupTier item;
+        item.step = tier->step;
+        item.end = tier->top;
+        item.begin = std::min(std::max(tier->first, tier->horizon()), item.end);
+        result.push_back(item);
+    }
+    return result;
+}
+
+void RollupStorage::read(size_t tier,
+                         aku_ParamId id,
+                         aku_Timestamp begin,
+                         aku_Timestamp end,
+                         std::vector<QP::RollupBucket>* out) const
+{
+    out->clear();
+    auto const& t = *tiers_.at(tier);
+    std::lock_guard<std::mutex> guard(t.mutex);
+    auto it = t.series.find(id);
+    if (it == t.series.end()) {
+        return;
+    }
+    for (auto const& bucket: it->second) {
+        if (t.is_live(bucket) && bucket.timestamp >= begin && bucket.timestamp < end) {
+            out->push_back(bucket);
+        }
+    }
+    std::sort(out->begin(), out->end(), [](QP::RollupBucket const& lhs, QP::RollupBucket const& rhs) {
+        return lhs.timestamp < rhs.timestamp;
+    });
+}
+
+//  Snapshot  //
+
+template<class T>
+static void put_value(std::vector<char>* out, T const& value) {
+    auto ptr = reinterpret_cast<const char*>(&value);
+    out->insert(out->end(), ptr, ptr + sizeof(T));
+}
+
+template<class T>
+static bool get_value(const char** it, const char* end, T* value) {
+    if (static_cast<size_t>(end - *it) < sizeof(T)) {
+        return false;
+    }
+    memcpy(value, *it, sizeof(T));
+    *it += sizeof(T);
+    return true;
+}
+
+aku_Status RollupStorage::write_snapshot(std::string const& path) {
+    std::vector<char> body;
+    std::vector<QP::RollupBucket> buckets;
+    for (auto const& tier: tiers_) {
+        std::lock_guard<std::mutex> guard(tier->mutex);
+        tier->expire();
+        put_value<uint64_t>(&body, tier->step);
+        put_value<uint64_t>(&body, tier->capacity);
+        put_value<uint64_t>(&body, tier->first);
+        put_value<uint64_t>(&body, tier->top);
+        put_value<uint64_t>(&body, tier->series.size());
+        for (auto const& kv: tier->series) {
+            buckets.clear();
+            for (auto const& bucket: kv.second) {
+                if (tier->is_live(bucket)) {
+                    buckets.push_back(bucket);
+                }
+            }
+            put_value<uint64_t>(&body, kv.first);
+            put_value<uint64_t>(&body, buckets.size());
+            for (auto const& bucket: buckets) {
+                put_value(&body, bucket);
+            }
+        }
+    }
+    boost::crc_32_type checksum;
+    checksum.process_bytes(body.data(), body.size());
+
+    RollupSnapshotHeader header = {};
+    header.magic    = MAGIC;
+    header.version  = VERSION;
+    header.ntiers   = tiers_.size();
+    header.size     = body.size();
+    header.checksum = checksum.checksum();
+
+    // Write to temporary file and replace old snapshot
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream stream(tmp_path, std::ios::binary|std::ios::trunc);
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(body.data(), body.size());
+        stream.flush();
+        if (!stream) {
+            return AKU_EGENERAL;
+        }
+    }
+    boost::system::error_code error;
+    boost::filesystem::rename(tmp_path, path, error);
+    if (error) {
+        return AKU_EGENERAL;
+    }
+    return AKU_SUCCESS;
+}
+
+aku_Status RollupStorage::read_snapshot(std::string const& path) {
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream) {
+        return AKU_ENOT_FOUND;
+    }
+    RollupSnapshotHeader header;
+    if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        return AKU_EBAD_DATA;
+    }
+    if (header.magic != MAGIC || header.version != VERSION) {
+        return AKU_EBAD_DATA;
+    }
+    std::vector<char> body;
+    try {
+        body.resize(header.size);
+    } catch (std::bad_alloc const&) {
+        return AKU_EBAD_DATA;
+    }
+    stream.read(body.data(), body.size());
+    boost::crc_32_type checksum;
+    checksum.process_bytes(body.data(), body.size());
+    if (!stream || checksum.checksum() != header.checksum) {
+        return AKU_EBAD_DATA;
+    }
+    const char* it = body.data();
+    const char* end = body.data() + body.size();
+    for (uint64_t i = 0; i < header.ntiers; i++) {
+        uint64_t step, capacity, first, top, nseries;
+        if (!get_value(&it, end, &step)     ||
+            !get_value(&it, end, &capacity) ||
+            !get_value(&it, end, &first)    ||
+            !get_value(&it, end, &top)      ||
+            !get_value(&it, end, &nseries))
+        {
+            return AKU_EBAD_DATA;
+        }
+        Tier* target = nullptr;
+        for (auto& tier: tiers_) {
+            if (tier->step == step && tier->capacity == capacity) {
+                target = tier.get();
+            }
+        }
+        std::unique_lock<std::mutex> guard;
+        if (target) {
+            guard = std::unique_lock<std::mutex>(target->mutex);
+            target->first = first;
+            target->top = top;
+            target->series.clear();
+        }
+        for (uint64_t s = 0; s < nseries; s++) {
+            uint64_t id, nbuckets;
+            if (!get_value(&it, end, &id) || !get_value(&it, end, &nbuckets)) {
+                return AKU_EBAD_DATA;
+            }
+            if (nbuckets > static_cast<size_t>(end - it)/sizeof(QP::RollupBucket)) {
+                return AKU_EBAD_DATA;
+            }
+            if (target) {
+                auto& ring = target->series[id];
+                for (uint64_t b = 0; b < nbuckets; b++) {
+                    QP::RollupBucket bucket;
+                    get_value(&it, end, &bucket);
+                    if (target->is_live(bucket) && bucket.timestamp % step == 0u) {
+                        *target->get_slot(&ring, bucket.timestamp) = bucket;
+                    }
+                }
+                if (ring.empty()) {
+                    target->series.erase(id);
+                }
+            } else {
+                it += nbuckets*sizeof(QP::RollupBucket);
+            }
+        }
+    }
+    return AKU_SUCCESS;
+}
+
+}
@@ -0,0 +1,137 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Downsampled series data (rollup tiers).
+ *
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "akumuli.h"
+#include "compression.h"
+#include "queryprocessor_framework.h"
+
+namespace Akumuli {
+
+//! Rollup snapshot file header
+struct RollupSnapshotHeader {
+    uint32_t magic;         //< File signature
+    uint32_t version;       //< Format version
+    uint64_t ntiers;        //< Number of tiers
+    uint64_t size;          //< Size of the body in bytes
+    uint32_t checksum;      //< CRC32 of the body
+} __attribute__((packed));
+
+
+/** Rollup tiers.
+  * Each tier stores min, max, sum and count of every series for the fixed-size
+  * time buckets (e.g. one minute or one hour). Tiers are updated incrementally
+  * from the sorted output of the sequencer, so every sample is processed once
+  * when it's written to the volume. Only last `capacity` buckets are retained.
+  * Bucket is complete when the sequencer moves past its end, samples that
+  * arrive late (e.g. after restart) update complete buckets in place.
+  */
+struct RollupStorage : QP::IRollupStorage {
+
+    static const uint32_t MAGIC   = 0x52524b41;  // "AKRR"
+    static const uint32_t VERSION = 1;
+
+    //! Tier configuration (bucket width, number of buckets to keep)
+    typedef std::pair<aku_Timestamp, size_t> TierConfig;
+
+    /** Buckets of the single series.
+      * Bucket is stored in slot `(timestamp/step) % ring.size()`. Ring starts small
+      * and grows up to tier capacity when two live buckets collide. Buckets older
+      * than tier horizon are not removed, they're treated as empty and overwritten
+      * on the next write to their slot.
+      */
+    typedef std::vector<QP::RollupBucket> RingT;
+
+    struct Tier {
+        enum {
+            INITIAL_RING_SIZE = 8,
+        };
+
+        aku_Timestamp   step;
+        size_t          capacity;
+        aku_Timestamp   first;      //< Beginning of the first complete bucket
+        aku_Timestamp   top;        //< Beginning of the newest bucket (the only one that is still open)
+        std::unordered_map<aku_ParamId, RingT> series;
+        mutable std::mutex mutex;
+
+        Tier(aku_Timestamp step, size_t capacity);
+
+        //! Beginning of the oldest retained bucket
+        aku_Timestamp horizon() const;
+
+        //! Check that bucket is not empty and not expired
+        bool is_live(QP::RollupBucket const& bucket) const;
+
+        //! Get slot for the bucket (ring is resized if slot is occupied by another live bucket)
+        QP::RollupBucket* get_slot(RingT* ring, aku_Timestamp bucket);
+
+        void add(aku_Timestamp ts, aku_ParamId id, double value);
+
+        //! Remove series that doesn't have live buckets
+        void expire();
+    };
+
+    std::vector<std::unique_ptr<Tier>> tiers_;
+    uint64_t nsamples_;  //< Number of samples added to tiers
+
+    RollupStorage(std::vector<TierConfig> const& config);
+
+    /** Parse tiers configuration string.
+      * @param str is a comma separated list of `step:capacity` pairs (e.g. "1m:1440,1h:720")
+      * @param out is an output parameter
+      * @return AKU_SUCCESS or AKU_EBAD_ARG if string is malformed
+      */
+    static aku_Status parse_config(std::string const& str, std::vector<TierConfig>* out);
+
+    //! Add single value to all tiers
+    void add(aku_Timestamp ts, aku_ParamId id, double value);
+
+    //! Add all values from the chunk (in time order) to all tiers
+    void append(UncompressedChunk const& chunk);
+
+    //! Read tiers from file, tiers that doesn't match current configuration are skipped
+    aku_Status read_snapshot(std::string const& path);
+
+    //! Write all tiers to file, series without live buckets are removed
+    aku_Status write_snapshot(std::string const& path);
+
+    // IRollupStorage interface
+
+    virtual std::vector<QP::RollupTier> get_tiers() const;
+
+    virtual void read(size_t tier,
+                      aku_ParamId id,
+                      aku_Timestamp begin,
+                      aku_Timestamp end,
+                      std::vector<QP::RollupBucket>* out) const;
+};
+
+typedef std::shared_ptr<RollupStorage> PRollupStorage;
+
+}
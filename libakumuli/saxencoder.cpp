@@ -16,6 +16,7 @@
  */
 
 #include "saxencoder.h"
+#include <cmath>
 #include <map>
 
 namespace Akumuli {
@@ -23,32 +24,6 @@ namespace SAX {
 
 #define AKU_ZNORM_THRESHOLD 1e-10
 
-template<class It>
-std::tuple<double, double> mean_and_stddev(It begin, It end) {
-    size_t size = std::distance(begin, end);
-    if (size == 0) {
-        return std::make_tuple(NAN, NAN);
-    }
-    double sqrsum = 0;
-    double sum = 0;
-    int count = 0;
-    for (auto it = begin; it < end; it++) {
-        auto val = *it;
-        sqrsum += val * val;
-        sum += val;
-        count += 1;
-    }
-    double stddev;
-    if (size > 1) {
-        stddev = sqrt((size * sqrsum - sum * sum) / (size * (size - 1)));
-    } else {
-        stddev = NAN;
-    }
-    double mean = sum / size;
-    return std::make_tuple(mean, stddev);
-}
-
-
 // source: https://github.com/jMotif/SAX/blob/master/src/main/java/net/seninp/jmotif/sax/alphabet/NormalAlphabet.java
 static const std::map<int, std::vector<double>> CUTPOINTS = {
     {  2, {  0.0                 }},
@@ -126,45 +101,6 @@ static const std::map<int, std::vector<double>> CUTPOINTS = {
              1.036433389493790,  1.281551565544600,  1.644853626951470   }},
 };
 
-static const char ALPHABET[] = {
-    'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u' // 21 symbols
-};
-
-static char to_char(double value, const std::vector<double>& cuts) {
-    for (auto i = 0u; i < cuts.size(); i++) {
-        if (value < cuts[i]) {
-            return ALPHABET[i];
-        }
-    }
-    return ALPHABET[cuts.size()];
-}
-
-//! Convert array of doubles to characters (both array modified in-place)
-static void saxify(const boost::circular_buffer<double>& input, std::string& output, double threshold, int alphabet_size) {
-    auto it = CUTPOINTS.find(alphabet_size);
-    if (it == CUTPOINTS.end()) {
-        std::runtime_error error("invalid alphabet size");
-        BOOST_THROW_EXCEPTION(error);
-    }
-    const std::vector<double>& cuts = it->second;
-
-    double mean, stddev;
-    std::tie(mean, stddev) = mean_and_stddev(input.begin(), input.end());
-    auto size = input.size();
-    output.resize(size);
-    if (stddev < threshold) {
-        for (size_t i = 0; i < size; i++) {
-            double val = input[i] - mean;
-            output[i] = to_char(val, cuts);
-        }
-    } else {
-        for (size_t i = 0; i < size; i++) {
-            double val = (input[i] - mean) / stddev;
-            output[i] = to_char(val, cuts);
-        }
-    }
-}
-
 int leading_zeroes(int value) {
     return value == 0 ? sizeof(value)*8 : __builtin_clz(value);
 }
@@ -173,27 +109,91 @@ int leading_zeroes(int value) {
 SAXEncoder::SAXEncoder()
     : alphabet_(0)
     , window_width_(0)
-    , input_samples_(1)
+    , pos_(0)
+    , count_(0)
+    , sum_(0)
+    , sqrsum_(0)
+    , has_last_(false)
 {
 }
 
 SAXEncoder::SAXEncoder(int alphabet, int window_width)
     : alphabet_(alphabet)
     , window_width_(window_width)
-    , input_samples_(window_width)
+    , window_(2*window_width, 0.0)
+    , pos_(0)
+    , count_(0)
+    , sum_(0)
+    , sqrsum_(0)
+    , word_(window_width)
+    , last_(window_width)
+    , has_last_(false)
 {
+    auto it = CUTPOINTS.find(alphabet_);
+    if (it == CUTPOINTS.end()) {
+        std::runtime_error error("invalid alphabet size");
+        BOOST_THROW_EXCEPTION(error);
+    }
+    cuts_ = it->second;
+    bounds_.resize(cuts_.size());
+}
+
+void SAXEncoder::saxify() {
+    const size_t size = static_cast<size_t>(window_width_);
+    double mean = sum_/size;
+    double stddev = NAN;
+    if (size > 1) {
+        stddev = sqrt(std::max(0.0, (size*sqrsum_ - sum_*sum_)/(size*(size - 1))));
+    }
+    // value is mapped to symbol `i` if `cuts[i-1] <= (value - mean)/stddev < cuts[i]`,
+    // the same can be done without division using scaled breakpoints
+    double scale = stddev < AKU_ZNORM_THRESHOLD ? 1.0 : stddev;
+    const size_t ncuts = cuts_.size();
+    for (size_t i = 0; i < ncuts; i++) {
+        bounds_[i] = mean + cuts_[i]*scale;
+    }
+    const double* __restrict__ values = window_.data() + pos_;
+    char* __restrict__ word = word_.data();
+    std::fill(word, word + size, 'a');
+    for (size_t i = 0; i < ncuts; i++) {
+        const double bound = bounds_[i];
+        for (size_t j = 0; j < size; j++) {
+            word[j] += values[j] >= bound ? 1 : 0;
+        }
+    }
 }
 
 bool SAXEncoder::encode(double sample, char *outword, size_t outword_size) {
-    input_samples_.push_back(sample);
-    if (input_samples_.full()) {
-        // scan samples
-        saxify(input_samples_, buffer_, AKU_ZNORM_THRESHOLD, alphabet_);
-        if (buffer_ != last_) {
+    const size_t size = static_cast<size_t>(window_width_);
+    if (count_ == size) {
+        double old = window_[pos_];
+        sum_ -= old;
+        sqrsum_ -= old*old;
+    } else {
+        count_++;
+    }
+    window_[pos_] = sample;
+    window_[pos_ + size] = sample;
+    sum_ += sample;
+    sqrsum_ += sample*sample;
+    pos_++;
+    if (pos_ == size) {
+        pos_ = 0;
+        // Recalculate window statistics to prevent error accumulation
+        sum_ = 0;
+        sqrsum_ = 0;
+        for (size_t i = 0; i < count_; i++) {
+            sum_ += window_[i];
+            sqrsum_ += window_[i]*window_[i];
+        }
+    }
+    if (count_ == size) {
+        saxify();
+        if (!has_last_ || !std::equal(word_.begin(), word_.end(), last_.begin())) {
             // Simple numerocity reduction
-            last_ = buffer_;
-            memcpy(outword, buffer_.data(), buffer_.size());
-            buffer_.clear();
+            std::swap(word_, last_);
+            has_last_ = true;
+            memcpy(outword, last_.data(), std::min(size, outword_size));
             return true;
         }
     }
@@ -16,8 +16,14 @@
  */
 #pragma once
 
-#include <boost/circular_buffer.hpp>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
 #include <boost/range.hpp>
+#include <boost/throw_exception.hpp>
 
 
 namespace Akumuli {
@@ -210,15 +216,27 @@ struct SAXWord {
 };
 
 
-//! Symbolic Aggregate approXimmation encoder.
+/** Symbolic Aggregate approXimmation encoder.
+  * Window statistics (sum and sum of squares) are updated incrementally,
+  * samples are converted to symbols by comparing them with breakpoints
+  * scaled by window mean and stddev so no per-sample normalization or
+  * allocation is needed.
+  */
 struct SAXEncoder
 {
     int alphabet_;      //! alphabet size
     int window_width_;  //! sliding window width
 
-    boost::circular_buffer<double> input_samples_;
-    std::string buffer_;
-    std::string last_;
+    std::vector<double> cuts_;      //< Breakpoints of the normal distribution for the alphabet
+    std::vector<double> window_;    //< Every sample is stored twice so window is always contiguous
+    size_t              pos_;       //< Position of the oldest sample in window
+    size_t              count_;     //< Number of samples in window
+    double              sum_;       //< Running sum of the window
+    double              sqrsum_;    //< Running sum of squares of the window
+    std::vector<double> bounds_;    //< Scaled breakpoints (scratch space)
+    std::vector<char>   word_;      //< Current word
+    std::vector<char>   last_;      //< Previously returned word
+    bool                has_last_;
 
     SAXEncoder();
 
@@ -233,6 +251,10 @@ struct SAXEncoder
      * @returns true if new sax word returned; false otherwise
      */
     bool encode(double sample, char *outword, size_t outword_size);
+
+private:
+    //! Convert current window to symbols
+    void saxify();
 };
 
 }
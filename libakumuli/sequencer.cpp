@@ -18,6 +18,8 @@
 #include "akumuli_def.h"
 #include "sequencer.h"
 #include "util.h"
+#include "tracing.h"
+#include "metrics.h"
 #include "compression.h"
 
 #include <future>
@@ -116,6 +118,7 @@ aku_Timestamp Sequencer::get_timestamp_(aku_Timestamp cp) const {
 
 // move sorted runs to ready_ collection
 int Sequencer::make_checkpoint_(aku_Timestamp new_checkpoint) {
+    AKU_TRACE_SPAN("sequencer.make_checkpoint");
     int flag = sequence_number_.fetch_add(1) + 1;
     if (flag % 2 != 0) {
         auto old_top = get_timestamp_(checkpoint_);
@@ -187,6 +190,8 @@ std::tuple<aku_Status, int> Sequencer::check_timestamp_(aku_Timestamp ts) {
 }
 
 std::tuple<aku_Status, int> Sequencer::add(TimeSeriesValue const& value) {
+    // Called for every sample, only slow calls (a few microseconds) are recorded
+    AKU_TRACE_SLOW_SPAN("sequencer.add", 10000u);
     aku_Status status = AKU_SUCCESS;
     int lock = 0;
     tie(status, lock) = check_timestamp_(value.get_timestamp());
@@ -239,7 +244,7 @@ void unlock_all(Cont& cont) {
     }
 }
 
-aku_Status Sequencer::close(PageHeader* target) {
+aku_Status Sequencer::close(PageHeader* target, RollupStorage* rollup, SubscriptionRegistry* subscriptions) {
     wrlock_all(run_locks_);
     for (auto& sorted_run: runs_) {
         ready_.push_back(move(sorted_run));
@@ -252,7 +257,7 @@ aku_Status Sequencer::close(PageHeader* target) {
 
     sequence_number_.store(1);
     if (!ready_.empty()) {
-        return merge_and_compress(target, true);
+        return merge_and_compress(target, true, rollup, subscriptions);
     }
     return AKU_SUCCESS;
 }
@@ -413,7 +418,12 @@ void Sequencer::merge(Caller& caller, InternalCursor* cur) {
 }
 
 
-aku_Status Sequencer::merge_and_compress(PageHeader* target, bool enforce_write) {
+aku_Status Sequencer::merge_and_compress(PageHeader* target,
+                                         bool enforce_write,
+                                         RollupStorage* rollup,
+                                         SubscriptionRegistry* subscriptions)
+{
+    AKU_TRACE_SPAN("sequencer.merge_and_compress");
     bool owns_lock = sequence_number_.load() % 2;  // progress_flag_ must be odd to start
     if (!owns_lock) {
         return AKU_EBUSY;
@@ -421,6 +431,8 @@ aku_Status Sequencer::merge_and_compress(PageHeader* target, bool enforce_write)
     if (ready_.size() == 0) {
         return AKU_ENO_DATA;
     }
+    Metrics::library().merges.inc();
+    Metrics::ScopedTimer timer(Metrics::library().merge_duration);
 
     aku_Status status = AKU_SUCCESS;
 
@@ -444,6 +456,12 @@ aku_Status Sequencer::merge_and_compress(PageHeader* target, bool enforce_write)
                 AKU_PANIC("Invalid chunk");
             }
             status = target->complete_chunk(reindexed_header);
+            if (status == AKU_SUCCESS && rollup) {
+                rollup->append(chunk_header);
+            }
+            if (status == AKU_SUCCESS && subscriptions) {
+                subscriptions->publish(chunk_header);
+            }
         } else {
             // Wait for more data
             status = AKU_ENO_DATA;
@@ -483,6 +501,19 @@ std::tuple<aku_Timestamp, int> Sequencer::get_window() const {
 }
 
 
+std::tuple<aku_Timestamp, aku_ParamId> Sequencer::get_low_watermark() const {
+    auto result = std::make_tuple(static_cast<aku_Timestamp>(AKU_MAX_TIMESTAMP),
+                                  static_cast<aku_ParamId>(AKU_LIMITS_MAX_ID));
+    Lock guard(runs_resize_lock_);
+    for (auto const& run: runs_) {
+        if (!run->empty()) {
+            auto const& top = run->front();
+            result = std::min(result, std::make_tuple(top.key_ts_, top.key_id_));
+        }
+    }
+    return result;
+}
+
 void Sequencer::filter(PSortedRun run, std::shared_ptr<QP::IQueryProcessor> q, std::vector<PSortedRun>* results) const {
     if (run->empty()) {
         return;
@@ -497,6 +528,7 @@ void Sequencer::filter(PSortedRun run, std::shared_ptr<QP::IQueryProcessor> q, s
 }
 
 void Sequencer::search(std::shared_ptr<QP::IQueryProcessor> query, int sequence_number) const {
+    AKU_TRACE_SPAN("sequencer.search");
     int seq_id = sequence_number_.load();
     if (seq_id % 2 != 0 || sequence_number != seq_id) {
         query->set_error(AKU_EBUSY);
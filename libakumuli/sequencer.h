@@ -24,6 +24,8 @@
 #include "page.h"
 #include "cursor.h"
 #include "queryprocessor_framework.h"
+#include "rollup.h"
+#include "subscription.h"
 
 #include <tuple>
 #include <vector>
@@ -112,11 +114,16 @@ struct Sequencer {
     /** Merge all values (ts, id, offset, length)
       * and write it to target page.
       * caller and cur parameters used for communication with storage (error reporting).
+      * @param rollup if not null, all values written to target page are added to rollup tiers
+      * @param subscriptions if not null, all values written to target page are published to continuous queries
       */
-    aku_Status merge_and_compress(PageHeader* target, bool enforce_write=false);
+    aku_Status merge_and_compress(PageHeader* target,
+                                  bool enforce_write=false,
+                                  RollupStorage* rollup=nullptr,
+                                  SubscriptionRegistry* subscriptions=nullptr);
 
     //! Close cache for writing, merge everything to page header.
-    aku_Status close(PageHeader* target);
+    aku_Status close(PageHeader* target, RollupStorage* rollup=nullptr, SubscriptionRegistry* subscriptions=nullptr);
 
     /** Reset sequencer.
       * All runs are ready for merging.
@@ -138,6 +145,12 @@ struct Sequencer {
 
     std::tuple<aku_Timestamp, int> get_window() const;
 
+    /** Get smallest key (timestamp, paramid) that is still stored in sequencer.
+      * All values with smaller keys are merged and written to page already.
+      * @note should be called from writer thread
+      */
+    std::tuple<aku_Timestamp, aku_ParamId> get_low_watermark() const;
+
 private:
     //! Checkpoint id = ⌊timestamp/window_size⌋
     aku_Timestamp get_checkpoint_(aku_Timestamp ts) const;
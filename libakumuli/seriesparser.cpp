@@ -46,12 +46,20 @@ SeriesMatcher::SeriesMatcher(uint64_t starting_id)
     }
 }
 
+aku_Status SeriesMatcher::load_snapshot(std::string const& path, uint64_t* max_id) {
+    // Tag index is loaded from snapshot as is
+    auto status = SeriesSnapshot::read(path, &pool, &index, &snapshot);
+    *max_id = status == AKU_SUCCESS ? snapshot.max_id : 0ul;
+    return status;
+}
+
 uint64_t SeriesMatcher::add(const char* begin, const char* end) {
     auto id = series_id++;
     StringT pstr = pool.add(begin, end, id);
     auto tup = std::make_tuple(std::get<0>(pstr), std::get<1>(pstr), id);
     table[pstr] = id;
     inv_table[id] = pstr;
+    index.add(begin, end, id);
     names.push_back(tup);
     return id;
 }
@@ -65,6 +73,7 @@ void SeriesMatcher::_add(std::string series, uint64_t id) {
     StringT pstr = pool.add(begin, end, id);
     table[pstr] = id;
     inv_table[id] = pstr;
+    index.add(begin, end, id);
 }
 
 uint64_t SeriesMatcher::match(const char* begin, const char* end) {
@@ -74,7 +83,7 @@ uint64_t SeriesMatcher::match(const char* begin, const char* end) {
 
     auto it = table.find(str);
     if (it == table.end()) {
-        return 0ul;
+        return snapshot.match(str);
     }
     return it->second;
 }
@@ -82,7 +91,7 @@ uint64_t SeriesMatcher::match(const char* begin, const char* end) {
 SeriesMatcher::StringT SeriesMatcher::id2str(uint64_t tokenid) const {
     auto it = inv_table.find(tokenid);
     if (it == inv_table.end()) {
-        return EMPTY;
+        return snapshot.id2str(tokenid);
     }
     return it->second;
 }
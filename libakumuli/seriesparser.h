@@ -18,6 +18,8 @@
 #include "akumuli_def.h"
 //#include "queryprocessor_framework.h"
 #include "stringpool.h"
+#include "seriessnapshot.h"
+#include "tagindex.h"
 
 #include <stdint.h>
 #include <map>
@@ -52,9 +54,19 @@ struct SeriesMatcher {
     uint64_t                 series_id;  //! Series ID counter
     std::vector<SeriesNameT> names;      //! List of recently added names
     std::mutex               mutex;      //! Mutex for shared data
+    SeriesSnapshot           snapshot;   //! Series loaded from snapshot (not in `table` and `inv_table`)
+    TagIndex                 index;      //! Tag index (includes series from snapshot)
 
     SeriesMatcher(uint64_t starting_id);
 
+    /** Load series from snapshot file. Series from snapshot are not
+      * added to hash tables, snapshot index is used to find them. Tag index
+      * is loaded from the snapshot too, series names are not parsed.
+      * @param path is a path to snapshot file
+      * @param max_id is an output parameter that receives largest id covered by snapshot
+      */
+    aku_Status load_snapshot(std::string const& path, uint64_t* max_id);
+
     /** Add new string to matcher.
       */
     uint64_t add(const char* begin, const char* end);
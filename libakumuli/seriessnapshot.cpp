@@ -0,0 +1,238 @@
+/**
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seriessnapshot.h"
+
+#include <cstring>
+#include <fstream>
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+
+namespace Akumuli {
+
+static const SeriesSnapshot::StringT EMPTY = std::make_pair(nullptr, 0);
+
+//! Size of the pool entry: name, \0, 64-bit id, \0
+static size_t entry_size(size_t name_len) {
+    return name_len + 2 + sizeof(uint64_t);
+}
+
+static uint64_t entry_id(const char* name, size_t name_len) {
+    uint64_t id;
+    memcpy(&id, name + name_len + 1, sizeof(id));
+    return id;
+}
+
+/** Iterate through all entries of the bin.
+  * @param fn is called with pointer to the entry name and its length
+  */
+template<class Fn>
+static void for_each_entry(const char* begin, size_t size, Fn const& fn) {
+    const char* end = begin + size;
+    const char* it = begin;
+    while (it < end) {
+        auto zero = static_cast<const char*>(memchr(it, '\0', end - it));
+        if (zero == nullptr || zero + 1 + sizeof(uint64_t) >= end) {
+            break;
+        }
+        size_t len = zero - it;
+        fn(it, len);
+        it += entry_size(len);
+    }
+}
+
+SeriesSnapshot::SeriesSnapshot()
+    : arena(nullptr)
+    , arena_size(0u)
+    , min_id(0u)
+    , max_id(0u)
+    , nseries(0u)
+{
+}
+
+uint64_t SeriesSnapshot::match(StringT str) const {
+    if (table.empty()) {
+        return 0ul;
+    }
+    size_t mask = table.size() - 1;
+    size_t ix = StringTools::hash(str) & mask;
+    while (table[ix] != 0) {
+        const char* name = arena + table[ix] - 1;
+        if (StringTools::equal(str, std::make_pair(name, static_cast<int>(strlen(name))))) {
+            return entry_id(name, str.second);
+        }
+        ix = (ix + 1) & mask;
+    }
+    return 0ul;
+}
+
+SeriesSnapshot::StringT SeriesSnapshot::id2str(uint64_t id) const {
+    if (id < min_id || id - min_id >= ids.size() || ids[id - min_id] == 0) {
+        return EMPTY;
+    }
+    const char* name = arena + ids[id - min_id] - 1;
+    return std::make_pair(name, static_cast<int>(strlen(name)));
+}
+
+static uint32_t snapshot_checksum(std::vector<char> const& arena,
+                                  std::vector<uint64_t> const& table,
+                                  std::vector<uint64_t> const& ids,
+                                  std::vector<char> const& index)
+{
+    boost::crc_32_type checksum;
+    checksum.process_bytes(arena.data(), arena.size());
+    checksum.process_bytes(table.data(), table.size()*sizeof(uint64_t));
+    checksum.process_bytes(ids.data(), ids.size()*sizeof(uint64_t));
+    checksum.process_bytes(index.data(), index.size());
+    return checksum.checksum();
+}
+
+aku_Status SeriesSnapshot::read(std::string const& path, StringPool* pool, TagIndex* index, SeriesSnapshot* out) {
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream) {
+        return AKU_ENOT_FOUND;
+    }
+    SeriesSnapshotHeader header;
+    if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        return AKU_EBAD_DATA;
+    }
+    if (header.magic != MAGIC || header.version != VERSION) {
+        return AKU_EBAD_DATA;
+    }
+    if (header.table_size & (header.table_size - 1)) {
+        // Hash table size should be a power of two
+        return AKU_EBAD_DATA;
+    }
+    std::vector<char> arena, indexbuf;
+    std::vector<uint64_t> table, ids;
+    try {
+        arena.resize(header.arena_size);
+        table.resize(header.table_size);
+        ids.resize(header.ids_size);
+        indexbuf.resize(header.index_size);
+    } catch (std::bad_alloc const&) {
+        return AKU_EBAD_DATA;
+    }
+    stream.read(arena.data(), arena.size());
+    stream.read(reinterpret_cast<char*>(table.data()), table.size()*sizeof(uint64_t));
+    stream.read(reinterpret_cast<char*>(ids.data()), ids.size()*sizeof(uint64_t));
+    stream.read(indexbuf.data(), indexbuf.size());
+    if (!stream || snapshot_checksum(arena, table, ids, indexbuf) != header.checksum) {
+        return AKU_EBAD_DATA;
+    }
+    if (!index->deserialize(indexbuf.data(), indexbuf.data() + indexbuf.size())) {
+        return AKU_EBAD_DATA;
+    }
+    out->arena_size = arena.size();
+    out->table.swap(table);
+    out->ids.swap(ids);
+    out->min_id = header.min_id;
+    out->max_id = header.max_id;
+    out->nseries = header.nseries;
+    // Vector's buffer doesn't move when vector itself is moved
+    out->arena = arena.data();
+    pool->add_bin(std::move(arena), header.nseries);
+    return AKU_SUCCESS;
+}
+
+aku_Status SeriesSnapshot::write(std::string const& path, StringPool const& pool, uint64_t max_id) {
+    // Build arena (only series that already stored in sqlite)
+    std::vector<char> arena;
+    uint64_t min_id = ~0ul;
+    uint64_t top_id = 0ul;
+    size_t nseries = 0;
+    auto bins = pool.get_bins();
+    for (auto bin: bins) {
+        for_each_entry(bin.first, bin.second, [&](const char* name, size_t len) {
+            auto id = entry_id(name, len);
+            if (id > max_id || len == 0) {
+                return;
+            }
+            arena.insert(arena.end(), name, name + entry_size(len));
+            min_id = std::min(min_id, id);
+            top_id = std::max(top_id, id);
+            nseries++;
+        });
+    }
+    if (nseries == 0) {
+        min_id = 0;
+    }
+
+    // Build tables
+    size_t table_size = 16;
+    while (table_size < nseries*2) {
+        table_size *= 2;
+    }
+    std::vector<uint64_t> table(table_size, 0ul);
+    std::vector<uint64_t> ids(nseries ? top_id - min_id + 1 : 0, 0ul);
+    const size_t mask = table_size - 1;
+    for_each_entry(arena.data(), arena.size(), [&](const char* name, size_t len) {
+        uint64_t offset = static_cast<uint64_t>(name - arena.data()) + 1;
+        size_t ix = StringTools::hash(std::make_pair(name, static_cast<int>(len))) & mask;
+        while (table[ix] != 0) {
+            ix = (ix + 1) & mask;
+        }
+        table[ix] = offset;
+        ids[entry_id(name, len) - min_id] = offset;
+    });
+
+    // Build tag index in id order (posting lists are appended without reordering)
+    TagIndex index;
+    for (size_t ix = 0; ix < ids.size(); ix++) {
+        if (ids[ix] != 0) {
+            const char* name = arena.data() + ids[ix] - 1;
+            index.add(name, name + strlen(name), min_id + ix);
+        }
+    }
+    std::vector<char> indexbuf;
+    index.serialize(&indexbuf);
+
+    SeriesSnapshotHeader header = {};
+    header.magic      = MAGIC;
+    header.version    = VERSION;
+    header.nseries    = nseries;
+    header.min_id     = min_id;
+    header.max_id     = max_id;
+    header.arena_size = arena.size();
+    header.table_size = table.size();
+    header.ids_size   = ids.size();
+    header.index_size = indexbuf.size();
+    header.checksum   = snapshot_checksum(arena, table, ids, indexbuf);
+
+    // Write to temporary file and replace old snapshot
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream stream(tmp_path, std::ios::binary|std::ios::trunc);
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(arena.data(), arena.size());
+        stream.write(reinterpret_cast<const char*>(table.data()), table.size()*sizeof(uint64_t));
+        stream.write(reinterpret_cast<const char*>(ids.data()), ids.size()*sizeof(uint64_t));
+        stream.write(indexbuf.data(), indexbuf.size());
+        stream.flush();
+        if (!stream) {
+            return AKU_EGENERAL;
+        }
+    }
+    boost::system::error_code error;
+    boost::filesystem::rename(tmp_path, path, error);
+    if (error) {
+        return AKU_EGENERAL;
+    }
+    return AKU_SUCCESS;
+}
+
+}
@@ -0,0 +1,94 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Binary snapshot of the series dictionary.
+ *
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "akumuli.h"
+#include "stringpool.h"
+#include "tagindex.h"
+
+namespace Akumuli {
+
+//! Snapshot file header
+struct SeriesSnapshotHeader {
+    uint32_t magic;         //< File signature
+    uint32_t version;       //< Format version
+    uint64_t nseries;       //< Number of series in snapshot
+    uint64_t min_id;        //< Smallest series id
+    uint64_t max_id;        //< Largest series id, everything above it should be read from sqlite
+    uint64_t arena_size;    //< Size of the string arena in bytes
+    uint64_t table_size;    //< Number of hash table slots
+    uint64_t ids_size;      //< Number of id table slots
+    uint64_t index_size;    //< Size of the serialized tag index in bytes
+    uint32_t checksum;      //< CRC32 of the arena, both tables and the tag index
+} __attribute__((packed));
+
+
+/** Series dictionary snapshot.
+  * @brief File contains string arena in string pool format (so it can be used as
+  * a string pool bin as is), open addressing hash table (name to arena offset)
+  * and direct id table (id to arena offset), followed by the serialized tag
+  * index of the same series. All data is position independent and can be
+  * used without any per-series processing. Offsets in both tables are stored
+  * with +1 bias, zero marks empty slot.
+  */
+struct SeriesSnapshot {
+    typedef StringTools::StringT StringT;
+
+    static const uint32_t MAGIC   = 0x53534b41;  // "AKSS"
+    static const uint32_t VERSION = 2;
+
+    const char*             arena;       //< Arena (owned by string pool)
+    size_t                  arena_size;
+    std::vector<uint64_t>   table;       //< Hash table (size is a power of two)
+    std::vector<uint64_t>   ids;         //< Id table, `id - min_id` is an index
+    uint64_t                min_id;
+    uint64_t                max_id;
+    size_t                  nseries;
+
+    SeriesSnapshot();
+
+    //! Find series id by name, return 0 if not found
+    uint64_t match(StringT str) const;
+
+    //! Find series name by id
+    StringT id2str(uint64_t id) const;
+
+    /** Read snapshot from file. Arena is added to the pool as a new bin.
+      * @param path is a path to snapshot file
+      * @param pool is a string pool that will own the arena
+      * @param index is a tag index that receives posting lists of the snapshot
+      * @param out is an output parameter
+      */
+    static aku_Status read(std::string const& path, StringPool* pool, TagIndex* index, SeriesSnapshot* out);
+
+    /** Write snapshot of the string pool to file.
+      * @param path is a path to snapshot file
+      * @param pool is a string pool to save
+      * @param max_id series with larger ids are not saved (they are not in sqlite yet)
+      */
+    static aku_Status write(std::string const& path, StringPool const& pool, uint64_t max_id);
+};
+
+}
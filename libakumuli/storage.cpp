@@ -20,8 +20,12 @@
 #include "util.h"
 #include "cursor.h"
 #include "queryprocessor.h"
+#include "queryparser.h"
+#include "tracing.h"
+#include "metrics.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <cstdarg>
 #include <stdexcept>
 #include <algorithm>
@@ -125,6 +129,8 @@ void Volume::close() {
 }
 
 void Volume::flush() {
+    AKU_TRACE_SPAN("volume.flush");
+    Metrics::ScopedTimer timer(Metrics::library().flush_duration);
     mmap_.flush();
     page_->create_checkpoint();
     mmap_.flush(0, sizeof(PageHeader));
@@ -187,10 +193,21 @@ struct VolumeIterator {
 
 static void zero_deleter(SeriesMatcher*) {}
 
+//! Returns path prefix for the files stored next to metadata file (write-ahead log, series snapshot)
+static std::string get_storage_prefix(const char* path) {
+    boost::filesystem::path prefix(path);
+    prefix.replace_extension();
+    return prefix.string();
+}
+
 Storage::Storage(const char* path, aku_FineTuneParams const& params)
     : config_(params)
     , open_error_code_(AKU_SUCCESS)
     , logger_(params.logger)
+    , subscriptions_(std::make_shared<SubscriptionRegistry>())
+    , persisted_id_(0u)
+    , snapshot_id_(0u)
+    , rollup_samples_(0u)
     , local_matcher_(&zero_deleter)
 {
     // 0. Check that file exists
@@ -221,8 +238,36 @@ Storage::Storage(const char* path, aku_FineTuneParams const& params)
 
     ttl_ = config_.window_size;
 
+    snapshot_path_ = get_storage_prefix(path) + ".series";
+
     // init cache
     cache_.reset(new ChunkCache(config_.max_cache_size));
+    if (config_.query_cache_size != 0) {
+        query_cache_.reset(new QueryCache(config_.query_cache_size));
+    }
+
+    // init rollup tiers
+    std::vector<RollupStorage::TierConfig> tiers;
+    if (config_.rollup_tiers != nullptr
+        && RollupStorage::parse_config(config_.rollup_tiers, &tiers) != AKU_SUCCESS)
+    {
+        (*logger_)(AKU_LOG_ERROR, "invalid rollup tiers configuration, rollups disabled");
+        tiers.clear();
+    }
+    config_.rollup_tiers = nullptr;  // string is owned by the caller
+    if (!tiers.empty()) {
+        rollup_path_ = get_storage_prefix(path) + ".rollup";
+        rollup_ = std::make_shared<RollupStorage>(tiers);
+        auto status = rollup_->read_snapshot(rollup_path_);
+        if (status == AKU_SUCCESS) {
+            log_message("rollup tiers loaded from snapshot");
+        } else if (status != AKU_ENOT_FOUND) {
+            log_error("rollup snapshot is corrupted");
+            rollup_ = std::make_shared<RollupStorage>(tiers);
+        }
+        // Snapshot is kept until it gets rewritten, if the process crashes only the samples
+        // merged after the last snapshot are missing from rollups
+    }
 
     // create volumes list
     for(auto path: v_iter.volume_names) {
@@ -235,22 +280,67 @@ Storage::Storage(const char* path, aku_FineTuneParams const& params)
     select_active_page();
 
     prepopulate_cache(config_.max_cache_size);
+
+    if (config_.enable_wal) {
+        open_wal(path);
+    }
+}
+
+Storage::~Storage() {
+    if (metadata_) {
+        metadata_->stop_writer();
+    }
 }
 
 void Storage::close() {
-    auto status = active_volume_->cache_->close(active_page_);
+    auto status = active_volume_->cache_->close(active_page_, rollup_.get(), subscriptions_.get());
     if (status != AKU_SUCCESS) {
         std::stringstream fmt;
         fmt << "Can't merge cached values back to disk, some data would be lost. Reason: " << aku_error_message(status);
         log_error(fmt.str().c_str());
-        return;
+    } else {
+        active_volume_->flush();
+        if (wal_) {
+            checkpoint_wal_();
+        }
+        if (rollup_) {
+            write_rollup_snapshot_();
+        }
+    }
+    if (wal_) {
+        // Unmerged values will be replayed from the log on next open
+        wal_->close();
     }
-    active_volume_->flush();
+    subscriptions_->stop_all();
     // Update metadata store
     std::vector<SeriesMatcher::SeriesNameT> names;
     matcher_->pull_new_names(&names);
-    if (!names.empty()) {
-        metadata_->insert_new_names(names);
+    metadata_->insert_new_names_async(std::move(names));
+    metadata_->stop_writer();
+    if (persisted_id_ != snapshot_id_) {
+        write_series_snapshot_();
+    }
+}
+
+void Storage::on_names_persisted_(uint64_t max_id) {
+    persisted_id_ = std::max(persisted_id_, max_id);
+    if (persisted_id_ - snapshot_id_ >= SERIES_SNAPSHOT_INTERVAL) {
+        // String pool is append only, so it's safe to read it from metadata thread
+        write_series_snapshot_();
+    }
+}
+
+void Storage::write_series_snapshot_() {
+    snapshot_id_ = persisted_id_;
+    if (SeriesSnapshot::write(snapshot_path_, matcher_->pool, snapshot_id_) != AKU_SUCCESS) {
+        log_error("can't write series snapshot");
+    }
+}
+
+void Storage::write_rollup_snapshot_() {
+    rollup_samples_ = rollup_->nsamples_;
+    if (rollup_->write_snapshot(rollup_path_) != AKU_SUCCESS) {
+        log_error("can't write rollup snapshot");
     }
 }
 
@@ -285,13 +375,43 @@ void Storage::prepopulate_cache(int64_t max_cache_size) {
         active_volume_->flush();
     }
 
-    // Read data from sqlite to series matcher
+    // Read data from snapshot and sqlite to series matcher
     uint64_t nextid = 1 + metadata_->get_prev_largest_id();
     matcher_ = std::make_shared<SeriesMatcher>(nextid + 1);
-    aku_Status status = metadata_->load_matcher_data(*matcher_);
+    aku_Status status = matcher_->load_snapshot(snapshot_path_, &snapshot_id_);
+    if (status == AKU_SUCCESS) {
+        log_message("series loaded from snapshot", matcher_->snapshot.nseries);
+    } else if (status != AKU_ENOT_FOUND) {
+        log_error("series snapshot is corrupted, series names will be loaded from sqlite");
+    }
+    // Only series that was added after snapshot was created should be read from sqlite
+    status = metadata_->load_matcher_data(*matcher_, snapshot_id_);
     if (status != AKU_SUCCESS) {
         AKU_PANIC("Can't read series names from sqlite");
     }
+    persisted_id_ = nextid - 1;
+    metadata_->start_writer([this](uint64_t max_id) {
+        on_names_persisted_(max_id);
+    });
+}
+
+void Storage::open_wal(const char* path) {
+    wal_.reset(new WriteAheadLog(get_storage_prefix(path), logger_));
+    aku_MemRange m = {};
+    auto nreplayed = wal_->replay([&](WalRecord const& rec) {
+        TimeSeriesValue ts_value(rec.timestamp, rec.paramid, rec.value);
+        auto status = _write_impl(ts_value, m);
+        if (status != AKU_SUCCESS) {
+            log_error(aku_error_message(status));
+        }
+    });
+    log_message("values replayed from write-ahead log", nreplayed);
+    // Segments that was replayed stays on disk until their values will be merged
+    wal_->start();
+}
+
+void Storage::checkpoint_wal_() {
+    wal_->checkpoint(active_volume_->cache_->get_low_watermark());
 }
 
 aku_Status Storage::get_open_error() const {
@@ -299,6 +419,7 @@ aku_Status Storage::get_open_error() const {
 }
 
 void Storage::advance_volume_(int local_rev) {
+    AKU_TRACE_SPAN("storage.advance_volume");
     if (local_rev == active_volume_index_.load()) {
         log_message("advance volume, current:");
         log_message("....page ID", active_volume_->page_->get_page_id());
@@ -307,6 +428,7 @@ void Storage::advance_volume_(int local_rev) {
 
         auto old_page_id = active_page_->get_page_id();
         AKU_UNUSED(old_page_id);
+        Metrics::library().volume_rotations.inc();
 
         auto prev_volume = active_volume_;
         active_volume_->close();
@@ -398,6 +520,7 @@ struct TerminalNode : QP::Node {
 
 
 void Storage::search(Caller &caller, InternalCursor* cur, const char* query) const {
+    AKU_TRACE_SPAN("storage.search");
     using namespace std;
     using namespace QP;
 
@@ -406,7 +529,7 @@ void Storage::search(Caller &caller, InternalCursor* cur, const char* query) con
         auto terminal_node = std::make_shared<TerminalNode>(caller, cur);
         std::shared_ptr<IQueryProcessor> query_processor;
         try {
-            query_processor = Builder::build_query_processor(query, terminal_node, *matcher_, logger_);
+            query_processor = Builder::build_query_processor(query, terminal_node, *matcher_, logger_, rollup_.get());
         } catch (const QueryParserError& qpe) {
             log_error(qpe.what());
             cur->set_error(caller, AKU_EQUERY_PARSING_ERROR);
@@ -419,13 +542,22 @@ void Storage::search(Caller &caller, InternalCursor* cur, const char* query) con
 
         if (query_processor->start()) {
 
+            std::string query_key;
+            if (query_cache_) {
+                // Query was already validated by the builder
+                query_key = canonical_json(query, query + strlen(query));
+                // Scan range can be narrower than query range (when rollups are used)
+                query_key += " " + std::to_string(query_processor->lowerbound())
+                           + " " + std::to_string(query_processor->upperbound());
+            }
+
             if (query_processor->direction() == AKU_CURSOR_DIR_FORWARD) {
                 uint32_t starting_ix = active_volume_->get_page()->get_page_id() + 1;  // Start from oldest volume
                 for (uint32_t ix = starting_ix; ix < (starting_ix + volumes_.size()); ix++) {
                     // Search volume
                     uint32_t index = ix % volumes_.size();
                     PVolume volume = volumes_.at(index);
-                    volume->get_page()->search(query_processor, cache_);
+                    search_volume_(volume, query_processor, query_key, false);
 
                     // Instead of searching cache we are using continuous querying feature here.
                     // We can read cache data only if we're interested in instant picture, for example if
@@ -444,13 +576,8 @@ void Storage::search(Caller &caller, InternalCursor* cur, const char* query) con
                 for (int64_t ix = (starting_ix + volumes_.size()); ix > starting_ix; ix--) {
                     uint32_t index = static_cast<uint32_t>(ix % volumes_.size());
                     PVolume volume = volumes_.at(index);
-                    // Search cache
-                    int seq_id;
-                    aku_Timestamp window;
-                    tie(window, seq_id) = volume->cache_->get_window();
-                    volume->cache_->search(query_processor, seq_id);
-                    // Search volume
-                    volume->get_page()->search(query_processor, cache_);
+                    // Search cache and volume
+                    search_volume_(volume, query_processor, query_key, true);
                 }
             } else {
                 AKU_PANIC("data corruption in query processor");
@@ -464,6 +591,121 @@ void Storage::search(Caller &caller, InternalCursor* cur, const char* query) con
 }
 
 
+std::shared_ptr<Subscription> Storage::subscribe(const char* query, aku_notify_cb_t notify, void* notify_arg) {
+    using namespace QP;
+
+    auto sub = std::make_shared<Subscription>(Subscription::DEFAULT_CAPACITY, notify, notify_arg);
+    std::shared_ptr<IQueryProcessor> query_processor;
+    try {
+        // Rollup tiers can't be used, processor receives raw samples
+        query_processor = Builder::build_query_processor(query, sub->make_sink(), *matcher_, logger_);
+    } catch (const QueryParserError& qpe) {
+        log_error(qpe.what());
+        sub->set_error(AKU_EQUERY_PARSING_ERROR);
+        return sub;
+    }
+    if (query_processor->direction() != AKU_CURSOR_DIR_FORWARD) {
+        log_error("continuous query can't use backward direction");
+        sub->set_error(AKU_EBAD_ARG);
+        return sub;
+    }
+    if (sub->start(query_processor)) {
+        subscriptions_->add(sub);
+    }
+    return sub;
+}
+
+
+/** Query processor wrapper that records all samples extracted from the volume.
+  */
+struct RecordingQueryProcessor : QP::IQueryProcessor {
+    std::shared_ptr<QP::IQueryProcessor> proc_;
+    std::vector<aku_Sample> samples_;
+    bool complete_;  //< Set to false if scan was interrupted
+
+    RecordingQueryProcessor(std::shared_ptr<QP::IQueryProcessor> proc)
+        : proc_(proc)
+        , complete_(true)
+    {
+    }
+
+    aku_Timestamp lowerbound() const { return proc_->lowerbound(); }
+    aku_Timestamp upperbound() const { return proc_->upperbound(); }
+    int direction() const { return proc_->direction(); }
+    QP::IQueryFilter& filter() { return proc_->filter(); }
+    SeriesMatcher* matcher() { return proc_->matcher(); }
+    bool start() { return proc_->start(); }
+    void stop() { proc_->stop(); }
+
+    bool put(const aku_Sample& sample) {
+        // Samples extracted from volume doesn't have extra payload. Empty samples
+        // are used to wait for new data, scan can't be completed in this case.
+        if (sample.payload.type != aku_PData::EMPTY) {
+            samples_.push_back(sample);
+        }
+        if (!proc_->put(sample)) {
+            complete_ = false;
+            return false;
+        }
+        return true;
+    }
+
+    void set_error(aku_Status error) {
+        complete_ = false;
+        proc_->set_error(error);
+    }
+};
+
+void Storage::search_volume_(PVolume const& volume,
+                             std::shared_ptr<QP::IQueryProcessor> const& query,
+                             std::string const& query_key,
+                             bool search_sequencer) const
+{
+    AKU_TRACE_SPAN("storage.search_volume");
+    auto page = volume->get_page();
+    if (query_key.empty() || volume == active_volume_) {
+        // Active volume can't be cached
+        if (search_sequencer) {
+            int seq_id;
+            aku_Timestamp window;
+            std::tie(window, seq_id) = volume->cache_->get_window();
+            volume->cache_->search(query, seq_id);
+        }
+        page->search(query, cache_);
+        return;
+    }
+    auto open_count = page->get_open_count();
+    auto close_count = page->get_close_count();
+    QueryCache::KeyT key(query_key, page->get_page_id(), open_count, close_count);
+    auto samples = query_cache_->get(key);
+    if (samples) {
+        for (auto const& sample: *samples) {
+            if (!query->put(sample)) {
+                break;
+            }
+        }
+        return;
+    }
+    auto recorder = std::make_shared<RecordingQueryProcessor>(query);
+    if (search_sequencer) {
+        int seq_id;
+        aku_Timestamp window;
+        std::tie(window, seq_id) = volume->cache_->get_window();
+        volume->cache_->search(recorder, seq_id);
+    }
+    page->search(recorder, cache_);
+    // Volume can be reopened by the writer during the scan
+    bool unchanged = volume != active_volume_
+                  && open_count  == page->get_open_count()
+                  && close_count == page->get_close_count();
+    if (recorder->complete_ && unchanged) {
+        auto item = std::make_shared<std::vector<aku_Sample>>();
+        item->swap(recorder->samples_);
+        query_cache_->put(key, item);
+    }
+}
+
+
 void Storage::get_stats(aku_StorageStats* rcv_stats) {
     for (PVolume const& vol: volumes_) {
         vol->page_->get_stats(rcv_stats);
@@ -482,32 +724,51 @@ aku_Status Storage::_write_impl(TimeSeriesValue ts_value, aku_MemRange data) {
             if (merge_lock % 2 == 1) {
                 // Slow path //
 
-                // Update metadata store
+                // Update metadata store (names are written by metadata thread)
                 std::vector<SeriesMatcher::SeriesNameT> names;
                 matcher_->pull_new_names(&names);
-                if (!names.empty()) {
-                    metadata_->insert_new_names(names);
-                }
+                metadata_->insert_new_names_async(std::move(names));
 
                 // Move data from cache to disk
-                status = active_volume_->cache_->merge_and_compress(active_volume_->get_page());
+                status = active_volume_->cache_->merge_and_compress(active_volume_->get_page(),
+                                                                       false,
+                                                                       rollup_.get(),
+                                                                       subscriptions_.get());
                 switch (status) {
-                case AKU_SUCCESS:
+                case AKU_SUCCESS: {
+                    bool flushed = false;
                     switch(config_.durability) {
                     case AKU_MAX_DURABILITY:
                         // Max durability
                         active_volume_->flush();
+                        flushed = true;
                         break;
                     case AKU_DURABILITY_SPEED_TRADEOFF:
                         // Compromice some durability for speed
                         if ((merge_lock % 8) == 1) {
                             active_volume_->flush();
+                            flushed = true;
                         }
                         break;
                     case AKU_MAX_WRITE_SPEED:
+                        // Data is protected by write-ahead log, flush volume only
+                        // when log segment is full to be able to truncate the log
+                        if (wal_ && wal_->needs_checkpoint()) {
+                            active_volume_->flush();
+                            flushed = true;
+                        }
                         break;
                     };
+                    if (flushed && wal_) {
+                        // Everything below the watermark is on disk now
+                        checkpoint_wal_();
+                    }
+                    if (flushed && rollup_ && rollup_->nsamples_ - rollup_samples_ >= ROLLUP_SNAPSHOT_INTERVAL) {
+                        // Snapshot matches the data on disk and the log checkpoint
+                        write_rollup_snapshot_();
+                    }
                     break;
+                }
                 case AKU_EOVERFLOW:
                     // Page overflow
                     advance_volume_(local_rev);
@@ -523,6 +784,11 @@ aku_Status Storage::_write_impl(TimeSeriesValue ts_value, aku_MemRange data) {
         default:
             break;
     }
+    if (status == AKU_SUCCESS) {
+        Metrics::library().samples_written.inc();
+    } else if (status == AKU_ELATE_WRITE) {
+        Metrics::library().late_writes.inc();
+    }
     return status;
 }
 
@@ -530,7 +796,11 @@ aku_Status Storage::_write_impl(TimeSeriesValue ts_value, aku_MemRange data) {
 aku_Status Storage::write_double(aku_ParamId param, aku_Timestamp ts, double value) {
     aku_MemRange m = {};
     TimeSeriesValue ts_value(ts, param, value);
-    return _write_impl(ts_value, m);
+    auto status = _write_impl(ts_value, m);
+    if (status == AKU_SUCCESS && wal_) {
+        wal_->append(ts, param, value);
+    }
+    return status;
 }
 
 aku_Status Storage::series_to_param_id(const char* begin, const char* end, uint64_t *value) {
@@ -555,6 +825,10 @@ void Storage::set_thread_local_matcher(SeriesMatcher *matcher) const {
     local_matcher_.reset(matcher);
 }
 
+SeriesMatcher* Storage::get_thread_local_matcher() const {
+    return local_matcher_.get();
+}
+
 int Storage::param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size) const {
     SeriesMatcher const* m;
     if (local_matcher_.get() != nullptr) {
@@ -870,6 +1144,12 @@ apr_status_t Storage::remove_storage(const char* file_name, aku_logger_cb_t logg
         }
     }
 
+    WriteAheadLog::remove_segments(get_storage_prefix(file_name), logger);
+    std::string snapshot_path = get_storage_prefix(file_name) + ".series";
+    std::remove(snapshot_path.c_str());
+    std::string rollup_path = get_storage_prefix(file_name) + ".rollup";
+    std::remove(rollup_path.c_str());
+
     status = apr_file_remove(file_name, mempool);
     apr_pool_destroy(mempool);
     return status;
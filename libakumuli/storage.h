@@ -42,6 +42,9 @@
 #include "seriesparser.h"
 #include "akumuli_def.h"
 #include "metadatastorage.h"
+#include "wal.h"
+#include "rollup.h"
+#include "subscription.h"
 
 #include <boost/thread.hpp>
 
@@ -101,6 +104,9 @@ struct Storage
     typedef std::shared_ptr<MetadataStorage>    PMetadataStorage;
     typedef std::shared_ptr<SeriesMatcher>      PSeriesMatcher;
     typedef std::shared_ptr<ChunkCache>         PCache;
+    typedef std::shared_ptr<QueryCache>         PQueryCache;
+    typedef std::unique_ptr<WriteAheadLog>      PWal;
+    typedef std::shared_ptr<SubscriptionRegistry> PSubscriptionRegistry;
 
     // Active volume state
     aku_FineTuneParams        config_;
@@ -119,6 +125,25 @@ struct Storage
     aku_logger_cb_t           logger_;
     Rand                      rand_;
     PCache                    cache_;
+    PQueryCache               query_cache_;               //< Samples extracted from closed volumes (can be null)
+    PWal                      wal_;                       //< Write-ahead log (can be null)
+    PRollupStorage            rollup_;                    //< Rollup tiers (can be null)
+    std::string               rollup_path_;               //< Path to rollup snapshot
+    PSubscriptionRegistry     subscriptions_;             //< Continuous queries
+
+    // Series dictionary snapshot (updated by metadata thread)
+    std::string               snapshot_path_;             //< Path to series snapshot
+    uint64_t                  persisted_id_;              //< Largest series id stored in sqlite
+    uint64_t                  snapshot_id_;               //< Largest series id stored in snapshot
+
+    // Rollup snapshot (updated by writer thread)
+    uint64_t                  rollup_samples_;            //< Number of samples added to rollups before last snapshot
+
+    //! New series stored in sqlite before series snapshot gets rewritten
+    static const uint64_t     SERIES_SNAPSHOT_INTERVAL = 0x100000;
+
+    //! Samples added to rollup tiers before rollup snapshot gets rewritten
+    static const uint64_t     ROLLUP_SNAPSHOT_INTERVAL = 0x1000000;
 
     //! Local (per query) string pool
     mutable boost::thread_specific_ptr<SeriesMatcher> local_matcher_;
@@ -128,18 +153,28 @@ struct Storage
       */
     Storage(const char *path, aku_FineTuneParams const& conf);
 
+    ~Storage();
+
     /** Override local series matcher.
       * This method is const because it doesn't affect any storage data except
       * thread local variable.
       */
     void set_thread_local_matcher(SeriesMatcher* spool) const;
 
+    //! Get series matcher override for the current thread (or nullptr)
+    SeriesMatcher* get_thread_local_matcher() const;
+
     //! Select page that was active last time
     void select_active_page();
 
     //! Prepopulate cache
     void prepopulate_cache(int64_t max_cache_size);
 
+    /** Replay write-ahead log into the active volume's sequencer and start logging.
+      * @param path path to metadata file, log segments are stored next to it
+      */
+    void open_wal(const char* path);
+
     void log_message(const char* message) const;
 
     void log_error(const char* message) const;
@@ -161,6 +196,18 @@ struct Storage
 
     aku_Status _write_impl(TimeSeriesValue value, aku_MemRange data);
 
+    //! Write checkpoint marker to write-ahead log (should be called after volume flush)
+    void checkpoint_wal_();
+
+    //! Called from metadata thread when new names are stored in sqlite
+    void on_names_persisted_(uint64_t max_id);
+
+    //! Write snapshot of the series names stored in sqlite
+    void write_series_snapshot_();
+
+    //! Write snapshot of the rollup tiers (should be called by writer thread after volume flush)
+    void write_rollup_snapshot_();
+
     /** Convert series name to parameter id
       * @param begin should point to series name
       * @param end should point to series name end
@@ -178,6 +225,26 @@ struct Storage
     //! Search storage using cursor
     void search(Caller &caller, InternalCursor* cur, const char* query) const;
 
+    /** Search single volume. Samples extracted from closed volumes are cached.
+      * @param volume is a volume to search
+      * @param query is a query processor
+      * @param query_key is a canonical query (empty if query shouldn't be cached)
+      * @param search_sequencer should be set to search volume's sequencer
+      */
+    void search_volume_(PVolume const& volume,
+                        std::shared_ptr<QP::IQueryProcessor> const& query,
+                        std::string const& query_key,
+                        bool search_sequencer) const;
+
+    /** Register continuous query. Query processor receives new samples when they're
+      * written to the active volume.
+      * @param query is a query text (query should use forward direction)
+      * @param notify is a callback that is invoked by writer thread when new data arrives
+      * @param notify_arg is a callback argument
+      * @return subscription (in error state if query is invalid)
+      */
+    std::shared_ptr<Subscription> subscribe(const char* query, aku_notify_cb_t notify, void* notify_arg);
+
     // Static interface
 
     /** Create new storage and initialize it.
@@ -23,6 +23,11 @@ namespace Akumuli {
 //      String Pool      //
 //                       //
 
+StringPool::StringPool()
+    : counter{0}
+{
+}
+
 StringPool::StringT StringPool::add(const char* begin, const char* end, uint64_t payload) {
     std::lock_guard<std::mutex> guard(pool_mutex);  // Maybe I'll need to optimize this
     if (pool.empty()) {
@@ -58,6 +63,24 @@ StringPool::StringT StringPool::add(const char* begin, const char* end, uint64_t
     return std::make_pair(p, token_size);
 }
 
+void StringPool::add_bin(std::vector<char>&& bin, size_t count) {
+    std::lock_guard<std::mutex> guard(pool_mutex);
+    pool.push_back(std::move(bin));
+    // Bin can't be used by `add` because it can be reallocated
+    pool.emplace_back();
+    pool.back().reserve(MAX_BIN_SIZE);
+    std::atomic_fetch_add(&counter, count);
+}
+
+std::vector<StringPool::BinT> StringPool::get_bins() const {
+    std::vector<BinT> results;
+    std::lock_guard<std::mutex> guard(pool_mutex);
+    for (auto const& bin: pool) {
+        results.push_back(std::make_pair(bin.data(), bin.size()));
+    }
+    return results;
+}
+
 size_t StringPool::size() const {
     return std::atomic_load(&counter);
 }
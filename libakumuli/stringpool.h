@@ -39,14 +39,27 @@ struct StringPoolOffset {
 struct StringPool {
 
     typedef std::pair<const char*, int> StringT;
+    typedef std::pair<const char*, size_t> BinT;
     const int MAX_BIN_SIZE = AKU_LIMITS_MAX_SNAME*0x1000;
 
     std::deque<std::vector<char>> pool;
     mutable std::mutex pool_mutex;
     std::atomic<size_t> counter;
 
+    StringPool();
+
     StringT add(const char* begin, const char *end, uint64_t payload);
 
+    /** Add preformatted bin (e.g. read from snapshot) to the pool.
+      * @param bin is a buffer that contains `count` strings in pool format
+      */
+    void add_bin(std::vector<char>&& bin, size_t count);
+
+    /** Get pointers to all bins and their sizes atomically.
+      * Content of the bins below returned sizes is immutable.
+      */
+    std::vector<BinT> get_bins() const;
+
     //! Get number of stored strings atomically
     size_t size() const;
 
@@ -0,0 +1,307 @@
+#include "subscription.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Akumuli {
+
+//! Terminal node of the continuous query
+struct Subscription::Sink : QP::Node {
+    Subscription& sub_;
+
+    Sink(Subscription& sub)
+        : sub_(sub)
+    {
+    }
+
+    // Node interface (subscription lock is held by the caller)
+
+    void complete() {
+        sub_.done_ = true;
+    }
+
+    bool put(const aku_Sample& sample) {
+        if (sample.payload.type != aku_PData::MARGIN) {
+            return sub_.enqueue(sample);
+        }
+        return true;
+    }
+
+    void set_error(aku_Status status) {
+        sub_.error_ = status;
+        sub_.done_ = true;
+    }
+
+    int get_requirements() const {
+        return TERMINAL;
+    }
+};
+
+//                      //
+//     Subscription     //
+//                      //
+
+Subscription::Subscription(size_t capacity, aku_notify_cb_t notify, void* notify_arg)
+    : capacity_(capacity)
+    , notify_(notify)
+    , notify_arg_(notify_arg)
+    , read_pos_(0)
+    , error_(AKU_SUCCESS)
+    , done_(false)
+    , last_ts_(AKU_MIN_TIMESTAMP)
+{
+}
+
+std::shared_ptr<QP::Node> Subscription::make_sink() {
+    return std::make_shared<Sink>(*this);
+}
+
+bool Subscription::start(std::shared_ptr<QP::IQueryProcessor> proc) {
+    bool active;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        proc_ = proc;
+        if (!proc_->start()) {
+            done_ = true;
+        }
+        active = !done_;
+    }
+    notify();
+    return active;
+}
+
+SeriesMatcher* Subscription::matcher() const {
+    return proc_ ? proc_->matcher() : nullptr;
+}
+
+void Subscription::set_error(aku_Status error) {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        error_ = error;
+        done_ = true;
+    }
+    notify();
+}
+
+bool Subscription::enqueue(aku_Sample const& sample) {
+    size_t size = std::max(sample.payload.size, (uint16_t)sizeof(aku_Sample));
+    if (queue_.size() - read_pos_ + size > capacity_) {
+        // Client can't keep up
+        error_ = AKU_EOVERFLOW;
+        done_ = true;
+        return false;
+    }
+    auto begin = reinterpret_cast<const char*>(&sample);
+    queue_.insert(queue_.end(), begin, begin + size);
+    return true;
+}
+
+void Subscription::notify() {
+    std::lock_guard<std::mutex> guard(notify_lock_);
+    if (notify_) {
+        notify_(notify_arg_);
+    }
+}
+
+bool Subscription::publish(UncompressedChunk const& chunk) {
+    bool active;
+    bool updated;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (done_) {
+            return false;
+        }
+        auto& filter = proc_->filter();
+        auto lowerbound = proc_->lowerbound();
+        auto upperbound = proc_->upperbound();
+        auto nbytes = queue_.size();
+        aku_Sample sample = {};
+        sample.payload.type = AKU_PAYLOAD_FLOAT;
+        sample.payload.size = sizeof(aku_Sample);
+        for (size_t i = 0; i < chunk.timestamps.size() && !done_; i++) {
+            auto ts = chunk.timestamps[i];
+            if (ts < lowerbound || ts < last_ts_) {
+                continue;
+            }
+            if (ts > upperbound) {
+                proc_->stop();
+                done_ = true;
+                break;
+            }
+            last_ts_ = ts;
+            auto id = chunk.paramids[i];
+            auto result = filter.apply(id);
+            if (result == QP::IQueryFilter::SKIP_THIS) {
+                continue;
+            } else if (result == QP::IQueryFilter::SKIP_ALL) {
+                proc_->stop();
+                done_ = true;
+                break;
+            }
+            sample.paramid = id;
+            sample.timestamp = ts;
+            sample.payload.float64 = chunk.values[i];
+            if (!proc_->put(sample)) {
+                if (!done_) {
+                    // Query is interrupted (e.g. limit reached)
+                    proc_->stop();
+                    done_ = true;
+                }
+            }
+        }
+        active = !done_;
+        updated = done_ || nbytes != queue_.size();
+    }
+    if (updated) {
+        notify();
+    }
+    return active;
+}
+
+void Subscription::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (done_) {
+            return;
+        }
+        if (proc_) {
+            proc_->stop();
+        }
+        done_ = true;
+    }
+    notify();
+}
+
+void Subscription::cancel() {
+    std::lock_guard<std::mutex> guard(notify_lock_);
+    notify_ = nullptr;
+}
+
+size_t Subscription::read_ex(void* buffer, size_t buffer_size) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto out = static_cast<char*>(buffer);
+    size_t nbytes = 0;
+    while (read_pos_ < queue_.size()) {
+        aku_Sample header;
+        memcpy(&header, queue_.data() + read_pos_, sizeof(header));
+        size_t size = std::max(header.payload.size, (uint16_t)sizeof(aku_Sample));
+        if (nbytes + size > buffer_size) {
+            break;
+        }
+        memcpy(out + nbytes, queue_.data() + read_pos_, size);
+        nbytes += size;
+        read_pos_ += size;
+    }
+    if (read_pos_ == queue_.size()) {
+        queue_.clear();
+        read_pos_ = 0;
+    } else if (read_pos_ > queue_.size() / 2) {
+        queue_.erase(queue_.begin(), queue_.begin() + read_pos_);
+        read_pos_ = 0;
+    }
+    return nbytes;
+}
+
+bool Subscription::is_done() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return done_ && read_pos_ == queue_.size();
+}
+
+bool Subscription::is_error(aku_Status* out_error_code_or_null) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (error_ != AKU_SUCCESS) {
+        if (out_error_code_or_null) {
+            *out_error_code_or_null = error_;
+        }
+        return true;
+    }
+    return false;
+}
+
+//                               //
+//     Subscription registry     //
+//                               //
+
+SubscriptionRegistry::SubscriptionRegistry()
+    : size_{0}
+{
+}
+
+void SubscriptionRegistry::add(std::shared_ptr<Subscription> sub) {
+    std::lock_guard<std::mutex> guard(lock_);
+    subs_.push_back(sub);
+    size_.store(subs_.size());
+}
+
+void SubscriptionRegistry::remove(Subscription const* sub) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = std::find_if(subs_.begin(), subs_.end(), [sub](std::shared_ptr<Subscription> const& p) {
+        return p.get() == sub;
+    });
+    if (it != subs_.end()) {
+        subs_.erase(it);
+    }
+    size_.store(subs_.size());
+}
+
+void SubscriptionRegistry::publish(UncompressedChunk const& chunk) {
+    if (size_.load() == 0) {
+        return;
+    }
+    std::vector<std::shared_ptr<Subscription>> subs;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        subs = subs_;
+    }
+    for (auto const& sub: subs) {
+        if (!sub->publish(chunk)) {
+            remove(sub.get());
+        }
+    }
+}
+
+void SubscriptionRegistry::stop_all() {
+    std::vector<std::shared_ptr<Subscription>> subs;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        std::swap(subs, subs_);
+        size_.store(0);
+    }
+    for (auto const& sub: subs) {
+        sub->stop();
+    }
+}
+
+size_t SubscriptionRegistry::size() const {
+    return size_.load();
+}
+
+//                             //
+//     Subscription cursor     //
+//                             //
+
+SubscriptionCursor::SubscriptionCursor(std::shared_ptr<Subscription> sub,
+                                       std::shared_ptr<SubscriptionRegistry> registry)
+    : sub_(sub)
+    , registry_(registry)
+{
+}
+
+size_t SubscriptionCursor::read_ex(void* buffer, size_t buffer_size) {
+    return sub_->read_ex(buffer, buffer_size);
+}
+
+bool SubscriptionCursor::is_done() const {
+    return sub_->is_done();
+}
+
+bool SubscriptionCursor::is_error(aku_Status* out_error_code_or_null) const {
+    return sub_->is_error(out_error_code_or_null);
+}
+
+void SubscriptionCursor::close() {
+    registry_->remove(sub_.get());
+    sub_->cancel();
+}
+
+}  // namespace
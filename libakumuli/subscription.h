@@ -0,0 +1,159 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Continuous queries (subscriptions to new data).
+ *
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "akumuli.h"
+#include "compression.h"
+#include "cursor.h"
+#include "queryprocessor_framework.h"
+
+namespace Akumuli {
+
+/** Continuous query.
+  * Query processor of the subscription receives samples right from the sequencer
+  * when they're merged and written to the volume, volumes are never scanned.
+  * Processor runs in the writer thread and its output is stored in the bounded
+  * queue. Output is read by another thread through the cursor interface.
+  * Samples should be published in time order, samples older than the last
+  * published one are skipped (they're still visible to regular queries).
+  */
+class Subscription {
+    struct Sink;
+
+    std::shared_ptr<QP::IQueryProcessor> proc_;
+    const size_t            capacity_;          //< Max size of the output queue in bytes
+    aku_notify_cb_t         notify_;            //< Data availability callback (can be null)
+    void*                   notify_arg_;
+    std::mutex              notify_lock_;       //< Held while callback is invoked
+    mutable std::mutex      lock_;              //< Output queue lock
+    std::vector<char>       queue_;             //< Output queue (samples stored back to back)
+    size_t                  read_pos_;          //< Position of the first unread sample in the queue
+    aku_Status              error_;
+    bool                    done_;              //< Set when processor completes
+    aku_Timestamp           last_ts_;           //< Timestamp of the last published sample
+
+    //! Add sample to output queue (lock should be held)
+    bool enqueue(aku_Sample const& sample);
+
+    //! Invoke callback (lock shouldn't be held)
+    void notify();
+public:
+    enum {
+        DEFAULT_CAPACITY = 0x1000000,  //< Default output queue size (16MB)
+    };
+
+    /** C-tor
+      * @param capacity is a max size of the output queue in bytes (subscription fails
+      *        with AKU_EOVERFLOW error if client can't keep up)
+      * @param notify is a callback that will be invoked from writer thread when new data
+      *        arrives or subscription completes
+      * @param notify_arg is an argument of the callback
+      */
+    Subscription(size_t capacity, aku_notify_cb_t notify, void* notify_arg);
+
+    //! Create terminal node for the query processor (node shouldn't outlive subscription)
+    std::shared_ptr<QP::Node> make_sink();
+
+    /** Start query processor (processor should be created using `make_sink` as a terminal).
+      * @return true if subscription can receive samples
+      */
+    bool start(std::shared_ptr<QP::IQueryProcessor> proc);
+
+    //! Get series matcher override of the query (or nullptr)
+    SeriesMatcher* matcher() const;
+
+    //! Fail subscription
+    void set_error(aku_Status error);
+
+    // Writer side
+
+    /** Process samples from the time ordered chunk.
+      * @return false if subscription is completed and should be removed
+      */
+    bool publish(UncompressedChunk const& chunk);
+
+    //! Complete subscription (no more data will be published)
+    void stop();
+
+    /** Disable callback. Callback is never invoked after this call returns, so
+      * it shouldn't be called from the callback itself.
+      */
+    void cancel();
+
+    // Reader side
+
+    //! Read samples to the buffer, returns number of bytes written
+    size_t read_ex(void* buffer, size_t buffer_size);
+
+    //! Check that processor completed and all data was read
+    bool is_done() const;
+
+    bool is_error(aku_Status* out_error_code_or_null) const;
+};
+
+
+/** List of active subscriptions.
+  * Samples are published by writer thread, subscriptions can be added
+  * and removed by any thread.
+  */
+class SubscriptionRegistry {
+    mutable std::mutex                          lock_;
+    std::vector<std::shared_ptr<Subscription>>  subs_;
+    std::atomic<size_t>                         size_;  //< Used to skip locking when registry is empty
+public:
+    SubscriptionRegistry();
+
+    void add(std::shared_ptr<Subscription> sub);
+
+    void remove(Subscription const* sub);
+
+    //! Publish time ordered chunk to all subscriptions (called by writer thread)
+    void publish(UncompressedChunk const& chunk);
+
+    //! Complete and remove all subscriptions
+    void stop_all();
+
+    size_t size() const;
+};
+
+
+//! Cursor that reads subscription output and unsubscribes on close
+struct SubscriptionCursor : ExternalCursor {
+    std::shared_ptr<Subscription>           sub_;
+    std::shared_ptr<SubscriptionRegistry>   registry_;
+
+    SubscriptionCursor(std::shared_ptr<Subscription> sub, std::shared_ptr<SubscriptionRegistry> registry);
+
+    virtual size_t read_ex(void* buffer, size_t buffer_size);
+
+    virtual bool is_done() const;
+
+    virtual bool is_error(aku_Status* out_error_code_or_null) const;
+
+    virtual void close();
+};
+
+}  // namespace
@@ -0,0 +1,437 @@
+/**
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tagindex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace Akumuli {
+
+//                        //
+//      Posting List      //
+//                        //
+
+static void put_varint(uint64_t value, std::vector<unsigned char>* out) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<unsigned char>(value));
+}
+
+static uint64_t get_varint(std::vector<unsigned char> const& data, size_t* pos) {
+    uint64_t result = 0;
+    int shift = 0;
+    while (true) {
+        unsigned char byte = data[(*pos)++];
+        result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            break;
+        }
+        shift += 7;
+    }
+    return result;
+}
+
+PostingList::PostingList()
+    : last_(0u)
+    , size_(0u)
+{
+}
+
+void PostingList::append(uint64_t id) {
+    if (size_ != 0 && id <= last_) {
+        // Slow path, should be used only on startup if ids are out of order
+        std::vector<uint64_t> ids;
+        decode(0u, &ids);
+        auto it = std::lower_bound(ids.begin(), ids.end(), id);
+        if (it != ids.end() && *it == id) {
+            return;
+        }
+        ids.insert(it, id);
+        *this = PostingList();
+        for (auto x: ids) {
+            append(x);
+        }
+        return;
+    }
+    if (size_ % BLOCK_SIZE == 0) {
+        skip_.push_back(std::make_pair(id, data_.size()));
+    } else {
+        put_varint(id - last_, &data_);
+    }
+    last_ = id;
+    size_++;
+}
+
+size_t PostingList::size() const {
+    return size_;
+}
+
+void PostingList::decode(uint64_t min_id, std::vector<uint64_t>* out) const {
+    Cursor cursor(*this);
+    if (!cursor.seek(min_id)) {
+        return;
+    }
+    do {
+        out->push_back(cursor.value_);
+    } while (cursor.next());
+}
+
+PostingList::Cursor::Cursor(PostingList const& list)
+    : list_(&list)
+    , block_(0u)
+    , pos_(0u)
+    , end_(0u)
+    , value_(0u)
+    , done_(list.size_ == 0)
+{
+    if (!done_) {
+        enter_block_(0u);
+    }
+}
+
+void PostingList::Cursor::enter_block_(size_t block) {
+    auto const& skip = list_->skip_;
+    block_ = block;
+    value_ = skip[block].first;
+    pos_   = skip[block].second;
+    end_   = block + 1 < skip.size() ? skip[block + 1].second : list_->data_.size();
+}
+
+bool PostingList::Cursor::next() {
+    if (done_) {
+        return false;
+    }
+    if (pos_ < end_) {
+        value_ += get_varint(list_->data_, &pos_);
+        return true;
+    }
+    if (block_ + 1 < list_->skip_.size()) {
+        enter_block_(block_ + 1);
+        return true;
+    }
+    done_ = true;
+    return false;
+}
+
+bool PostingList::Cursor::seek(uint64_t id) {
+    if (done_) {
+        return false;
+    }
+    if (value_ >= id) {
+        return true;
+    }
+    auto const& skip = list_->skip_;
+    if (block_ + 1 < skip.size() && skip[block_ + 1].first <= id) {
+        // Jump to the last block that starts before `id`
+        auto it = std::upper_bound(skip.begin() + block_ + 1, skip.end(), id,
+                                   [](uint64_t lhs, SkipT const& rhs) {
+                                       return lhs < rhs.first;
+                                   });
+        enter_block_(std::distance(skip.begin(), it) - 1);
+    }
+    while (value_ < id) {
+        if (!next()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//                     //
+//      Tag Index      //
+//                     //
+
+TagIndex::TagIndex()
+    : max_id_(0u)
+    , size_{0u}
+{
+}
+
+void TagIndex::add(const char* begin, const char* end, uint64_t id) {
+    // Series name should be in normal form: metric name followed by
+    // the list of tags separated by exactly one space.
+    const char* it = std::find(begin, end, ' ');
+    if (it == begin) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    metrics_[std::string(begin, it)].append(id);
+    while (it < end) {
+        const char* tag = it + 1;
+        it = std::find(tag, end, ' ');
+        const char* eq = std::find(tag, it, '=');
+        if (eq == it || eq == tag) {
+            continue;
+        }
+        tags_[std::string(tag, eq)].append(id);
+        pairs_[std::string(tag, it)].append(id);
+    }
+    all_.append(id);
+    max_id_ = std::max(max_id_, id);
+    std::atomic_fetch_add(&size_, static_cast<size_t>(1u));
+}
+
+size_t TagIndex::size() const {
+    return std::atomic_load(&size_);
+}
+
+static PostingList const* find_list(TagIndex::TableT const& table, std::string const& key) {
+    auto it = table.find(key);
+    if (it == table.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+TagIndex::IdsT TagIndex::query(Query const& query, uint64_t* min_id) const {
+    // Query is a conjunction of the groups, every group is a disjunction of the posting lists
+    typedef std::vector<PostingList const*> GroupT;
+    std::vector<GroupT> groups;
+    IdsT results;
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    uint64_t first_id = *min_id;
+    *min_id = std::max(first_id, max_id_ + 1);
+
+    if (!query.metric.empty()) {
+        auto list = find_list(metrics_, query.metric);
+        if (list == nullptr) {
+            return results;
+        }
+        groups.push_back(GroupT{list});
+    }
+    for (auto const& tag: query.tags) {
+        auto list = find_list(tags_, tag);
+        if (list == nullptr) {
+            return results;
+        }
+        groups.push_back(GroupT{list});
+    }
+    for (auto const& item: query.where) {
+        GroupT group;
+        for (auto const& value: item.second) {
+            auto list = find_list(pairs_, item.first + "=" + value);
+            if (list != nullptr) {
+                group.push_back(list);
+            }
+        }
+        if (group.empty()) {
+            return results;
+        }
+        groups.push_back(group);
+    }
+    if (groups.empty()) {
+        groups.push_back(GroupT{&all_});
+    }
+
+    auto group_size = [](GroupT const& group) {
+        size_t sum = 0;
+        for (auto list: group) {
+            sum += list->size();
+        }
+        return sum;
+    };
+    std::sort(groups.begin(), groups.end(), [&](GroupT const& lhs, GroupT const& rhs) {
+        return group_size(lhs) < group_size(rhs);
+    });
+
+    // Union of the posting lists, ids are merged in one pass (IN-lists can be large)
+    auto decode_group = [first_id](GroupT const& group, IdsT* out) {
+        for (auto list: group) {
+            list->decode(first_id, out);
+        }
+        if (group.size() > 1) {
+            std::sort(out->begin(), out->end());
+            out->erase(std::unique(out->begin(), out->end()), out->end());
+        }
+    };
+
+    // Decode smallest group
+    decode_group(groups.front(), &results);
+
+    // Filter candidates using other groups without decompressing them completely
+    for (auto git = groups.begin() + 1; git != groups.end() && !results.empty(); git++) {
+        if (results.size()*git->size() > group_size(*git)) {
+            // Seeking every list is more expensive than decoding the whole group
+            IdsT ids, merged;
+            decode_group(*git, &ids);
+            std::set_intersection(results.begin(), results.end(), ids.begin(), ids.end(), std::back_inserter(merged));
+            results.swap(merged);
+            continue;
+        }
+        std::vector<PostingList::Cursor> cursors;
+        for (auto list: *git) {
+            cursors.emplace_back(*list);
+        }
+        auto out = results.begin();
+        for (auto id: results) {
+            for (auto& cursor: cursors) {
+                if (cursor.seek(id) && cursor.value_ == id) {
+                    *out++ = id;
+                    break;
+                }
+            }
+        }
+        results.erase(out, results.end());
+    }
+    return results;
+}
+
+//                                  //
+//      Tag Index Serialization     //
+//                                  //
+
+// Layout: max_id, size, `all_` list, then `metrics_`, `tags_` and `pairs_` tables.
+// Table is a number of keys followed by {u32 key length, key, list} entries.
+// List is {last, size, skip table size, data size, skip table, data}.
+
+template<class T>
+static void put_raw(T value, std::vector<char>* out) {
+    auto ptr = reinterpret_cast<const char*>(&value);
+    out->insert(out->end(), ptr, ptr + sizeof(T));
+}
+
+static void put_list(PostingList const& list, std::vector<char>* out) {
+    put_raw<uint64_t>(list.last_, out);
+    put_raw<uint64_t>(list.size_, out);
+    put_raw<uint64_t>(list.skip_.size(), out);
+    put_raw<uint64_t>(list.data_.size(), out);
+    for (auto const& skip: list.skip_) {
+        put_raw<uint64_t>(skip.first, out);
+        put_raw<uint64_t>(skip.second, out);
+    }
+    out->insert(out->end(), list.data_.begin(), list.data_.end());
+}
+
+static void put_table(TagIndex::TableT const& table, std::vector<char>* out) {
+    put_raw<uint64_t>(table.size(), out);
+    for (auto const& kv: table) {
+        put_raw<uint32_t>(static_cast<uint32_t>(kv.first.size()), out);
+        out->insert(out->end(), kv.first.begin(), kv.first.end());
+        put_list(kv.second, out);
+    }
+}
+
+//! Bounds checked reader of the serialized index
+struct IndexReader {
+    const char* pos;
+    const char* end;
+
+    template<class T>
+    bool get_raw(T* value) {
+        if (end - pos < static_cast<ptrdiff_t>(sizeof(T))) {
+            return false;
+        }
+        memcpy(value, pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    bool get_list(PostingList* list) {
+        uint64_t last, size, nskip, ndata;
+        if (!get_raw(&last) || !get_raw(&size) || !get_raw(&nskip) || !get_raw(&ndata)) {
+            return false;
+        }
+        if (static_cast<uint64_t>(end - pos)/(2*sizeof(uint64_t)) < nskip
+            || nskip != (size + PostingList::BLOCK_SIZE - 1)/PostingList::BLOCK_SIZE)
+        {
+            return false;
+        }
+        list->skip_.resize(nskip);
+        for (auto& skip: list->skip_) {
+            uint64_t offset;
+            get_raw(&skip.first);
+            get_raw(&offset);
+            if (offset > ndata) {
+                return false;
+            }
+            skip.second = offset;
+        }
+        if (static_cast<uint64_t>(end - pos) < ndata) {
+            return false;
+        }
+        list->data_.assign(pos, pos + ndata);
+        pos += ndata;
+        list->last_ = last;
+        list->size_ = size;
+        return true;
+    }
+
+    bool get_table(TagIndex::TableT* table) {
+        uint64_t nkeys;
+        if (!get_raw(&nkeys)) {
+            return false;
+        }
+        table->reserve(std::min(nkeys, static_cast<uint64_t>(end - pos)));
+        for (uint64_t i = 0; i < nkeys; i++) {
+            uint32_t len;
+            if (!get_raw(&len) || static_cast<uint64_t>(end - pos) < len) {
+                return false;
+            }
+            std::string key(pos, len);
+            pos += len;
+            if (!get_list(&(*table)[key])) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+void TagIndex::serialize(std::vector<char>* out) const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    put_raw<uint64_t>(max_id_, out);
+    put_raw<uint64_t>(size_.load(), out);
+    put_list(all_, out);
+    put_table(metrics_, out);
+    put_table(tags_, out);
+    put_table(pairs_, out);
+}
+
+bool TagIndex::deserialize(const char* begin, const char* end) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto clear = [this]() {
+        metrics_.clear();
+        tags_.clear();
+        pairs_.clear();
+        all_ = PostingList();
+        max_id_ = 0u;
+        size_ = 0u;
+    };
+    clear();
+    IndexReader reader = { begin, end };
+    uint64_t max_id, size;
+    bool success = reader.get_raw(&max_id)
+                && reader.get_raw(&size)
+                && reader.get_list(&all_)
+                && reader.get_table(&metrics_)
+                && reader.get_table(&tags_)
+                && reader.get_table(&pairs_)
+                && reader.pos == end;
+    if (!success) {
+        clear();
+        return false;
+    }
+    max_id_ = max_id;
+    size_ = static_cast<size_t>(size);
+    return true;
+}
+
+}
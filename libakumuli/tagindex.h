@@ -0,0 +1,143 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Tag index. Maps metric names and tags to the lists of series ids.
+ *
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+namespace Akumuli {
+
+/** Compressed sorted list of series ids.
+  * Ids are stored in ascending order as varint encoded deltas. Every
+  * BLOCK_SIZE ids new block is started. First id and offset of each block
+  * are stored uncompressed in skip table, this allows to seek to arbitrary
+  * id without decoding the whole list.
+  */
+struct PostingList {
+    enum {
+        BLOCK_SIZE = 128,
+    };
+
+    typedef std::pair<uint64_t, size_t> SkipT;  //< First id of the block and offset of the next delta
+
+    std::vector<unsigned char> data_;   //< Encoded deltas
+    std::vector<SkipT>         skip_;   //< Skip table
+    uint64_t                   last_;   //< Largest id in the list
+    size_t                     size_;   //< Number of ids
+
+    PostingList();
+
+    /** Add id to the list. Ids are expected to arrive in ascending order,
+      * out of order id causes list to be rebuilt.
+      */
+    void append(uint64_t id);
+
+    size_t size() const;
+
+    //! Decode ids that are not less than `min_id`
+    void decode(uint64_t min_id, std::vector<uint64_t>* out) const;
+
+    //! Forward iterator over compressed list
+    struct Cursor {
+        PostingList const* list_;
+        size_t   block_;     //< Current block
+        size_t   pos_;       //< Offset of the next delta
+        size_t   end_;       //< End of the current block
+        uint64_t value_;     //< Current id
+        bool     done_;
+
+        Cursor(PostingList const& list);
+
+        //! Move to next id, return false if there is no more ids
+        bool next();
+
+        //! Move to first id that is not less than `id`, return false if there is no such id
+        bool seek(uint64_t id);
+
+    private:
+        void enter_block_(size_t block);
+    };
+};
+
+
+/** Tag index.
+  * Maintains posting lists for metric names, tag names and name=value pairs.
+  * Updated by series matcher when new series is added, used by query processor
+  * to resolve `where` and `group-by` clauses without scanning all series names.
+  */
+struct TagIndex {
+    typedef std::vector<uint64_t> IdsT;
+
+    //! Query description
+    struct Query {
+        //! Metric name, empty string matches any metric
+        std::string metric;
+        //! Series should have all of this tags (any value)
+        std::vector<std::string> tags;
+        //! Tag name and list of allowed values, series should match all items
+        std::vector<std::pair<std::string, std::vector<std::string>>> where;
+    };
+
+    typedef std::unordered_map<std::string, PostingList> TableT;
+
+    TableT              metrics_;   //< Metric name -> ids
+    TableT              tags_;      //< Tag name -> ids
+    TableT              pairs_;     //< "name=value" -> ids
+    PostingList         all_;       //< All series
+    uint64_t            max_id_;    //< Largest indexed id
+    std::atomic<size_t> size_;      //< Number of indexed series
+    mutable std::mutex  mutex_;
+
+    TagIndex();
+
+    /** Add series to index.
+      * @param begin points to the series name in normal form
+      * @param end points to the end of the series name
+      * @param id is a series id
+      */
+    void add(const char* begin, const char* end, uint64_t id);
+
+    //! Get number of indexed series atomically
+    size_t size() const;
+
+    /** Find series that match query.
+      * @param query is a query description
+      * @param min_id is an in-out parameter, only ids starting from this one are returned,
+      *        on return contains first id that wasn't indexed yet
+      * @return sorted list of ids
+      */
+    IdsT query(Query const& query, uint64_t* min_id) const;
+
+    //! Append position independent binary representation of the index to `out`
+    void serialize(std::vector<char>* out) const;
+
+    /** Replace content of the index with serialized data.
+      * Posting lists are copied as is, series names are not parsed.
+      * @return false if data is malformed (index is left empty in this case)
+      */
+    bool deserialize(const char* begin, const char* end);
+};
+
+}
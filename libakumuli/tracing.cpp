@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "tracing.h"
+
+#include <fstream>
+#include <iomanip>
+#include <thread>
+
+namespace Akumuli {
+namespace Tracing {
+
+static uint64_t steady_ns() {
+    auto ts = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(ts).count());
+}
+
+/** Pair of trace clock and steady clock readings taken at library load.
+  * Trace clock frequency is computed using the time elapsed since then.
+  */
+struct ClockAnchor {
+    uint64_t ticks;
+    uint64_t ns;
+
+    ClockAnchor()
+        : ticks(now())
+        , ns(steady_ns())
+    {
+    }
+};
+
+static ClockAnchor g_anchor;
+
+//! Get number of trace clock ticks per microsecond
+static double ticks_per_us() {
+    uint64_t ns = steady_ns();
+    if (ns - g_anchor.ns < 10000000ul) {
+        // Measurement interval is too short to be precise
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ns = steady_ns();
+    }
+    uint64_t ticks = now();
+    return static_cast<double>(ticks - g_anchor.ticks)*1000.0/static_cast<double>(ns - g_anchor.ns);
+}
+
+static std::string get_thread_name(TraceBuffer const& buf) {
+    if (buf.is_retired()) {
+        return buf.thread_name();
+    }
+    std::ifstream comm("/proc/self/task/" + std::to_string(buf.tid()) + "/comm");
+    std::string name;
+    std::getline(comm, name);
+    return name;
+}
+
+static void write_json_string(std::ostream& out, std::string const& str) {
+    out << '"';
+    for (char c: str) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << ' ';
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+bool is_enabled() {
+#ifdef AKU_ENABLE_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+void dump_chrome_trace(std::ostream& out) {
+    auto freq = ticks_per_us();
+    auto pid = getpid();
+    auto buffers = TraceRegistry::instance().collect();
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&]() {
+        if (!first) {
+            out << ",";
+        }
+        out << "\n";
+        first = false;
+    };
+    for (auto const& buf: buffers) {
+        auto events = buf->read();
+        separator();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << buf->tid()
+            << ",\"args\":{\"name\":";
+        write_json_string(out, get_thread_name(*buf));
+        out << "}}";
+        for (auto const& ev: events) {
+            // Events recorded before the anchor was taken are clamped to zero
+            auto begin = ev.begin > g_anchor.ticks ? ev.begin - g_anchor.ticks : 0;
+            auto duration = ev.end > ev.begin ? ev.end - ev.begin : 0;
+            separator();
+            out << "{\"name\":";
+            write_json_string(out, ev.name);
+            out << ",\"cat\":\"akumuli\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << buf->tid()
+                << ",\"ts\":" << static_cast<double>(begin)/freq
+                << ",\"dur\":" << static_cast<double>(duration)/freq << "}";
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"enabled\":" << (is_enabled() ? "true" : "false")
+        << ",\"ticks_per_us\":" << freq << "}}\n";
+}
+
+}  // namespace Tracing
+}  // namespace Akumuli
@@ -0,0 +1,284 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Hot path tracing spans.
+ *
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/** Tracing spans are compiled in only if AKU_ENABLE_TRACING is defined
+  * (cmake -DAKU_ENABLE_TRACING=ON), otherwise macros expand to nothing.
+  * Span name should be a string literal.
+  * AKU_TRACE_SPAN records every execution of the enclosing scope.
+  * AKU_TRACE_SLOW_SPAN records only executions that took at least `min_ticks`
+  * clock ticks, it should be used in functions that are called for every sample.
+  */
+#ifdef AKU_ENABLE_TRACING
+#define AKU_TRACE_CAT2_(a, b) a##b
+#define AKU_TRACE_CAT_(a, b) AKU_TRACE_CAT2_(a, b)
+#define AKU_TRACE_SPAN(name) \
+    Akumuli::Tracing::Span AKU_TRACE_CAT_(aku_trace_span_, __LINE__)(name, 0u)
+#define AKU_TRACE_SLOW_SPAN(name, min_ticks) \
+    Akumuli::Tracing::Span AKU_TRACE_CAT_(aku_trace_span_, __LINE__)(name, min_ticks)
+#else
+#define AKU_TRACE_SPAN(name)
+#define AKU_TRACE_SLOW_SPAN(name, min_ticks)
+#endif
+
+namespace Akumuli {
+namespace Tracing {
+
+//! Read trace clock (TSC if available, nanoseconds otherwise)
+inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    auto ts = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(ts).count());
+#endif
+}
+
+//! Recorded span
+struct Event {
+    const char* name;
+    uint64_t    begin;  //< Trace clock value at the start of the span
+    uint64_t    end;    //< Trace clock value at the end of the span
+};
+
+/** Per-thread ring buffer of the recorded spans.
+  * @brief Only owner thread can write to the buffer, `read` can be called
+  * from any thread at any time without blocking the writer. Old events are
+  * overwritten when buffer is full. Reader uses two counters to detect events
+  * that were overwritten while they were being copied (seqlock) and drops them.
+  */
+class TraceBuffer {
+public:
+    enum {
+        CAPACITY = 0x4000,  //< Number of events (should be a power of two)
+    };
+private:
+    struct Slot {
+        std::atomic<const char*> name;
+        std::atomic<uint64_t>    begin;
+        std::atomic<uint64_t>    end;
+    };
+    std::unique_ptr<Slot[]>     slots_;
+    std::atomic<uint64_t>       claimed_;    //< Number of events that writer have started to write
+    std::atomic<uint64_t>       committed_;  //< Number of events that were completely written
+    const long                  tid_;
+    std::atomic<bool>           retired_;    //< Owner thread is finished
+    std::string                 thread_name_;
+public:
+    TraceBuffer()
+        : slots_(new Slot[CAPACITY])
+        , claimed_{0}
+        , committed_{0}
+        , tid_(syscall(SYS_gettid))
+        , retired_{false}
+    {
+        for (int i = 0; i < CAPACITY; i++) {
+            slots_[i].name.store(nullptr, std::memory_order_relaxed);
+            slots_[i].begin.store(0, std::memory_order_relaxed);
+            slots_[i].end.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    //! Add event (should be called only by the owner thread)
+    void push(const char* name, uint64_t begin, uint64_t end) {
+        auto ix = claimed_.load(std::memory_order_relaxed);
+        claimed_.store(ix + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        auto& slot = slots_[ix & (CAPACITY - 1)];
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.begin.store(begin, std::memory_order_relaxed);
+        slot.end.store(end, std::memory_order_relaxed);
+        committed_.store(ix + 1, std::memory_order_release);
+    }
+
+    //! Copy recorded events in the order of completion
+    std::vector<Event> read() const {
+        std::vector<Event> result;
+        auto last = committed_.load(std::memory_order_acquire);
+        auto first = last > CAPACITY ? last - CAPACITY : 0;
+        result.reserve(last - first);
+        for (auto ix = first; ix < last; ix++) {
+            auto const& slot = slots_[ix & (CAPACITY - 1)];
+            Event ev = {
+                slot.name.load(std::memory_order_relaxed),
+                slot.begin.load(std::memory_order_relaxed),
+                slot.end.load(std::memory_order_relaxed),
+            };
+            result.push_back(ev);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // Slot `ix` is reused by the event `ix + CAPACITY`, drop the events
+        // that could have been overwritten while they were copied
+        auto claimed = claimed_.load(std::memory_order_relaxed);
+        if (claimed > first + CAPACITY) {
+            auto nlost = std::min(claimed - CAPACITY - first, static_cast<uint64_t>(result.size()));
+            result.erase(result.begin(), result.begin() + static_cast<std::ptrdiff_t>(nlost));
+        }
+        return result;
+    }
+
+    //! Get OS thread id of the owner thread
+    long tid() const {
+        return tid_;
+    }
+
+    //! Mark buffer as retired (called by owner thread on exit)
+    void retire() {
+        char name[16] = {};
+        if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0) {
+            thread_name_ = name;
+        }
+        retired_.store(true);
+    }
+
+    bool is_retired() const {
+        return retired_.load();
+    }
+
+    //! Get owner thread name (valid only if buffer is retired)
+    std::string const& thread_name() const {
+        return thread_name_;
+    }
+};
+
+/** List of all trace buffers.
+  * Buffers of the finished threads are kept until next dump (only
+  * MAX_RETIRED of them) so spans from short-lived threads are not lost.
+  */
+class TraceRegistry {
+    std::mutex                                  lock_;
+    std::vector<std::shared_ptr<TraceBuffer>>   buffers_;
+public:
+    enum {
+        MAX_RETIRED = 64,
+    };
+
+    void add(std::shared_ptr<TraceBuffer> buffer) {
+        std::lock_guard<std::mutex> guard(lock_);
+        buffers_.push_back(buffer);
+        size_t nretired = 0;
+        for (auto const& buf: buffers_) {
+            nretired += buf->is_retired() ? 1 : 0;
+        }
+        for (auto it = buffers_.begin(); it != buffers_.end() && nretired > MAX_RETIRED;) {
+            if ((*it)->is_retired()) {
+                it = buffers_.erase(it);
+                nretired--;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    //! Get all buffers, buffers of the finished threads are removed from registry
+    std::vector<std::shared_ptr<TraceBuffer>> collect() {
+        std::lock_guard<std::mutex> guard(lock_);
+        auto result = buffers_;
+        std::vector<std::shared_ptr<TraceBuffer>> alive;
+        for (auto const& buf: buffers_) {
+            if (!buf->is_retired()) {
+                alive.push_back(buf);
+            }
+        }
+        std::swap(alive, buffers_);
+        return result;
+    }
+
+    static TraceRegistry& instance() {
+        static TraceRegistry registry;
+        return registry;
+    }
+};
+
+//! Owner of the thread's trace buffer
+struct ThreadTraceBuffer {
+    std::shared_ptr<TraceBuffer> buffer;
+
+    ThreadTraceBuffer()
+        : buffer(std::make_shared<TraceBuffer>())
+    {
+        TraceRegistry::instance().add(buffer);
+    }
+
+    ~ThreadTraceBuffer() {
+        buffer->retire();
+    }
+};
+
+//! Get trace buffer of the current thread (created on first use)
+inline TraceBuffer& local_buffer() {
+    static thread_local ThreadTraceBuffer tls;
+    return *tls.buffer;
+}
+
+//! Scope guard that records the span on exit
+class Span {
+    const char* name_;
+    uint64_t    min_ticks_;
+    uint64_t    begin_;
+public:
+    Span(const char* name, uint64_t min_ticks)
+        : name_(name)
+        , min_ticks_(min_ticks)
+        , begin_(now())
+    {
+    }
+
+    Span(Span const&) = delete;
+    Span& operator = (Span const&) = delete;
+
+    ~Span() {
+        auto end = now();
+        if (end - begin_ >= min_ticks_) {
+            local_buffer().push(name_, begin_, end);
+        }
+    }
+};
+
+//! Returns true if library is built with tracing spans
+bool is_enabled();
+
+/** Write all recorded spans in Chrome trace event format (JSON object with
+  * `traceEvents` array of complete events, timestamps in microseconds).
+  * Can be opened in chrome://tracing or Perfetto UI.
+  */
+void dump_chrome_trace(std::ostream& out);
+
+}  // namespace Tracing
+}  // namespace Akumuli
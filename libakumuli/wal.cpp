@@ -0,0 +1,338 @@
+/**
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "wal.h"
+#include "util.h"
+
+#include <cstring>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace Akumuli {
+
+static std::string segment_path(std::string const& prefix, uint64_t id) {
+    std::stringstream fmt;
+    fmt << prefix << "_" << id << ".wal";
+    return fmt.str();
+}
+
+//! Returns sorted list of segment numbers
+static std::vector<uint64_t> list_segments(std::string const& prefix) {
+    namespace fs = boost::filesystem;
+    std::vector<uint64_t> result;
+    fs::path base(prefix);
+    fs::path dir = base.parent_path();
+    if (dir.empty()) {
+        dir = fs::current_path();
+    }
+    std::string stem = base.filename().string() + "_";
+    boost::system::error_code error;
+    fs::directory_iterator it(dir, error), end;
+    if (error) {
+        return result;
+    }
+    for (; it != end; it++) {
+        if (it->path().extension() != ".wal") {
+            continue;
+        }
+        std::string name = it->path().stem().string();
+        if (name.size() <= stem.size() || name.compare(0, stem.size(), stem) != 0) {
+            continue;
+        }
+        try {
+            result.push_back(boost::lexical_cast<uint64_t>(name.substr(stem.size())));
+        } catch (boost::bad_lexical_cast const&) {
+            continue;
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+static uint32_t frame_checksum(uint32_t type, uint32_t count, WalRecord const* records) {
+    boost::crc_32_type checksum;
+    checksum.process_bytes(&type, sizeof(type));
+    checksum.process_bytes(&count, sizeof(count));
+    checksum.process_bytes(records, sizeof(WalRecord)*count);
+    return checksum.checksum();
+}
+
+WriteAheadLog::WriteAheadLog(std::string prefix, aku_logger_cb_t logger)
+    : prefix_(prefix)
+    , logger_(logger)
+    , current_({0u, Key(), 0u})
+    , fd_(-1)
+    , nbytes_(0u)
+    , last_marker_()
+    , stop_(false)
+    , unchecked_{0}
+{
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    close();
+}
+
+size_t WriteAheadLog::replay(std::function<void(WalRecord const&)> const& cb) {
+    // Read all frames in log order
+    std::vector<std::pair<uint32_t, WalRecord>> entries;
+    auto segments = list_segments(prefix_);
+    for (auto id: segments) {
+        std::ifstream stream(segment_path(prefix_, id), std::ios::binary);
+        Segment segment = { id, Key(), 0u };
+        while (stream) {
+            WalFrameHeader header;
+            if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+                break;
+            }
+            bool bad_frame = (header.type != DATA && header.type != MARKER) || header.count > MAX_FRAME_RECORDS;
+            std::vector<WalRecord> records;
+            if (!bad_frame) {
+                records.resize(header.count);
+                bad_frame = !stream.read(reinterpret_cast<char*>(records.data()), sizeof(WalRecord)*header.count)
+                         || frame_checksum(header.type, header.count, records.data()) != header.checksum;
+            }
+            if (bad_frame) {
+                // Torn write at the end of the segment, everything after it can't be trusted
+                std::stringstream fmt;
+                fmt << "WAL segment " << segment_path(prefix_, id) << " is truncated or corrupted";
+                (*logger_)(AKU_LOG_ERROR, fmt.str().c_str());
+                break;
+            }
+            for (auto const& rec: records) {
+                entries.push_back(std::make_pair(static_cast<uint32_t>(header.type), rec));
+                if (header.type == DATA) {
+                    segment.max_key = std::max(segment.max_key, Key(rec.timestamp, rec.paramid));
+                    segment.nrecords++;
+                }
+            }
+        }
+        closed_.push_back(segment);
+        current_.id = id + 1;
+    }
+
+    // Record is persisted if some marker that follows it has larger key
+    std::vector<bool> persisted(entries.size(), false);
+    Key watermark;
+    for (auto i = static_cast<int64_t>(entries.size()) - 1; i >= 0; i--) {
+        auto const& rec = entries[i].second;
+        Key key(rec.timestamp, rec.paramid);
+        if (entries[i].first == MARKER) {
+            watermark = std::max(watermark, key);
+        } else {
+            persisted[i] = key < watermark;
+        }
+    }
+
+    size_t nreplayed = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].first == DATA && !persisted[i]) {
+            cb(entries[i].second);
+            nreplayed++;
+        }
+    }
+    return nreplayed;
+}
+
+void WriteAheadLog::start() {
+    // Never overwrite existing segments
+    auto segments = list_segments(prefix_);
+    if (!segments.empty()) {
+        current_.id = std::max(current_.id, segments.back() + 1);
+    }
+    open_segment_();
+    thread_ = std::thread(&WriteAheadLog::worker_, this);
+}
+
+void WriteAheadLog::append(aku_Timestamp ts, aku_ParamId id, double value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    pending_.push_back({ts, id, value});
+    bool notify = pending_.size() == BATCH_SIZE;
+    lock.unlock();
+    if (notify) {
+        cond_.notify_one();
+    }
+}
+
+void WriteAheadLog::checkpoint(Key const& watermark) {
+    unchecked_.store(0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    markers_.push_back(std::make_pair(pending_.size(), watermark));
+}
+
+bool WriteAheadLog::needs_checkpoint() const {
+    return unchecked_.load() != 0;
+}
+
+void WriteAheadLog::close() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_one();
+    thread_.join();
+
+    // Active segment can be removed too if everything was checkpointed
+    if (fd_ >= 0) {
+        ::fdatasync(fd_);
+        ::close(fd_);
+        fd_ = -1;
+        closed_.push_back(current_);
+    }
+    truncate_(last_marker_);
+}
+
+void WriteAheadLog::open_segment_() {
+    auto path = segment_path(prefix_, current_.id);
+    fd_ = ::open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0644);
+    if (fd_ < 0) {
+        std::stringstream fmt;
+        fmt << "can't create WAL segment " << path << ", error: " << strerror(errno);
+        AKU_PANIC(fmt.str().c_str());
+    }
+    nbytes_ = 0u;
+}
+
+void WriteAheadLog::rotate_() {
+    ::fdatasync(fd_);
+    ::close(fd_);
+    closed_.push_back(current_);
+    current_ = { current_.id + 1, Key(), 0u };
+    open_segment_();
+    unchecked_++;
+}
+
+void WriteAheadLog::write_frame_(FrameType type, WalRecord const* records, uint32_t count) {
+    WalFrameHeader header = { type, count, frame_checksum(type, count, records) };
+    size_t size = sizeof(header) + sizeof(WalRecord)*count;
+    frame_buf_.resize(size);
+    memcpy(frame_buf_.data(), &header, sizeof(header));
+    memcpy(frame_buf_.data() + sizeof(header), records, sizeof(WalRecord)*count);
+    const char* data = frame_buf_.data();
+    while (size) {
+        auto nwritten = ::write(fd_, data, size);
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::stringstream fmt;
+            fmt << "WAL write error: " << strerror(errno);
+            (*logger_)(AKU_LOG_ERROR, fmt.str().c_str());
+            return;
+        }
+        data   += nwritten;
+        size   -= static_cast<size_t>(nwritten);
+        nbytes_ += static_cast<size_t>(nwritten);
+    }
+    if (type == DATA) {
+        for (uint32_t i = 0; i < count; i++) {
+            current_.max_key = std::max(current_.max_key, Key(records[i].timestamp, records[i].paramid));
+        }
+        current_.nrecords += count;
+    }
+}
+
+void WriteAheadLog::write_batch_(std::vector<WalRecord> const& records,
+                                 std::vector<std::pair<size_t, Key>> const& markers)
+{
+    size_t pos = 0;
+    auto write_data = [&](size_t end) {
+        while (pos < end) {
+            auto count = static_cast<uint32_t>(std::min(end - pos, static_cast<size_t>(MAX_FRAME_RECORDS)));
+            write_frame_(DATA, records.data() + pos, count);
+            pos += count;
+        }
+    };
+    for (auto const& marker: markers) {
+        write_data(marker.first);
+        WalRecord rec = { std::get<0>(marker.second), std::get<1>(marker.second), 0.0 };
+        write_frame_(MARKER, &rec, 1u);
+        last_marker_ = marker.second;
+        truncate_(marker.second);
+    }
+    write_data(records.size());
+    ::fdatasync(fd_);
+    if (nbytes_ >= SEGMENT_SIZE) {
+        rotate_();
+    }
+}
+
+void WriteAheadLog::truncate_(Key const& watermark) {
+    // Segments are removed in log order, otherwise markers from removed segments
+    // can be lost while records covered by them are still present.
+    while (!closed_.empty()) {
+        auto const& segment = closed_.front();
+        if (segment.nrecords != 0 && !(segment.max_key < watermark)) {
+            break;
+        }
+        auto path = segment_path(prefix_, segment.id);
+        if (::unlink(path.c_str()) != 0 && errno != ENOENT) {
+            std::stringstream fmt;
+            fmt << "can't remove WAL segment " << path << ", error: " << strerror(errno);
+            (*logger_)(AKU_LOG_ERROR, fmt.str().c_str());
+            break;
+        }
+        closed_.pop_front();
+    }
+}
+
+void WriteAheadLog::worker_() {
+    std::vector<WalRecord> records;
+    std::vector<std::pair<size_t, Key>> markers;
+    bool done = false;
+    while (!done) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS), [this] {
+                return stop_ || pending_.size() >= BATCH_SIZE;
+            });
+            std::swap(records, pending_);
+            std::swap(markers, markers_);
+            done = stop_;
+        }
+        if (!records.empty() || !markers.empty()) {
+            write_batch_(records, markers);
+        }
+        records.clear();
+        markers.clear();
+    }
+}
+
+void WriteAheadLog::remove_segments(std::string prefix, aku_logger_cb_t logger) {
+    for (auto id: list_segments(prefix)) {
+        auto path = segment_path(prefix, id);
+        if (::unlink(path.c_str()) != 0) {
+            std::stringstream fmt;
+            fmt << "can't remove WAL segment " << path;
+            (*logger)(AKU_LOG_ERROR, fmt.str().c_str());
+        }
+    }
+}
+
+}
@@ -0,0 +1,145 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Write-ahead log for the in-memory sequencer window.
+ *
+ * Copyright (c) 2015 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <tuple>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+#include "akumuli.h"
+
+namespace Akumuli {
+
+//! WAL record
+struct WalRecord {
+    aku_Timestamp timestamp;
+    aku_ParamId   paramid;
+    double        value;
+} __attribute__((packed));
+
+//! WAL frame header, followed by `count` records
+struct WalFrameHeader {
+    uint32_t type;      //< Frame type
+    uint32_t count;     //< Number of records in the frame
+    uint32_t checksum;  //< CRC32 of the type, count and records
+} __attribute__((packed));
+
+
+/** Write-ahead log.
+  * @brief All samples accepted by the sequencer are appended to the log
+  * by the writer thread. Appended records are batched and written to disk
+  * sequentially by the background thread (one CRC-framed frame per batch).
+  * The log is divided into segments. When data is merged into the page and
+  * page is flushed, storage writes checkpoint marker with the lowest key
+  * (timestamp, paramid) that is still in the sequencer. All records that
+  * precede marker in the log and have smaller keys are durable and segments
+  * that contain only such records are deleted.
+  */
+class WriteAheadLog {
+public:
+    typedef std::tuple<aku_Timestamp, aku_ParamId> Key;
+
+    enum FrameType {
+        DATA   = 0x5741,  //< Frame contains samples
+        MARKER = 0x4d4b,  //< Frame contains checkpoint marker
+    };
+
+    static const size_t   SEGMENT_SIZE       = 0x4000000;  //< Segment size limit (64Mb)
+    static const size_t   BATCH_SIZE         = 0x1000;     //< Writer thread is woken up when batch is full
+    static const uint32_t MAX_FRAME_RECORDS  = 0x10000;    //< Max number of records in one frame
+    static const int      FLUSH_INTERVAL_MS  = 10;         //< Group commit interval
+
+private:
+    struct Segment {
+        uint64_t id;        //< Segment number
+        Key      max_key;   //< Largest key stored in segment
+        size_t   nrecords;  //< Number of data records in segment
+    };
+
+    const std::string          prefix_;
+    aku_logger_cb_t            logger_;
+    // Writer state (used by background thread)
+    std::deque<Segment>        closed_;       //< Closed segments in log order
+    Segment                    current_;      //< Active segment
+    int                        fd_;           //< Active segment file descriptor
+    size_t                     nbytes_;       //< Active segment size
+    Key                        last_marker_;  //< Last checkpoint marker written
+    std::vector<char>          frame_buf_;
+    // Queue
+    std::mutex                 mutex_;
+    std::condition_variable    cond_;
+    std::vector<WalRecord>     pending_;      //< Records waiting to be written
+    std::vector<std::pair<size_t, Key>> markers_;  //< Markers (position in `pending_` and key)
+    bool                       stop_;
+    std::thread                thread_;
+    std::atomic<int>           unchecked_;    //< Segments rotated since last checkpoint
+
+    void open_segment_();
+    void rotate_();
+    void write_frame_(FrameType type, WalRecord const* records, uint32_t count);
+    void write_batch_(std::vector<WalRecord> const& records, std::vector<std::pair<size_t, Key>> const& markers);
+    void truncate_(Key const& watermark);
+    void worker_();
+
+public:
+    /** C-tor
+      * @param prefix path prefix, segments are named `<prefix>_<N>.wal`
+      * @param logger logger
+      */
+    WriteAheadLog(std::string prefix, aku_logger_cb_t logger);
+
+    ~WriteAheadLog();
+
+    /** Read all segments and pass records that wasn't persisted to the page
+      * to callback (in log order). Should be called before `start`.
+      * @returns number of replayed records
+      */
+    size_t replay(std::function<void(WalRecord const&)> const& cb);
+
+    //! Open new segment and start background thread
+    void start();
+
+    //! Add sample to the log (called from writer thread)
+    void append(aku_Timestamp ts, aku_ParamId id, double value);
+
+    /** Add checkpoint marker.
+      * @param watermark lowest key that wasn't written to disk yet
+      */
+    void checkpoint(Key const& watermark);
+
+    //! Returns true if new segment was created since last checkpoint
+    bool needs_checkpoint() const;
+
+    //! Write all pending records, stop background thread and close active segment
+    void close();
+
+    //! Remove all segments
+    static void remove_segments(std::string prefix, aku_logger_cb_t logger);
+};
+
+}
@@ -0,0 +1,469 @@
+#include "benchmark.h"
+#include "perftest_tools.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace Akumuli {
+namespace Bench {
+
+uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000000ul + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+//                   //
+//     Histogram     //
+//                   //
+
+Histogram::Histogram()
+    : counts_(NBUCKETS, 0u)
+{
+    reset();
+}
+
+size_t Histogram::index_of(uint64_t value) {
+    int msb = value ? 63 - __builtin_clzll(value) : 0;
+    int shift = msb > SUB_BITS ? msb - SUB_BITS : 0;
+    return static_cast<size_t>(shift)*SUB_COUNT + static_cast<size_t>(value >> shift);
+}
+
+uint64_t Histogram::upper_bound_of(size_t index) {
+    if (index < 2*SUB_COUNT) {
+        return index;
+    }
+    size_t shift = index/SUB_COUNT - 1;
+    uint64_t top = index - shift*SUB_COUNT;
+    return ((top + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+    counts_[index_of(value)]++;
+    count_++;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+    sum_ += static_cast<double>(value);
+}
+
+void Histogram::merge(Histogram const& other) {
+    for (size_t i = 0; i < counts_.size(); i++) {
+        counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    sum_ += other.sum_;
+}
+
+void Histogram::reset() {
+    std::fill(counts_.begin(), counts_.end(), 0u);
+    count_ = 0u;
+    min_ = UINT64_MAX;
+    max_ = 0u;
+    sum_ = 0.0;
+}
+
+uint64_t Histogram::count() const {
+    return count_;
+}
+
+uint64_t Histogram::min() const {
+    return count_ ? min_ : 0u;
+}
+
+uint64_t Histogram::max() const {
+    return max_;
+}
+
+double Histogram::mean() const {
+    return count_ ? sum_/count_ : 0.0;
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if (count_ == 0) {
+        return 0u;
+    }
+    auto target = static_cast<uint64_t>(std::ceil(p/100.0*count_));
+    if (target == 0) {
+        return min_;
+    }
+    uint64_t acc = 0u;
+    for (size_t i = 0; i < counts_.size(); i++) {
+        acc += counts_[i];
+        if (acc >= target) {
+            return std::max(min_, std::min(upper_bound_of(i), max_));
+        }
+    }
+    return max_;
+}
+
+//                        //
+//     Resource usage     //
+//                        //
+
+static double to_seconds(timeval tv) {
+    return double(tv.tv_sec) + double(tv.tv_usec)/1000000.0;
+}
+
+static size_t get_rss() {
+    size_t size = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%zu %zu", &size, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return resident*static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+ResourceUsage ResourceUsage::current() {
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    ResourceUsage res;
+    res.user_cpu = to_seconds(usage.ru_utime);
+    res.sys_cpu = to_seconds(usage.ru_stime);
+    res.rss = get_rss();
+    return res;
+}
+
+RssSampler::RssSampler(int interval_ms)
+    : stop_{false}
+    , peak_{0u}
+    , interval_ms_(interval_ms)
+{
+}
+
+RssSampler::~RssSampler() {
+    stop();
+}
+
+void RssSampler::start() {
+    stop_.store(false);
+    peak_.store(get_rss());
+    thread_ = std::thread([this]() {
+        while (!stop_.load()) {
+            auto rss = get_rss();
+            if (rss > peak_.load()) {
+                peak_.store(rss);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms_));
+        }
+    });
+}
+
+void RssSampler::stop() {
+    if (thread_.joinable()) {
+        stop_.store(true);
+        thread_.join();
+        auto rss = get_rss();
+        if (rss > peak_.load()) {
+            peak_.store(rss);
+        }
+    }
+}
+
+size_t RssSampler::peak() const {
+    return peak_.load();
+}
+
+//               //
+//     Trial     //
+//               //
+
+Trial::Trial(uint64_t ops, Histogram* latency, std::map<std::string, double>* counters, bool warmup)
+    : start_(now_ns())
+    , ops_(ops)
+    , latency_(latency)
+    , counters_(counters)
+    , warmup_(warmup)
+{
+}
+
+void Trial::restart() {
+    start_ = now_ns();
+}
+
+void Trial::record(uint64_t latency_ns) {
+    latency_->record(latency_ns);
+}
+
+void Trial::set_ops(uint64_t ops) {
+    ops_ = ops;
+}
+
+void Trial::set_counter(std::string const& name, double value) {
+    (*counters_)[name] = value;
+}
+
+bool Trial::is_warmup() const {
+    return warmup_;
+}
+
+//               //
+//     Suite     //
+//               //
+
+static int parse_int(std::string const& opt, const char* value) {
+    try {
+        return std::stoi(value);
+    } catch (std::exception const&) {
+        std::runtime_error error("invalid value of the " + opt + " option: " + value);
+        throw error;
+    }
+}
+
+Suite::Suite(std::string name, int argc, const char* const* argv, int default_trials, int default_warmup)
+    : name_(name)
+    , warmup_(default_warmup)
+    , trials_(default_trials)
+    , graphite_(false)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--warmup" && has_value) {
+            warmup_ = parse_int(arg, argv[++i]);
+        } else if (arg == "--trials" && has_value) {
+            trials_ = parse_int(arg, argv[++i]);
+        } else if (arg == "--json" && has_value) {
+            json_path_ = argv[++i];
+        } else if (arg == "--filter" && has_value) {
+            filter_ = argv[++i];
+        } else if (arg == "--graphite" || arg == "graphite") {
+            // Plain `graphite` is supported for compatibility with old scripts
+            graphite_ = true;
+        } else {
+            args_.push_back(arg);
+        }
+    }
+    warmup_ = std::max(warmup_, 0);
+    trials_ = std::max(trials_, 1);
+}
+
+std::vector<std::string> const& Suite::args() const {
+    return args_;
+}
+
+int Suite::trials() const {
+    return trials_;
+}
+
+bool Suite::run(std::string const& name, uint64_t nops, BenchFn fn) {
+    if (!filter_.empty() && name.find(filter_) == std::string::npos) {
+        return false;
+    }
+    Result res;
+    res.name = name;
+    res.ops = nops;
+    res.user_cpu = 0.0;
+    res.sys_cpu = 0.0;
+    res.rss_peak = 0u;
+    res.rss_end = 0u;
+    try {
+        for (int i = 0; i < warmup_; i++) {
+            Histogram latency;
+            std::map<std::string, double> counters;
+            Trial trial(nops, &latency, &counters, true);
+            fn(trial);
+        }
+        for (int i = 0; i < trials_; i++) {
+            Histogram latency;
+            RssSampler sampler;
+            Trial trial(nops, &latency, &res.counters, false);
+            sampler.start();
+            auto before = ResourceUsage::current();
+            trial.restart();
+            fn(trial);
+            auto end = now_ns();
+            auto after = ResourceUsage::current();
+            sampler.stop();
+            // Setup code before `restart` call is excluded from the time but not from CPU usage
+            res.times.push_back(double(end - trial.start_)/1000000000.0);
+            res.ops = trial.ops_;
+            res.latency.merge(latency);
+            res.user_cpu += after.user_cpu - before.user_cpu;
+            res.sys_cpu += after.sys_cpu - before.sys_cpu;
+            res.rss_peak = std::max(res.rss_peak, sampler.peak());
+            res.rss_end = after.rss;
+        }
+    } catch (std::exception const& e) {
+        res.error = e.what();
+    }
+    print(res);
+    if (graphite_ && res.error.empty()) {
+        auto min = *std::min_element(res.times.begin(), res.times.end());
+        push_metric_to_graphite(name_ + "." + name, 1000.0*min);
+    }
+    results_.push_back(res);
+    return res.error.empty();
+}
+
+struct Stats {
+    double min, median, mean, max, stddev;
+
+    Stats(std::vector<double> values)
+        : min(0), median(0), mean(0), max(0), stddev(0)
+    {
+        if (values.empty()) {
+            return;
+        }
+        std::sort(values.begin(), values.end());
+        min = values.front();
+        max = values.back();
+        auto n = values.size();
+        median = n % 2 ? values[n/2] : (values[n/2 - 1] + values[n/2])/2;
+        for (auto x: values) {
+            mean += x;
+        }
+        mean /= n;
+        for (auto x: values) {
+            stddev += (x - mean)*(x - mean);
+        }
+        stddev = n > 1 ? std::sqrt(stddev/(n - 1)) : 0.0;
+    }
+};
+
+static std::vector<double> get_throughput(uint64_t ops, std::vector<double> const& times) {
+    std::vector<double> res;
+    for (auto t: times) {
+        res.push_back(t > 0 ? ops/t : 0.0);
+    }
+    return res;
+}
+
+void Suite::print(Result const& res) const {
+    std::cout << name_ << "." << res.name << ": ";
+    if (!res.error.empty()) {
+        std::cout << "error: " << res.error << std::endl;
+        return;
+    }
+    Stats time(res.times);
+    Stats tput(get_throughput(res.ops, res.times));
+    std::cout << "min " << time.min << "s, median " << time.median << "s";
+    if (res.ops) {
+        std::cout << ", " << static_cast<uint64_t>(tput.median) << " ops/sec";
+    }
+    if (res.latency.count()) {
+        std::cout << ", p50 " << res.latency.percentile(50)
+                  << "ns, p99 " << res.latency.percentile(99)
+                  << "ns, max " << res.latency.max() << "ns";
+    }
+    std::cout << ", peak rss " << res.rss_peak/(1024*1024) << "MB";
+    for (auto kv: res.counters) {
+        std::stringstream value;
+        value << std::setprecision(9) << kv.second;
+        std::cout << ", " << kv.first << " " << value.str();
+    }
+    std::cout << std::endl;
+}
+
+static std::string quote(std::string const& str) {
+    std::stringstream out;
+    out << '"';
+    for (auto c: str) {
+        switch (c) {
+        case '"':  out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\n': out << "\\n"; break;
+        case '\t': out << "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+            } else {
+                out << c;
+            }
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+static void write_stats(std::ostream& out, const char* name, Stats const& stats) {
+    out << "      " << quote(name) << ": {"
+        << "\"min\": " << stats.min
+        << ", \"median\": " << stats.median
+        << ", \"mean\": " << stats.mean
+        << ", \"max\": " << stats.max
+        << ", \"stddev\": " << stats.stddev << "},\n";
+}
+
+void Suite::write_json(std::ostream& out) const {
+    out << std::setprecision(9);
+    out << "{\n";
+    out << "  \"suite\": " << quote(name_) << ",\n";
+    out << "  \"options\": {\"warmup\": " << warmup_ << ", \"trials\": " << trials_ << "},\n";
+    out << "  \"benchmarks\": [";
+    for (size_t i = 0; i < results_.size(); i++) {
+        auto const& res = results_[i];
+        out << (i ? ",\n" : "\n") << "    {\n";
+        out << "      \"name\": " << quote(res.name) << ",\n";
+        if (!res.error.empty()) {
+            out << "      \"error\": " << quote(res.error) << "\n    }";
+            continue;
+        }
+        out << "      \"ops\": " << res.ops << ",\n";
+        out << "      \"trials\": " << res.times.size() << ",\n";
+        write_stats(out, "time", Stats(res.times));
+        write_stats(out, "throughput", Stats(get_throughput(res.ops, res.times)));
+        auto const& lat = res.latency;
+        out << "      \"latency_ns\": {"
+            << "\"count\": " << lat.count()
+            << ", \"min\": " << lat.min()
+            << ", \"mean\": " << lat.mean()
+            << ", \"p50\": " << lat.percentile(50)
+            << ", \"p90\": " << lat.percentile(90)
+            << ", \"p99\": " << lat.percentile(99)
+            << ", \"p999\": " << lat.percentile(99.9)
+            << ", \"max\": " << lat.max() << "},\n";
+        double total = 0.0;
+        for (auto t: res.times) {
+            total += t;
+        }
+        out << "      \"cpu\": {"
+            << "\"user\": " << res.user_cpu
+            << ", \"sys\": " << res.sys_cpu
+            << ", \"utilization\": " << (total > 0 ? (res.user_cpu + res.sys_cpu)/total : 0.0) << "},\n";
+        out << "      \"rss\": {\"peak\": " << res.rss_peak << ", \"end\": " << res.rss_end << "},\n";
+        out << "      \"counters\": {";
+        bool first = true;
+        for (auto const& kv: res.counters) {
+            out << (first ? "" : ", ") << quote(kv.first) << ": " << kv.second;
+            first = false;
+        }
+        out << "}\n    }";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int Suite::finish() {
+    if (!json_path_.empty()) {
+        std::ofstream out(json_path_);
+        write_json(out);
+        if (!out) {
+            std::cerr << "Can't write results to " << json_path_ << std::endl;
+            return 1;
+        }
+    }
+    for (auto const& res: results_) {
+        if (!res.error.empty()) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+}  // namespace Bench
+}  // namespace Akumuli
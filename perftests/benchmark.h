@@ -0,0 +1,196 @@
+/**
+ * Common benchmark harness for the performance tests.
+ *
+ * Every perftest creates a `Suite` and runs a number of named benchmarks
+ * through it. Each benchmark is executed several times (warmup runs are
+ * discarded), per-operation latencies can be recorded into the histogram,
+ * CPU time and RSS are sampled during each trial. Results are printed to
+ * stdout and can be written to JSON file to compare different builds.
+ *
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Akumuli {
+namespace Bench {
+
+//! Get monotonic time in nanoseconds
+uint64_t now_ns();
+
+/** Latency histogram with logarithmic buckets (HDR histogram layout).
+  * Every power of two range is divided into SUB_COUNT linear sub-buckets,
+  * values below 2*SUB_COUNT are stored exactly. Relative error of the
+  * reported percentiles is below 1/SUB_COUNT.
+  */
+class Histogram {
+public:
+    enum {
+        SUB_BITS = 7,
+        SUB_COUNT = 1 << SUB_BITS,
+        NBUCKETS = (64 - SUB_BITS + 1)*SUB_COUNT,
+    };
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t              count_;
+    uint64_t              min_;
+    uint64_t              max_;
+    double                sum_;
+
+    static size_t index_of(uint64_t value);
+
+    //! Get largest value that falls into the bucket
+    static uint64_t upper_bound_of(size_t index);
+public:
+    Histogram();
+
+    void record(uint64_t value);
+
+    void merge(Histogram const& other);
+
+    void reset();
+
+    uint64_t count() const;
+    uint64_t min() const;
+    uint64_t max() const;
+    double mean() const;
+
+    //! Get value at percentile (0 - 100)
+    uint64_t percentile(double p) const;
+};
+
+//! Process resource usage snapshot
+struct ResourceUsage {
+    double  user_cpu;  //< User CPU time in seconds
+    double  sys_cpu;   //< System CPU time in seconds
+    size_t  rss;       //< Resident set size in bytes
+
+    static ResourceUsage current();
+};
+
+/** Samples RSS of the process in background thread to find its peak
+  * value during the trial (ru_maxrss can't be reset between trials).
+  */
+class RssSampler {
+    std::thread         thread_;
+    std::atomic<bool>   stop_;
+    std::atomic<size_t> peak_;
+    const int           interval_ms_;
+public:
+    RssSampler(int interval_ms = 10);
+    ~RssSampler();
+
+    void start();
+
+    void stop();
+
+    size_t peak() const;
+};
+
+//! Single run of the benchmark
+class Trial {
+    friend class Suite;
+    uint64_t                        start_;
+    uint64_t                        ops_;
+    Histogram                      *latency_;
+    std::map<std::string, double>  *counters_;
+    const bool                      warmup_;
+
+    Trial(uint64_t ops, Histogram* latency, std::map<std::string, double>* counters, bool warmup);
+public:
+    //! Restart trial timer (used to exclude setup code from measurement)
+    void restart();
+
+    //! Add latency sample (in nanoseconds)
+    void record(uint64_t latency_ns);
+
+    //! Override number of operations performed by this trial
+    void set_ops(uint64_t ops);
+
+    //! Set custom metric (compression ratio, counter value, etc)
+    void set_counter(std::string const& name, double value);
+
+    //! Returns true if this trial is not measured
+    bool is_warmup() const;
+};
+
+/** Set of benchmarks that belongs to one perftest.
+  * Recognized command line options:
+  * --warmup N     number of warmup runs (not measured)
+  * --trials N     number of measured runs
+  * --json FILE    write results to file
+  * --filter STR   run only benchmarks which names contain STR
+  * --graphite     push results to graphite (GRAPHITE_HOST env. variable)
+  * Other arguments are available through `args` method.
+  */
+class Suite {
+public:
+    typedef std::function<void(Trial&)> BenchFn;
+private:
+    struct Result {
+        std::string                     name;
+        uint64_t                        ops;
+        std::vector<double>             times;      //< Duration of every trial in seconds
+        Histogram                       latency;
+        double                          user_cpu;
+        double                          sys_cpu;
+        size_t                          rss_peak;
+        size_t                          rss_end;
+        std::map<std::string, double>   counters;
+        std::string                     error;
+    };
+    std::string                 name_;
+    int                         warmup_;
+    int                         trials_;
+    std::string                 json_path_;
+    std::string                 filter_;
+    bool                        graphite_;
+    std::vector<std::string>    args_;
+    std::vector<Result>         results_;
+
+    void print(Result const& res) const;
+    void write_json(std::ostream& out) const;
+public:
+    Suite(std::string name, int argc, const char* const* argv, int default_trials = 5, int default_warmup = 1);
+
+    //! Get positional (unrecognized) command line arguments
+    std::vector<std::string> const& args() const;
+
+    int trials() const;
+
+    /** Run benchmark.
+      * @param name benchmark name (unique within suite)
+      * @param nops number of operations performed by single trial
+      * @param fn benchmark body, can throw to report an error
+      * @return false if benchmark was filtered out or failed
+      */
+    bool run(std::string const& name, uint64_t nops, BenchFn fn);
+
+    /** Write results.
+      * @return process exit code (non zero if any benchmark failed)
+      */
+    int finish();
+};
+
+}  // namespace Bench
+}  // namespace Akumuli
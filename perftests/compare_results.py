@@ -0,0 +1,60 @@
+"""Compare two perftest result files (written using --json option).
+
+Usage: python compare_results.py baseline.json current.json [threshold]
+
+Prints relative change of the median trial time and latency percentiles
+for every benchmark. Exits with non zero code if median time of any
+benchmark increased by more than threshold (0.1 by default).
+"""
+from __future__ import print_function
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data['suite'], dict((b['name'], b) for b in data['benchmarks'])
+
+
+def change(old, new):
+    if not old:
+        return None
+    return float(new - old)/old
+
+
+def fmt(value):
+    return '     n/a' if value is None else '{0:+8.1%}'.format(value)
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__)
+        return 2
+    threshold = float(sys.argv[3]) if len(sys.argv) > 3 else 0.1
+    suite, baseline = load(sys.argv[1])
+    _, current = load(sys.argv[2])
+    regressions = 0
+    print('{0:40} {1:>8} {2:>8} {3:>8} {4:>8}'.format(suite, 'time', 'p50', 'p99', 'rss'))
+    for name in sorted(set(baseline) | set(current)):
+        old, new = baseline.get(name), current.get(name)
+        if old is None or new is None:
+            print('{0:40} {1}'.format(name, 'added' if old is None else 'removed'))
+            continue
+        if 'error' in old or 'error' in new:
+            print('{0:40} error: {1}'.format(name, new.get('error', old.get('error'))))
+            continue
+        dtime = change(old['time']['median'], new['time']['median'])
+        dp50 = change(old['latency_ns']['p50'], new['latency_ns']['p50'])
+        dp99 = change(old['latency_ns']['p99'], new['latency_ns']['p99'])
+        drss = change(old['rss']['peak'], new['rss']['peak'])
+        mark = ''
+        if dtime is not None and dtime > threshold:
+            mark = ' <- regression'
+            regressions += 1
+        print('{0:40} {1} {2} {3} {4}{5}'.format(name, fmt(dtime), fmt(dp50), fmt(dp99), fmt(drss), mark))
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,530 @@
+/**
+ * End-to-end load generator for akumulid.
+ *
+ * Writer threads send samples to the running server over TCP or UDP
+ * using RESP protocol, query threads send HTTP queries concurrently.
+ * Series cardinality, write rate and fraction of out of order samples
+ * (to exercise late write path of the sequencer) are configurable.
+ * All random choices are derived from the seed so the same command line
+ * produces the same workload (timestamps follow the wall clock).
+ *
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/socket.h>
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "benchmark.h"
+
+namespace po = boost::program_options;
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+using namespace Akumuli;
+
+struct Options {
+    std::string host;
+    std::string protocol;       //< tcp or udp
+    int         tcp_port;
+    int         udp_port;
+    int         http_port;
+    int         writers;        //< Number of writer threads (one connection each)
+    int         queriers;       //< Number of query threads
+    int         duration;       //< Test duration in seconds
+    uint64_t    rate;           //< Samples per second per writer (0 - unlimited)
+    int         batch;          //< Samples per write call
+    int         datagram_size;  //< Max UDP datagram size
+    int         cardinality;    //< Number of unique series
+    int         hosts;          //< Number of unique `host` tag values
+    std::string metric;
+    double      ooo_fraction;   //< Fraction of out of order samples
+    int         ooo_delay_ms;   //< Max delay of out of order sample
+    int         query_interval_ms;
+    int         query_range_sec;
+    uint64_t    seed;
+    std::string json_path;
+};
+
+//! Global counters (updated by all threads)
+struct Counters {
+    std::atomic<uint64_t> samples{0};       //< Samples sent
+    std::atomic<uint64_t> bytes{0};         //< Bytes sent
+    std::atomic<uint64_t> ooo_samples{0};   //< Out of order samples sent
+    std::atomic<uint64_t> late_writes{0};   //< AKU_ELATE_WRITE errors received from the server
+    std::atomic<uint64_t> db_errors{0};     //< Other errors received from the server
+    std::atomic<uint64_t> send_errors{0};
+    std::atomic<uint64_t> reconnects{0};
+};
+
+enum QueryKind {
+    RAW_SERIES,     //< Read raw data of the single series
+    PAA_GROUPBY,    //< Aggregate all series using one second step
+    SCAN,           //< Read raw data of all series
+    NQUERY_KINDS,
+};
+
+static const char* QUERY_NAMES[] = { "raw_series", "paa_groupby", "scan" };
+
+struct QueryStats {
+    Bench::Histogram    latency[NQUERY_KINDS];
+    uint64_t            errors[NQUERY_KINDS] = {};
+    uint64_t            bytes = 0;
+};
+
+static uint64_t wall_clock_ns() {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+}
+
+//! Format timestamp as ISO string used by the query language
+static std::string to_iso(uint64_t ts) {
+    time_t seconds = static_cast<time_t>(ts / 1000000000ul);
+    tm parts;
+    gmtime_r(&seconds, &parts);
+    char buffer[0x40];
+    auto n = strftime(buffer, sizeof(buffer), "%Y%m%dT%H%M%S", &parts);
+    snprintf(buffer + n, sizeof(buffer) - n, ".%09d", static_cast<int>(ts % 1000000000ul));
+    return buffer;
+}
+
+//! Generates samples in RESP format
+class SampleGenerator {
+    Options const&                      opt_;
+    std::vector<std::string> const&     series_;
+    std::mt19937_64                     rand_;
+    std::uniform_int_distribution<int>  series_dist_;
+    std::uniform_real_distribution<double> unit_;
+    std::uniform_int_distribution<uint64_t> delay_;
+public:
+    SampleGenerator(Options const& opt, std::vector<std::string> const& series, uint64_t seed)
+        : opt_(opt)
+        , series_(series)
+        , rand_(seed)
+        , series_dist_(0, static_cast<int>(series.size()) - 1)
+        , unit_(0.0, 1.0)
+        , delay_(1u, static_cast<uint64_t>(std::max(opt.ooo_delay_ms, 1))*1000000ul)
+    {
+    }
+
+    //! Append sample to the buffer, returns true if sample is out of order
+    bool next(uint64_t now, std::string* out) {
+        bool ooo = opt_.ooo_fraction > 0 && unit_(rand_) < opt_.ooo_fraction;
+        uint64_t ts = ooo ? now - delay_(rand_) : now;
+        char buffer[0x40];
+        int n = snprintf(buffer, sizeof(buffer), ":%lu\r\n+%.3f\r\n", ts, 100.0*unit_(rand_));
+        out->append(series_[series_dist_(rand_)]);
+        out->append(buffer, n);
+        return ooo;
+    }
+};
+
+//! Pace writer to the target rate
+static void throttle(Options const& opt, uint64_t begin_ns, uint64_t nsamples) {
+    if (opt.rate == 0) {
+        return;
+    }
+    uint64_t target = begin_ns + nsamples*1000000000ul/opt.rate;
+    uint64_t now = Bench::now_ns();
+    if (target > now) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(target - now));
+    }
+}
+
+//! Read error messages sent by the server until connection is closed
+static void tcp_reader(tcp::socket& sock, Counters& cnt) {
+    std::string line;
+    char buffer[0x1000];
+    boost::system::error_code error;
+    while (true) {
+        auto n = sock.read_some(boost::asio::buffer(buffer), error);
+        if (error) {
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (buffer[i] != '\n') {
+                line.push_back(buffer[i]);
+                continue;
+            }
+            if (line.find("late write") != std::string::npos) {
+                cnt.late_writes++;
+            } else if (!line.empty() && line[0] == '-') {
+                cnt.db_errors++;
+            }
+            line.clear();
+        }
+    }
+}
+
+static void tcp_writer(Options const& opt, std::vector<std::string> const& series, int id,
+                       Counters& cnt, std::atomic<bool> const& stop)
+{
+    boost::asio::io_service io;
+    tcp::resolver resolver(io);
+    auto endpoints = resolver.resolve(tcp::resolver::query(opt.host, std::to_string(opt.tcp_port)));
+    SampleGenerator gen(opt, series, opt.seed + id);
+    std::string buffer;
+    uint64_t nsent = 0;
+    auto begin = Bench::now_ns();
+    while (!stop.load()) {
+        tcp::socket sock(io);
+        boost::asio::connect(sock, endpoints);
+        // Server reports errors asynchronously and closes the connection after that
+        std::thread reader(&tcp_reader, std::ref(sock), std::ref(cnt));
+        boost::system::error_code error;
+        while (!stop.load() && !error) {
+            buffer.clear();
+            uint64_t nooo = 0;
+            auto now = wall_clock_ns();
+            for (int i = 0; i < opt.batch; i++) {
+                nooo += gen.next(now, &buffer);
+            }
+            boost::asio::write(sock, boost::asio::buffer(buffer), error);
+            if (!error) {
+                nsent += opt.batch;
+                cnt.samples += opt.batch;
+                cnt.ooo_samples += nooo;
+                cnt.bytes += buffer.size();
+                throttle(opt, begin, nsent);
+            }
+        }
+        // Wake up the reader
+        ::shutdown(sock.native_handle(), SHUT_RDWR);
+        reader.join();
+        if (error && !stop.load()) {
+            cnt.send_errors++;
+            cnt.reconnects++;
+        }
+    }
+}
+
+static void udp_writer(Options const& opt, std::vector<std::string> const& series, int id,
+                       Counters& cnt, std::atomic<bool> const& stop)
+{
+    boost::asio::io_service io;
+    udp::resolver resolver(io);
+    auto endpoint = *resolver.resolve(udp::resolver::query(udp::v4(), opt.host, std::to_string(opt.udp_port)));
+    udp::socket sock(io, udp::v4());
+    SampleGenerator gen(opt, series, opt.seed + id);
+    std::string datagram, sample;
+    bool sample_ooo = gen.next(wall_clock_ns(), &sample);
+    uint64_t nsent = 0;
+    auto begin = Bench::now_ns();
+    while (!stop.load()) {
+        // Samples are never split between datagrams, sample that doesn't fit goes to the next one
+        datagram.clear();
+        uint64_t nsamples = 0, nooo = 0;
+        auto now = wall_clock_ns();
+        while (nsamples == 0 || datagram.size() + sample.size() <= static_cast<size_t>(opt.datagram_size)) {
+            datagram += sample;
+            nsamples++;
+            nooo += sample_ooo;
+            sample.clear();
+            sample_ooo = gen.next(now, &sample);
+        }
+        boost::system::error_code error;
+        sock.send_to(boost::asio::buffer(datagram), endpoint, 0, error);
+        if (error) {
+            cnt.send_errors++;
+            continue;
+        }
+        nsent += nsamples;
+        cnt.samples += nsamples;
+        cnt.ooo_samples += nooo;
+        cnt.bytes += datagram.size();
+        throttle(opt, begin, nsent);
+    }
+}
+
+/** Send HTTP request and read the whole response.
+  * @return HTTP status code (0 on connection error)
+  */
+static int http_request(Options const& opt, std::string const& method, std::string const& path,
+                        std::string const& body, std::string* response_body)
+{
+    try {
+        boost::asio::io_service io;
+        tcp::resolver resolver(io);
+        tcp::socket sock(io);
+        boost::asio::connect(sock, resolver.resolve(tcp::resolver::query(opt.host, std::to_string(opt.http_port))));
+        std::stringstream request;
+        request << method << " " << path << " HTTP/1.1\r\n"
+                << "Host: " << opt.host << "\r\n"
+                << "Content-Type: application/json\r\n"
+                << "Content-Length: " << body.size() << "\r\n"
+                << "Connection: close\r\n\r\n"
+                << body;
+        boost::asio::write(sock, boost::asio::buffer(request.str()));
+        std::string response;
+        char buffer[0x4000];
+        boost::system::error_code error;
+        while (!error) {
+            auto n = sock.read_some(boost::asio::buffer(buffer), error);
+            response.append(buffer, n);
+        }
+        int status = 0;
+        if (sscanf(response.c_str(), "HTTP/%*d.%*d %d", &status) != 1) {
+            return 0;
+        }
+        auto pos = response.find("\r\n\r\n");
+        *response_body = pos == std::string::npos ? std::string() : response.substr(pos + 4);
+        return status;
+    } catch (boost::system::system_error const&) {
+        return 0;
+    }
+}
+
+static std::string make_query(Options const& opt, QueryKind kind, int series_id) {
+    auto now = wall_clock_ns();
+    int range = kind == SCAN ? 1 : opt.query_range_sec;
+    std::stringstream query;
+    query << R"({"metric": ")" << opt.metric << R"(", "range": {"from": ")"
+          << to_iso(now - range*1000000000ul) << R"(", "to": ")" << to_iso(now) << R"("})";
+    switch (kind) {
+    case RAW_SERIES:
+        query << R"(, "where": {"id": [")" << series_id << R"("]})";
+        break;
+    case PAA_GROUPBY:
+        query << R"(, "sample": [{"name": "paa"}], "group-by": {"time": "1s"})";
+        break;
+    case SCAN:
+    case NQUERY_KINDS:
+        break;
+    }
+    query << "}";
+    return query.str();
+}
+
+static void query_worker(Options const& opt, int id, QueryStats& stats, std::atomic<bool> const& stop) {
+    std::mt19937_64 rand(opt.seed + 1000000 + id);
+    std::uniform_int_distribution<int> kind_dist(0, NQUERY_KINDS - 1);
+    std::uniform_int_distribution<int> series_dist(0, opt.cardinality - 1);
+    while (!stop.load()) {
+        auto kind = static_cast<QueryKind>(kind_dist(rand));
+        auto query = make_query(opt, kind, series_dist(rand));
+        std::string body;
+        auto begin = Bench::now_ns();
+        int status = http_request(opt, "POST", "/", query, &body);
+        auto elapsed = Bench::now_ns() - begin;
+        // Errors are reported with 400 status code or as RESP error in the body
+        if (status != 200 || (!body.empty() && body[0] == '-')) {
+            stats.errors[kind]++;
+        } else {
+            stats.latency[kind].record(elapsed);
+            stats.bytes += body.size();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(opt.query_interval_ms));
+    }
+}
+
+//! Server side pipeline counters
+struct ServerStats {
+    bool     valid = false;
+    uint64_t written = 0;
+    uint64_t errors = 0;
+};
+
+static ServerStats get_server_stats(Options const& opt) {
+    ServerStats res;
+    std::string body;
+    if (http_request(opt, "GET", "/stats", "", &body) != 200) {
+        return res;
+    }
+    try {
+        boost::property_tree::ptree ptree;
+        std::stringstream stream(body);
+        boost::property_tree::json_parser::read_json(stream, ptree);
+        res.written = ptree.get<uint64_t>("pipeline.writer.samples");
+        res.errors = ptree.get<uint64_t>("pipeline.writer.errors");
+        res.valid = true;
+    } catch (std::exception const&) {
+        // Old server version or HTTP server is disabled
+    }
+    return res;
+}
+
+static void print_report(std::ostream& out, Options const& opt, double elapsed, Counters const& cnt,
+                         std::vector<double> const& rates, ServerStats const& before,
+                         ServerStats const& after, QueryStats const& qstats)
+{
+    double min_rate = 0, max_rate = 0;
+    if (!rates.empty()) {
+        min_rate = *std::min_element(rates.begin(), rates.end());
+        max_rate = *std::max_element(rates.begin(), rates.end());
+    }
+    out << "{\n";
+    out << "  \"protocol\": \"" << opt.protocol << "\",\n";
+    out << "  \"writers\": " << opt.writers << ",\n";
+    out << "  \"queriers\": " << opt.queriers << ",\n";
+    out << "  \"cardinality\": " << opt.cardinality << ",\n";
+    out << "  \"ooo_fraction\": " << opt.ooo_fraction << ",\n";
+    out << "  \"ooo_delay_ms\": " << opt.ooo_delay_ms << ",\n";
+    out << "  \"seed\": " << opt.seed << ",\n";
+    out << "  \"duration\": " << elapsed << ",\n";
+    out << "  \"ingest\": {"
+        << "\"samples\": " << cnt.samples.load()
+        << ", \"bytes\": " << cnt.bytes.load()
+        << ", \"rate\": " << cnt.samples.load()/elapsed
+        << ", \"rate_min\": " << min_rate
+        << ", \"rate_max\": " << max_rate
+        << ", \"ooo_samples\": " << cnt.ooo_samples.load()
+        << ", \"late_writes\": " << cnt.late_writes.load()
+        << ", \"db_errors\": " << cnt.db_errors.load()
+        << ", \"send_errors\": " << cnt.send_errors.load()
+        << ", \"reconnects\": " << cnt.reconnects.load() << "},\n";
+    if (before.valid && after.valid) {
+        out << "  \"server\": {"
+            << "\"written\": " << after.written - before.written
+            << ", \"errors\": " << after.errors - before.errors << "},\n";
+    }
+    out << "  \"queries\": {";
+    for (int i = 0; i < NQUERY_KINDS; i++) {
+        auto const& lat = qstats.latency[i];
+        out << (i ? ",\n" : "\n") << "    \"" << QUERY_NAMES[i] << "\": {"
+            << "\"count\": " << lat.count()
+            << ", \"errors\": " << qstats.errors[i]
+            << ", \"p50_ms\": " << lat.percentile(50)/1000000.0
+            << ", \"p90_ms\": " << lat.percentile(90)/1000000.0
+            << ", \"p99_ms\": " << lat.percentile(99)/1000000.0
+            << ", \"max_ms\": " << lat.max()/1000000.0 << "}";
+    }
+    out << "\n  },\n";
+    out << "  \"query_bytes\": " << qstats.bytes << "\n}\n";
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    po::options_description desc("akumuli_loadgen options");
+    desc.add_options()
+            ("help", "Produce help message")
+            ("host", po::value<std::string>(&opt.host)->default_value("127.0.0.1"), "Server address")
+            ("protocol", po::value<std::string>(&opt.protocol)->default_value("tcp"), "Ingestion protocol (tcp or udp)")
+            ("tcp-port", po::value<int>(&opt.tcp_port)->default_value(8282), "TCP server port")
+            ("udp-port", po::value<int>(&opt.udp_port)->default_value(8383), "UDP server port")
+            ("http-port", po::value<int>(&opt.http_port)->default_value(8181), "HTTP server port")
+            ("writers", po::value<int>(&opt.writers)->default_value(4), "Number of writer threads")
+            ("queriers", po::value<int>(&opt.queriers)->default_value(1), "Number of query threads")
+            ("duration", po::value<int>(&opt.duration)->default_value(30), "Test duration in seconds")
+            ("rate", po::value<uint64_t>(&opt.rate)->default_value(0), "Samples per second per writer (0 - unlimited)")
+            ("batch", po::value<int>(&opt.batch)->default_value(1000), "Samples per TCP write")
+            ("datagram-size", po::value<int>(&opt.datagram_size)->default_value(1400), "Max UDP datagram size")
+            ("cardinality", po::value<int>(&opt.cardinality)->default_value(10000), "Number of unique series")
+            ("hosts", po::value<int>(&opt.hosts)->default_value(100), "Number of unique `host` tag values")
+            ("metric", po::value<std::string>(&opt.metric)->default_value("loadgen"), "Metric name")
+            ("ooo-fraction", po::value<double>(&opt.ooo_fraction)->default_value(0.0), "Fraction of out of order samples")
+            ("ooo-delay", po::value<int>(&opt.ooo_delay_ms)->default_value(1000), "Max delay of out of order sample in ms")
+            ("query-interval", po::value<int>(&opt.query_interval_ms)->default_value(100), "Pause between queries in ms")
+            ("query-range", po::value<int>(&opt.query_range_sec)->default_value(10), "Query time range in seconds")
+            ("seed", po::value<uint64_t>(&opt.seed)->default_value(1), "Random seed")
+            ("json", po::value<std::string>(&opt.json_path), "Write report to file");
+
+    try {
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+        if (opt.protocol != "tcp" && opt.protocol != "udp") {
+            throw std::runtime_error("unknown protocol " + opt.protocol);
+        }
+        if (opt.writers < 0 || opt.queriers < 0 || opt.batch <= 0 || opt.cardinality <= 0 || opt.hosts <= 0) {
+            throw std::runtime_error("invalid options");
+        }
+    } catch (std::exception const& e) {
+        std::cerr << "Error: " << e.what() << std::endl << desc << std::endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::string> series;
+    for (int i = 0; i < opt.cardinality; i++) {
+        series.push_back("+" + opt.metric + " host=host" + std::to_string(i % opt.hosts)
+                         + " id=" + std::to_string(i) + "\r\n");
+    }
+
+    auto before = get_server_stats(opt);
+    Counters cnt;
+    std::atomic<bool> stop{false};
+    std::vector<QueryStats> qstats(opt.queriers);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opt.writers; i++) {
+        auto fn = opt.protocol == "tcp" ? &tcp_writer : &udp_writer;
+        threads.emplace_back([&, fn, i]() {
+            try {
+                fn(opt, series, i, cnt, stop);
+            } catch (std::exception const& e) {
+                std::cerr << "Writer " << i << " failed: " << e.what() << std::endl;
+            }
+        });
+    }
+    for (int i = 0; i < opt.queriers; i++) {
+        threads.emplace_back(&query_worker, std::cref(opt), i, std::ref(qstats[i]), std::cref(stop));
+    }
+
+    // Report ingestion rate every second
+    std::vector<double> rates;
+    auto begin = Bench::now_ns();
+    uint64_t last_samples = 0;
+    for (int sec = 1; sec <= opt.duration; sec++) {
+        auto target = begin + sec*1000000000ul;
+        std::this_thread::sleep_for(std::chrono::nanoseconds(target - std::min(target, Bench::now_ns())));
+        auto samples = cnt.samples.load();
+        rates.push_back(samples - last_samples);
+        last_samples = samples;
+        std::cout << sec << "s: " << rates.back() << " samples/sec, late writes "
+                  << cnt.late_writes.load() << ", reconnects " << cnt.reconnects.load() << std::endl;
+    }
+    stop.store(true);
+    double elapsed = (Bench::now_ns() - begin)/1000000000.0;
+    for (auto& th: threads) {
+        th.join();
+    }
+    // Give the server some time to drain its queues
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    auto after = get_server_stats(opt);
+
+    QueryStats total;
+    for (auto const& qs: qstats) {
+        for (int i = 0; i < NQUERY_KINDS; i++) {
+            total.latency[i].merge(qs.latency[i]);
+            total.errors[i] += qs.errors[i];
+        }
+        total.bytes += qs.bytes;
+    }
+    print_report(std::cout, opt, elapsed, cnt, rates, before, after, total);
+    if (!opt.json_path.empty()) {
+        std::ofstream out(opt.json_path);
+        print_report(out, opt, elapsed, cnt, rates, before, after, total);
+    }
+    return 0;
+}
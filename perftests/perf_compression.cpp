@@ -1,11 +1,13 @@
 #include "compression.h"
-#include "perftest_tools.h"
+#include "benchmark.h"
 
 #include <iostream>
 #include <cstdlib>
 #include <algorithm>
 #include <zlib.h>
 #include <cstring>
+#include <random>
+#include <stdexcept>
 
 using namespace Akumuli;
 
@@ -36,6 +38,7 @@ struct RandomWalk {
 };
 
 int main(int argc, char** argv) {
+    Bench::Suite suite("compression", argc, argv);
     const uint64_t N_TIMESTAMPS = 1000;
     const uint64_t N_PARAMS = 100;
     UncompressedChunk header;
@@ -185,55 +188,62 @@ int main(int argc, char** argv) {
         }
     }
 
-    if (argc == 2 && std::string(argv[1]) == "benchmark") {
-        // Bench compression process
-        const int NRUNS = 1000;
-        PerfTimer tm;
-        aku_Status tstatus;
-        volatile uint32_t vn;
+    if (!first_error) {
+        return 1;
+    }
+
+    const int NRUNS = 100;
+    suite.run("encode_akumuli", NRUNS*header.paramids.size(), [&](Bench::Trial& trial) {
         ByteVector vec;
         for (int i = 0; i < NRUNS; i++) {
+            auto begin = Bench::now_ns();
             vec.resize(N_PARAMS*N_TIMESTAMPS*24);
             Writer w(&vec);
             aku_Timestamp ts;
             uint32_t n;
-            tstatus = CompressionUtil::encode_chunk(&n, &ts, &ts, &w, header);
+            auto tstatus = CompressionUtil::encode_chunk(&n, &ts, &ts, &w, header);
             if (tstatus != AKU_SUCCESS) {
-                std::cout << "Encoding error" << std::endl;
-                return 1;
+                throw std::runtime_error("encoding error");
             }
-            vn = n;
+            trial.record(Bench::now_ns() - begin);
         }
-        double elapsed = tm.elapsed();
-        std::cout << "Elapsed (akumuli): " << elapsed << " " << vn << std::endl;
+        trial.set_counter("ratio", COMPRESSION_RATIO);
+        trial.set_counter("bytes_per_elem", BYTES_PER_EL);
+    });
 
-        tm.restart();
+    suite.run("encode_zlib", NRUNS*header.paramids.size(), [&](Bench::Trial& trial) {
         for (int i = 0; i < NRUNS; i++) {
+            auto begin = Bench::now_ns();
             uLongf offset = 0;
+            gzoutlen = gz_max_size;
             // compress param ids
             auto zstatus = compress(pgzout, &gzoutlen, pgz_ids, header.paramids.size()*8);
             if (zstatus != Z_OK) {
-                std::cout << "GZip error" << std::endl;
-                exit(zstatus);
+                throw std::runtime_error("gzip error");
             }
             offset += gzoutlen;
             gzoutlen = gz_max_size - offset;
             // compress timestamps
             zstatus = compress(pgzout + offset, &gzoutlen, pgz_ts, header.timestamps.size()*8);
             if (zstatus != Z_OK) {
-                std::cout << "GZip error" << std::endl;
-                exit(zstatus);
+                throw std::runtime_error("gzip error");
             }
             offset += gzoutlen;
             gzoutlen = gz_max_size - offset;
             // compress floats
             zstatus = compress(pgzout + offset, &gzoutlen, pgz_val, header.values.size()*8);
             if (zstatus != Z_OK) {
-                std::cout << "GZip error" << std::endl;
-                exit(zstatus);
+                throw std::runtime_error("gzip error");
             }
+            trial.record(Bench::now_ns() - begin);
         }
-        elapsed = tm.elapsed();
-        std::cout << "Elapsed (zlib): " << elapsed << " " << vn << std::endl;
-    }
+        trial.set_counter("ratio", GZ_RATIO);
+        trial.set_counter("bytes_per_elem", GZ_BPE);
+    });
+
+    free(pgz_ids);
+    free(pgz_ts);
+    free(pgz_val);
+    free(pgzout);
+    return suite.finish();
 }
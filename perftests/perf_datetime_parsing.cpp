@@ -1,9 +1,12 @@
 #include "datetime.h"
-#include "perftest_tools.h"
+#include "benchmark.h"
+
+#include <iostream>
 
 using namespace Akumuli;
 
-int main() {
+int main(int argc, char** argv) {
+    Bench::Suite suite("datetime_parsing", argc, argv);
 
     const char* test_strings[] = {
         "20060102T100405.999999999",
@@ -17,15 +20,15 @@ int main() {
         "20060902T180403.111111111",
         "20061002T190404.000000000"
     };
+    const int NITER = 100000;
     aku_Timestamp tsacc = 0;
-    PerfTimer timer;
-    for(int k = 100000; k --> 0;) {
-        for(int i = 10; i --> 0;) {
-            tsacc += DateTimeUtil::from_iso_string(test_strings[i]);
+    suite.run("from_iso_string", NITER*10, [&](Bench::Trial&) {
+        for(int k = NITER; k --> 0;) {
+            for(int i = 10; i --> 0;) {
+                tsacc += DateTimeUtil::from_iso_string(test_strings[i]);
+            }
         }
-    }
-    double elapsed = timer.elapsed();
+    });
     std::cout << "Summ: " << tsacc << std::endl;
-    std::cout << "Elapsed: " << elapsed << std::endl;
-    return 0;
+    return suite.finish();
 }
@@ -6,16 +6,18 @@
 #include <vector>
 #include <algorithm>
 #include <memory>
+#include <stdexcept>
 
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <apr_mmap.h>
 #include <apr_general.h>
-#include <sys/time.h>
 
 #include "akumuli.h"
+#include "benchmark.h"
 
 using namespace std;
+namespace Bench = Akumuli::Bench;
 
 int DB_SIZE = 8;
 uint64_t NUM_ITERATIONS = 100*1000*1000ul;
@@ -25,21 +27,6 @@ const char* DB_NAME = "db";
 const char* DB_PATH = "";
 const char* DB_META_FILE = "/tmp/akumuli/db.akumuli";
 
-class Timer
-{
-public:
-    Timer() { gettimeofday(&_start_time, nullptr); }
-    void   restart() { gettimeofday(&_start_time, nullptr); }
-    double elapsed() const {
-        timeval curr;
-        gettimeofday(&curr, nullptr);
-        return double(curr.tv_sec - _start_time.tv_sec) +
-               double(curr.tv_usec - _start_time.tv_usec)/1000000.0;
-    }
-private:
-    timeval _start_time;
-};
-
 int format_timestamp(uint64_t ts, char* buffer) {
     auto fractional = static_cast<int>(ts %  1000000000);  // up to 9 decimal digits
     auto seconds = static_cast<int>(ts / 1000000000);      // two seconds digits
@@ -65,7 +52,7 @@ void delete_storage() {
     aku_remove_database(DB_META_FILE, &aku_console_logger);
 }
 
-bool query_database_forward(aku_Database* db, aku_Timestamp begin, aku_Timestamp end, uint64_t& counter, Timer& timer, uint64_t mod) {
+bool query_database_forward(aku_Database* db, aku_Timestamp begin, aku_Timestamp end, uint64_t& counter) {
     const aku_Timestamp EPOCH = 1420167840000000000;
     const unsigned int NUM_ELEMENTS = 1000;
     std::string query = build_query(begin, end);
@@ -95,10 +82,6 @@ bool query_database_forward(aku_Database* db, aku_Timestamp begin, aku_Timestamp
             }
             current_time++;
             counter++;
-            if (counter % mod == 0) {
-                std::cout << counter << " " << timer.elapsed() << "s" << std::endl;
-                timer.restart();
-            }
             cursor_ix++;
         }
     }
@@ -230,6 +213,12 @@ int main(int cnt, const char** args)
 {
     aku_initialize(nullptr);
 
+    // Database state is changed by every benchmark so each one runs only once by default
+    Bench::Suite suite("ingestion", cnt, args, 1, 0);
+    if (!suite.args().empty()) {
+        NUM_ITERATIONS = boost::lexical_cast<uint64_t>(suite.args().front());
+    }
+
     aku_FineTuneParams params = {};
     params.debug_mode = 0;
     params.durability = AKU_MAX_DURABILITY; //AKU_MAX_WRITE_SPEED;
@@ -240,50 +229,48 @@ int main(int cnt, const char** args)
 
     auto db = aku_open_database(DB_META_FILE, params);
 
-    Timer timer;
-
     aku_debug_print(db);
 
-    uint64_t busy_count = 0;
     // Fill in data
-    RandomWalk rwalk(10.0, 0.0, 0.002, 10000);
-    for(uint64_t i = 0; i < NUM_ITERATIONS; i++) {
-        aku_Sample sample;
-        char buffer[100];
-
-        // =series=
-        int id = i % 1000;
-        int hashval =  i % 10;
-        int nchars = sprintf(buffer, "cpu key=%d hash=%d", id, hashval);
-        aku_series_to_param_id(db, buffer, buffer + nchars, &sample);
-
-        // =timestamp=
-        sample.timestamp = i/100;
-
-        // =payload=
-        if (i == 1000000ul) {
-            // Add anomalous value
-            rwalk.add_anomaly(id, 100.0);
-        }
-        if (i == 899999999ul) {
-            // Add anomalous value
-            rwalk.add_anomaly(id, 100.0);
-        }
-        sample.payload.type = AKU_PAYLOAD_FLOAT;
-        sample.payload.float64 = rwalk.generate(id);
+    suite.run("write", NUM_ITERATIONS, [&](Bench::Trial& trial) {
+        uint64_t busy_count = 0;
+        RandomWalk rwalk(10.0, 0.0, 0.002, 10000);
+        for(uint64_t i = 0; i < NUM_ITERATIONS; i++) {
+            auto begin = Bench::now_ns();
+            aku_Sample sample;
+            char buffer[100];
+
+            // =series=
+            int id = i % 1000;
+            int hashval =  i % 10;
+            int nchars = sprintf(buffer, "cpu key=%d hash=%d", id, hashval);
+            aku_series_to_param_id(db, buffer, buffer + nchars, &sample);
+
+            // =timestamp=
+            sample.timestamp = i/100;
+
+            // =payload=
+            if (i == 1000000ul) {
+                // Add anomalous value
+                rwalk.add_anomaly(id, 100.0);
+            }
+            if (i == 899999999ul) {
+                // Add anomalous value
+                rwalk.add_anomaly(id, 100.0);
+            }
+            sample.payload.type = AKU_PAYLOAD_FLOAT;
+            sample.payload.float64 = rwalk.generate(id);
 
-        aku_Status status = aku_write(db, &sample);
+            aku_Status status = aku_write(db, &sample);
 
-        while (status == AKU_EBUSY) {
-            status = aku_write(db, &sample);
-            busy_count++;
-        }
-        if (i % 1000000 == 0) {
-            std::cout << i << " " << timer.elapsed() << "s" << std::endl;
-            timer.restart();
+            while (status == AKU_EBUSY) {
+                status = aku_write(db, &sample);
+                busy_count++;
+            }
+            trial.record(Bench::now_ns() - begin);
         }
-    }
-    std::cout << "!busy count = " << busy_count << std::endl;
+        trial.set_counter("busy_count", busy_count);
+    });
 
     aku_debug_print(db);
 
@@ -292,52 +279,50 @@ int main(int cnt, const char** args)
     print_storage_stats(storage_stats);
 
     // Search
-    std::cout << "Sequential access" << std::endl;
     aku_SearchStats search_stats = {0};
-    uint64_t counter = 0;
-
-    timer.restart();
-
-    if (!query_database_forward(db, std::numeric_limits<aku_Timestamp>::min(),
-                                NUM_ITERATIONS-1,
-                                counter,
-                                timer,
-                                1000000))
-    {
-        return 2;
-    }
+    suite.run("sequential_read", NUM_ITERATIONS, [&](Bench::Trial& trial) {
+        uint64_t counter = 0;
+        if (!query_database_forward(db, std::numeric_limits<aku_Timestamp>::min(),
+                                    NUM_ITERATIONS-1,
+                                    counter))
+        {
+            throw std::runtime_error("sequential read failed");
+        }
+        trial.set_ops(counter);
+    });
 
     aku_global_search_stats(&search_stats, true);
     print_search_stats(search_stats);
 
     // Random access
-    std::cout << "Prepare test data" << std::endl;
-    std::vector<std::pair<aku_Timestamp, aku_Timestamp>> ranges;
-    for (aku_Timestamp i = 1u; i < (aku_Timestamp)NUM_ITERATIONS/CHUNK_SIZE; i++) {
-        aku_Timestamp j = (i - 1)*CHUNK_SIZE;
-        int count = 5;
-        for (int d = 0; d < count; d++) {
-            int r = std::rand() % CHUNK_SIZE;
-            int k = j + r;
-            ranges.push_back(std::make_pair(k, k+1));
+    suite.run("random_access", 0, [&](Bench::Trial& trial) {
+        std::vector<std::pair<aku_Timestamp, aku_Timestamp>> ranges;
+        for (aku_Timestamp i = 1u; i < (aku_Timestamp)NUM_ITERATIONS/CHUNK_SIZE; i++) {
+            aku_Timestamp j = (i - 1)*CHUNK_SIZE;
+            int count = 5;
+            for (int d = 0; d < count; d++) {
+                int r = std::rand() % CHUNK_SIZE;
+                int k = j + r;
+                ranges.push_back(std::make_pair(k, k+1));
+            }
         }
-    }
-
-    std::random_shuffle(ranges.begin(), ranges.end());
-
-    std::cout << "Random access" << std::endl;
-    counter = 0;
-    timer.restart();
-    for(auto range: ranges) {
-        if (!query_database_forward(db, range.first, range.second, counter, timer, 1000)) {
-            return 3;
+        std::random_shuffle(ranges.begin(), ranges.end());
+        trial.set_ops(ranges.size());
+        trial.restart();
+
+        uint64_t counter = 0;
+        for(auto range: ranges) {
+            auto begin = Bench::now_ns();
+            if (!query_database_forward(db, range.first, range.second, counter)) {
+                throw std::runtime_error("random access failed");
+            }
+            trial.record(Bench::now_ns() - begin);
         }
-    }
+    });
     aku_global_search_stats(&search_stats, true);
     print_search_stats(search_stats);
 
     aku_close_database(db);
 
-    return 0;
+    return suite.finish();
 }
-
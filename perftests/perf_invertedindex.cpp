@@ -1,11 +1,68 @@
 #include "invertedindex.h"
+#include "benchmark.h"
+
 #include <iostream>
 #include <cstring>
+#include <random>
+#include <unordered_map>
 
 using namespace Akumuli;
 
-int main() {
+//! Previous posting list implementation (hash map of counters), used as a baseline
+struct MapPostings {
+    std::unordered_map<aku_ParamId, size_t> counters_;
+
+    void append(aku_ParamId id) {
+        counters_[id]++;
+    }
+
+    size_t get_size() const {
+        return counters_.size();
+    }
 
+    void merge(const MapPostings& other) {
+        std::unordered_map<aku_ParamId, size_t> tmp;
+        for (auto kv: counters_) {
+            auto it = other.counters_.find(kv.first);
+            if (it != other.counters_.end()) {
+                tmp[kv.first] = std::min(kv.second, it->second);
+            }
+        }
+        std::swap(tmp, counters_);
+    }
+};
+
+static const size_t NIDS = 2000000;
+
+template<class PostingsT>
+void run_postings_test(Bench::Suite& suite, std::string name, std::vector<aku_ParamId> const& lhs, std::vector<aku_ParamId> const& rhs) {
+    suite.run(name + "_append", lhs.size() + rhs.size(), [&](Bench::Trial&) {
+        PostingsT a, b;
+        for (auto id: lhs) {
+            a.append(id);
+        }
+        for (auto id: rhs) {
+            b.append(id);
+        }
+    });
+    suite.run(name + "_merge", lhs.size() + rhs.size(), [&](Bench::Trial& trial) {
+        PostingsT a, b;
+        for (auto id: lhs) {
+            a.append(id);
+        }
+        for (auto id: rhs) {
+            b.append(id);
+        }
+        trial.restart();
+        a.merge(b);
+        trial.set_counter("result_size", a.get_size());
+    });
+}
+
+int main(int argc, char** argv) {
+    Bench::Suite suite("invertedindex", argc, argv);
+
+    // Collision counts test
     InvertedIndex index(128);
 
     for (int i = 0; i < 1000; i++) {
@@ -20,5 +77,44 @@ int main() {
         std::cout << "kv: " << kv.first << ", " << kv.second << std::endl;
     }
 
-    return 0;
+    // Posting list comparison: dense range intersected with random ids
+    std::vector<aku_ParamId> dense, sparse;
+    for (aku_ParamId i = 0; i < NIDS; i++) {
+        dense.push_back(i);
+    }
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<aku_ParamId> distribution(0, NIDS*4);
+    for (size_t i = 0; i < NIDS; i++) {
+        sparse.push_back(distribution(generator));
+    }
+    run_postings_test<MapPostings>(suite, "map_postings", dense, sparse);
+    run_postings_test<Postings>(suite, "bitmap_postings", dense, sparse);
+
+    // Bitmap operations
+    RoaringBitmap a, b;
+    for (auto id: dense) {
+        a.add(id);
+    }
+    for (auto id: sparse) {
+        b.add(id);
+    }
+    suite.run("bitmap_and", 1, [&](Bench::Trial& trial) {
+        auto c = a & b;
+        trial.set_counter("cardinality", c.cardinality());
+    });
+    suite.run("bitmap_or", 1, [&](Bench::Trial& trial) {
+        auto c = a | b;
+        trial.set_counter("cardinality", c.cardinality());
+    });
+    suite.run("bitmap_andnot", 1, [&](Bench::Trial& trial) {
+        auto c = b.and_not(a);
+        trial.set_counter("cardinality", c.cardinality());
+    });
+    suite.run("bitmap_and_cardinality", 1, [&](Bench::Trial& trial) {
+        auto est = a.and_cardinality(b);
+        trial.set_counter("cardinality", est);
+        trial.set_counter("memory_usage", a.memory_usage() + b.memory_usage());
+    });
+
+    return suite.finish();
 }
@@ -6,17 +6,20 @@
 #include <vector>
 #include <algorithm>
 #include <memory>
+#include <atomic>
 #include <thread>
+#include <stdexcept>
 
-#include <boost/timer.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <apr_mmap.h>
 #include <apr_general.h>
 
 #include "akumuli.h"
+#include "benchmark.h"
 
 using namespace std;
+namespace Bench = Akumuli::Bench;
 
 const int DB_SIZE = 3;
 const int NUM_ITERATIONS = 100*1000*1000;
@@ -25,7 +28,7 @@ const char* DB_NAME = "test";
 const char* DB_PATH = "./test";
 const char* DB_META_FILE = "./test/test.akumuli";
 
-uint64_t reader_n_busy = 0ul;
+std::atomic<uint64_t> reader_n_busy{0ul};
 
 void delete_storage() {
     boost::filesystem::remove_all(DB_PATH);
@@ -82,7 +85,7 @@ std::string build_query(uint64_t begin, uint64_t end) {
     return str.str();
 }
 
-aku_Timestamp query_database_backward(aku_Database* db, aku_Timestamp begin, aku_Timestamp end, uint64_t& counter, boost::timer& timer, uint64_t mod) {
+aku_Timestamp query_database_backward(aku_Database* db, aku_Timestamp begin, aku_Timestamp end, uint64_t& counter) {
     const int NUM_ELEMENTS = 1000;
     std::string query = build_query(begin, end);
     aku_Cursor* cursor = aku_query(db, query.c_str());
@@ -126,17 +129,13 @@ aku_Timestamp query_database_backward(aku_Database* db, aku_Timestamp begin, aku
             }
             current_time--;
             counter++;
-            if (counter % mod == 0) {
-                std::cout << counter << "..." << timer.elapsed() << "s (bw)" << std::endl;
-                timer.restart();
-            }
         }
     }
     aku_cursor_close(cursor);
     return last;
 }
 
-aku_Timestamp query_database_forward(aku_Database* db, aku_Timestamp begin, aku_Timestamp end, uint64_t& counter, boost::timer& timer, uint64_t mod) {
+aku_Timestamp query_database_forward(aku_Database* db, aku_Timestamp begin, aku_Timestamp end, uint64_t& counter) {
     const int NUM_ELEMENTS = 1000;
     std::string query = build_query(end, begin);
     aku_Cursor* cursor = aku_query(db, query.c_str());
@@ -173,10 +172,6 @@ aku_Timestamp query_database_forward(aku_Database* db, aku_Timestamp begin, aku_
             current_time++;
             last = samples[i].timestamp;
             counter++;
-            if (counter % mod == 0) {
-                std::cout << counter << "..." << timer.elapsed() << "s (fw)" << std::endl;
-                timer.restart();
-            }
         }
     }
     aku_cursor_close(cursor);
@@ -187,92 +182,91 @@ int main(int cnt, const char** args)
 {
     aku_initialize(nullptr);
 
-    // Cleanup
-    delete_storage();
+    // Every trial creates new database, one trial by default because test is slow
+    Bench::Suite suite("parallel_ingestion", cnt, args, 1, 0);
 
-    // Create database
-    apr_status_t result = aku_create_database(DB_NAME, DB_PATH, DB_PATH, DB_SIZE, nullptr);
-    if (result != APR_SUCCESS) {
-        std::cout << "Error in new_storage" << std::endl;
-        return (int)result;
-    }
+    suite.run("write_with_readers", NUM_ITERATIONS, [&](Bench::Trial& trial) {
+        // Cleanup
+        delete_storage();
 
-    aku_FineTuneParams params = {};
-    params.debug_mode = 0;
-    auto db = aku_open_database(DB_META_FILE, params);
-    boost::timer timer;
-
-    auto reader_fn_bw = [&db]() {
-        boost::timer timer;
-        aku_Timestamp top = 0u;
-        uint64_t counter = 0;
-        uint64_t query_counter = 0;
-        // query last elements from database
-        while (true) {
-            top = query_database_backward(db, top, AKU_MAX_TIMESTAMP, counter, timer, 1000000);
-            query_counter++;
-            if (top == NUM_ITERATIONS - 1) {
-                std::cout << "query_counter=" << query_counter << std::endl;
-                break;
-            }
+        // Create database
+        apr_status_t result = aku_create_database(DB_NAME, DB_PATH, DB_PATH, DB_SIZE, nullptr);
+        if (result != APR_SUCCESS) {
+            throw std::runtime_error("error in new_storage");
         }
-    };
-
-    auto reader_fn_fw = [&db]() {
-        boost::timer timer;
-        aku_Timestamp top = 0u;
-        uint64_t counter = 0;
-        uint64_t query_counter = 0;
-        // query last elements from database
-        while (true) {
-            top = query_database_forward(db, top, AKU_MAX_TIMESTAMP, counter, timer, 1000000);
-            query_counter++;
-            if (top >= (NUM_ITERATIONS - 20001)) {
-                std::cout << "query_counter=" << query_counter << std::endl;
-                break;
+
+        aku_FineTuneParams params = {};
+        params.debug_mode = 0;
+        auto db = aku_open_database(DB_META_FILE, params);
+        reader_n_busy = 0;
+        trial.restart();
+
+        auto reader_fn_bw = [&db]() {
+            aku_Timestamp top = 0u;
+            uint64_t counter = 0;
+            uint64_t query_counter = 0;
+            // query last elements from database
+            while (true) {
+                top = query_database_backward(db, top, AKU_MAX_TIMESTAMP, counter);
+                query_counter++;
+                if (top == NUM_ITERATIONS - 1) {
+                    std::cout << "query_counter=" << query_counter << std::endl;
+                    break;
+                }
             }
-        }
-    };
-
-    std::thread fw_reader_thread(reader_fn_fw);
-    std::thread bw_reader_thread(reader_fn_bw);
-
-    int writer_n_busy = 0;
-    for(uint64_t ts = 0; ts < NUM_ITERATIONS; ts++) {
-        uint64_t k = ts + 2;
-        double value = 0.0001*k;
-        aku_ParamId id = ts & 0xF;
-        aku_Status status = aku_write_double_raw(db, id, ts, value);
-        if (status == AKU_SUCCESS) {
-            if (ts % 1000000 == 0) {
-                std::cout << ts << "---" << timer.elapsed() << "s" << std::endl;
-                timer.restart();
+        };
+
+        auto reader_fn_fw = [&db]() {
+            aku_Timestamp top = 0u;
+            uint64_t counter = 0;
+            uint64_t query_counter = 0;
+            // query last elements from database
+            while (true) {
+                top = query_database_forward(db, top, AKU_MAX_TIMESTAMP, counter);
+                query_counter++;
+                if (top >= (NUM_ITERATIONS - 20001)) {
+                    std::cout << "query_counter=" << query_counter << std::endl;
+                    break;
+                }
+            }
+        };
+
+        std::thread fw_reader_thread(reader_fn_fw);
+        std::thread bw_reader_thread(reader_fn_bw);
+
+        int writer_n_busy = 0;
+        for(uint64_t ts = 0; ts < NUM_ITERATIONS; ts++) {
+            uint64_t k = ts + 2;
+            double value = 0.0001*k;
+            aku_ParamId id = ts & 0xF;
+            auto begin = Bench::now_ns();
+            aku_Status status = aku_write_double_raw(db, id, ts, value);
+            if (status == AKU_EBUSY) {
+                writer_n_busy++;
+                status = aku_write_double_raw(db, id, ts, value);
+            }
+            trial.record(Bench::now_ns() - begin);
+            if (status != AKU_SUCCESS) {
+                std::cout << "aku_add_sample error " << aku_error_message(status) << std::endl;
+                break;
             }
-        } else if (status == AKU_EBUSY) {
-            writer_n_busy++;
-            status = aku_write_double_raw(db, id, ts, value);
-        }
-        if (status != AKU_SUCCESS) {
-            std::cout << "aku_add_sample error " << aku_error_message(status) << std::endl;
-            break;
         }
-    }
-    std::cout << "Writer busy count = " << writer_n_busy << std::endl;
 
-    fw_reader_thread.join();
-    bw_reader_thread.join();
+        fw_reader_thread.join();
+        bw_reader_thread.join();
 
-    std::cout << "Reader busy count = " << reader_n_busy << std::endl;
+        trial.set_counter("writer_busy_count", writer_n_busy);
+        trial.set_counter("reader_busy_count", reader_n_busy.load());
 
-    aku_SearchStats search_stats;
+        aku_SearchStats search_stats;
 
-    aku_global_search_stats(&search_stats, true);
-    print_search_stats(search_stats);
+        aku_global_search_stats(&search_stats, true);
+        print_search_stats(search_stats);
 
-    aku_close_database(db);
+        aku_close_database(db);
 
-    delete_storage();
+        delete_storage();
+    });
 
-    return 0;
+    return suite.finish();
 }
-
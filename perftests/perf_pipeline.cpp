@@ -22,12 +22,13 @@
 
 #include "ingestion_pipeline.h"
 #include "utility.h"
-#include "perftest_tools.h"
+#include "benchmark.h"
 
 #include <boost/lockfree/queue.hpp>
 
 #include <thread>
 #include <iostream>
+#include <stdexcept>
 
 using namespace Akumuli;
 
@@ -36,6 +37,7 @@ namespace detail {
     const static int TAG = 111222333;
     struct ConnectionMock : Akumuli::DbConnection {
         int cnt;
+        void close() {}
         aku_Status write(const aku_Sample &sample) {
             if (AKU_LIKELY(sample.paramid == TAG)) {
                 cnt++;
@@ -51,12 +53,18 @@ namespace detail {
         std::shared_ptr<DbCursor> search(std::string query) {
             throw "not implemented";
         }
+        std::shared_ptr<DbCursor> subscribe(std::string query, std::function<void()> notify) {
+            throw "not implemented";
+        }
         int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) {
             throw "not implemented";
         }
         aku_Status series_to_param_id(const char *name, size_t size, aku_Sample *sample) {
             throw "not implemented";
         }
+        std::string get_all_stats() {
+            return "{}";
+        }
     };
 };
 
@@ -67,7 +75,7 @@ struct SpoutTest {
         N_ITERS = 10000000,
     };
 
-    static double run_baseline() {
+    static void run_baseline(Bench::Trial&) {
 
         boost::lockfree::queue<int, boost::lockfree::capacity<0x1000>, boost::lockfree::fixed_sized<true>> queue;
 
@@ -85,7 +93,6 @@ struct SpoutTest {
         std::thread workerA(worker);
         std::thread workerB(worker);
 
-        PerfTimer timer;
         int cnt = 0;
         while(true) {
             int val;
@@ -96,14 +103,12 @@ struct SpoutTest {
                 }
             }
         }
-        double e = timer.elapsed();
 
         workerA.join();
         workerB.join();
-        return e;
     }
 
-    static double run_pipeline() {
+    static void run_pipeline(Bench::Trial&) {
         using namespace detail;
         std::shared_ptr<ConnectionMock> con = std::make_shared<ConnectionMock>();
         con->cnt = 0;
@@ -113,36 +118,42 @@ struct SpoutTest {
             for (int i = N_ITERS/2; i --> 0;) {
                 spout->write({(aku_Timestamp)i, (aku_ParamId)detail::TAG});
             }
+            // Spout can't be destroyed until pipeline processes all its values
+            spout->flush();
+            while (!spout->is_empty()) {
+                std::this_thread::yield();
+            }
         };
-        PerfTimer tm;
         pipeline->start();
         std::thread workerA(worker);
         std::thread workerB(worker);
         workerA.join();
         workerB.join();
         pipeline->stop();
-        double e = tm.elapsed();
         if (con->cnt != N_ITERS) {
-            std::cout << "Error in pipeline " << con->cnt << std::endl;
+            throw std::runtime_error("pipeline lost samples: " + std::to_string(con->cnt));
         }
-        return e;
     }
 };
 
 
 int main(int argc, char* argv[]) {
-    std::cout << "Spout test" << std::endl;
-    double b = SpoutTest::run_baseline();
-    std::cout << "- baseline " << b << "s" << std::endl;
-    double e = SpoutTest::run_pipeline();
-    std::cout << "- pipeline " << e << "s" << std::endl;
-    double rel = b/e;
-    std::cout << "relative speedup " << rel << std::endl;
-    bool push_to_graphite = false;
-    if (argc == 2) {
-        push_to_graphite = std::string(argv[1]) == "graphite";
-    }
-    if (push_to_graphite) {
-        push_metric_to_graphite("pipeline", rel);
-    }
+    Bench::Suite suite("pipeline", argc, argv);
+    // Best baseline time is used to calculate relative speedup of the pipeline
+    double baseline = 0.0;
+    suite.run("spout_baseline", SpoutTest::N_ITERS, [&](Bench::Trial& trial) {
+        auto begin = Bench::now_ns();
+        SpoutTest::run_baseline(trial);
+        double elapsed = (Bench::now_ns() - begin)/1000000000.0;
+        if (!trial.is_warmup() && (baseline == 0.0 || elapsed < baseline)) {
+            baseline = elapsed;
+        }
+    });
+    suite.run("spout_pipeline", SpoutTest::N_ITERS, [&](Bench::Trial& trial) {
+        auto begin = Bench::now_ns();
+        SpoutTest::run_pipeline(trial);
+        double elapsed = (Bench::now_ns() - begin)/1000000000.0;
+        trial.set_counter("relative_speedup", baseline/elapsed);
+    });
+    return suite.finish();
 }
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <sstream>
+#include <cstring>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "akumuli.h"
+#include "benchmark.h"
+#include "queryparser.h"
+#include "queryprocessor.h"
+
+using namespace Akumuli;
+
+const int NNAMES = 10000;
+const int NITER = 100;
+
+static void logger_stub(aku_LogLevel, const char*) {}
+
+struct NodeStub : QP::Node {
+    virtual void complete() {}
+    virtual bool put(const aku_Sample&) { return true; }
+    virtual void set_error(aku_Status) {}
+    virtual int get_requirements() const { return EMPTY; }
+};
+
+//! Query with large `where` clause (IN-list)
+static std::string make_query() {
+    std::stringstream query;
+    query << R"({"metric": "cpu", "range": {"from": "20150101T000000", "to": "20150102T000000"},)"
+          << R"("sample": [{"name": "paa"}], "group-by": {"time": "1m"}, "where": {"host": [)";
+    for (int i = 0; i < NNAMES; i++) {
+        query << (i ? ", " : "") << "\"host-" << i << "\"";
+    }
+    query << "]}}";
+    return query.str();
+}
+
+int main(int argc, char** argv) {
+    Bench::Suite suite("queryparser", argc, argv);
+    auto query = make_query();
+    SeriesMatcher matcher(1ul);
+    for (int i = 0; i < NNAMES; i++) {
+        auto name = "cpu host=host-" + std::to_string(i);
+        matcher.add(name.data(), name.data() + name.size());
+    }
+
+    suite.run("property_tree", NITER, [&](Bench::Trial& trial) {
+        for (int i = 0; i < NITER; i++) {
+            auto begin = Bench::now_ns();
+            boost::property_tree::ptree ptree;
+            std::stringstream stream(query);
+            boost::property_tree::json_parser::read_json(stream, ptree);
+            trial.record(Bench::now_ns() - begin);
+        }
+    });
+
+    suite.run("query_ast", NITER, [&](Bench::Trial& trial) {
+        size_t nvalues = 0;
+        for (int i = 0; i < NITER; i++) {
+            auto begin = Bench::now_ns();
+            auto ast = QP::QueryAST::parse(query.data(), query.data() + query.size());
+            nvalues += ast.where.at(0).second.size();
+            trial.record(Bench::now_ns() - begin);
+        }
+        trial.set_counter("names_in_where", nvalues/NITER);
+    });
+
+    auto terminal = std::make_shared<NodeStub>();
+    suite.run("query_setup", NITER, [&](Bench::Trial& trial) {
+        for (int i = 0; i < NITER; i++) {
+            auto begin = Bench::now_ns();
+            auto proc = QP::Builder::build_query_processor(query.c_str(), terminal, matcher, &logger_stub);
+            trial.record(Bench::now_ns() - begin);
+        }
+    });
+
+    // Full path through Storage::search (query cache key, volume scans), volumes are
+    // empty so the query setup dominates
+    aku_initialize(nullptr);
+    auto path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("akumuli-perf-%%%%%%");
+    boost::filesystem::create_directories(path);
+    auto status = aku_create_test_database("db", path.c_str(), path.c_str(), 2, &logger_stub);
+    if (status != APR_SUCCESS) {
+        std::cout << "can't create database in " << path << std::endl;
+        return 1;
+    }
+    auto meta_path = (path / "db.akumuli").string();
+    aku_FineTuneParams params = {};
+    params.logger = &logger_stub;
+    auto db = aku_open_database(meta_path.c_str(), params);
+    for (int i = 0; i < NNAMES; i++) {
+        auto name = "cpu host=host-" + std::to_string(i);
+        aku_Sample sample;
+        aku_series_to_param_id(db, name.data(), name.data() + name.size(), &sample);
+    }
+    suite.run("storage_search", NITER, [&](Bench::Trial& trial) {
+        aku_Sample samples[0x100];
+        for (int i = 0; i < NITER; i++) {
+            auto begin = Bench::now_ns();
+            auto cursor = aku_query(db, query.c_str());
+            while (!aku_cursor_is_done(cursor)) {
+                if (aku_cursor_is_error(cursor, nullptr)) {
+                    break;
+                }
+                aku_cursor_read(cursor, samples, sizeof(samples));
+            }
+            aku_cursor_close(cursor);
+            trial.record(Bench::now_ns() - begin);
+        }
+    });
+    aku_close_database(db);
+    aku_remove_database(meta_path.c_str(), &logger_stub);
+    boost::filesystem::remove_all(path);
+    return suite.finish();
+}
@@ -7,7 +7,8 @@
 #include <algorithm>
 #include <memory>
 
-#include <boost/timer.hpp>
+#include <stdexcept>
+
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <apr_mmap.h>
@@ -17,11 +18,12 @@
 #include "page.h"
 #include "storage.h"
 #include "sequencer.h"
+#include "benchmark.h"
 
 using namespace Akumuli;
 using namespace std;
 
-const uint32_t NUM_ITERATIONS = 100*1000*1000;
+uint32_t NUM_ITERATIONS = 10*1000*1000;
 
 
 //! Simple static buffer cursor
@@ -60,52 +62,55 @@ struct BufferedCursor : InternalCursor {
 };
 
 
-int main(int cnt, const char** args)
+//! Merge ready samples and check that they're ordered
+static void merge_and_check(Sequencer& seq, size_t& ix_merged, Bench::Trial& trial) {
+    aku_Sample results[0x10000];
+    BufferedCursor cursor(results, 0x10000);
+    Caller caller;
+    auto begin = Bench::now_ns();
+    seq.merge(caller, &cursor);
+    trial.record(Bench::now_ns() - begin);
+    for (size_t i = 0; i < cursor.count; i++) {
+        size_t actual = static_cast<size_t>(cursor.results_buffer[i].timestamp);
+        if (actual != ix_merged) {
+            throw std::runtime_error("error at " + std::to_string(i) + ": " + std::to_string(actual)
+                                     + " != " + std::to_string(ix_merged));
+        }
+        ix_merged++;
+    }
+}
+
+int main(int argc, const char** argv)
 {
     aku_initialize(nullptr);
-    {
-        std::cout << "Sequencer perf-test, ordered timestamps" << std::endl;
-        // Patience sort perf-test
-        boost::timer timer;
+    Bench::Suite suite("sequencer", argc, argv, 3);
+    if (!suite.args().empty()) {
+        NUM_ITERATIONS = boost::lexical_cast<uint32_t>(suite.args().front());
+    }
+    aku_FineTuneParams params = {};
+    params.window_size = 10000;
+
+    // Patience sort perf-test, latency histogram contains merge times
+    suite.run("ordered", NUM_ITERATIONS, [&](Bench::Trial& trial) {
         size_t ix_merged = 0;
-        aku_FineTuneParams params = {};
-        params.window_size = 10000;
-        Sequencer seq(nullptr, params);
+        Sequencer seq(params);
         for (uint32_t ix = 0u; ix < NUM_ITERATIONS; ix++) {
             TimeSeriesValue value({(uint64_t)ix}, ix & 0xFF, (double)ix);
             int status = 0;
             int lock = 0;
             tie(status, lock) = seq.add(value);
             if (lock % 2 == 1) {
-                aku_Sample results[0x10000];
-                BufferedCursor cursor(results, 0x10000);
-                Caller caller;
-                seq.merge(caller, &cursor);
-                for (size_t i = 0; i < cursor.count; i++) {
-                    size_t actual = static_cast<size_t>(cursor.results_buffer[i].timestamp);
-                    if (actual != ix_merged) {
-                        // report error
-                        std::cout << "Error at: " << i << " " << actual << " != " << ix_merged << std::endl;
-                        return -1;
-                    }
-                    ix_merged++;
-                }
-            }
-            if (ix % 1000000 == 0) {
-                std::cout << ix << " " << timer.elapsed() << "s" << std::endl;
-                timer.restart();
+                merge_and_check(seq, ix_merged, trial);
             }
         }
-    }
-    {
-        std::cout << "Sequencer perf-test, unordered timestamps" << std::endl;
-        // Patience sort perf-test
-        boost::timer timer;
+    });
+
+    suite.run("unordered", NUM_ITERATIONS, [&](Bench::Trial& trial) {
         size_t ix_merged = 0;
         const int buffer_size = 10000;
-        uint32_t buffer[buffer_size];
+        std::vector<uint32_t> buffer(buffer_size);
         int buffer_ix = buffer_size;
-        Sequencer seq(nullptr, {10000});
+        Sequencer seq(params);
         for (uint32_t ix = 0u; ix < NUM_ITERATIONS; ix++) {
             buffer_ix--;
             buffer[buffer_ix] = ix;
@@ -117,27 +122,11 @@ int main(int cnt, const char** args)
                     int lock = 0;
                     tie(status, lock) = seq.add(value);
                     if (lock % 2 == 1) {
-                        aku_Sample results[0x10000];
-                        BufferedCursor cursor(results, 0x10000);
-                        Caller caller;
-                        seq.merge(caller, &cursor);
-                        for (size_t i = 0; i < cursor.count; i++) {
-                            auto offset = static_cast<size_t>(cursor.results_buffer[i].timestamp);
-                            if (offset != ix_merged) {
-                                // report error
-                                std::cout << "Error at: " << i << " " << offset << " != " << ix_merged << std::endl;
-                                return -1;
-                            }
-                            ix_merged++;
-                        }
+                        merge_and_check(seq, ix_merged, trial);
                     }
                 }
             }
-            if (ix % 1000000 == 0) {
-                std::cout << ix << " " << timer.elapsed() << "s" << std::endl;
-                timer.restart();
-            }
         }
-    }
-    return 0;
+    });
+    return suite.finish();
 }
@@ -1,32 +1,45 @@
+/**
+ * TCP server throughput test. Server and clients are running in the same
+ * process, clients send pre-generated RESP messages through the loopback
+ * interface and database mock counts received samples.
+ */
+#include <atomic>
+#include <future>
 #include <iostream>
+#include <stdexcept>
 #include <thread>
 
+#include <boost/asio.hpp>
+
 #include "tcp_server.h"
-#include "perftest_tools.h"
-#include <sys/time.h>
+#include "signal_handler.h"
+#include "benchmark.h"
 
 using namespace Akumuli;
 
+const int NCLIENTS = 4;
+const int NMESSAGES = 1000000;  // Per client
+const int CONCURRENCY = 4;
+const int DEFAULT_PORT = 4111;
+
 struct DbMock : DbConnection {
-    typedef std::tuple<aku_ParamId, aku_Timestamp, double> ValueT;
-    size_t nrec = 0u;
-    PerfTimer tm;
-    Logger logger_ = Logger("dbmock", 100);
+    std::atomic<uint64_t> nrec;
+
+    DbMock() : nrec{0u} {}
+
+    void close() {}
 
     aku_Status write(aku_Sample const&) {
-        static const int N = 1000000;
-        if (nrec++ % N == 0) {
-            double elapsed = tm.elapsed();
-            auto throughput = static_cast<int>(N*(1.0/elapsed));
-            logger_.info() << "Server throughput " << throughput << " msg/sec";
-            tm.restart();
-        }
+        nrec++;
         return AKU_SUCCESS;
     }
 
     virtual std::shared_ptr<DbCursor> search(std::string query) {
         throw "not implemented";
     }
+    virtual std::shared_ptr<DbCursor> subscribe(std::string query, std::function<void()> notify) {
+        throw "not implemented";
+    }
 
     int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) {
         throw "not implemented";
@@ -35,14 +48,66 @@ struct DbMock : DbConnection {
     aku_Status series_to_param_id(const char *name, size_t size, aku_Sample *sample) {
         throw "not implemented";
     }
+
+    std::string get_all_stats() {
+        return "{}";
+    }
 };
 
+static std::string make_payload(int client) {
+    std::string payload;
+    for (int i = 0; i < NMESSAGES; i++) {
+        payload += ":" + std::to_string(client*NMESSAGES + i) + "\r\n"  // id
+                +  ":" + std::to_string(i) + "\r\n"                     // timestamp
+                +  "+" + std::to_string(i % 1000) + ".5\r\n";           // value
+    }
+    return payload;
+}
+
+static void send_payload(int port, std::string const& payload) {
+    using namespace boost::asio;
+    io_service io;
+    ip::tcp::socket sock(io);
+    sock.connect(ip::tcp::endpoint(ip::address_v4::loopback(), static_cast<unsigned short>(port)));
+    write(sock, buffer(payload));
+    sock.shutdown(ip::tcp::socket::shutdown_both);
+    sock.close();
+}
+
 int main(int argc, char *argv[]) {
-    std::cout << "Tcp server performance test" << std::endl;
+    Bench::Suite suite("tcp_server", argc, argv);
+    int port = suite.args().empty() ? DEFAULT_PORT : std::stoi(suite.args().front());
+
+    std::vector<std::string> payloads;
+    for (int i = 0; i < NCLIENTS; i++) {
+        payloads.push_back(make_payload(i));
+    }
+
     auto con = std::make_shared<DbMock>();
     auto ppl = std::make_shared<IngestionPipeline>(con, AKU_LINEAR_BACKOFF);
-    auto server = std::make_shared<TcpServer>(ppl, 4, 4111);
-    server->start();
-    server->wait_for_signal();
+    auto server = std::make_shared<TcpServer>(ppl, CONCURRENCY, port);
+    SignalHandler sig;
+    server->start(&sig, 0);
+
+    suite.run("ingest", NCLIENTS*NMESSAGES, [&](Bench::Trial&) {
+        uint64_t expected = con->nrec.load() + NCLIENTS*NMESSAGES;
+        std::vector<std::future<void>> clients;
+        for (int i = 0; i < NCLIENTS; i++) {
+            clients.push_back(std::async(std::launch::async, &send_payload, port, std::cref(payloads[i])));
+        }
+        for (auto& client: clients) {
+            client.get();
+        }
+        // Wait until pipeline writes everything to the mock
+        auto deadline = Bench::now_ns() + 60000000000ul;
+        while (con->nrec.load() < expected) {
+            if (Bench::now_ns() > deadline) {
+                throw std::runtime_error("timeout, samples lost: " + std::to_string(expected - con->nrec.load()));
+            }
+            std::this_thread::yield();
+        }
+    });
+
     server->stop();
+    return suite.finish();
 }
@@ -0,0 +1,70 @@
+#include <iostream>
+#include <random>
+#include <vector>
+#include <cstdio>
+
+#include "benchmark.h"
+#include "textformat.h"
+#include "datetime.h"
+
+using namespace Akumuli;
+
+const int NVALUES = 10000000;
+
+int main(int argc, char** argv) {
+    Bench::Suite suite("textformat", argc, argv, 3);
+    std::mt19937_64 gen(1);
+    std::uniform_real_distribution<double> dist(-1000.0, 1000.0);
+    std::vector<double> values;
+    std::vector<uint64_t> ids;
+    for (int i = 0; i < NVALUES; i++) {
+        values.push_back(dist(gen));
+        ids.push_back(gen() % 1000000);
+    }
+    // Timestamps with 1ms step
+    const aku_Timestamp ts_begin = 1420070400000000000ul;
+    const aku_Timestamp ts_step = 1000000ul;
+
+    char buffer[0x100];
+    size_t checksum = 0;
+
+    suite.run("snprintf_uint", NVALUES, [&](Bench::Trial&) {
+        for (auto id: ids) {
+            checksum += snprintf(buffer, sizeof(buffer), "%lu", id);
+        }
+    });
+
+    suite.run("format_uint", NVALUES, [&](Bench::Trial&) {
+        for (auto id: ids) {
+            checksum += format_uint(id, buffer, buffer + sizeof(buffer)) - buffer;
+        }
+    });
+
+    suite.run("snprintf_double", NVALUES, [&](Bench::Trial&) {
+        for (auto value: values) {
+            checksum += snprintf(buffer, sizeof(buffer), "%.17g", value);
+        }
+    });
+
+    suite.run("format_double", NVALUES, [&](Bench::Trial&) {
+        for (auto value: values) {
+            checksum += format_double(value, buffer, buffer + sizeof(buffer)) - buffer;
+        }
+    });
+
+    suite.run("to_iso_string", NVALUES, [&](Bench::Trial&) {
+        for (int i = 0; i < NVALUES; i++) {
+            checksum += DateTimeUtil::to_iso_string(ts_begin + i*ts_step, buffer, sizeof(buffer));
+        }
+    });
+
+    suite.run("iso_timestamp_formatter", NVALUES, [&](Bench::Trial&) {
+        IsoTimestampFormatter iso;
+        for (int i = 0; i < NVALUES; i++) {
+            checksum += iso.format(ts_begin + i*ts_step, buffer, buffer + sizeof(buffer)) - buffer;
+        }
+    });
+
+    std::cout << "checksum: " << checksum << std::endl;
+    return suite.finish();
+}
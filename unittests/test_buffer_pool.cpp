@@ -0,0 +1,96 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+
+#include "buffer_pool.h"
+
+using namespace Akumuli;
+
+BOOST_AUTO_TEST_CASE(Test_buffer_pool_recycle) {
+    auto pool = BufferPool::create(100, 4);
+    BOOST_REQUIRE_EQUAL(pool->capacity(), 0u);
+    const Byte* data;
+    {
+        auto buf = pool->acquire();
+        BOOST_REQUIRE_EQUAL(buf->size(), 100u);
+        BOOST_REQUIRE_EQUAL(buf->use_count(), 1);
+        BOOST_REQUIRE_EQUAL(reinterpret_cast<uintptr_t>(buf.get()) % BufferPool::ALIGNMENT, 0u);
+        data = buf->data();
+        ConstBufferPtr copy = buf;
+        BOOST_REQUIRE_EQUAL(buf->use_count(), 2);
+    }
+    // Released buffer should be reused
+    auto buf = pool->acquire();
+    BOOST_REQUIRE(buf->data() == data);
+    BOOST_REQUIRE_EQUAL(pool->capacity(), 4u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_buffer_pool_slabs) {
+    auto pool = BufferPool::create(1000, 4);
+    std::vector<BufferPtr> buffers;
+    for (int i = 0; i < 10; i++) {
+        buffers.push_back(pool->acquire());
+        // Fill buffer to check that buffers don't overlap
+        memset(buffers.back()->data(), i, 1000);
+    }
+    BOOST_REQUIRE_EQUAL(pool->capacity(), 12u);
+    for (int i = 0; i < 10; i++) {
+        auto data = buffers.at(i)->data();
+        for (int j = 0; j < 1000; j++) {
+            BOOST_REQUIRE_EQUAL(data[j], static_cast<Byte>(i));
+        }
+    }
+    buffers.clear();
+    for (int i = 0; i < 12; i++) {
+        buffers.push_back(pool->acquire());
+    }
+    BOOST_REQUIRE_EQUAL(pool->capacity(), 12u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_buffer_outlives_pool) {
+    BufferPtr buf;
+    {
+        auto pool = BufferPool::create(100);
+        buf = pool->acquire();
+    }
+    // Pool is destroyed only when the last buffer is released
+    memset(buf->data(), 0, buf->size());
+    BOOST_REQUIRE_EQUAL(buf->size(), 100u);
+    buf.reset();
+}
+
+BOOST_AUTO_TEST_CASE(Test_buffer_pool_threads) {
+    auto pool = BufferPool::create(64, 8);
+    const int NTHREADS = 4;
+    const int NITER = 10000;
+    std::atomic<int> nerrors = {0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < NTHREADS; t++) {
+        threads.emplace_back([pool, t, &nerrors]() {
+            std::vector<BufferPtr> local;
+            for (int i = 0; i < NITER; i++) {
+                local.push_back(pool->acquire());
+                local.back()->data()[0] = static_cast<Byte>(t);
+                if (local.size() == 16) {
+                    for (auto const& buf: local) {
+                        if (buf->data()[0] != static_cast<Byte>(t)) {
+                            nerrors++;
+                        }
+                    }
+                    local.clear();
+                }
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    BOOST_REQUIRE_EQUAL(nerrors.load(), 0);
+    BOOST_REQUIRE_LE(pool->capacity(), static_cast<size_t>(NTHREADS*16 + 8));
+}
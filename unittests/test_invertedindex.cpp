@@ -31,3 +31,84 @@ BOOST_AUTO_TEST_CASE(Test_inverted_index_0) {
         BOOST_REQUIRE_EQUAL(results.at(0).second, 1);
     }
 }
+
+static RoaringBitmap make_bitmap(std::vector<uint64_t> const& values) {
+    RoaringBitmap bitmap;
+    for (auto value: values) {
+        bitmap.add(value);
+    }
+    return bitmap;
+}
+
+BOOST_AUTO_TEST_CASE(Test_roaring_bitmap_ops) {
+    // Sparse and dense containers in the same bitmap
+    std::vector<uint64_t> a, b;
+    for (uint64_t i = 0; i < 200000; i += 2) {
+        a.push_back(i);
+    }
+    for (uint64_t i = 0; i < 200000; i += 37) {
+        b.push_back(i);
+    }
+    b.push_back(1ul << 40);
+    auto ba = make_bitmap(a);
+    auto bb = make_bitmap(b);
+    BOOST_REQUIRE_EQUAL(ba.cardinality(), a.size());
+    BOOST_REQUIRE_EQUAL(bb.cardinality(), b.size());
+    BOOST_REQUIRE(bb.contains(1ul << 40));
+    BOOST_REQUIRE(!ba.contains(1u));
+
+    std::vector<uint64_t> expected;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    BOOST_REQUIRE((ba & bb).to_vector() == expected);
+    BOOST_REQUIRE_EQUAL(ba.and_cardinality(bb), expected.size());
+
+    expected.clear();
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    BOOST_REQUIRE((ba | bb).to_vector() == expected);
+
+    expected.clear();
+    std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    BOOST_REQUIRE(ba.and_not(bb).to_vector() == expected);
+
+    expected.clear();
+    std::set_difference(b.begin(), b.end(), a.begin(), a.end(), std::back_inserter(expected));
+    BOOST_REQUIRE(bb.and_not(ba).to_vector() == expected);
+}
+
+BOOST_AUTO_TEST_CASE(Test_roaring_bitmap_serialization) {
+    std::vector<uint64_t> values;
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<uint64_t> distribution(0, 1000000);
+    for (int i = 0; i < 100000; i++) {
+        values.push_back(distribution(generator));
+    }
+    auto bitmap = make_bitmap(values);
+    std::vector<char> buffer;
+    bitmap.serialize(&buffer);
+
+    RoaringBitmap restored;
+    auto status = RoaringBitmap::deserialize(buffer.data(), buffer.size(), &restored);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE(restored.to_vector() == bitmap.to_vector());
+
+    // Truncated buffer
+    status = RoaringBitmap::deserialize(buffer.data(), buffer.size() - 1, &restored);
+    BOOST_REQUIRE_EQUAL(status, AKU_EBAD_DATA);
+}
+
+BOOST_AUTO_TEST_CASE(Test_postings_counters) {
+    Postings a, b;
+    a.append(1);
+    a.append(1);
+    a.append(1);
+    a.append(2);
+    b.append(1);
+    b.append(1);
+    b.append(3);
+    BOOST_REQUIRE_EQUAL(a.get_count(1), 3u);
+    BOOST_REQUIRE_EQUAL(a.get_count(3), 0u);
+    a.merge(b);
+    BOOST_REQUIRE_EQUAL(a.get_size(), 1u);
+    BOOST_REQUIRE_EQUAL(a.get_count(1), 2u);
+    BOOST_REQUIRE_EQUAL(a.get_count(2), 0u);
+}
@@ -0,0 +1,86 @@
+#include <iostream>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+using namespace Akumuli;
+using namespace Akumuli::Metrics;
+
+BOOST_AUTO_TEST_CASE(Test_counter_concurrent_updates) {
+    Counter counter;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&counter]() {
+            for (int j = 0; j < 100000; j++) {
+                counter.inc();
+            }
+        });
+    }
+    for (auto& th: threads) {
+        th.join();
+    }
+    BOOST_REQUIRE_EQUAL(counter.value(), 400000u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_histogram_buckets) {
+    Histogram hist({1.0, 10.0});
+    hist.observe(0.5);
+    hist.observe(1.0);  // upper bound is inclusive
+    hist.observe(5.0);
+    hist.observe(100.0);
+    BOOST_REQUIRE_EQUAL(hist.bucket_count(0), 2u);
+    BOOST_REQUIRE_EQUAL(hist.bucket_count(1), 1u);
+    BOOST_REQUIRE_EQUAL(hist.bucket_count(2), 1u);
+    BOOST_REQUIRE_CLOSE(hist.sum(), 106.5, 0.0001);
+}
+
+BOOST_AUTO_TEST_CASE(Test_text_format) {
+    Counter counter;
+    counter.inc(42);
+    Histogram hist({0.5, 1.0});
+    hist.observe(0.25);
+    hist.observe(0.75);
+    hist.observe(2.0);
+
+    std::stringstream out;
+    TextWriter writer(out);
+    writer.counter("test_total", "Test counter", counter.value());
+    writer.gauge("test_depth", "Test gauge", "queue", {{"a\"b", 1.0}, {"c", 2.5}});
+    writer.histogram("test_seconds", "Test histogram", hist);
+
+    std::string expected =
+        "# HELP test_total Test counter\n"
+        "# TYPE test_total counter\n"
+        "test_total 42\n"
+        "# HELP test_depth Test gauge\n"
+        "# TYPE test_depth gauge\n"
+        "test_depth{queue=\"a\\\"b\"} 1\n"
+        "test_depth{queue=\"c\"} 2.5\n"
+        "# HELP test_seconds Test histogram\n"
+        "# TYPE test_seconds histogram\n"
+        "test_seconds_bucket{le=\"0.5\"} 1\n"
+        "test_seconds_bucket{le=\"1\"} 2\n"
+        "test_seconds_bucket{le=\"+Inf\"} 3\n"
+        "test_seconds_sum 3\n"
+        "test_seconds_count 3\n";
+    BOOST_REQUIRE_EQUAL(out.str(), expected);
+}
+
+BOOST_AUTO_TEST_CASE(Test_library_metrics_text) {
+    auto& metrics = library();
+    metrics.samples_written.inc(10);
+    metrics.chunk_cache_hits.inc();
+    std::stringstream out;
+    TextWriter writer(out);
+    metrics.write_text(writer);
+    auto text = out.str();
+    BOOST_REQUIRE(text.find("\nakumuli_samples_written_total 10\n") != std::string::npos);
+    BOOST_REQUIRE(text.find("\nakumuli_cache_hits_total{cache=\"chunk\"} 1\n") != std::string::npos);
+    BOOST_REQUIRE(text.find("\nakumuli_merge_duration_seconds_count 0\n") != std::string::npos);
+}
@@ -351,3 +351,22 @@ BOOST_AUTO_TEST_CASE(Test_Compression_backward_0) {
 BOOST_AUTO_TEST_CASE(Test_Compression_backward_1) {
     generic_compression_test(1u, 0ul, AKU_CURSOR_DIR_BACKWARD, 100);
 }
+
+BOOST_AUTO_TEST_CASE(Test_query_cache_eviction) {
+    const size_t NSAMPLES = 100;
+    QueryCache cache(NSAMPLES*sizeof(aku_Sample)*10);
+    auto samples = std::make_shared<std::vector<aku_Sample>>(NSAMPLES);
+    for (uint32_t i = 0; i < 20; i++) {
+        cache.put(QueryCache::KeyT("query", i, 1, 1), samples);
+    }
+    // Oldest entries should be evicted
+    BOOST_REQUIRE(!cache.get(QueryCache::KeyT("query", 0, 1, 1)));
+    BOOST_REQUIRE(cache.get(QueryCache::KeyT("query", 19, 1, 1)));
+    // Volume version is a part of the key
+    BOOST_REQUIRE(!cache.get(QueryCache::KeyT("query", 19, 2, 1)));
+    BOOST_REQUIRE(cache.total_size_ <= cache.size_limit_);
+    // Too large entries shouldn't be cached
+    auto large = std::make_shared<std::vector<aku_Sample>>(NSAMPLES*5);
+    cache.put(QueryCache::KeyT("large", 0, 1, 1), large);
+    BOOST_REQUIRE(!cache.get(QueryCache::KeyT("large", 0, 1, 1)));
+}
@@ -111,6 +111,200 @@ BOOST_AUTO_TEST_CASE(Test_seriesmatcher_1) {
     BOOST_REQUIRE_EQUAL(res.size(), 0u);
 }
 
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_snapshot) {
+
+    const char* path = "/tmp/test_seriesmatcher_snapshot.series";
+    SeriesMatcher matcher(1ul);
+    const char* foo = "cpu host=1 region=A";
+    const char* bar = "cpu host=1 region=B";
+    const char* buz = "cpu host=2 region=C";
+    matcher.add(foo, foo+strlen(foo));
+    matcher.add(bar, bar+strlen(bar));
+    matcher.add(buz, buz+strlen(buz));
+
+    // Last series isn't stored in sqlite yet and shouldn't be saved
+    auto status = SeriesSnapshot::write(path, matcher.pool, 2ul);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    SeriesMatcher restored(4ul);
+    uint64_t max_id = 0;
+    status = restored.load_snapshot(path, &max_id);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(max_id, 2ul);
+    BOOST_REQUIRE_EQUAL(restored.pool.size(), 2u);
+
+    BOOST_REQUIRE_EQUAL(restored.match(foo, foo+strlen(foo)), 1ul);
+    BOOST_REQUIRE_EQUAL(restored.match(bar, bar+strlen(bar)), 2ul);
+    BOOST_REQUIRE_EQUAL(restored.match(buz, buz+strlen(buz)), 0ul);
+
+    auto str = restored.id2str(2ul);
+    BOOST_REQUIRE_EQUAL(std::string(str.first, str.first + str.second), bar);
+    BOOST_REQUIRE(restored.id2str(3ul).first == nullptr);
+
+    // New series should go to the regular table
+    auto id = restored.add(buz, buz+strlen(buz));
+    BOOST_REQUIRE_EQUAL(restored.match(buz, buz+strlen(buz)), id);
+
+    // Snapshot should be searchable by regex
+    auto res = restored.pool.regex_match("cpu host=1 \\w+=\\w");
+    BOOST_REQUIRE_EQUAL(res.size(), 2u);
+
+    // Tag index is loaded from snapshot, new series are appended to it
+    TagIndex::Query query;
+    query.metric = "cpu";
+    uint64_t next_id = 0;
+    auto ids = restored.index.query(query, &next_id);
+    BOOST_REQUIRE((ids == std::vector<uint64_t>{1, 2, id}));
+    query.where.push_back(std::make_pair("region", std::vector<std::string>{"B"}));
+    next_id = 0;
+    ids = restored.index.query(query, &next_id);
+    BOOST_REQUIRE((ids == std::vector<uint64_t>{2}));
+
+    std::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(Test_posting_list) {
+
+    PostingList list;
+    std::vector<uint64_t> expected;
+    for (uint64_t id = 1; id < 10000; id += 3) {
+        list.append(id);
+        expected.push_back(id);
+    }
+    // Out of order id
+    list.append(2u);
+    expected.insert(expected.begin() + 1, 2u);
+    BOOST_REQUIRE_EQUAL(list.size(), expected.size());
+
+    std::vector<uint64_t> actual;
+    list.decode(0u, &actual);
+    BOOST_REQUIRE(actual == expected);
+
+    actual.clear();
+    list.decode(5000u, &actual);
+    BOOST_REQUIRE_EQUAL(actual.front(), 5002u);
+    BOOST_REQUIRE_EQUAL(actual.back(), 9997u);
+
+    PostingList::Cursor cursor(list);
+    BOOST_REQUIRE(cursor.seek(7777u));
+    BOOST_REQUIRE_EQUAL(cursor.value_, 7777u);
+    BOOST_REQUIRE(cursor.seek(7778u));
+    BOOST_REQUIRE_EQUAL(cursor.value_, 7780u);
+    BOOST_REQUIRE(!cursor.seek(10000u));
+}
+
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_tagindex) {
+
+    SeriesMatcher matcher(1ul);
+    const char* series[] = {
+        "cpu host=1 region=A",
+        "cpu host=1 region=B",
+        "cpu host=2 region=C",
+        "mem host=1 region=A",
+        "cpu region=A",
+    };
+    for (auto name: series) {
+        matcher.add(name, name + strlen(name));
+    }
+
+    TagIndex::Query query;
+    uint64_t next_id = 0;
+    query.metric = "cpu";
+    auto ids = matcher.index.query(query, &next_id);
+    BOOST_REQUIRE((ids == std::vector<uint64_t>{1, 2, 3, 5}));
+    BOOST_REQUIRE_EQUAL(next_id, 6u);
+
+    // Intersection of tags and union of values
+    query.where.push_back(std::make_pair("host", std::vector<std::string>{"1", "2"}));
+    query.where.push_back(std::make_pair("region", std::vector<std::string>{"A", "C"}));
+    next_id = 0;
+    ids = matcher.index.query(query, &next_id);
+    BOOST_REQUIRE((ids == std::vector<uint64_t>{1, 3}));
+
+    // Group-by style query
+    TagIndex::Query groupby;
+    groupby.tags.push_back("host");
+    next_id = 0;
+    ids = matcher.index.query(groupby, &next_id);
+    BOOST_REQUIRE((ids == std::vector<uint64_t>{1, 2, 3, 4}));
+
+    // Only new series should be returned
+    const char* buz = "cpu host=3 region=A";
+    matcher.add(buz, buz + strlen(buz));
+    ids = matcher.index.query(groupby, &next_id);
+    BOOST_REQUIRE((ids == std::vector<uint64_t>{6}));
+    BOOST_REQUIRE_EQUAL(next_id, 7u);
+
+    // Unknown tag value
+    query.where.back().second = { "D" };
+    next_id = 0;
+    BOOST_REQUIRE(matcher.index.query(query, &next_id).empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_tag_index_large_in_list) {
+    SeriesMatcher matcher(1ul);
+    for (int i = 0; i < 1000; i++) {
+        auto name = "cpu host=" + std::to_string(i) + " rack=" + std::to_string(i % 10);
+        matcher.add(name.data(), name.data() + name.size());
+    }
+    // Every third host, the list is decoded as a whole
+    TagIndex::Query query;
+    query.metric = "cpu";
+    std::vector<std::string> hosts;
+    for (int i = 999; i >= 0; i -= 3) {
+        hosts.push_back(std::to_string(i));
+    }
+    query.where.push_back(std::make_pair("host", hosts));
+    uint64_t next_id = 0;
+    auto ids = matcher.index.query(query, &next_id);
+    BOOST_REQUIRE_EQUAL(ids.size(), 334u);
+    BOOST_REQUIRE(std::is_sorted(ids.begin(), ids.end()));
+
+    // Small group is used to filter the large one
+    query.where.push_back(std::make_pair("rack", std::vector<std::string>{"0"}));
+    next_id = 0;
+    ids = matcher.index.query(query, &next_id);
+    BOOST_REQUIRE_EQUAL(ids.size(), 34u);
+    BOOST_REQUIRE(std::is_sorted(ids.begin(), ids.end()));
+}
+
+BOOST_AUTO_TEST_CASE(Test_tag_index_serialization) {
+    TagIndex index;
+    for (int i = 1; i <= 1000; i++) {
+        auto name = "cpu host=" + std::to_string(i) + " rack=" + std::to_string(i % 10);
+        index.add(name.data(), name.data() + name.size(), static_cast<uint64_t>(i));
+    }
+    std::vector<char> buffer;
+    index.serialize(&buffer);
+
+    TagIndex restored;
+    BOOST_REQUIRE(restored.deserialize(buffer.data(), buffer.data() + buffer.size()));
+    BOOST_REQUIRE_EQUAL(restored.size(), 1000u);
+    TagIndex::Query query;
+    query.metric = "cpu";
+    query.where.push_back(std::make_pair("rack", std::vector<std::string>{"3", "7"}));
+    uint64_t expected_next = 0, actual_next = 0;
+    auto expected = index.query(query, &expected_next);
+    auto actual = restored.query(query, &actual_next);
+    BOOST_REQUIRE_EQUAL(actual.size(), 200u);
+    BOOST_REQUIRE(actual == expected);
+    BOOST_REQUIRE_EQUAL(actual_next, expected_next);
+
+    // New ids are appended to the loaded lists
+    const char* name = "cpu host=1001 rack=3";
+    restored.add(name, name + strlen(name), 1001u);
+    actual_next = 0;
+    actual = restored.query(query, &actual_next);
+    BOOST_REQUIRE_EQUAL(actual.size(), 201u);
+    BOOST_REQUIRE_EQUAL(actual.back(), 1001u);
+
+    // Truncated data is rejected
+    BOOST_REQUIRE(!restored.deserialize(buffer.data(), buffer.data() + buffer.size()/2));
+    BOOST_REQUIRE_EQUAL(restored.size(), 0u);
+    actual_next = 0;
+    BOOST_REQUIRE(restored.query(query, &actual_next).empty());
+}
+
 BOOST_AUTO_TEST_CASE(Test_seriesparser_0) {
 
     const char* series1 = " cpu  region=europe   host=127.0.0.1 ";
@@ -5,6 +5,10 @@
 #include <boost/test/unit_test.hpp>
 #include <vector>
 #include <thread>
+#include <sstream>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
 
 #include "ingestion_pipeline.h"
 
@@ -33,6 +37,9 @@ struct ConnectionMock : DbConnection {
     std::shared_ptr<DbCursor> search(std::string query) {
         throw "not implemented";
     }
+    std::shared_ptr<DbCursor> subscribe(std::string query, std::function<void()> notify) {
+        throw "not implemented";
+    }
 
     int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) {
         throw "not implemented";
@@ -63,3 +70,132 @@ BOOST_AUTO_TEST_CASE(Test_spout_in_single_thread) {
         BOOST_REQUIRE_EQUAL(con->cntt, sumt);
         BOOST_REQUIRE_EQUAL(con->cntp, sump);
 }
+
+//! Connection that is slower than the spout
+struct SlowConnectionMock : ConnectionMock {
+    aku_Status write(const aku_Sample &sample) {
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+        return ConnectionMock::write(sample);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Test_spout_adaptive_batching) {
+
+        std::shared_ptr<SlowConnectionMock> con = std::make_shared<SlowConnectionMock>();
+        con->cntp = 0;
+        con->cntt = 0;
+        const int pool_size = 2;
+        const int queue_capacity = 2;
+        const int max_batch_size = 64;
+        auto pipeline = std::make_shared<IngestionPipeline>(con, AKU_LINEAR_BACKOFF, pool_size,
+                                                            queue_capacity, max_batch_size);
+        pipeline->start();
+        auto spout = pipeline->make_spout();
+        int sump = 0;
+        int sumt = 0;
+        for (int i = 0; i < 10000; i++) {
+            sump += i;
+            sumt += 1;
+            aku_Sample sample = { 1ul, (aku_ParamId)i };
+            spout->write(sample);
+        }
+        spout->flush();
+        pipeline->stop();
+        BOOST_REQUIRE_EQUAL(con->cntt, sumt);
+        BOOST_REQUIRE_EQUAL(con->cntp, sump);
+
+        // Writer lags behind so batch size should grow
+        BOOST_REQUIRE_EQUAL(spout->nsamples_.load(), 10000u);
+        BOOST_REQUIRE_LT(spout->nbatches_.load(), 10000u);
+        BOOST_REQUIRE_GT(spout->npool_full_.load() + spout->nqueue_full_.load(), 0u);
+        BOOST_REQUIRE_LE(spout->batch_size_.load(), max_batch_size);
+}
+
+BOOST_AUTO_TEST_CASE(Test_pipeline_stats) {
+
+        std::shared_ptr<ConnectionMock> con = std::make_shared<ConnectionMock>();
+        con->cntp = 0;
+        con->cntt = 0;
+        auto pipeline = std::make_shared<IngestionPipeline>(con, AKU_LINEAR_BACKOFF);
+        pipeline->start();
+        auto spout0 = pipeline->make_spout();
+        auto spout1 = pipeline->make_spout();
+        for (int i = 0; i < 100; i++) {
+            aku_Sample sample = { 1ul, (aku_ParamId)i };
+            spout0->write(sample);
+        }
+        pipeline->stop();
+
+        std::stringstream json(pipeline->get_all_stats());
+        boost::property_tree::ptree ptree;
+        boost::property_tree::json_parser::read_json(json, ptree);
+        BOOST_REQUIRE_EQUAL(ptree.get<int>("writer.samples"), 100);
+        BOOST_REQUIRE_EQUAL(ptree.get<int>("writer.errors"), 0);
+        BOOST_REQUIRE_EQUAL(ptree.get<int>("spout_0.samples"), 100);
+        BOOST_REQUIRE_EQUAL(ptree.get<int>("spout_0.in_flight"), 0);
+        BOOST_REQUIRE_EQUAL(ptree.get<int>("spout_1.samples"), 0);
+
+        // Stats of the closed spouts are not reported
+        spout1.reset();
+        auto spout2 = pipeline->make_spout();
+        std::stringstream json2(pipeline->get_all_stats());
+        boost::property_tree::ptree ptree2;
+        boost::property_tree::json_parser::read_json(json2, ptree2);
+        BOOST_REQUIRE(ptree2.get_child_optional("spout_1") == boost::none);
+        BOOST_REQUIRE(ptree2.get_child_optional("spout_2"));
+}
+
+BOOST_AUTO_TEST_CASE(Test_pipeline_metrics) {
+
+        std::shared_ptr<ConnectionMock> con = std::make_shared<ConnectionMock>();
+        con->cntp = 0;
+        con->cntt = 0;
+        auto pipeline = std::make_shared<IngestionPipeline>(con, AKU_LINEAR_BACKOFF);
+        pipeline->start();
+        auto spout = pipeline->make_spout();
+        for (int i = 0; i < 100; i++) {
+            aku_Sample sample = { 1ul, (aku_ParamId)i };
+            spout->write(sample);
+        }
+        pipeline->stop();
+
+        std::stringstream out;
+        Metrics::TextWriter writer(out);
+        pipeline->write_metrics(writer);
+        auto text = out.str();
+        BOOST_REQUIRE(text.find("# TYPE akumuli_pipeline_samples_written_total counter\n") != std::string::npos);
+        BOOST_REQUIRE(text.find("\nakumuli_pipeline_samples_written_total 100\n") != std::string::npos);
+        BOOST_REQUIRE(text.find("\nakumuli_pipeline_write_errors_total 0\n") != std::string::npos);
+        BOOST_REQUIRE(text.find("\nakumuli_pipeline_spout_queue_depth{spout=\"0\"} 0\n") != std::string::npos);
+        BOOST_REQUIRE(text.find("\nakumuli_pipeline_spout_samples_total{spout=\"0\"} 100\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(Test_pipeline_queue_per_spout_index) {
+
+        std::shared_ptr<ConnectionMock> con = std::make_shared<ConnectionMock>();
+        con->cntp = 0;
+        con->cntt = 0;
+        const int nqueues = 12;
+        auto pipeline = std::make_shared<IngestionPipeline>(con, AKU_LINEAR_BACKOFF,
+                                                            PipelineSpout::POOL_SIZE,
+                                                            PipelineSpout::QCAP, 1, nqueues);
+        pipeline->start();
+        std::vector<std::shared_ptr<PipelineSpout>> spouts;
+        for (int i = 0; i < nqueues; i++) {
+            spouts.push_back(pipeline->make_spout(i));
+            for (int j = 0; j < i; j++) {
+                BOOST_REQUIRE(spouts.at(i)->queue_ != spouts.at(j)->queue_);
+            }
+        }
+        // Index wraps around number of queues
+        BOOST_REQUIRE(pipeline->make_spout(nqueues)->queue_ == spouts.at(0)->queue_);
+        int sump = 0;
+        for (int i = 0; i < nqueues; i++) {
+            sump += i;
+            aku_Sample sample = { 1ul, (aku_ParamId)i };
+            spouts.at(i)->write(sample);
+        }
+        pipeline->stop();
+        BOOST_REQUIRE_EQUAL(con->cntt, nqueues);
+        BOOST_REQUIRE_EQUAL(con->cntp, sump);
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <cstring>
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
@@ -30,10 +31,14 @@ struct ConsumerMock : ProtocolConsumer {
     }
 };
 
-void null_deleter(const char* s) {}
+static BufferPoolPtr pool = BufferPool::create(0x1000);
 
-std::shared_ptr<const Byte> buffer_from_static_string(const char* str) {
-    return std::shared_ptr<const Byte>(str, &null_deleter);
+ConstBufferPtr buffer_from_static_string(const char* str) {
+    auto buffer = pool->acquire();
+    auto len = strlen(str);
+    BOOST_REQUIRE_LE(len, buffer->size());
+    memcpy(buffer->data(), str, len);
+    return buffer;
 }
 
 BOOST_AUTO_TEST_CASE(Test_protocol_parse_1) {
@@ -133,6 +138,37 @@ BOOST_AUTO_TEST_CASE(Test_protocol_parse_bulk_strings) {
 }
 
 
+BOOST_AUTO_TEST_CASE(Test_protocol_parse_same_buffer) {
+
+    // Second chunk is read to the same buffer after the first one
+    const char *messages = ":1\r\n:2\r\n+34.5\r\n:6\r\n:7\r\n+8.9\r\n";
+    auto buffer = buffer_from_static_string(messages);
+    PDU pdu1 = {
+        buffer,
+        10,
+        0u
+    };
+    PDU pdu2 = {
+        buffer,
+        29,
+        10u
+    };
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock);
+    ProtocolParser parser(cons);
+    parser.start();
+    parser.parse_next(pdu1);
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 0);
+    parser.parse_next(pdu2);
+    parser.close();
+
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 2);
+    BOOST_REQUIRE_EQUAL(cons->param_[1], 6);
+    BOOST_REQUIRE_EQUAL(cons->data_[0], 34.5);
+    BOOST_REQUIRE_EQUAL(cons->data_[1], 8.9);
+    // Parser shouldn't hold the consumed buffer
+    BOOST_REQUIRE_EQUAL(buffer->use_count(), 3);
+}
+
 BOOST_AUTO_TEST_CASE(Test_protocol_parse_error_format) {
 
     const char *messages = ":1\r\n:2\r\n+34.5\r\n:d\r\n:7\r\n+8.9\r\n";
@@ -160,3 +196,39 @@ BOOST_AUTO_TEST_CASE(Test_protocol_parse_error_format) {
     parser.start();
     BOOST_REQUIRE_EXCEPTION(parser.parse_next(pdu), RESPError, check_resp_error);
 }
+
+BOOST_AUTO_TEST_CASE(Test_datagram_parse) {
+
+    const char *message = ":1\r\n:2\r\n+34.5\r\n:6\r\n:7\r\n+8.9\r\n";
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock());
+    DatagramParser parser(cons);
+    auto nsamples = parser.parse(message, strlen(message));
+
+    BOOST_REQUIRE_EQUAL(nsamples, 2);
+    BOOST_REQUIRE_EQUAL(cons->param_[0], 1);
+    BOOST_REQUIRE_EQUAL(cons->param_[1], 6);
+    BOOST_REQUIRE_EQUAL(cons->ts_[0], 2);
+    BOOST_REQUIRE_EQUAL(cons->ts_[1], 7);
+    BOOST_REQUIRE_EQUAL(cons->data_[0], 34.5);
+    BOOST_REQUIRE_EQUAL(cons->data_[1], 8.9);
+}
+
+BOOST_AUTO_TEST_CASE(Test_datagram_parse_is_stateless) {
+
+    const char *message1 = ":1\r\n:2\r\n+34.5\r\n:6\r\n:7";
+    const char *message2 = ":10\r\n:11\r\n+12.13\r\n";
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock());
+    DatagramParser parser(cons);
+
+    // Truncated sample is dropped, samples that precede it are written
+    BOOST_REQUIRE_THROW(parser.parse(message1, strlen(message1)), StreamError);
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 1);
+
+    // Next message is parsed from scratch
+    auto nsamples = parser.parse(message2, strlen(message2));
+    BOOST_REQUIRE_EQUAL(nsamples, 1);
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 2);
+    BOOST_REQUIRE_EQUAL(cons->param_[1], 10);
+    BOOST_REQUIRE_EQUAL(cons->ts_[1], 11);
+    BOOST_REQUIRE_EQUAL(cons->data_[1], 12.13);
+}
@@ -58,10 +58,36 @@ struct CursorMock : DbCursor {
     }
 
     void close() {}
+
+    int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) {
+        std::string strid = std::to_string(id);
+        if (strid.size() < buffer_size) {
+            memcpy(buffer, strid.data(), strid.size());
+            buffer[strid.size()] = 0;
+            return strid.size() + 1;
+        }
+        return -1*strid.size();
+    }
+};
+
+//! Continuous query cursor, returns data when it's ready
+struct SubscriptionMock : CursorMock {
+    bool ready_ = false;
+
+    size_t read(void *dest, size_t dest_size) {
+        return ready_ ? CursorMock::read(dest, dest_size) : 0u;
+    }
+
+    int is_done() {
+        return false;
+    }
 };
 
 struct ConnectionMock : DbConnection
 {
+    std::shared_ptr<SubscriptionMock> subscription_;
+    std::function<void()> notify_;
+
     aku_Status write(const aku_Sample &sample) {
         return AKU_SUCCESS;
     }
@@ -73,6 +99,12 @@ struct ConnectionMock : DbConnection
         return std::make_shared<CursorMock>();
     }
 
+    std::shared_ptr<DbCursor> subscribe(std::string query, std::function<void()> notify) {
+        notify_ = notify;
+        subscription_ = std::make_shared<SubscriptionMock>();
+        return subscription_;
+    }
+
     std::string get_all_stats() {
         return "{}";
     }
@@ -96,7 +128,7 @@ using namespace Akumuli;
 
 BOOST_AUTO_TEST_CASE(Test_query_cursor) {
 
-    std::string expected = "+33\r\n+20141210T074243.111999000\r\n+3.1415000000000002\r\n+44\r\n+20141210T122434.999111000\r\n+3.1415000000000002\r\n";
+    std::string expected = "+33\r\n+20141210T074243.111999000\r\n+3.1415\r\n+44\r\n+20141210T122434.999111000\r\n+3.1415\r\n";
     std::shared_ptr<DbConnection> con;
     con.reset(new ConnectionMock());
     char buffer[0x1000];
@@ -111,3 +143,217 @@ BOOST_AUTO_TEST_CASE(Test_query_cursor) {
     auto actual = std::string(buffer, buffer + len);
     BOOST_REQUIRE_EQUAL(expected, actual);
 }
+
+BOOST_AUTO_TEST_CASE(Test_query_cursor_subscription) {
+
+    std::string expected = "+33\r\n+20141210T074243.111999000\r\n+3.1415\r\n+44\r\n+20141210T122434.999111000\r\n+3.1415\r\n";
+    auto con = std::make_shared<ConnectionMock>();
+    char buffer[0x1000];
+    QueryResultsPooler cursor(con, 1000);
+    int nnotifications = 0;
+    cursor.subscribe([&nnotifications]() { nnotifications++; });
+    cursor.append("{}", 2);
+    cursor.start();
+    BOOST_REQUIRE(con->subscription_);
+
+    // No data yet
+    size_t len;
+    bool done;
+    std::tie(len, done) = cursor.read_some(buffer, 0x1000);
+    BOOST_REQUIRE_EQUAL(len, 0u);
+    BOOST_REQUIRE(!done);
+
+    // New data arrives
+    con->subscription_->ready_ = true;
+    con->notify_();
+    BOOST_REQUIRE_EQUAL(nnotifications, 1);
+    std::tie(len, done) = cursor.read_some(buffer, 0x1000);
+    BOOST_REQUIRE(!done);
+    BOOST_REQUIRE_EQUAL(expected, std::string(buffer, buffer + len));
+}
+
+static std::string read_all(QueryResultsPooler& cursor, size_t bufsize) {
+    std::string result;
+    std::vector<char> buffer(bufsize);
+    size_t len;
+    bool done = false;
+    while (!done) {
+        std::tie(len, done) = cursor.read_some(buffer.data(), buffer.size());
+        result.append(buffer.data(), len);
+    }
+    return result;
+}
+
+static uint64_t get_varint(const char** it) {
+    uint64_t result = 0;
+    int shift = 0;
+    while (true) {
+        uint8_t byte = static_cast<uint8_t>(*(*it)++);
+        result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return result;
+        }
+        shift += 7;
+    }
+}
+
+static void check_columnar_output(std::string const& output, bool compressed) {
+    BOOST_REQUIRE_GE(output.size(), sizeof(ColumnarBlockHeader));
+    ColumnarBlockHeader header;
+    memcpy(&header, output.data(), sizeof(header));
+    BOOST_REQUIRE_EQUAL(header.magic, ColumnarBlockHeader::MAGIC);
+    BOOST_REQUIRE_EQUAL(header.flags, compressed ? ColumnarBlockHeader::COMPRESSED : 0);
+    BOOST_REQUIRE_EQUAL(header.nrows, 2u);
+    BOOST_REQUIRE_EQUAL(header.nseries, 2u);
+    BOOST_REQUIRE_EQUAL(output.size(), sizeof(header) + header.size);
+    BOOST_REQUIRE_EQUAL(output.size() % 8, 0u);
+
+    aku_Sample expected[2];
+    aku_parse_timestamp("20141210T074243.111999", &expected[0]);
+    aku_parse_timestamp("20141210T122434.999111", &expected[1]);
+    uint64_t ids[2], timestamps[2];
+    double values[2];
+    const char* it = output.data() + sizeof(header);
+    if (compressed) {
+        uint64_t prev = 0;
+        for (auto column: { ids, timestamps }) {
+            prev = 0;
+            for (int i = 0; i < 2; i++) {
+                uint64_t zz = get_varint(&it);
+                prev += static_cast<uint64_t>((zz >> 1) ^ -(zz & 1));
+                column[i] = prev;
+            }
+        }
+        prev = 0;
+        for (int i = 0; i < 2; i++) {
+            prev ^= get_varint(&it);
+            memcpy(&values[i], &prev, sizeof(double));
+        }
+    } else {
+        memcpy(ids, it, sizeof(ids));
+        it += sizeof(ids);
+        memcpy(timestamps, it, sizeof(timestamps));
+        it += sizeof(timestamps);
+        memcpy(values, it, sizeof(values));
+        it += sizeof(values);
+    }
+    BOOST_REQUIRE_EQUAL(ids[0], 33u);
+    BOOST_REQUIRE_EQUAL(ids[1], 44u);
+    BOOST_REQUIRE_EQUAL(timestamps[0], expected[0].timestamp);
+    BOOST_REQUIRE_EQUAL(timestamps[1], expected[1].timestamp);
+    const double expected_value = CursorMock::floatval;
+    BOOST_REQUIRE_EQUAL(values[0], expected_value);
+    BOOST_REQUIRE_EQUAL(values[1], expected_value);
+
+    // Series dictionary
+    for (auto id: { 33u, 44u }) {
+        uint64_t actual_id;
+        uint32_t len;
+        memcpy(&actual_id, it, sizeof(actual_id));
+        it += sizeof(actual_id);
+        memcpy(&len, it, sizeof(len));
+        it += sizeof(len);
+        BOOST_REQUIRE_EQUAL(actual_id, id);
+        BOOST_REQUIRE_EQUAL(std::string(it, it + len), std::to_string(id));
+        it += len;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_cursor_columnar) {
+    std::shared_ptr<DbConnection> con;
+    con.reset(new ConnectionMock());
+    QueryResultsPooler cursor(con, 1000);
+    cursor.set_accept("text/html, application/x-akumuli-columnar");
+    cursor.append("{}", 2);
+    cursor.start();
+    BOOST_REQUIRE_EQUAL(std::string(cursor.get_content_type()), "application/x-akumuli-columnar");
+    // Small buffer, block should be split between calls
+    check_columnar_output(read_all(cursor, 7), false);
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_cursor_columnar_compressed) {
+    std::shared_ptr<DbConnection> con;
+    con.reset(new ConnectionMock());
+    QueryResultsPooler cursor(con, 1000);
+    cursor.set_accept("application/x-akumuli-columnar; compression=delta");
+    cursor.append("{}", 2);
+    cursor.start();
+    check_columnar_output(read_all(cursor, 0x1000), true);
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_cursor_text_by_default) {
+    std::shared_ptr<DbConnection> con;
+    con.reset(new ConnectionMock());
+    QueryResultsPooler cursor(con, 1000);
+    cursor.set_accept("*/*");
+    cursor.append(R"({"output": {"format": "csv"}})", 29);
+    cursor.start();
+    BOOST_REQUIRE_EQUAL(std::string(cursor.get_content_type()), "text/csv");
+    std::string expected = "33,20141210T074243.111999000,3.1415\n44,20141210T122434.999111000,3.1415\n";
+    // Small buffer, rows shouldn't be split
+    BOOST_REQUIRE_EQUAL(read_all(cursor, 40), expected);
+}
+
+//! Returns one full columnar block of data and then fails
+struct ErrorCursorMock : CursorMock {
+    enum {
+        NROWS = 4096,  //< Number of rows in the columnar block
+    };
+    bool error_ = false;
+
+    size_t read(void *dest, size_t dest_size) {
+        if (isdone_) {
+            error_ = true;
+            return 0;
+        }
+        if (dest_size < NROWS*sizeof(aku_Sample)) {
+            BOOST_FAIL("invalid mock usage");
+        }
+        aku_Sample* samples = static_cast<aku_Sample*>(dest);
+        for (int i = 0; i < NROWS; i++) {
+            samples[i].paramid = 33;
+            samples[i].timestamp = static_cast<aku_Timestamp>(i);
+            samples[i].payload.size = sizeof(aku_Sample);
+            samples[i].payload.type = AKU_PAYLOAD_FLOAT;
+            samples[i].payload.float64 = floatval;
+        }
+        isdone_ = true;
+        return NROWS*sizeof(aku_Sample);
+    }
+
+    int is_done() {
+        return error_;
+    }
+
+    bool is_error(aku_Status *out_error_code_or_null) {
+        if (out_error_code_or_null) {
+            *out_error_code_or_null = error_ ? AKU_EBUSY : AKU_SUCCESS;
+        }
+        return error_;
+    }
+};
+
+struct ErrorConnectionMock : ConnectionMock {
+    std::shared_ptr<DbCursor> search(std::string query) {
+        return std::make_shared<ErrorCursorMock>();
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Test_query_cursor_columnar_error) {
+    std::shared_ptr<DbConnection> con;
+    con.reset(new ErrorConnectionMock());
+    QueryResultsPooler cursor(con, ErrorCursorMock::NROWS*sizeof(aku_Sample));
+    cursor.set_accept("application/x-akumuli-columnar");
+    cursor.append("{}", 2);
+    cursor.start();
+    // Small buffer, error message shouldn't be written in the middle of the block
+    auto output = read_all(cursor, 7);
+    BOOST_REQUIRE_GE(output.size(), sizeof(ColumnarBlockHeader));
+    ColumnarBlockHeader header;
+    memcpy(&header, output.data(), sizeof(header));
+    BOOST_REQUIRE_EQUAL(header.magic, ColumnarBlockHeader::MAGIC);
+    BOOST_REQUIRE_EQUAL(header.nrows, static_cast<uint32_t>(ErrorCursorMock::NROWS));
+    BOOST_REQUIRE_GE(output.size(), sizeof(header) + header.size);
+    auto error = output.substr(sizeof(header) + header.size);
+    BOOST_REQUIRE_EQUAL(error, std::string("-") + aku_error_message(AKU_EBUSY) + "\r\n");
+}
@@ -0,0 +1,140 @@
+#include <iostream>
+#include <cstring>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+
+#include "queryparser.h"
+
+using namespace Akumuli;
+using namespace Akumuli::QP;
+
+static QueryAST parse(const char* query) {
+    return QueryAST::parse(query, query + strlen(query));
+}
+
+BOOST_AUTO_TEST_CASE(Test_json_reader_tokens) {
+    const char* json = R"({"a": [1, -2.5e3, "x\"y\u0041\ud83d\ude00", true, null], "b": {}, "c": []})";
+    JsonReader reader(json, json + strlen(json));
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::OBJECT_BEGIN);
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::KEY);
+    BOOST_REQUIRE(reader.equals("a"));
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::ARRAY_BEGIN);
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::NUMBER);
+    BOOST_REQUIRE_EQUAL(reader.str(), "1");
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::NUMBER);
+    BOOST_REQUIRE_EQUAL(reader.str(), "-2.5e3");
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::STRING);
+    BOOST_REQUIRE_EQUAL(reader.str(), "x\"yA\xF0\x9F\x98\x80");
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::LITERAL);
+    BOOST_REQUIRE(reader.equals("true"));
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::LITERAL);
+    BOOST_REQUIRE(reader.equals("null"));
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::ARRAY_END);
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::KEY);
+    BOOST_REQUIRE(reader.equals("b"));
+    auto tok = reader.next();
+    BOOST_REQUIRE_EQUAL(tok, JsonReader::OBJECT_BEGIN);
+    reader.skip(tok);
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::KEY);
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::ARRAY_BEGIN);
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::ARRAY_END);
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::OBJECT_END);
+    BOOST_REQUIRE_EQUAL(reader.next(), JsonReader::END);
+}
+
+BOOST_AUTO_TEST_CASE(Test_json_reader_errors) {
+    const char* bad[] = {
+        "",
+        "{",
+        "{\"a\" 1}",
+        "{\"a\": 1,}",
+        "[1 2]",
+        "[\"abc]",
+        "[\"\\x\"]",
+        "[\"\\ud83d\"]",
+        "[tru]",
+        "{} {}",
+        "{a: 1}",
+    };
+    for (auto json: bad) {
+        JsonReader reader(json, json + strlen(json));
+        BOOST_CHECK_THROW(
+            for (auto tok = reader.next(); tok != JsonReader::END; tok = reader.next()) {},
+            QueryParserError);
+    }
+}
+
+static std::string canonical(const char* json) {
+    return canonical_json(json, json + strlen(json));
+}
+
+BOOST_AUTO_TEST_CASE(Test_canonical_json) {
+    auto a = canonical(R"({"sample": "all", "range": {"to": "20150102T000000", "from": "20150101T000000"}, "where": {"key": [3, 1, 2]}})");
+    auto b = canonical(R"({"where":{"key":[3,1,2]},"range":{"from":"20150101T000000","to":"20150102T000000"},"sample":"all"})");
+    auto c = canonical(R"({"where":{"key":[1,2,3]},"range":{"from":"20150101T000000","to":"20150102T000000"},"sample":"all"})");
+    BOOST_REQUIRE_EQUAL(a, R"({"range":{"from":"20150101T000000","to":"20150102T000000"},"sample":"all","where":{"key":[3,1,2]}})");
+    BOOST_REQUIRE_EQUAL(a, b);
+    BOOST_REQUIRE(a != c);
+    // Value types are preserved
+    BOOST_REQUIRE(canonical(R"({"limit": 10})") != canonical(R"({"limit": "10"})"));
+    BOOST_REQUIRE_EQUAL(canonical(R"({"a": true, "b": null})"), R"({"a":true,"b":null})");
+    // Escaped strings are written in one form
+    BOOST_REQUIRE_EQUAL(canonical(R"(["A\"\n"])"), R"(["A\"\u000a"])");
+    BOOST_CHECK_THROW(canonical("{bad json"), QueryParserError);
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_ast_full) {
+    auto ast = parse(R"(
+        {
+            "metric": "cpu",
+            "range": { "from": "20150101T000000", "to": "20150102T000000" },
+            "where": { "host": ["a", "b", 3], "region": "eu" },
+            "group-by": { "time": "1m", "tag": ["host", "region"] },
+            "sample": [{ "name": "paa" }, { "name": "reservoir", "size": "100" }],
+            "limit": 10,
+            "offset": "5",
+            "output": { "format": "csv", "timestamp": "raw" },
+            "unknown": { "nested": [1, 2, {"x": []}] }
+        })");
+    BOOST_REQUIRE_EQUAL(*ast.metric, "cpu");
+    BOOST_REQUIRE(!ast.select);
+    BOOST_REQUIRE_EQUAL(*ast.range_from, "20150101T000000");
+    BOOST_REQUIRE_EQUAL(*ast.range_to, "20150102T000000");
+    BOOST_REQUIRE_EQUAL(ast.where.size(), 2u);
+    BOOST_REQUIRE_EQUAL(ast.where.at(0).first, "host");
+    BOOST_REQUIRE_EQUAL(ast.where.at(0).second.size(), 3u);
+    BOOST_REQUIRE_EQUAL(ast.where.at(0).second.at(2), "3");
+    BOOST_REQUIRE_EQUAL(ast.where.at(1).first, "region");
+    BOOST_REQUIRE_EQUAL(ast.where.at(1).second.at(0), "eu");
+    BOOST_REQUIRE_EQUAL(*ast.groupby_time, "1m");
+    BOOST_REQUIRE_EQUAL(ast.groupby_tags.size(), 2u);
+    BOOST_REQUIRE(ast.has_sample);
+    BOOST_REQUIRE_EQUAL(ast.samplers.size(), 2u);
+    BOOST_REQUIRE_EQUAL(ast.samplers.at(0).get<std::string>("name"), "paa");
+    BOOST_REQUIRE_EQUAL(ast.samplers.at(1).get<int>("size"), 100);
+    BOOST_REQUIRE_EQUAL(ast.limit, 10u);
+    BOOST_REQUIRE_EQUAL(ast.offset, 5u);
+    BOOST_REQUIRE_EQUAL(*ast.output_format, "csv");
+    BOOST_REQUIRE_EQUAL(*ast.output_timestamp, "raw");
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_ast_select) {
+    auto ast = parse(R"({"select": "names", "group-by": {"tag": "host"}})");
+    BOOST_REQUIRE_EQUAL(*ast.select, "names");
+    BOOST_REQUIRE(!ast.metric);
+    BOOST_REQUIRE(!ast.has_sample);
+    BOOST_REQUIRE_EQUAL(ast.groupby_tags.size(), 1u);
+    BOOST_REQUIRE_EQUAL(ast.limit, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_ast_errors) {
+    BOOST_CHECK_THROW(parse("[]"), QueryParserError);
+    BOOST_CHECK_THROW(parse(R"({"metric": ["cpu"]})"), QueryParserError);
+    BOOST_CHECK_THROW(parse(R"({"where": ["host"]})"), QueryParserError);
+    BOOST_CHECK_THROW(parse(R"({"where": {"host": [{}]}})"), QueryParserError);
+    BOOST_CHECK_THROW(parse(R"({"limit": -1})"), QueryParserError);
+    BOOST_CHECK_THROW(parse(R"({"range": "today"})"), QueryParserError);
+    BOOST_CHECK_THROW(parse(R"({"metric": "cpu"} x)"), QueryParserError);
+}
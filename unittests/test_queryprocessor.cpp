@@ -10,7 +10,10 @@
 #include "queryprocessor.h"
 #include "query_processing/randomsamplingnode.h"
 #include "query_processing/paa.h"
+#include "query_processing/quantile.h"
 #include "datetime.h"
+#include "anomalydetector.h"
+#include "rollup.h"
 
 using namespace Akumuli;
 using namespace Akumuli::QP;
@@ -251,3 +254,361 @@ BOOST_AUTO_TEST_CASE(Test_queryprocessor_building_1) {
     BOOST_REQUIRE_EQUAL(terminal->ids.at(1), 2);
     BOOST_REQUIRE_EQUAL(terminal->values.at(1), 0.234);
 }
+
+BOOST_AUTO_TEST_CASE(Test_approx_anomaly_detector) {
+    // Series 13 deviates from forecast, other series are stable
+    auto detector = AnomalyDetectorUtil::create_approx_sma(3, 1024, 2.0, 4);
+    for (int step = 0; step < 10; step++) {
+        for (uint64_t id = 0; id < 100; id++) {
+            double value = 1.0;
+            if (id == 13 && step == 9) {
+                value = 1000.0;
+            }
+            detector->add(id, value);
+        }
+        detector->move_sliding_window();
+    }
+    BOOST_REQUIRE(detector->is_anomaly_candidate(13));
+    int ncandidates = 0;
+    for (uint64_t id = 0; id < 100; id++) {
+        ncandidates += detector->is_anomaly_candidate(id);
+    }
+    // Sketch can produce false positives because of collisions
+    BOOST_REQUIRE(ncandidates < 10);
+}
+
+BOOST_AUTO_TEST_CASE(Test_ddsketch_quantiles) {
+    DDSketch sketch(0.01, 2048), part(0.01, 2048);
+    for (int i = 1; i <= 10000; i++) {
+        if (i % 2) {
+            sketch.add(i);
+        } else {
+            part.add(i);
+        }
+    }
+    sketch.merge(part);
+    BOOST_REQUIRE_EQUAL(sketch.count(), 10000u);
+    BOOST_REQUIRE_CLOSE(sketch.quantile(0.5), 5000.0, 2.0);
+    BOOST_REQUIRE_CLOSE(sketch.quantile(0.99), 9900.0, 2.0);
+    BOOST_REQUIRE_CLOSE(sketch.quantile(0.0), 1.0, 2.0);
+    BOOST_REQUIRE_CLOSE(sketch.quantile(1.0), 10000.0, 2.0);
+
+    // Negative values and zeroes
+    DDSketch mixed(0.01, 2048);
+    for (int i = -100; i <= 100; i++) {
+        mixed.add(i);
+    }
+    BOOST_REQUIRE_EQUAL(mixed.quantile(0.5), 0.0);
+    BOOST_REQUIRE_CLOSE(mixed.quantile(0.0), -100.0, 2.0);
+    BOOST_REQUIRE_CLOSE(mixed.quantile(0.25), -50.0, 2.0);
+
+    // Memory is bounded
+    DDSketch bounded(0.01, 64);
+    for (int i = 1; i <= 100000; i++) {
+        bounded.add(i);
+    }
+    BOOST_REQUIRE(bounded.positive_.bins.size() <= 64u);
+    BOOST_REQUIRE_CLOSE(bounded.quantile(0.99), 99000.0, 2.0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_quantile_node) {
+    aku_Sample margin = {};
+    margin.payload.type = aku_PData::HI_MARGIN;
+    margin.payload.size = sizeof(aku_Sample);
+    auto mock = std::make_shared<NodeMock>();
+    auto node = std::make_shared<QuantileNode>(std::vector<double>{0.5, 0.99}, 0.01, 2048, mock);
+    for (int step = 0; step < 2; step++) {
+        for (int i = 1; i <= 1000; i++) {
+            BOOST_REQUIRE(node->put(make(step*1000 + i, 1, i)));
+            BOOST_REQUIRE(node->put(make(step*1000 + i, 2, 2*i)));
+        }
+        margin.timestamp = (step + 1)*1000;
+        BOOST_REQUIRE(node->put(margin));
+    }
+    node->complete();
+    // two buckets, two series, two quantiles
+    BOOST_REQUIRE_EQUAL(mock->values.size(), 8u);
+    BOOST_REQUIRE_EQUAL(mock->ids.at(0), 1u);
+    BOOST_REQUIRE_CLOSE(mock->values.at(0), 500.0, 2.0);
+    BOOST_REQUIRE_CLOSE(mock->values.at(1), 990.0, 2.0);
+    BOOST_REQUIRE_EQUAL(mock->ids.at(2), 2u);
+    BOOST_REQUIRE_CLOSE(mock->values.at(2), 1000.0, 2.0);
+    BOOST_REQUIRE_EQUAL(mock->timestamps.at(7), 2000u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_quantile_series_names) {
+    SeriesMatcher matcher(1ul);
+    const char* names[] = { "cpu key=1", "cpu zone=2" };
+    for (auto name: names) {
+        matcher.add(name, name + strlen(name));
+    }
+    const char* json = R"(
+            {
+                "metric": "cpu",
+                "range" : {
+                    "from": "20150101T000000",
+                    "to"  : "20150102T000000"
+                },
+                "sample": [{ "name": "quantile", "quantiles": [0.5, 0.99] }],
+                "group-by": { "time": "1h" }
+            }
+    )";
+    auto terminal = std::make_shared<NodeMock>();
+    auto qproc = QP::Builder::build_query_processor(json, terminal, matcher, &logger_stub);
+    auto begin = DateTimeUtil::from_iso_string("20150101T000000");
+    BOOST_REQUIRE(qproc->start());
+    for (int i = 1; i <= 100; i++) {
+        BOOST_REQUIRE(qproc->put(make(begin + i, 1, i)));
+        BOOST_REQUIRE(qproc->put(make(begin + i, 2, 2*i)));
+    }
+    // Close the first bucket
+    BOOST_REQUIRE(qproc->put(make(begin + 3600*1000000000ul, 1, 0.0)));
+    qproc->stop();
+
+    // Every quantile is a separate series
+    auto output = qproc->matcher();
+    BOOST_REQUIRE(output != nullptr);
+    BOOST_REQUIRE_EQUAL(terminal->ids.size(), 4u);
+    std::vector<std::string> actual;
+    for (auto id: terminal->ids) {
+        auto str = output->id2str(id);
+        BOOST_REQUIRE(str.first != nullptr);
+        actual.push_back(std::string(str.first, str.first + str.second));
+    }
+    BOOST_REQUIRE_EQUAL(actual.at(0), "cpu key=1 quantile=0.5");
+    BOOST_REQUIRE_EQUAL(actual.at(1), "cpu key=1 quantile=0.99");
+    BOOST_REQUIRE_EQUAL(actual.at(2), "cpu quantile=0.5 zone=2");
+    BOOST_REQUIRE_EQUAL(actual.at(3), "cpu quantile=0.99 zone=2");
+    BOOST_REQUIRE_CLOSE(terminal->values.at(1), 99.0, 2.0);
+    BOOST_REQUIRE_CLOSE(terminal->values.at(3), 198.0, 2.0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_slot_map) {
+    // Dense ids use direct table, slots follow id order
+    SlotMap dense({102, 100, 101, 101});
+    BOOST_REQUIRE_EQUAL(dense.size(), 3u);
+    BOOST_REQUIRE(!dense.table_.empty());
+    BOOST_REQUIRE_EQUAL(dense.slot(100), 0u);
+    BOOST_REQUIRE_EQUAL(dense.slot(102), 2u);
+    BOOST_REQUIRE_EQUAL(dense.find(99), (uint32_t)SlotMap::NO_SLOT);
+    // New ids get new slots
+    BOOST_REQUIRE_EQUAL(dense.slot(200), 3u);
+    BOOST_REQUIRE_EQUAL(dense.slot(50), 4u);
+    BOOST_REQUIRE_EQUAL(dense.slot(200), 3u);
+    BOOST_REQUIRE_EQUAL(dense.find(50), 4u);
+    BOOST_REQUIRE_EQUAL(dense.id(4), 50u);
+
+    // Sparse ids
+    SlotMap sparse({1, 1000000000, 2000000000});
+    BOOST_REQUIRE(sparse.table_.empty());
+    BOOST_REQUIRE_EQUAL(sparse.slot(1000000000), 1u);
+    BOOST_REQUIRE_EQUAL(sparse.find(3), (uint32_t)SlotMap::NO_SLOT);
+
+    // Empty map grows on demand
+    SlotMap empty;
+    for (aku_ParamId id = 1000; id < 11000; id++) {
+        BOOST_REQUIRE_EQUAL(empty.slot(id), id - 1000);
+    }
+    BOOST_REQUIRE(empty.overflow_.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_paa_shared_slot_map) {
+    aku_Sample margin = {};
+    margin.payload.type = aku_PData::LO_MARGIN;
+    margin.payload.size = sizeof(aku_Sample);
+    auto mock = std::make_shared<NodeMock>();
+    auto node = std::make_shared<MeanPAA>(mock);
+    node->set_slot_map(std::make_shared<SlotMap>(std::vector<aku_ParamId>{10, 20, 30}));
+    BOOST_REQUIRE(node->put(make(3, 30, 3.0)));
+    BOOST_REQUIRE(node->put(make(2, 10, 1.0)));
+    BOOST_REQUIRE(node->put(make(2, 40, 4.0)));  // not known in advance
+    BOOST_REQUIRE(node->put(make(1, 10, 3.0)));
+    BOOST_REQUIRE(node->put(margin));
+    node->complete();
+    // series without samples are skipped, ids are in backward order
+    BOOST_REQUIRE_EQUAL(mock->ids.size(), 3u);
+    BOOST_REQUIRE_EQUAL(mock->ids.at(0), 40u);
+    BOOST_REQUIRE_EQUAL(mock->ids.at(1), 30u);
+    BOOST_REQUIRE_EQUAL(mock->ids.at(2), 10u);
+    BOOST_REQUIRE_CLOSE(mock->values.at(2), 2.0, 0.001);
+}
+
+BOOST_AUTO_TEST_CASE(Test_paa_skips_idle_series) {
+    aku_Sample margin = {};
+    margin.payload.type = aku_PData::HI_MARGIN;
+    margin.payload.size = sizeof(aku_Sample);
+    auto mock = std::make_shared<NodeMock>();
+    auto node = std::make_shared<MedianPAA>(mock);
+    for (aku_Timestamp bucket = 0; bucket < 100; bucket++) {
+        // series 1 is active in every bucket, series 2 - in every 10th bucket
+        BOOST_REQUIRE(node->put(make(bucket*10 + 1, 1, bucket)));
+        BOOST_REQUIRE(node->put(make(bucket*10 + 2, 1, bucket + 2)));
+        BOOST_REQUIRE(node->put(make(bucket*10 + 3, 1, bucket + 1)));
+        if (bucket % 10 == 0) {
+            BOOST_REQUIRE(node->put(make(bucket*10 + 4, 2, bucket)));
+        }
+        margin.timestamp = bucket*10 + 10;
+        BOOST_REQUIRE(node->put(margin));
+    }
+    BOOST_REQUIRE_EQUAL(mock->ids.size(), 110u);
+    BOOST_REQUIRE_EQUAL(mock->ids.at(0), 1u);
+    BOOST_REQUIRE_EQUAL(mock->ids.at(1), 2u);
+    BOOST_REQUIRE_EQUAL(mock->ids.at(2), 1u);
+    BOOST_REQUIRE_CLOSE(mock->values.at(2), 2.0, 0.001);
+    BOOST_REQUIRE_EQUAL(mock->timestamps.at(2), 20u);
+}
+
+struct RollupQueryFixture {
+    SeriesMatcher matcher;
+    RollupStorage rollup;
+    std::vector<aku_Sample> samples;
+    aku_Timestamp begin;
+
+    RollupQueryFixture()
+        : matcher(1ul)
+        , rollup({ std::make_pair(60*1000000000ul, 1000u) })
+        , begin(DateTimeUtil::from_iso_string("20150101T000000"))
+    {
+        const char* names[] = { "cpu key=1", "cpu key=2", "mem key=1" };
+        std::vector<aku_ParamId> ids;
+        for (auto name: names) {
+            ids.push_back(matcher.add(name, name + strlen(name)));
+        }
+        // Data starts before the range to make the first tier bucket complete
+        const aku_Timestamp step = 10*1000000000ul;
+        for (aku_Timestamp ts = begin - 600*step; ts < begin + 1080*step; ts += step) {
+            for (auto id: ids) {
+                double value = static_cast<double>((ts/step*id) % 37);
+                samples.push_back(make(ts, id, value));
+                rollup.add(ts, id, value);
+            }
+        }
+    }
+
+    //! Run query the same way storage does
+    std::shared_ptr<NodeMock> run(const char* query, bool use_rollup, bool* routed) {
+        auto terminal = std::make_shared<NodeMock>();
+        auto proc = QP::Builder::build_query_processor(query, terminal, matcher, &logger_stub,
+                                                       use_rollup ? &rollup : nullptr);
+        *routed = static_cast<bool>(std::dynamic_pointer_cast<RollupQueryProcessor>(proc));
+        if (proc->start()) {
+            auto scan = [&](aku_Sample const& s) {
+                if (s.timestamp < proc->lowerbound() || s.timestamp > proc->upperbound()) {
+                    return true;
+                }
+                if (proc->filter().apply(s.paramid) != IQueryFilter::PROCESS) {
+                    return true;
+                }
+                return proc->put(s);
+            };
+            if (proc->direction() == AKU_CURSOR_DIR_FORWARD) {
+                std::all_of(samples.begin(), samples.end(), scan);
+            } else {
+                std::all_of(samples.rbegin(), samples.rend(), scan);
+            }
+            proc->stop();
+        }
+        return terminal;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Test_rollup_query_forward) {
+    RollupQueryFixture fixture;
+    const char* query = R"(
+            {
+                "metric": "cpu",
+                "range" : {
+                    "from": "20150101T000000",
+                    "to"  : "20150101T023000"
+                },
+                "sample": [{ "name": "paa" }],
+                "group-by": { "time": "10m" }
+            }
+    )";
+    bool routed;
+    auto raw = fixture.run(query, false, &routed);
+    BOOST_REQUIRE(!routed);
+    auto res = fixture.run(query, true, &routed);
+    BOOST_REQUIRE(routed);
+    BOOST_REQUIRE_EQUAL(raw->ids.size(), 30u);
+    BOOST_REQUIRE_EQUAL(res->ids.size(), raw->ids.size());
+    for (size_t i = 0; i < raw->ids.size(); i++) {
+        BOOST_REQUIRE_EQUAL(res->ids.at(i), raw->ids.at(i));
+        BOOST_REQUIRE_EQUAL(res->timestamps.at(i), raw->timestamps.at(i));
+        BOOST_REQUIRE_CLOSE(res->values.at(i), raw->values.at(i), 0.0001);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_rollup_query_backward) {
+    RollupQueryFixture fixture;
+    const char* query = R"(
+            {
+                "metric": "cpu",
+                "range" : {
+                    "from": "20150101T030000",
+                    "to"  : "20150101T000000"
+                },
+                "sample": [{ "name": "max-paa" }],
+                "group-by": { "time": "30m" }
+            }
+    )";
+    bool routed;
+    auto raw = fixture.run(query, false, &routed);
+    BOOST_REQUIRE(!routed);
+    auto res = fixture.run(query, true, &routed);
+    BOOST_REQUIRE(routed);
+    // Raw data scan can't close the oldest bucket
+    BOOST_REQUIRE_EQUAL(raw->ids.size(), 10u);
+    BOOST_REQUIRE_EQUAL(res->ids.size(), 12u);
+    for (size_t i = 0; i < raw->ids.size(); i++) {
+        BOOST_REQUIRE_EQUAL(res->ids.at(i), raw->ids.at(i));
+        BOOST_REQUIRE_EQUAL(res->timestamps.at(i), raw->timestamps.at(i));
+        BOOST_REQUIRE_EQUAL(res->values.at(i), raw->values.at(i));
+    }
+    BOOST_REQUIRE_EQUAL(res->ids.at(10), 2u);
+    BOOST_REQUIRE_EQUAL(res->ids.at(11), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_rollup_query_unaligned_begin) {
+    RollupQueryFixture fixture;
+    // Range starts inside the query bucket and inside the tier bucket
+    const char* queries[] = {
+        R"({ "metric": "cpu", "range": { "from": "20150101T000100", "to": "20150101T023000" },
+             "sample": [{ "name": "paa" }], "group-by": { "time": "10m" } })",
+        R"({ "metric": "cpu", "range": { "from": "20150101T000130", "to": "20150101T023000" },
+             "sample": [{ "name": "paa" }], "group-by": { "time": "10m" } })",
+    };
+    bool expect_routed[] = { true, false };
+    for (int i = 0; i < 2; i++) {
+        bool routed;
+        auto raw = fixture.run(queries[i], false, &routed);
+        BOOST_REQUIRE(!routed);
+        auto res = fixture.run(queries[i], true, &routed);
+        BOOST_REQUIRE_EQUAL(routed, expect_routed[i]);
+        BOOST_REQUIRE_EQUAL(raw->ids.size(), 30u);
+        BOOST_REQUIRE_EQUAL(res->ids.size(), raw->ids.size());
+        for (size_t j = 0; j < raw->ids.size(); j++) {
+            BOOST_REQUIRE_EQUAL(res->ids.at(j), raw->ids.at(j));
+            BOOST_REQUIRE_EQUAL(res->timestamps.at(j), raw->timestamps.at(j));
+            BOOST_REQUIRE_CLOSE(res->values.at(j), raw->values.at(j), 0.0001);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_rollup_query_not_routed) {
+    RollupQueryFixture fixture;
+    const char* query = R"(
+            {
+                "metric": "cpu",
+                "range" : {
+                    "from": "20150101T000000",
+                    "to"  : "20150101T023000"
+                },
+                "sample": [{ "name": "median-paa" }],
+                "group-by": { "time": "10m" }
+            }
+    )";
+    bool routed;
+    fixture.run(query, true, &routed);
+    BOOST_REQUIRE(!routed);
+}
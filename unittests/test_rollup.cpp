@@ -0,0 +1,159 @@
+#include <iostream>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include "rollup.h"
+
+using namespace Akumuli;
+
+static const aku_Timestamp MINUTE = 60*1000000000ul;
+
+BOOST_AUTO_TEST_CASE(Test_rollup_parse_config) {
+    std::vector<RollupStorage::TierConfig> tiers;
+    BOOST_REQUIRE_EQUAL(RollupStorage::parse_config("1m:1440, 1h:720", &tiers), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(tiers.size(), 2u);
+    BOOST_REQUIRE_EQUAL(tiers.at(0).first, MINUTE);
+    BOOST_REQUIRE_EQUAL(tiers.at(0).second, 1440u);
+    BOOST_REQUIRE_EQUAL(tiers.at(1).first, 60*MINUTE);
+    BOOST_REQUIRE_EQUAL(tiers.at(1).second, 720u);
+
+    tiers.clear();
+    BOOST_REQUIRE_EQUAL(RollupStorage::parse_config("", &tiers), AKU_SUCCESS);
+    BOOST_REQUIRE(tiers.empty());
+    BOOST_REQUIRE_EQUAL(RollupStorage::parse_config("1m", &tiers), AKU_EBAD_ARG);
+    BOOST_REQUIRE_EQUAL(RollupStorage::parse_config("1x:10", &tiers), AKU_EBAD_ARG);
+    BOOST_REQUIRE_EQUAL(RollupStorage::parse_config("1m:0", &tiers), AKU_EBAD_ARG);
+}
+
+BOOST_AUTO_TEST_CASE(Test_rollup_aggregates) {
+    RollupStorage rollup({ std::make_pair(MINUTE, 100u) });
+    UncompressedChunk chunk;
+    for (aku_Timestamp ts = 10*MINUTE; ts < 20*MINUTE; ts += MINUTE/10) {
+        for (aku_ParamId id = 1; id < 3; id++) {
+            chunk.timestamps.push_back(ts);
+            chunk.paramids.push_back(id);
+            chunk.values.push_back(static_cast<double>(ts % MINUTE / (MINUTE/10)) * id);
+        }
+    }
+    rollup.append(chunk);
+
+    // First bucket can be partial, last one is still open
+    auto tiers = rollup.get_tiers();
+    BOOST_REQUIRE_EQUAL(tiers.size(), 1u);
+    BOOST_REQUIRE_EQUAL(tiers.at(0).step, MINUTE);
+    BOOST_REQUIRE_EQUAL(tiers.at(0).begin, 11*MINUTE);
+    BOOST_REQUIRE_EQUAL(tiers.at(0).end, 19*MINUTE);
+
+    std::vector<QP::RollupBucket> buckets;
+    rollup.read(0, 2, 12*MINUTE, 15*MINUTE, &buckets);
+    BOOST_REQUIRE_EQUAL(buckets.size(), 3u);
+    for (size_t i = 0; i < buckets.size(); i++) {
+        BOOST_REQUIRE_EQUAL(buckets[i].timestamp, (12 + i)*MINUTE);
+        BOOST_REQUIRE_EQUAL(buckets[i].count, 10u);
+        BOOST_REQUIRE_EQUAL(buckets[i].min, 0.0);
+        BOOST_REQUIRE_EQUAL(buckets[i].max, 18.0);
+        BOOST_REQUIRE_EQUAL(buckets[i].sum, 90.0);
+    }
+    rollup.read(0, 3, 0, 100*MINUTE, &buckets);
+    BOOST_REQUIRE(buckets.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_rollup_retention_and_late_writes) {
+    RollupStorage rollup({ std::make_pair(MINUTE, 4u) });
+    for (aku_Timestamp ts = 0; ts < 10*MINUTE; ts += MINUTE) {
+        rollup.add(ts, 1, 1.0);
+    }
+    // Only last four buckets are retained
+    auto tiers = rollup.get_tiers();
+    BOOST_REQUIRE_EQUAL(tiers.at(0).begin, 6*MINUTE);
+    BOOST_REQUIRE_EQUAL(tiers.at(0).end, 9*MINUTE);
+    std::vector<QP::RollupBucket> buckets;
+    rollup.read(0, 1, 0, 10*MINUTE, &buckets);
+    BOOST_REQUIRE_EQUAL(buckets.size(), 4u);
+    BOOST_REQUIRE_EQUAL(buckets.front().timestamp, 6*MINUTE);
+
+    // Late writes update complete buckets, too old values are ignored
+    rollup.add(7*MINUTE + 1, 1, 3.0);
+    rollup.add(7*MINUTE + 2, 2, 5.0);
+    rollup.add(2*MINUTE, 1, 100.0);
+    rollup.read(0, 1, 0, 10*MINUTE, &buckets);
+    BOOST_REQUIRE_EQUAL(buckets.size(), 4u);
+    BOOST_REQUIRE_EQUAL(buckets.at(1).count, 2u);
+    BOOST_REQUIRE_EQUAL(buckets.at(1).max, 3.0);
+    BOOST_REQUIRE_EQUAL(buckets.at(1).sum, 4.0);
+    rollup.read(0, 2, 0, 10*MINUTE, &buckets);
+    BOOST_REQUIRE_EQUAL(buckets.size(), 1u);
+    BOOST_REQUIRE_EQUAL(buckets.at(0).timestamp, 7*MINUTE);
+}
+
+BOOST_AUTO_TEST_CASE(Test_rollup_ring_buffer) {
+    RollupStorage rollup({ std::make_pair(MINUTE, 100u) });
+    auto const& tier = *rollup.tiers_.at(0);
+
+    // Ring grows only when live buckets collide
+    rollup.add(0, 1, 1.0);
+    rollup.add(MINUTE, 1, 1.0);
+    BOOST_REQUIRE_EQUAL(tier.series.at(1).size(), static_cast<size_t>(RollupStorage::Tier::INITIAL_RING_SIZE));
+    for (aku_Timestamp ts = 2*MINUTE; ts < 150*MINUTE; ts += 7*MINUTE) {
+        rollup.add(ts, 1, 1.0);
+        rollup.add(ts, 2, 2.0);
+    }
+    BOOST_REQUIRE(tier.series.at(1).size() <= 100u);
+    BOOST_REQUIRE(tier.series.at(2).size() < 100u);
+
+    // Expired buckets are not returned
+    std::vector<QP::RollupBucket> buckets;
+    rollup.read(0, 1, 0, 200*MINUTE, &buckets);
+    BOOST_REQUIRE_EQUAL(buckets.size(), 15u);
+    BOOST_REQUIRE_EQUAL(buckets.front().timestamp, 51*MINUTE);
+    BOOST_REQUIRE_EQUAL(buckets.back().timestamp, 149*MINUTE);
+    for (size_t i = 1; i < buckets.size(); i++) {
+        BOOST_REQUIRE_EQUAL(buckets[i].timestamp - buckets[i - 1].timestamp, 7*MINUTE);
+    }
+
+    // Stale series are removed when snapshot is written
+    rollup.add(300*MINUTE, 2, 2.0);
+    rollup.read(0, 1, 0, 400*MINUTE, &buckets);
+    BOOST_REQUIRE(buckets.empty());
+    auto path = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+    BOOST_REQUIRE_EQUAL(rollup.write_snapshot(path), AKU_SUCCESS);
+    boost::filesystem::remove(path);
+    BOOST_REQUIRE_EQUAL(tier.series.count(1), 0u);
+    BOOST_REQUIRE_EQUAL(tier.series.count(2), 1u);
+    BOOST_REQUIRE_EQUAL(rollup.nsamples_, 47u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_rollup_snapshot) {
+    auto path = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+    RollupStorage rollup({ std::make_pair(MINUTE, 100u), std::make_pair(60*MINUTE, 10u) });
+    for (aku_Timestamp ts = 0; ts < 200*MINUTE; ts += MINUTE/2) {
+        rollup.add(ts, ts % 3, static_cast<double>(ts % 7));
+    }
+    BOOST_REQUIRE_EQUAL(rollup.write_snapshot(path), AKU_SUCCESS);
+
+    // Tier with different configuration is skipped
+    RollupStorage copy({ std::make_pair(MINUTE, 100u), std::make_pair(60*MINUTE, 20u) });
+    BOOST_REQUIRE_EQUAL(copy.read_snapshot(path), AKU_SUCCESS);
+    boost::filesystem::remove(path);
+
+    auto expected = rollup.get_tiers();
+    auto actual = copy.get_tiers();
+    BOOST_REQUIRE_EQUAL(actual.at(0).begin, expected.at(0).begin);
+    BOOST_REQUIRE_EQUAL(actual.at(0).end, expected.at(0).end);
+    BOOST_REQUIRE_EQUAL(actual.at(1).end, 0u);
+    for (aku_ParamId id = 0; id < 3; id++) {
+        std::vector<QP::RollupBucket> lhs, rhs;
+        rollup.read(0, id, 0, 200*MINUTE, &lhs);
+        copy.read(0, id, 0, 200*MINUTE, &rhs);
+        BOOST_REQUIRE_EQUAL(lhs.size(), rhs.size());
+        for (size_t i = 0; i < lhs.size(); i++) {
+            BOOST_REQUIRE_EQUAL(lhs[i].timestamp, rhs[i].timestamp);
+            BOOST_REQUIRE_EQUAL(lhs[i].sum, rhs[i].sum);
+            BOOST_REQUIRE_EQUAL(lhs[i].count, rhs[i].count);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(copy.read_snapshot(path), AKU_ENOT_FOUND);
+}
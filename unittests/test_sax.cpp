@@ -57,3 +57,57 @@ BOOST_AUTO_TEST_CASE(Test_encoding) {
     BOOST_REQUIRE_EQUAL_COLLECTIONS(words.begin(), words.end(), expected.begin(), expected.end());
 }
 
+
+//! Straightforward implementation (normalize window, map every value to symbol)
+static std::string reference_sax(std::vector<double> const& window, std::vector<double> const& cuts) {
+    double sum = 0, sqrsum = 0;
+    for (auto x: window) {
+        sum += x;
+        sqrsum += x*x;
+    }
+    double n = window.size();
+    double mean = sum/n;
+    double stddev = sqrt((n*sqrsum - sum*sum)/(n*(n - 1)));
+    std::string result;
+    for (auto x: window) {
+        double val = stddev < 1e-10 ? x - mean : (x - mean)/stddev;
+        char c = 'a';
+        while (c - 'a' < (int)cuts.size() && val >= cuts[c - 'a']) {
+            c++;
+        }
+        result.push_back(c);
+    }
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(Test_encoding_random_walk) {
+
+    const int W = 16;
+    const std::vector<double> cuts = { -1.150349380376010, -0.674489750196082, -0.318639363964375, 0.0,
+                                        0.318639363964375,  0.674489750196082,  1.150349380376010 };
+    SAXEncoder encoder(8, W);
+    std::vector<double> window;
+    std::string last;
+    double x = 100.0;
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> step(-1.0, 1.0);
+    for (int i = 0; i < 10000; i++) {
+        x += step(gen);
+        window.push_back(x);
+        if (window.size() > W) {
+            window.erase(window.begin());
+        }
+        std::string w(W, ' ');
+        bool res = encoder.encode(x, &w[0], w.size());
+        if (window.size() == W) {
+            auto expected = reference_sax(window, cuts);
+            BOOST_REQUIRE_EQUAL(res, expected != last);
+            if (res) {
+                BOOST_REQUIRE_EQUAL(w, expected);
+                last = expected;
+            }
+        } else {
+            BOOST_REQUIRE(!res);
+        }
+    }
+}
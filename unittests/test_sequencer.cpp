@@ -307,3 +307,77 @@ BOOST_AUTO_TEST_CASE(Test_sequencer_search_backward) {
 BOOST_AUTO_TEST_CASE(Test_sequencer_search_forward) {
     test_sequencer_searching(AKU_CURSOR_DIR_FORWARD);
 }
+
+static void count_notifications(void* arg) {
+    static_cast<std::atomic<int>*>(arg)->fetch_add(1);
+}
+
+BOOST_AUTO_TEST_CASE(Test_sequencer_publish_to_subscription) {
+    const int SZLOOP = 1000;
+    const int WINDOW = 10;
+    const aku_Timestamp BEGIN = 100u, END = 899u;
+
+    aku_FineTuneParams params = {};
+    params.window_size = WINDOW;
+    Sequencer seq(params);
+    std::vector<char> page_mem(0x100000);
+    auto page = new (page_mem.data()) PageHeader(0, page_mem.size(), 0, 1);
+
+    std::atomic<int> nnotifications = {0};
+    SubscriptionRegistry registry;
+    auto sub = std::make_shared<Subscription>(Subscription::DEFAULT_CAPACITY, &count_notifications, &nnotifications);
+    auto qproc = std::make_shared<TestQueryProcessor>(sub->make_sink(), BEGIN, END, AKU_CURSOR_DIR_FORWARD);
+    BOOST_REQUIRE(sub->start(qproc));
+    registry.add(sub);
+
+    for (int i = 0; i < SZLOOP; i++) {
+        int status;
+        int lock = 0;
+        tie(status, lock) = seq.add(TimeSeriesValue(static_cast<aku_Timestamp>(i), 42u, i));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        if (lock % 2 == 1) {
+            status = seq.merge_and_compress(page, false, nullptr, &registry);
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(seq.close(page, nullptr, &registry), AKU_SUCCESS);
+
+    std::vector<aku_Sample> results(SZLOOP);
+    auto nbytes = sub->read_ex(results.data(), results.size()*sizeof(aku_Sample));
+    results.resize(nbytes/sizeof(aku_Sample));
+    BOOST_REQUIRE_EQUAL(results.size(), END - BEGIN + 1);
+    for (auto i = 0u; i < results.size(); i++) {
+        BOOST_REQUIRE_EQUAL(results[i].timestamp, BEGIN + i);
+        BOOST_REQUIRE_EQUAL(results[i].payload.float64, BEGIN + i);
+    }
+    // Subscription is completed when query range ends
+    BOOST_REQUIRE(sub->is_done());
+    BOOST_REQUIRE(!sub->is_error(nullptr));
+    BOOST_REQUIRE_EQUAL(registry.size(), 0u);
+    BOOST_REQUIRE(nnotifications.load() > 0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_subscription_overflow) {
+    const size_t CAPACITY = 10;
+    auto sub = std::make_shared<Subscription>(CAPACITY*sizeof(aku_Sample), nullptr, nullptr);
+    auto qproc = std::make_shared<TestQueryProcessor>(sub->make_sink(), AKU_MIN_TIMESTAMP, AKU_MAX_TIMESTAMP,
+                                                      AKU_CURSOR_DIR_FORWARD);
+    BOOST_REQUIRE(sub->start(qproc));
+
+    UncompressedChunk chunk;
+    for (int i = 0; i < 20; i++) {
+        chunk.timestamps.push_back(i);
+        chunk.paramids.push_back(42u);
+        chunk.values.push_back(i);
+    }
+    BOOST_REQUIRE(!sub->publish(chunk));
+    aku_Status status = AKU_SUCCESS;
+    BOOST_REQUIRE(sub->is_error(&status));
+    BOOST_REQUIRE_EQUAL(status, AKU_EOVERFLOW);
+
+    // Samples received before overflow can be read
+    std::vector<aku_Sample> results(20);
+    auto nbytes = sub->read_ex(results.data(), results.size()*sizeof(aku_Sample));
+    BOOST_REQUIRE_EQUAL(nbytes, CAPACITY*sizeof(aku_Sample));
+    BOOST_REQUIRE(sub->is_done());
+}
@@ -4,8 +4,16 @@
 #define BOOST_TEST_MODULE Main
 #include <boost/test/unit_test.hpp>
 #include <vector>
+#include <cstring>
+#include <atomic>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+#include <sqlite3.h>
 
 #include "metadatastorage.h"
+#include "seriessnapshot.h"
 
 
 using namespace Akumuli;
@@ -22,7 +30,7 @@ AkumuliInitializer initializer;
 
 BOOST_AUTO_TEST_CASE(Test_metadata_storage_volumes_config) {
 
-    auto db = MetadataStorage(":memory:", &logger_stub);
+    MetadataStorage db(":memory:", &logger_stub);
     std::vector<MetadataStorage::VolumeDesc> volumes = {
         std::make_pair(0, "first"),
         std::make_pair(1, "second"),
@@ -38,7 +46,7 @@ BOOST_AUTO_TEST_CASE(Test_metadata_storage_volumes_config) {
 
 BOOST_AUTO_TEST_CASE(Test_metadata_storage_numeric_config) {
 
-    auto db = MetadataStorage(":memory:", &logger_stub);
+    MetadataStorage db(":memory:", &logger_stub);
     const char* creation_datetime = "2015-02-03 00:00:00";  // Formatting not required
     db.init_config(creation_datetime);
     std::string actual_dt;
@@ -46,3 +54,126 @@ BOOST_AUTO_TEST_CASE(Test_metadata_storage_numeric_config) {
     BOOST_REQUIRE_EQUAL(creation_datetime, actual_dt);
 }
 
+
+static const char* SERIES_NAMES[] = {
+    "cpu host=A region=eu",
+    "cpu host=B region=eu",
+    "mem host=A region=us",
+    "mem host=C region=us",
+};
+
+//! Add test series to matcher and pull them
+static std::vector<SeriesMatcher::SeriesNameT> add_series(SeriesMatcher* matcher) {
+    for (auto name: SERIES_NAMES) {
+        matcher->add(name, name + strlen(name));
+    }
+    std::vector<SeriesMatcher::SeriesNameT> names;
+    matcher->pull_new_names(&names);
+    return names;
+}
+
+//! Check that all test series are present in matcher
+static void check_series(SeriesMatcher& expected, SeriesMatcher& actual) {
+    for (auto name: SERIES_NAMES) {
+        auto id = expected.match(name, name + strlen(name));
+        BOOST_REQUIRE(id != 0);
+        BOOST_REQUIRE_EQUAL(actual.match(name, name + strlen(name)), id);
+        auto str = actual.id2str(id);
+        BOOST_REQUIRE_EQUAL(std::string(str.first, str.first + str.second), name);
+    }
+}
+
+//! Temporary sqlite database
+struct TempDatabase {
+    std::string path;
+
+    TempDatabase()
+        : path((boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string())
+    {
+    }
+
+    ~TempDatabase() {
+        boost::filesystem::remove(path);
+        boost::filesystem::remove(path + ".series");
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Test_metadata_storage_writer_persists_names) {
+
+    MetadataStorage db(":memory:", &logger_stub);
+    SeriesMatcher matcher(1ul);
+    uint64_t committed_id = 0;
+    db.start_writer([&committed_id](uint64_t max_id) {
+        committed_id = max_id;
+    });
+    db.insert_new_names_async(add_series(&matcher));
+    db.stop_writer();
+    BOOST_REQUIRE_EQUAL(committed_id, 4u);
+    BOOST_REQUIRE_EQUAL(db.writer_errors_.load(), 0u);
+    BOOST_REQUIRE_EQUAL(db.get_prev_largest_id(), 4u);
+
+    SeriesMatcher restored(1ul);
+    BOOST_REQUIRE_EQUAL(db.load_matcher_data(restored), AKU_SUCCESS);
+    check_series(matcher, restored);
+}
+
+BOOST_AUTO_TEST_CASE(Test_metadata_storage_writer_retries_failed_batch) {
+
+    TempDatabase tmp;
+    MetadataStorage db(tmp.path.c_str(), &logger_stub);
+    SeriesMatcher matcher(1ul);
+    std::atomic<uint64_t> committed_id = {0};
+    db.start_writer([&committed_id](uint64_t max_id) {
+        committed_id = max_id;
+    });
+
+    // Lock the database using another connection, transaction should fail
+    sqlite3* other = nullptr;
+    BOOST_REQUIRE_EQUAL(sqlite3_open(tmp.path.c_str(), &other), SQLITE_OK);
+    BOOST_REQUIRE_EQUAL(sqlite3_exec(other, "BEGIN EXCLUSIVE;", nullptr, nullptr, nullptr), SQLITE_OK);
+
+    db.insert_new_names_async(add_series(&matcher));
+    for (int i = 0; i < 1000 && db.writer_errors_.load() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_REQUIRE_GT(db.writer_errors_.load(), 0u);
+    BOOST_REQUIRE_EQUAL(committed_id.load(), 0u);
+
+    // Batch should be saved when database becomes available
+    BOOST_REQUIRE_EQUAL(sqlite3_exec(other, "COMMIT;", nullptr, nullptr, nullptr), SQLITE_OK);
+    sqlite3_close(other);
+    db.stop_writer();
+    BOOST_REQUIRE_EQUAL(committed_id.load(), 4u);
+
+    SeriesMatcher restored(1ul);
+    BOOST_REQUIRE_EQUAL(db.load_matcher_data(restored), AKU_SUCCESS);
+    check_series(matcher, restored);
+}
+
+BOOST_AUTO_TEST_CASE(Test_metadata_storage_writer_snapshot) {
+
+    TempDatabase tmp;
+    std::string snapshot_path = tmp.path + ".series";
+    MetadataStorage db(":memory:", &logger_stub);
+    SeriesMatcher matcher(1ul);
+    // Snapshot is written from the writer thread the same way as in Storage
+    aku_Status snapshot_status = AKU_EGENERAL;
+    db.start_writer([&](uint64_t max_id) {
+        snapshot_status = SeriesSnapshot::write(snapshot_path, matcher.pool, max_id);
+    });
+    auto names = add_series(&matcher);
+    // Series that isn't in sqlite yet shouldn't get into the snapshot
+    const char* unsaved = "cpu host=D region=us";
+    auto unsaved_id = matcher.add(unsaved, unsaved + strlen(unsaved));
+    db.insert_new_names_async(std::move(names));
+    db.stop_writer();
+    BOOST_REQUIRE_EQUAL(snapshot_status, AKU_SUCCESS);
+
+    SeriesMatcher restored(unsaved_id);
+    uint64_t max_id = 0;
+    BOOST_REQUIRE_EQUAL(restored.load_snapshot(snapshot_path, &max_id), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(max_id, 4u);
+    BOOST_REQUIRE_EQUAL(restored.snapshot.nseries, 4u);
+    check_series(matcher, restored);
+    BOOST_REQUIRE_EQUAL(restored.match(unsaved, unsaved + strlen(unsaved)), 0u);
+}
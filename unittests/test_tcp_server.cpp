@@ -31,6 +31,9 @@ struct DbMock : DbConnection {
     std::shared_ptr<DbCursor> search(std::string query) {
         throw "not implemented";
     }
+    std::shared_ptr<DbCursor> subscribe(std::string query, std::function<void()> notify) {
+        throw "not implemented";
+    }
     int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) {
         throw "not implemented";
     }
@@ -54,6 +57,9 @@ struct DbErrMock : DbConnection {
     std::shared_ptr<DbCursor> search(std::string query) {
         throw "not implemented";
     }
+    std::shared_ptr<DbCursor> subscribe(std::string query, std::function<void()> notify) {
+        throw "not implemented";
+    }
     int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) {
         throw "not implemented";
     }
@@ -289,3 +295,45 @@ BOOST_AUTO_TEST_CASE(Test_tcp_server_backend_error_handling) {
         BOOST_REQUIRE_EQUAL(std::string(buffer, buffer + 3), "-DB");
     });
 }
+
+
+BOOST_AUTO_TEST_CASE(Test_tcp_core_acceptor_loopback) {
+
+    auto dbcon = std::make_shared<DbMock>();
+    auto pline = std::make_shared<IngestionPipeline>(dbcon, AKU_LINEAR_BACKOFF);
+    pline->start();
+
+    // Two acceptors can listen on the same port
+    auto core0 = std::make_shared<TcpCoreAcceptor>(PORT + 1, 0, pline);
+    auto core1 = std::make_shared<TcpCoreAcceptor>(PORT + 1, 1, pline);
+    core0->start();
+    // Close second acceptor so all connections will go to the first one
+    core1->_stop();
+
+    IOServiceT& io = core0->get_io();
+    SocketT socket(io);
+    auto loopback = boost::asio::ip::address_v4::loopback();
+    boost::asio::ip::tcp::endpoint peer(loopback, PORT + 1);
+    socket.connect(peer);
+    core0->_run_one();  // run handle_accept one time
+
+    boost::asio::streambuf stream;
+    std::ostream os(&stream);
+    os << ":1\r\n" << ":2\r\n" << "+3.14\r\n";
+    boost::asio::write(socket, stream);
+
+    // TCPSession.handle_read (without strand)
+    io.run_one();
+    pline->stop();
+
+    BOOST_REQUIRE_EQUAL(dbcon->results.size(), 1);
+    aku_ParamId id;
+    aku_Timestamp ts;
+    double value;
+    std::tie(id, ts, value) = dbcon->results.at(0);
+    BOOST_REQUIRE_EQUAL(id, 1);
+    BOOST_REQUIRE_EQUAL(ts, 2);
+    BOOST_REQUIRE_CLOSE_FRACTION(value, 3.14, 0.00001);
+
+    core0->_stop();
+}
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <random>
+#include <limits>
+#include <cstring>
+#include <cstdlib>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+
+#include "textformat.h"
+#include "datetime.h"
+
+using namespace Akumuli;
+
+static std::string fmt_uint(uint64_t value) {
+    char buffer[32];
+    char* end = format_uint(value, buffer, buffer + sizeof(buffer));
+    BOOST_REQUIRE(end != nullptr);
+    return std::string(buffer, end);
+}
+
+static std::string fmt_double(double value) {
+    char buffer[32];
+    char* end = format_double(value, buffer, buffer + sizeof(buffer));
+    BOOST_REQUIRE(end != nullptr);
+    return std::string(buffer, end);
+}
+
+BOOST_AUTO_TEST_CASE(Test_format_uint) {
+    BOOST_REQUIRE_EQUAL(fmt_uint(0), "0");
+    BOOST_REQUIRE_EQUAL(fmt_uint(7), "7");
+    BOOST_REQUIRE_EQUAL(fmt_uint(10), "10");
+    BOOST_REQUIRE_EQUAL(fmt_uint(12345), "12345");
+    BOOST_REQUIRE_EQUAL(fmt_uint(std::numeric_limits<uint64_t>::max()), "18446744073709551615");
+    std::mt19937_64 gen(1);
+    for (int i = 0; i < 100000; i++) {
+        uint64_t value = gen() >> (gen() % 64);
+        BOOST_REQUIRE_EQUAL(fmt_uint(value), std::to_string(value));
+    }
+    // Not enough space
+    char buffer[4];
+    BOOST_REQUIRE(format_uint(12345, buffer, buffer + 4) == nullptr);
+    BOOST_REQUIRE(format_uint(1234, buffer, buffer + 4) == buffer + 4);
+}
+
+BOOST_AUTO_TEST_CASE(Test_format_double) {
+    BOOST_REQUIRE_EQUAL(fmt_double(0.0), "0");
+    BOOST_REQUIRE_EQUAL(fmt_double(-0.0), "-0");
+    BOOST_REQUIRE_EQUAL(fmt_double(1.0), "1");
+    BOOST_REQUIRE_EQUAL(fmt_double(-2.5), "-2.5");
+    BOOST_REQUIRE_EQUAL(fmt_double(0.1), "0.1");
+    BOOST_REQUIRE_EQUAL(fmt_double(3.1415), "3.1415");
+    BOOST_REQUIRE_EQUAL(fmt_double(0.0001), "0.0001");
+    BOOST_REQUIRE_EQUAL(fmt_double(0.00001), "1e-05");
+    BOOST_REQUIRE_EQUAL(fmt_double(123456789.0), "123456789");
+    BOOST_REQUIRE_EQUAL(fmt_double(1e16), "10000000000000000");
+    BOOST_REQUIRE_EQUAL(fmt_double(1e17), "1e+17");
+    BOOST_REQUIRE_EQUAL(fmt_double(1e20), "1e+20");
+    BOOST_REQUIRE_EQUAL(fmt_double(1.5e300), "1.5e+300");
+    BOOST_REQUIRE_EQUAL(fmt_double(std::numeric_limits<double>::quiet_NaN()), "nan");
+    BOOST_REQUIRE_EQUAL(fmt_double(-std::numeric_limits<double>::infinity()), "-inf");
+    BOOST_REQUIRE_EQUAL(fmt_double(std::numeric_limits<double>::max()), "1.7976931348623157e+308");
+    BOOST_REQUIRE_EQUAL(fmt_double(std::numeric_limits<double>::denorm_min()), "5e-324");
+
+    // Round trip
+    std::mt19937_64 gen(2);
+    for (int i = 0; i < 100000; i++) {
+        uint64_t bits = gen();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (!std::isfinite(value)) {
+            continue;
+        }
+        auto str = fmt_double(value);
+        double actual = strtod(str.c_str(), nullptr);
+        BOOST_REQUIRE_EQUAL(memcmp(&actual, &value, sizeof(value)), 0);
+        BOOST_REQUIRE_LE(str.size(), 24u);
+    }
+    std::uniform_real_distribution<double> dist(-1000.0, 1000.0);
+    for (int i = 0; i < 100000; i++) {
+        double value = dist(gen);
+        auto str = fmt_double(value);
+        BOOST_REQUIRE_EQUAL(strtod(str.c_str(), nullptr), value);
+    }
+
+    // Not enough space
+    char buffer[4];
+    BOOST_REQUIRE(format_double(3.1415, buffer, buffer + 4) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(Test_format_iso_timestamp) {
+    IsoTimestampFormatter formatter;
+    std::mt19937_64 gen(3);
+    aku_Timestamp ts = 0;
+    for (int i = 0; i < 100000; i++) {
+        // Mix of large jumps and sub-second steps
+        ts = i % 10 == 0 ? gen() % (1ull << 62) : ts + gen() % 100000000u;
+        char expected[64], actual[64];
+        int len = DateTimeUtil::to_iso_string(ts, expected, sizeof(expected));
+        BOOST_REQUIRE_GT(len, 0);
+        char* end = formatter.format(ts, actual, actual + sizeof(actual));
+        BOOST_REQUIRE(end != nullptr);
+        BOOST_REQUIRE_EQUAL(std::string(actual, end), std::string(expected, expected + len - 1));
+    }
+    char buffer[IsoTimestampFormatter::SIZE - 1];
+    BOOST_REQUIRE(formatter.format(ts, buffer, buffer + sizeof(buffer)) == nullptr);
+}
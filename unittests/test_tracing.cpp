@@ -0,0 +1,117 @@
+#include <iostream>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "tracing.h"
+
+using namespace Akumuli;
+using namespace Akumuli::Tracing;
+
+BOOST_AUTO_TEST_CASE(Test_trace_buffer_read) {
+    TraceBuffer buffer;
+    BOOST_REQUIRE(buffer.read().empty());
+    for (uint64_t i = 0; i < 10; i++) {
+        buffer.push("event", i, i + 1);
+    }
+    auto events = buffer.read();
+    BOOST_REQUIRE_EQUAL(events.size(), 10u);
+    for (uint64_t i = 0; i < 10; i++) {
+        BOOST_REQUIRE_EQUAL(events.at(i).name, "event");
+        BOOST_REQUIRE_EQUAL(events.at(i).begin, i);
+        BOOST_REQUIRE_EQUAL(events.at(i).end, i + 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_trace_buffer_overwrite) {
+    TraceBuffer buffer;
+    const uint64_t N = TraceBuffer::CAPACITY*2 + 100;
+    for (uint64_t i = 0; i < N; i++) {
+        buffer.push("event", i, i + 1);
+    }
+    auto events = buffer.read();
+    BOOST_REQUIRE_EQUAL(events.size(), static_cast<size_t>(TraceBuffer::CAPACITY));
+    BOOST_REQUIRE_EQUAL(events.front().begin, N - TraceBuffer::CAPACITY);
+    BOOST_REQUIRE_EQUAL(events.back().begin, N - 1);
+}
+
+BOOST_AUTO_TEST_CASE(Test_trace_buffer_concurrent_read) {
+    // Reader shouldn't see torn or reordered events while writer overwrites them
+    TraceBuffer buffer;
+    std::atomic<bool> done{false};
+    std::thread writer([&]() {
+        for (uint64_t i = 0; i < 2000000; i++) {
+            buffer.push("event", i, i*2);
+        }
+        done = true;
+    });
+    int nreads = 0;
+    while (!done || nreads == 0) {
+        auto events = buffer.read();
+        for (size_t i = 0; i < events.size(); i++) {
+            BOOST_REQUIRE_EQUAL(events[i].end, events[i].begin*2);
+            if (i > 0) {
+                BOOST_REQUIRE_EQUAL(events[i].begin, events[i - 1].begin + 1);
+            }
+        }
+        nreads++;
+    }
+    writer.join();
+}
+
+BOOST_AUTO_TEST_CASE(Test_slow_span) {
+    auto before = local_buffer().read().size();
+    {
+        Span span("never", ~0ull);
+    }
+    BOOST_REQUIRE_EQUAL(local_buffer().read().size(), before);
+    {
+        Span span("always", 0u);
+    }
+    auto events = local_buffer().read();
+    BOOST_REQUIRE_EQUAL(events.size(), before + 1);
+    BOOST_REQUIRE_EQUAL(std::string(events.back().name), "always");
+    BOOST_REQUIRE(events.back().end >= events.back().begin);
+}
+
+BOOST_AUTO_TEST_CASE(Test_chrome_trace_dump) {
+    {
+        Span outer("outer", 0u);
+        Span inner("inner", 0u);
+    }
+    // Spans of the finished thread shouldn't be lost
+    std::thread worker([]() {
+        Span span("worker", 0u);
+    });
+    worker.join();
+
+    std::stringstream out;
+    dump_chrome_trace(out);
+    boost::property_tree::ptree ptree;
+    boost::property_tree::json_parser::read_json(out, ptree);
+
+    std::set<std::string> names;
+    std::set<std::string> tids;
+    for (auto const& item: ptree.get_child("traceEvents")) {
+        auto const& ev = item.second;
+        if (ev.get<std::string>("ph") == "X") {
+            names.insert(ev.get<std::string>("name"));
+            BOOST_REQUIRE(ev.get<double>("dur") >= 0.0);
+        }
+        tids.insert(ev.get<std::string>("tid"));
+    }
+    BOOST_REQUIRE(names.count("outer"));
+    BOOST_REQUIRE(names.count("inner"));
+    BOOST_REQUIRE(names.count("worker"));
+    BOOST_REQUIRE(tids.size() >= 2);
+    BOOST_REQUIRE(ptree.get<double>("otherData.ticks_per_us") > 0.0);
+}
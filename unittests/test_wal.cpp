@@ -0,0 +1,123 @@
+#include <iostream>
+#include <fstream>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include <vector>
+
+#include "wal.h"
+
+using namespace Akumuli;
+
+void logger_stub(aku_LogLevel level, const char* msg) {
+    if (level == AKU_LOG_ERROR) {
+        BOOST_MESSAGE(msg);
+    }
+}
+
+static std::string get_prefix() {
+    auto dir = boost::filesystem::temp_directory_path() / "akumuli_test_wal";
+    boost::filesystem::create_directories(dir);
+    return (dir / "db").string();
+}
+
+static std::vector<WalRecord> replay_all(std::string prefix) {
+    std::vector<WalRecord> results;
+    WriteAheadLog wal(prefix, &logger_stub);
+    wal.replay([&](WalRecord const& rec) {
+        results.push_back(rec);
+    });
+    return results;
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_replay) {
+    auto prefix = get_prefix();
+    WriteAheadLog::remove_segments(prefix, &logger_stub);
+    {
+        WriteAheadLog wal(prefix, &logger_stub);
+        wal.replay([](WalRecord const&) {
+            BOOST_FAIL("log should be empty");
+        });
+        wal.start();
+        for (aku_Timestamp ts = 0; ts < 10000; ts++) {
+            wal.append(ts, ts % 10, double(ts));
+        }
+        wal.close();
+    }
+    auto results = replay_all(prefix);
+    BOOST_REQUIRE_EQUAL(results.size(), 10000u);
+    for (aku_Timestamp ts = 0; ts < 10000; ts++) {
+        BOOST_REQUIRE_EQUAL(results.at(ts).timestamp, ts);
+        BOOST_REQUIRE_EQUAL(results.at(ts).paramid, ts % 10);
+        BOOST_REQUIRE_EQUAL(results.at(ts).value, double(ts));
+    }
+    WriteAheadLog::remove_segments(prefix, &logger_stub);
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_checkpoint) {
+    auto prefix = get_prefix();
+    WriteAheadLog::remove_segments(prefix, &logger_stub);
+    {
+        WriteAheadLog wal(prefix, &logger_stub);
+        wal.replay([](WalRecord const&) {});
+        wal.start();
+        for (aku_Timestamp ts = 0; ts < 100; ts++) {
+            wal.append(ts, 1u, double(ts));
+        }
+        // everything before ts=50 is persisted
+        wal.checkpoint(std::make_tuple(50u, 0u));
+        // late write, shouldn't be covered by previous marker
+        wal.append(10u, 2u, 10.0);
+        wal.close();
+    }
+    auto results = replay_all(prefix);
+    BOOST_REQUIRE_EQUAL(results.size(), 51u);
+    BOOST_REQUIRE_EQUAL(results.front().timestamp, 50u);
+    BOOST_REQUIRE_EQUAL(results.back().timestamp, 10u);
+    BOOST_REQUIRE_EQUAL(results.back().paramid, 2u);
+    WriteAheadLog::remove_segments(prefix, &logger_stub);
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_truncate_on_close) {
+    auto prefix = get_prefix();
+    WriteAheadLog::remove_segments(prefix, &logger_stub);
+    {
+        WriteAheadLog wal(prefix, &logger_stub);
+        wal.replay([](WalRecord const&) {});
+        wal.start();
+        for (aku_Timestamp ts = 0; ts < 100; ts++) {
+            wal.append(ts, 1u, double(ts));
+        }
+        wal.checkpoint(std::make_tuple(AKU_MAX_TIMESTAMP, AKU_LIMITS_MAX_ID));
+        wal.close();
+    }
+    auto dir = boost::filesystem::path(prefix).parent_path();
+    BOOST_REQUIRE(boost::filesystem::is_empty(dir));
+}
+
+BOOST_AUTO_TEST_CASE(Test_wal_torn_write) {
+    auto prefix = get_prefix();
+    WriteAheadLog::remove_segments(prefix, &logger_stub);
+    {
+        WriteAheadLog wal(prefix, &logger_stub);
+        wal.replay([](WalRecord const&) {});
+        wal.start();
+        for (aku_Timestamp ts = 0; ts < 100; ts++) {
+            wal.append(ts, 1u, double(ts));
+        }
+        wal.close();
+    }
+    {
+        // Append incomplete frame to the end of the log
+        std::ofstream stream(prefix + "_0.wal", std::ios::binary|std::ios::app);
+        WalFrameHeader header = { WriteAheadLog::DATA, 10u, 0u };
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write("garbage", 7);
+    }
+    auto results = replay_all(prefix);
+    BOOST_REQUIRE_EQUAL(results.size(), 100u);
+    WriteAheadLog::remove_segments(prefix, &logger_stub);
+}